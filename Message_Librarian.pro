@@ -6,6 +6,7 @@
 
 QT       += core gui
 QT       += sql
+QT       += concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -17,20 +18,56 @@ SOURCES += main.cpp\
         mainwindow.cpp \
     settingswindow.cpp \
     databasesupport.cpp \
+    tracer.cpp \
     editsermon.cpp \
     statusindicatordelegate.cpp \
     findsermon.cpp \
     sermonsortfilterproxymodel.cpp \
-    publishsermon.cpp
+    publishsermon.cpp \
+    sermonfiltermatcher.cpp \
+    sermontablemodel.cpp \
+    sermonsearchquery.cpp \
+    searchscheduler.cpp \
+    sermoncatalog.cpp \
+    sermoncatalogprovider.cpp \
+    audioimporter.cpp \
+    blobstore.cpp \
+    attachmentmanifest.cpp \
+    csvreader.cpp \
+    sermoncsvimporter.cpp \
+    sermonexporter.cpp \
+    editjournal.cpp \
+    audiometadata.cpp \
+    audioscanner.cpp \
+    publishplanner.cpp \
+    publishstager.cpp
 
 HEADERS  += mainwindow.h \
     settingswindow.h \
     databasesupport.h \
+    tracer.h \
     editsermon.h \
     statusindicatordelegate.h \
     findsermon.h \
     sermonsortfilterproxymodel.h \
-    publishsermon.h
+    publishsermon.h \
+    sermonfiltermatcher.h \
+    sermontablemodel.h \
+    sermonsearchquery.h \
+    searchscheduler.h \
+    sermoncatalog.h \
+    sermoncatalogprovider.h \
+    audioimporter.h \
+    blobstore.h \
+    attachmentmanifest.h \
+    csvreader.h \
+    sermoncsvimporter.h \
+    sermonexporter.h \
+    editjournal.h \
+    audiometadata.h \
+    audioscanner.h \
+    publishplanner.h \
+    publishstager.h
 
 FORMS    += mainwindow.ui \
     settingswindow.ui \
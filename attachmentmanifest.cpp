@@ -0,0 +1,309 @@
+#include "attachmentmanifest.h"
+#include "databasesupport.h"
+#include "tracer.h"
+#include "blobstore.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSet>
+#include <QDebug>
+#include <QtConcurrent>
+
+#define WATCHED_FOLDER_LIMIT 256 //Each watch costs a handle (and on Windows, a share of a thread).
+
+AttachmentManifest::AttachmentManifest(const QString &libraryRoot, QObject *parent) :
+    QObject(parent), root(libraryRoot), loaded(false)
+{
+    connect(&watcher, SIGNAL(directoryChanged(QString)), this, SLOT(folderChanged(QString)));
+    connect(&loadWatcher, SIGNAL(finished()), this, SLOT(listingsRead()));
+}
+
+//Reads every listing into memory. Call once, after BlobStore::InitManifest().
+bool AttachmentManifest::load()
+{
+    listings.clear();
+    loaded = ReadListings(listings);
+    if (!loaded)
+        return false;
+
+    if (QDir(root).exists())
+        watcher.addPath(root); //Notices entry folders that are removed or put back.
+    return true;
+}
+
+void AttachmentManifest::loadInBackground()
+{
+    if (loadWatcher.isRunning())
+        return;
+    loaded = false;
+    if (QDir(root).exists())
+        watcher.addPath(root);
+    loadWatcher.setFuture(QtConcurrent::run(ReadListingsOnWorker));
+}
+
+void AttachmentManifest::listingsRead()
+{
+    Listings all = loadWatcher.result();
+    //Entries read, listed or reloaded while the load ran are at least as recent as what it found.
+    for (Listings::const_iterator it = listings.constBegin(); it != listings.constEnd(); ++it)
+        all.insert(it.key(), it.value());
+    listings.swap(all);
+    loaded = true;
+    emit manifestLoaded();
+}
+
+bool AttachmentManifest::ReadListings(Listings &all)
+{
+    TraceSpan span("AttachmentManifest::ReadListings");
+    QSqlQuery query(DatabaseSupport::Connection());
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT entry_id, file_name, size, modified, hash FROM " ENTRY_FILE_TABLE " ORDER BY entry_id, file_name;"))
+        return false;
+    while (query.next()) {
+        AttachmentFile file;
+        file.fileName = query.value(1).toString();
+        file.size = query.value(2).toLongLong();
+        file.modified = query.value(3).toLongLong();
+        file.sha256 = QByteArray::fromHex(query.value(4).toByteArray());
+        all[query.value(0).toString()].append(file);
+    }
+    span.setValue(all.size());
+    return true;
+}
+
+//Runs on a worker thread, on that thread's own connection.
+AttachmentManifest::Listings AttachmentManifest::ReadListingsOnWorker()
+{
+    Listings all;
+    if (!ReadListings(all))
+        qDebug("Cannot read the attachment manifest.");
+    return all;
+}
+
+QVector<AttachmentFile> AttachmentManifest::files(const QString &entryId)
+{
+    if (entryId.isEmpty())
+        return QVector<AttachmentFile>();
+
+    QHash<QString, QVector<AttachmentFile> >::const_iterator cached = listings.constFind(entryId);
+    if (cached == listings.constEnd()) {
+        QVector<AttachmentFile> listing;
+        if (!loaded && ReadEntry(entryId, listing) && !listing.isEmpty()) {
+            //Still loading: the entry may well be recorded, and recording it from disk would lose its hashes.
+            listings.insert(entryId, listing);
+        } else {
+            //Imported before the manifest existed: list the folder this once and keep the result.
+            listing = Scan(entryId);
+            if (!Record(entryId, listing))
+                listings.insert(entryId, listing); //Still spares the disk for the rest of this session.
+        }
+        listing = listings.value(entryId);
+        Watch(entryId);
+        //fileCount() had no answer for the entry until now, so rows painted without one must be worked out again.
+        emit entryChanged(entryId);
+        return listing;
+    }
+    Watch(entryId);
+    return cached.value();
+}
+
+QStringList AttachmentManifest::filePaths(const QString &entryId)
+{
+    QStringList paths;
+    QString folder = entryFolder(entryId);
+    foreach (const AttachmentFile &file, files(entryId))
+        paths << folder + "/" + file.fileName;
+    return paths;
+}
+
+bool AttachmentManifest::hasFiles(const QString &entryId)
+{
+    return !files(entryId).isEmpty();
+}
+
+int AttachmentManifest::fileCount(const QString &entryId) const
+{
+    QHash<QString, QVector<AttachmentFile> >::const_iterator cached = listings.constFind(entryId);
+    return cached == listings.constEnd() ? -1 : cached.value().size();
+}
+
+void AttachmentManifest::reload(const QString &entryId)
+{
+    QVector<AttachmentFile> listing;
+    if (!ReadEntry(entryId, listing)) {
+        listings.remove(entryId); //Listed from disk on next use.
+        return;
+    }
+    listings.insert(entryId, listing);
+    emit entryChanged(entryId);
+}
+
+//The entry's rows in the database; empty if there are none.
+bool AttachmentManifest::ReadEntry(const QString &entryId, QVector<AttachmentFile> &listing)
+{
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT file_name, size, modified, hash FROM " ENTRY_FILE_TABLE
+                                                     " WHERE entry_id = ? ORDER BY file_name;");
+    query.bindValue(0, entryId);
+    if (!query.exec())
+        return false;
+    listing.clear();
+    while (query.next()) {
+        AttachmentFile file;
+        file.fileName = query.value(0).toString();
+        file.size = query.value(1).toLongLong();
+        file.modified = query.value(2).toLongLong();
+        file.sha256 = QByteArray::fromHex(query.value(3).toByteArray());
+        listing.append(file);
+    }
+    query.finish();
+    return true;
+}
+
+void AttachmentManifest::forget(const QString &entryId)
+{
+    listings.remove(entryId);
+    if (watchedEntries.removeOne(entryId))
+        watcher.removePath(entryFolder(entryId));
+    emit entryChanged(entryId);
+}
+
+void AttachmentManifest::folderChanged(const QString &path)
+{
+    QStringList changed;
+    if (QDir::cleanPath(path) == QDir::cleanPath(root)) {
+        //An entry folder came or went. Only entries whose folder's presence no longer fits their listing need a look.
+        QSet<QString> folders = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot).toSet();
+        for (QHash<QString, QVector<AttachmentFile> >::const_iterator it = listings.constBegin(); it != listings.constEnd(); ++it) {
+            if (folders.contains(it.key()) == it.value().isEmpty())
+                changed << it.key();
+        }
+    } else {
+        QString entryId = QFileInfo(path).fileName();
+        if (listings.contains(entryId))
+            changed << entryId;
+    }
+
+    foreach (const QString &entryId, changed) {
+        QVector<AttachmentFile> listing = Scan(entryId);
+        if (!Record(entryId, listing))
+            continue; //Keep the old listing; the next change will try again.
+        emit entryChanged(entryId);
+    }
+}
+
+QString AttachmentManifest::entryFolder(const QString &entryId) const
+{
+    return root + "/" + entryId;
+}
+
+QVector<AttachmentFile> AttachmentManifest::Scan(const QString &entryId) const
+{
+    QVector<AttachmentFile> listing;
+    foreach (const QFileInfo &info, QDir(entryFolder(entryId)).entryInfoList(QDir::Files, QDir::Name)) {
+        AttachmentFile file;
+        file.fileName = info.fileName();
+        file.size = info.size();
+        file.modified = info.lastModified().toMSecsSinceEpoch();
+        listing.append(file);
+    }
+    return listing;
+}
+
+/* Replaces the entry's rows with 'listing'. A file that is unchanged keeps
+ * its hash; one that was changed or removed behind our back gives up its
+ * reference to the BlobStore, as it no longer is what the store holds.
+ * Replacing or deleting a link leaves the stored file alone, but writing
+ * into one changes the stored file itself, and so every entry sharing it:
+ * such a file is split off from the store instead.
+ */
+bool AttachmentManifest::Record(const QString &entryId, const QVector<AttachmentFile> &listing)
+{
+    QHash<QString, AttachmentFile> previous;
+    foreach (const AttachmentFile &file, listings.value(entryId))
+        previous.insert(file.fileName, file);
+
+    BlobStore store(root);
+    QVector<AttachmentFile> recorded = listing;
+    QStringList released;
+    QStringList written;
+    for (int i = 0; i < recorded.size(); ++i) {
+        AttachmentFile old = previous.take(recorded.at(i).fileName);
+        if (old.size == recorded.at(i).size && old.modified == recorded.at(i).modified) {
+            recorded[i].sha256 = old.sha256;
+        } else if (!old.sha256.isEmpty()) {
+            //The stored file looking like the changed one means they are one file, i.e. the edit went through the link.
+            QFileInfo blob(store.blobPath(old.sha256));
+            if (blob.exists() && blob.size() == recorded.at(i).size && blob.lastModified().toMSecsSinceEpoch() == recorded.at(i).modified)
+                written << QString::fromLatin1(old.sha256.toHex());
+            else
+                released << QString::fromLatin1(old.sha256.toHex());
+        }
+    }
+    foreach (const AttachmentFile &old, previous) {
+        if (!old.sha256.isEmpty())
+            released << QString::fromLatin1(old.sha256.toHex());
+    }
+
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QString error;
+    db.transaction();
+    bool ok = store.dropReferences(released, error) && store.splitOff(written, error);
+
+    QSqlQuery dropRows(db);
+    dropRows.prepare("DELETE FROM " ENTRY_FILE_TABLE " WHERE entry_id = ?;");
+    dropRows.addBindValue(entryId);
+    ok = ok && dropRows.exec();
+
+    QSqlQuery addRow(db);
+    addRow.prepare("INSERT INTO " ENTRY_FILE_TABLE " (entry_id, file_name, size, modified, hash) VALUES (?, ?, ?, ?, ?);");
+    foreach (const AttachmentFile &file, recorded) {
+        if (!ok)
+            break;
+        addRow.bindValue(0, entryId);
+        addRow.bindValue(1, file.fileName);
+        addRow.bindValue(2, file.size);
+        addRow.bindValue(3, file.modified);
+        addRow.bindValue(4, file.sha256.isEmpty() ? QVariant(QVariant::String) : QVariant(QString::fromLatin1(file.sha256.toHex())));
+        ok = addRow.exec();
+    }
+
+    if (!ok || !db.commit()) {
+        qDebug() << "Cannot update the attachment manifest for" << entryId << ":" << error << dropRows.lastError().text()
+                 << addRow.lastError().text() << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    store.removeUnusedBlobs();
+    listings.insert(entryId, recorded);
+    if (!written.isEmpty())
+        ForgetHashes(written);
+    return true;
+}
+
+//The in-memory side of BlobStore::splitOff(): other entries' listings no longer refer to those files either.
+void AttachmentManifest::ForgetHashes(const QStringList &hashes)
+{
+    QSet<QByteArray> gone;
+    foreach (const QString &hash, hashes)
+        gone.insert(QByteArray::fromHex(hash.toLatin1()));
+    for (Listings::iterator entry = listings.begin(); entry != listings.end(); ++entry) {
+        for (int i = 0; i < entry.value().size(); ++i) {
+            if (gone.contains(entry.value().at(i).sha256))
+                entry.value()[i].sha256.clear();
+        }
+    }
+}
+
+//Watches the folders of the entries looked at most recently. Adding a watch is the one disk access navigation can cause, once per entry.
+void AttachmentManifest::Watch(const QString &entryId)
+{
+    if (watchedEntries.contains(entryId))
+        return;
+    if (listings.value(entryId).isEmpty())
+        return; //Likely no folder to watch; the library folder's watch covers one appearing.
+    if (watchedEntries.size() >= WATCHED_FOLDER_LIMIT)
+        watcher.removePath(entryFolder(watchedEntries.takeFirst()));
+    if (watcher.addPath(entryFolder(entryId)))
+        watchedEntries << entryId;
+}
@@ -0,0 +1,86 @@
+#ifndef ATTACHMENTMANIFEST_H
+#define ATTACHMENTMANIFEST_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+
+//One audio file of an entry, as last seen on disk.
+struct AttachmentFile
+{
+    AttachmentFile() : size(0), modified(0) {}
+
+    QString fileName;
+    qint64 size;
+    qint64 modified; //Milliseconds since the epoch.
+    QByteArray sha256; //Empty for files that are not kept in the BlobStore.
+};
+
+/* Answers "which audio files does this entry have?" without going to the
+ * disk. The listing of every entry folder is kept in the database (the
+ * Attachment_Files table, shared with BlobStore) and read into memory once.
+ * Entries that predate the manifest are listed from disk the first time
+ * they are asked for, and recorded, so that only ever happens once.
+ *
+ * The folders of entries looked at in this session are watched, as is the
+ * library folder itself; when something changes them behind our back the
+ * folder is listed again, the manifest updated and entryChanged() emitted.
+ * Changes made while the program is not running are not noticed.
+ *
+ * At start-up the manifest can be read on a worker thread instead
+ * (loadInBackground()). Until it is in, an entry asked for is read from the
+ * database on its own, and fileCount() answers -1 for the rest.
+ */
+class AttachmentManifest : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AttachmentManifest(const QString &libraryRoot, QObject *parent = 0);
+
+    bool load();
+    void loadInBackground();
+    bool isLoaded() const { return loaded; }
+
+    QVector<AttachmentFile> files(const QString &entryId);
+    QStringList filePaths(const QString &entryId);
+    bool hasFiles(const QString &entryId);
+    int fileCount(const QString &entryId) const; //-1 if the entry has not been listed yet; never goes to the disk.
+
+    void reload(const QString &entryId); //After the entry's rows were rewritten, e.g. by an import.
+    void forget(const QString &entryId); //After the entry and its rows were removed.
+
+signals:
+    void entryChanged(const QString &entryId);
+    void manifestLoaded(); //The background load is done; fileCount() now knows every recorded entry.
+
+private slots:
+    void folderChanged(const QString &path);
+    void listingsRead();
+
+private:
+    typedef QHash<QString, QVector<AttachmentFile> > Listings;
+
+    static bool ReadListings(Listings &all);
+    static Listings ReadListingsOnWorker();
+    bool ReadEntry(const QString &entryId, QVector<AttachmentFile> &listing);
+    QString entryFolder(const QString &entryId) const;
+    QVector<AttachmentFile> Scan(const QString &entryId) const;
+    bool Record(const QString &entryId, const QVector<AttachmentFile> &listing);
+    void ForgetHashes(const QStringList &hashes);
+    void Watch(const QString &entryId);
+
+    QString root;
+    QHash<QString, QVector<AttachmentFile> > listings;
+    QFileSystemWatcher watcher;
+    QStringList watchedEntries; //Oldest first.
+    QFutureWatcher<Listings> loadWatcher;
+    bool loaded;
+};
+
+#endif // ATTACHMENTMANIFEST_H
@@ -0,0 +1,235 @@
+#include "audioimporter.h"
+#include "tracer.h"
+
+#include <QtConcurrent>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSet>
+
+#define IMPORT_BUFFER_BYTES (1024 * 1024)
+#define IMPORT_PROGRESS_EVERY 8 //Report progress every this many buffers.
+
+AudioImporter::AudioImporter(int concurrency, QObject *parent) :
+    QObject(parent), cancelled(0), remaining(0), running(false), totalBytes(0), copiedBytes(0)
+{
+    pool.setMaxThreadCount(qMax(1, concurrency));
+}
+
+AudioImporter::~AudioImporter()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+/* Starts copying 'sourceFiles' into 'stagingDir' and returns at once.
+ * finished() is emitted when every file is done, one way or the other.
+ */
+void AudioImporter::start(const QStringList &sourceFiles, const QString &stagingDir)
+{
+    staging = stagingDir;
+    cancelled.store(0);
+    copiedBytes = 0;
+    totalBytes = 0;
+    importedFiles.clear();
+
+    QDir().mkpath(staging);
+    QSet<QString> stagedNames;
+    foreach (const QString &source, sourceFiles) {
+        ImportedFile file;
+        file.sourcePath = source;
+
+        //Files picked from different folders may share a name; don't let one overwrite another.
+        QFileInfo info(source);
+        QString name = info.fileName();
+        for (int n = 2; stagedNames.contains(name.toLower()); ++n)
+            name = QString("%1 (%2).%3").arg(info.completeBaseName()).arg(n).arg(info.suffix());
+        stagedNames.insert(name.toLower());
+
+        file.stagedPath = staging + "/" + name;
+        file.size = info.size();
+        totalBytes += file.size;
+        importedFiles.append(file);
+    }
+    fileCopied.fill(0, importedFiles.size());
+
+    running = true;
+    remaining.store(importedFiles.size());
+    timer.start();
+    if (importedFiles.isEmpty()) {
+        running = false;
+        emit finished();
+        return;
+    }
+
+    //The workers each write to their own element only; the vector itself is left alone until they are done.
+    for (int i = 0; i < importedFiles.size(); ++i)
+        QtConcurrent::run(&pool, ImportFile, this, &importedFiles[i], i);
+}
+
+bool AudioImporter::succeeded() const
+{
+    if (running || cancelled.load())
+        return false;
+    foreach (const ImportedFile &file, importedFiles) {
+        if (!file.ok)
+            return false;
+    }
+    return true;
+}
+
+QString AudioImporter::errorString() const
+{
+    if (cancelled.load())
+        return "The import was cancelled.";
+    foreach (const ImportedFile &file, importedFiles) {
+        if (!file.ok)
+            return QFileInfo(file.sourcePath).fileName() + ": " + file.error;
+    }
+    return QString();
+}
+
+/* Moves the staging folder to 'targetDir' in one rename, so the entry's
+ * folder either appears complete or not at all.
+ */
+bool AudioImporter::commit(const QString &targetDir)
+{
+    if (!succeeded() || !QDir().rename(staging, targetDir))
+        return false;
+
+    for (int i = 0; i < importedFiles.size(); ++i)
+        importedFiles[i].stagedPath = targetDir + "/" + QFileInfo(importedFiles.at(i).stagedPath).fileName();
+    staging = targetDir;
+    return true;
+}
+
+void AudioImporter::discard()
+{
+    if (!staging.isEmpty() && QDir(staging).exists())
+        QDir(staging).removeRecursively();
+}
+
+double AudioImporter::bytesPerSecond() const
+{
+    qint64 msecs = timer.isValid() ? timer.elapsed() : 0;
+    return msecs > 0 ? copiedBytes * 1000.0 / msecs : 0.0;
+}
+
+void AudioImporter::cancel()
+{
+    cancelled.store(1);
+}
+
+void AudioImporter::updateProgress(int fileIndex, qint64 bytesCopied)
+{
+    copiedBytes += bytesCopied - fileCopied.at(fileIndex);
+    fileCopied[fileIndex] = bytesCopied;
+    emit fileProgress(fileIndex, bytesCopied, importedFiles.at(fileIndex).size);
+    emit progress(copiedBytes, totalBytes);
+}
+
+void AudioImporter::fileDone()
+{
+    if (remaining.fetchAndAddOrdered(-1) != 1)
+        return;
+    running = false;
+    Tracer::RecordSince("AudioImporter::run", timer, totalBytes);
+    emit finished();
+}
+
+//Runs on a worker thread: copy, hashing on the way, then read the copy back to make sure it matches.
+//knownContent is not touched by the GUI thread while an import runs.
+void AudioImporter::ImportFile(AudioImporter *importer, ImportedFile *file, int fileIndex)
+{
+    TraceSpan span("AudioImporter::ImportFile");
+    span.setValue(file->size);
+    QString error;
+    qint64 copied = 0;
+
+    //Only a file of the same size as something we already have can be a duplicate, so only those are hashed first.
+    QHash<qint64, QSet<QByteArray> >::const_iterator known = importer->knownContent.constFind(file->size);
+    if (known != importer->knownContent.constEnd()) {
+        if (!StreamFile(importer, file->sourcePath, file->sha256, copied, fileIndex, QString(), error)) {
+            file->error = error;
+        } else if (known.value().contains(file->sha256)) {
+            file->alreadyStored = true;
+            file->ok = true;
+        }
+        if (file->ok || !file->error.isEmpty()) {
+            QMetaObject::invokeMethod(importer, "fileDone", Qt::QueuedConnection);
+            return;
+        }
+    }
+
+    if (StreamFile(importer, file->sourcePath, file->sha256, copied, fileIndex, file->stagedPath, error)) {
+        QByteArray verifyHash;
+        qint64 verified = 0;
+        if (!StreamFile(importer, file->stagedPath, verifyHash, verified, -1, QString(), error))
+            file->error = error;
+        else if (verified != copied || verifyHash != file->sha256)
+            file->error = "The copy does not match the original.";
+        else
+            file->ok = true;
+    } else {
+        file->error = error;
+    }
+
+    QMetaObject::invokeMethod(importer, "fileDone", Qt::QueuedConnection);
+}
+
+/* Reads 'path' from start to end, hashing it, and writes it to 'copyTo'
+ * unless that is empty. Progress is reported for non-negative fileIndex.
+ */
+bool AudioImporter::StreamFile(AudioImporter *importer, const QString &path, QByteArray &sha256, qint64 &bytes,
+                               int fileIndex, const QString &copyTo, QString &error)
+{
+    QFile source(path);
+    if (!source.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        error = source.errorString();
+        return false;
+    }
+    QFile target(copyTo);
+    if (!copyTo.isEmpty() && !target.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        error = target.errorString();
+        return false;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray buffer(IMPORT_BUFFER_BYTES, Qt::Uninitialized);
+    bytes = 0;
+    for (int chunk = 1; ; ++chunk) {
+        if (importer->cancelled.load()) {
+            error = "Cancelled.";
+            return false;
+        }
+        qint64 count = source.read(buffer.data(), buffer.size());
+        if (count < 0) {
+            error = source.errorString();
+            return false;
+        }
+        if (count == 0)
+            break;
+
+        hash.addData(buffer.constData(), int(count));
+        if (target.isOpen() && target.write(buffer.constData(), count) != count) {
+            error = target.errorString();
+            return false;
+        }
+        bytes += count;
+        if (fileIndex >= 0 && chunk % IMPORT_PROGRESS_EVERY == 0)
+            QMetaObject::invokeMethod(importer, "updateProgress", Qt::QueuedConnection, Q_ARG(int, fileIndex), Q_ARG(qint64, bytes));
+    }
+
+    if (target.isOpen()) {
+        target.close();
+        if (target.error() != QFileDevice::NoError) {
+            error = target.errorString();
+            return false;
+        }
+    }
+    if (fileIndex >= 0)
+        QMetaObject::invokeMethod(importer, "updateProgress", Qt::QueuedConnection, Q_ARG(int, fileIndex), Q_ARG(qint64, bytes));
+    sha256 = hash.result();
+    return true;
+}
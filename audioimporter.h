@@ -0,0 +1,93 @@
+#ifndef AUDIOIMPORTER_H
+#define AUDIOIMPORTER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+//What became of one file of an import.
+struct ImportedFile
+{
+    ImportedFile() : size(0), ok(false), alreadyStored(false) {}
+
+    QString sourcePath;
+    QString stagedPath;
+    QByteArray sha256;
+    qint64 size;
+    bool ok;
+    bool alreadyStored; //The library already holds this content; nothing was copied to stagedPath.
+    QString error;
+};
+
+/* Copies a set of audio files into a staging folder on worker threads.
+ * Each file is streamed through a large buffer and hashed on the way; once
+ * written, the copy is read back and its hash compared, so a file only
+ * counts as imported if it arrived intact. Several files are copied at
+ * once, up to the given concurrency (more than a couple rarely helps on a
+ * single disk, but does on network shares).
+ *
+ * A file whose content the library already holds is only read to hash it.
+ *
+ * Nothing is visible in the library until the caller commits the staging
+ * folder, which is only possible if every file made it.
+ */
+class AudioImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AudioImporter(int concurrency = 2, QObject *parent = 0);
+    ~AudioImporter();
+
+    //Content the library already has (see BlobStore), by size; such files are only hashed, not copied.
+    void setKnownContent(const QHash<qint64, QSet<QByteArray> > &hashesBySize) { knownContent = hashesBySize; }
+
+    void start(const QStringList &sourceFiles, const QString &stagingDir);
+    bool isRunning() const { return running; }
+    bool succeeded() const;
+    QString errorString() const;
+    QVector<ImportedFile> files() const { return importedFiles; }
+
+    bool commit(const QString &targetDir); //Moves the staged files into place.
+    void discard(); //Removes the staging folder and everything in it.
+
+    qint64 bytesTotal() const { return totalBytes; }
+    double bytesPerSecond() const;
+
+signals:
+    void fileProgress(int fileIndex, qint64 bytesCopied, qint64 fileSize);
+    void progress(qint64 bytesCopied, qint64 bytesTotal);
+    void finished();
+
+public slots:
+    void cancel();
+
+private slots:
+    void updateProgress(int fileIndex, qint64 bytesCopied);
+    void fileDone();
+
+private:
+    static void ImportFile(AudioImporter *importer, ImportedFile *file, int fileIndex);
+    static bool StreamFile(AudioImporter *importer, const QString &path, QByteArray &sha256, qint64 &bytes,
+                           int fileIndex, const QString &copyTo, QString &error);
+
+    QThreadPool pool;
+    QVector<ImportedFile> importedFiles;
+    QVector<qint64> fileCopied; //GUI thread's view of each file's progress.
+    QHash<qint64, QSet<QByteArray> > knownContent;
+    QString staging;
+    QAtomicInt cancelled;
+    QAtomicInt remaining;
+    bool running;
+    qint64 totalBytes;
+    qint64 copiedBytes;
+    QElapsedTimer timer;
+};
+
+#endif // AUDIOIMPORTER_H
@@ -0,0 +1,287 @@
+#include "audiometadata.h"
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+#define WAV_MAX_CHUNKS 64 //A WAV file with more chunks than this before its data is not one we can time.
+#define MP3_SYNC_SEARCH_BYTES (64 * 1024) //How far past the tags the first frame is looked for.
+#define ASF_MAX_HEADER_OBJECTS 256
+
+//ASF object GUIDs, as they are laid out in the file.
+static const uchar asfHeaderGuid[16] = { 0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C };
+static const uchar asfFilePropertiesGuid[16] = { 0xA1, 0xDC, 0xAB, 0x8C, 0x47, 0xA9, 0xCF, 0x11, 0x8E, 0xE4, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65 };
+static const uchar asfStreamPropertiesGuid[16] = { 0x91, 0x07, 0xDC, 0xB7, 0xB7, 0xA9, 0xCF, 0x11, 0x8E, 0xE6, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65 };
+static const uchar asfAudioMediaGuid[16] = { 0x40, 0x9E, 0x69, 0xF8, 0x4D, 0x5B, 0xCF, 0x11, 0xA8, 0xFD, 0x00, 0x80, 0x5F, 0x5C, 0x44, 0x2B };
+
+//Kilobits per second, by [MPEG-1 or not][layer - 1][bitrate index].
+static const int mpegBitrates[2][3][15] = {
+    { { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+      { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+      { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 } },
+    { { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+      { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+      { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } }
+};
+
+//By [MPEG-1, MPEG-2, MPEG-2.5][sample rate index].
+static const int mpegSampleRates[3][3] = { { 44100, 48000, 32000 }, { 22050, 24000, 16000 }, { 11025, 12000, 8000 } };
+
+struct MpegFrame
+{
+    int version; //0 for MPEG-1, 1 for MPEG-2, 2 for MPEG-2.5.
+    int layer;
+    int bitrate; //Bits per second.
+    int sampleRate;
+    int channels;
+    int samples; //Per frame.
+    int length; //Bytes, header included.
+};
+
+static bool ReadAt(QFile &file, qint64 offset, char *buffer, qint64 size)
+{
+    return file.seek(offset) && file.read(buffer, size) == size;
+}
+
+static const uchar *Bytes(const QByteArray &data, int offset)
+{
+    return reinterpret_cast<const uchar *>(data.constData()) + offset;
+}
+
+//Free-format frames (bitrate index 0) are not supported; they are next to unheard of.
+static bool ParseMpegHeader(const uchar *header, MpegFrame &frame)
+{
+    if (header[0] != 0xFF || (header[1] & 0xE0) != 0xE0)
+        return false;
+    int versionBits = (header[1] >> 3) & 0x03;
+    int layerBits = (header[1] >> 1) & 0x03;
+    int bitrateIndex = header[2] >> 4;
+    int rateIndex = (header[2] >> 2) & 0x03;
+    if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3)
+        return false;
+
+    frame.version = versionBits == 3 ? 0 : (versionBits == 2 ? 1 : 2);
+    frame.layer = 4 - layerBits;
+    frame.bitrate = mpegBitrates[frame.version == 0 ? 0 : 1][frame.layer - 1][bitrateIndex] * 1000;
+    frame.sampleRate = mpegSampleRates[frame.version][rateIndex];
+    frame.channels = (header[3] >> 6) == 3 ? 1 : 2;
+    int padding = (header[2] >> 1) & 0x01;
+    if (frame.layer == 1) {
+        frame.samples = 384;
+        frame.length = (12 * frame.bitrate / frame.sampleRate + padding) * 4;
+    } else {
+        frame.samples = (frame.layer == 3 && frame.version != 0) ? 576 : 1152;
+        frame.length = frame.samples / 8 * frame.bitrate / frame.sampleRate + padding;
+    }
+    return true;
+}
+
+/* Whether the name says audio. Read() goes by the content instead; this is
+ * for telling a recording it could not read from a file that is no audio.
+ */
+bool AudioMetadata::IsAudioFileName(const QString &fileName)
+{
+    static const char *extensions[] = { "wav", "mp3", "wma", "m4a", "aac", "flac", "ogg", "opus", "aif", "aiff" };
+    QString suffix = QFileInfo(fileName).suffix();
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+        if (suffix.compare(QLatin1String(extensions[i]), Qt::CaseInsensitive) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool AudioMetadata::Read(const QString &fileName, AudioInfo &info, QString &error)
+{
+    info = AudioInfo();
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = file.errorString();
+        return false;
+    }
+    QByteArray start = file.read(16);
+    if (start.size() >= 12 && start.startsWith("RIFF") && start.mid(8, 4) == "WAVE")
+        return ReadWav(file, info, error);
+    if (start.size() == 16 && memcmp(start.constData(), asfHeaderGuid, 16) == 0)
+        return ReadAsf(file, info, error);
+    if (start.startsWith("ID3") || (start.size() >= 4 && (uchar(start.at(0)) == 0xFF && (uchar(start.at(1)) & 0xE0) == 0xE0)))
+        return ReadMp3(file, info, error);
+    error = "Not a WAV, MP3 or WMA file.";
+    return false;
+}
+
+/* A RIFF file is a list of chunks, each an id and a little-endian size.
+ * Only the "fmt " chunk is read; the "data" chunk is only measured, so the
+ * samples themselves are never touched.
+ */
+bool AudioMetadata::ReadWav(QFile &file, AudioInfo &info, QString &error)
+{
+    qint64 position = 12;
+    qint64 byteRate = 0;
+    qint64 dataBytes = -1;
+    char header[8];
+    for (int chunk = 0; chunk < WAV_MAX_CHUNKS && (byteRate == 0 || dataBytes < 0); ++chunk) {
+        if (!ReadAt(file, position, header, 8))
+            break;
+        qint64 size = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(header + 4));
+        position += 8;
+        if (memcmp(header, "fmt ", 4) == 0) {
+            QByteArray format = file.read(qMin<qint64>(size, 16));
+            if (format.size() < 16)
+                break;
+            info.channels = qFromLittleEndian<quint16>(Bytes(format, 2));
+            info.sampleRate = qFromLittleEndian<quint32>(Bytes(format, 4));
+            byteRate = qFromLittleEndian<quint32>(Bytes(format, 8));
+        } else if (memcmp(header, "data", 4) == 0) {
+            //Recorders that were cut off, and streamed files, leave the size unset or too large.
+            dataBytes = qMin(size, file.size() - position);
+        }
+        position += size + (size & 1); //Chunks are padded to an even length.
+    }
+
+    if (byteRate <= 0 || dataBytes < 0) {
+        error = "The WAV header is incomplete.";
+        return false;
+    }
+    info.format = "wav";
+    info.bitrate = int(qMin<qint64>(byteRate * 8, INT_MAX));
+    info.durationMs = dataBytes * 1000 / byteRate;
+    return true;
+}
+
+/* Skips any ID3v2 tags, then looks for the first frame: a frame header
+ * whose successor is where its length says (a lone sync pattern in tag
+ * padding or cover art is not enough). Variable bitrate files carry a
+ * Xing/Info or VBRI tag in that first frame giving the frame count;
+ * otherwise the bitrate is constant and the length follows from the size.
+ */
+bool AudioMetadata::ReadMp3(QFile &file, AudioInfo &info, QString &error)
+{
+    qint64 audioStart = 0;
+    char tag[10];
+    while (ReadAt(file, audioStart, tag, 10) && memcmp(tag, "ID3", 3) == 0) {
+        const uchar *size = reinterpret_cast<const uchar *>(tag + 6);
+        qint64 tagSize = (qint64(size[0] & 0x7F) << 21) | ((size[1] & 0x7F) << 14) | ((size[2] & 0x7F) << 7) | (size[3] & 0x7F);
+        audioStart += 10 + tagSize + ((tag[5] & 0x10) ? 10 : 0); //The footer flag adds a copy of the header at the end.
+    }
+    qint64 audioEnd = file.size();
+    if (audioEnd >= 128 && ReadAt(file, audioEnd - 128, tag, 3) && memcmp(tag, "TAG", 3) == 0)
+        audioEnd -= 128; //ID3v1
+
+    if (!file.seek(audioStart)) {
+        error = file.errorString();
+        return false;
+    }
+    QByteArray data = file.read(MP3_SYNC_SEARCH_BYTES);
+    MpegFrame frame;
+    int offset = -1;
+    for (int i = 0; i + 4 <= data.size(); ++i) {
+        if (!ParseMpegHeader(Bytes(data, i), frame))
+            continue;
+        MpegFrame next;
+        int following = i + frame.length;
+        if (following + 4 > data.size() || ParseMpegHeader(Bytes(data, following), next)) {
+            offset = i;
+            break;
+        }
+    }
+    if (offset < 0) {
+        error = "No MPEG audio frame found.";
+        return false;
+    }
+
+    info.format = "mp3";
+    info.channels = frame.channels;
+    info.sampleRate = frame.sampleRate;
+
+    qint64 frames = 0;
+    qint64 bytes = 0;
+    int sideInfo = frame.version == 0 ? (frame.channels == 1 ? 17 : 32) : (frame.channels == 1 ? 9 : 17);
+    int xing = offset + 4 + sideInfo;
+    int vbri = offset + 4 + 32;
+    if (xing + 16 <= data.size() && (data.mid(xing, 4) == "Xing" || data.mid(xing, 4) == "Info")) {
+        quint32 flags = qFromBigEndian<quint32>(Bytes(data, xing + 4));
+        int field = xing + 8;
+        if (flags & 0x01) {
+            frames = qFromBigEndian<quint32>(Bytes(data, field));
+            field += 4;
+        }
+        if ((flags & 0x02) && field + 4 <= data.size())
+            bytes = qFromBigEndian<quint32>(Bytes(data, field));
+    } else if (vbri + 18 <= data.size() && data.mid(vbri, 4) == "VBRI") {
+        bytes = qFromBigEndian<quint32>(Bytes(data, vbri + 10));
+        frames = qFromBigEndian<quint32>(Bytes(data, vbri + 14));
+    }
+
+    if (frames > 0) {
+        info.durationMs = frames * frame.samples * 1000 / frame.sampleRate;
+        info.bitrate = bytes > 0 && info.durationMs > 0 ? int(bytes * 8 * 1000 / info.durationMs) : frame.bitrate;
+    } else {
+        info.bitrate = frame.bitrate;
+        info.durationMs = qMax<qint64>(0, audioEnd - audioStart - offset) * 8 * 1000 / frame.bitrate;
+    }
+    return true;
+}
+
+/* An ASF file starts with a header object holding a list of objects, each a
+ * GUID and a 64-bit size. The file properties object gives the playing
+ * time (in 100 ns units, including the preroll, which is in milliseconds)
+ * and the stream properties object of the audio stream a WAVEFORMATEX.
+ * Other objects, such as cover art in the metadata, are skipped over.
+ */
+bool AudioMetadata::ReadAsf(QFile &file, AudioInfo &info, QString &error)
+{
+    char header[30];
+    if (!ReadAt(file, 0, header, 30)) {
+        error = file.errorString();
+        return false;
+    }
+    qint64 headerEnd = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(header + 16));
+    quint32 objectCount = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(header + 24));
+
+    qint64 position = 30;
+    bool haveDuration = false;
+    bool haveStream = false;
+    char object[24];
+    for (quint32 i = 0; i < objectCount && i < ASF_MAX_HEADER_OBJECTS && position + 24 <= headerEnd; ++i) {
+        if (!ReadAt(file, position, object, 24))
+            break;
+        qint64 size = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(object + 16));
+        if (size < 24)
+            break;
+
+        if (!haveDuration && memcmp(object, asfFilePropertiesGuid, 16) == 0) {
+            QByteArray properties = file.read(80); //From the file id to the maximum bitrate.
+            if (properties.size() == 80) {
+                quint32 flags = qFromLittleEndian<quint32>(Bytes(properties, 64));
+                qint64 playDuration = qFromLittleEndian<quint64>(Bytes(properties, 40));
+                qint64 preroll = qFromLittleEndian<quint64>(Bytes(properties, 56));
+                if (!(flags & 0x01)) { //A live broadcast has no duration.
+                    info.durationMs = qMax<qint64>(0, playDuration / 10000 - preroll);
+                    haveDuration = true;
+                }
+                if (info.bitrate == 0)
+                    info.bitrate = qFromLittleEndian<quint32>(Bytes(properties, 76));
+            }
+        } else if (!haveStream && memcmp(object, asfStreamPropertiesGuid, 16) == 0) {
+            QByteArray stream = file.read(66); //Up to and including the average bytes per second of the WAVEFORMATEX.
+            if (stream.size() == 66 && memcmp(stream.constData(), asfAudioMediaGuid, 16) == 0) {
+                info.channels = qFromLittleEndian<quint16>(Bytes(stream, 56));
+                info.sampleRate = qFromLittleEndian<quint32>(Bytes(stream, 58));
+                info.bitrate = qFromLittleEndian<quint32>(Bytes(stream, 62)) * 8; //Preferred over the file's maximum.
+                haveStream = true;
+            }
+        }
+        if (haveDuration && haveStream)
+            break;
+        position += size;
+    }
+
+    if (!haveDuration) {
+        error = "The ASF header has no playing time.";
+        return false;
+    }
+    info.format = "wma";
+    return true;
+}
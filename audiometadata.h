@@ -0,0 +1,48 @@
+#ifndef AUDIOMETADATA_H
+#define AUDIOMETADATA_H
+
+#include <QString>
+#include <QFile>
+
+//What the headers of one audio file say about it.
+struct AudioInfo
+{
+    AudioInfo() : durationMs(-1), bitrate(0), channels(0), sampleRate(0) {}
+
+    QString format; //"wav", "mp3" or "wma"; empty if the file was not recognised.
+    qint64 durationMs; //-1 if unknown.
+    int bitrate; //Bits per second; the average for variable bitrate files.
+    int channels;
+    int sampleRate;
+
+    bool isValid() const { return durationMs >= 0; }
+};
+
+/* Reads the playing time, bitrate, channels and sample rate of WAV, MP3 and
+ * WMA files from their headers, without decoding anything and without
+ * reading the audio itself:
+ *
+ *   WAV  the RIFF "fmt " chunk, and the size of the "data" chunk
+ *   MP3  the first frame header, and the Xing/Info or VBRI tag written
+ *        after it by encoders of variable bitrate files; constant bitrate
+ *        files are timed from their size
+ *   WMA  the ASF file properties and audio stream properties objects
+ *
+ * At most a few hundred kilobytes are read from the start of a file (and a
+ * tag's worth from its end), however long the recording. The format is
+ * told by the content, not the file name.
+ */
+class AudioMetadata
+{
+public:
+    static bool Read(const QString &fileName, AudioInfo &info, QString &error);
+    static bool IsAudioFileName(const QString &fileName);
+
+private:
+    AudioMetadata();
+    static bool ReadWav(QFile &file, AudioInfo &info, QString &error);
+    static bool ReadMp3(QFile &file, AudioInfo &info, QString &error);
+    static bool ReadAsf(QFile &file, AudioInfo &info, QString &error);
+};
+
+#endif // AUDIOMETADATA_H
@@ -0,0 +1,315 @@
+#include "audioscanner.h"
+#include "blobstore.h"
+#include "databasesupport.h"
+#include "tracer.h"
+
+#include <QtConcurrent>
+#include <QDir>
+#include <QDateTime>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+
+AudioScanner::AudioScanner(const QString &libraryRoot, int concurrency, QObject *parent) :
+    QObject(parent), root(libraryRoot), cancelled(0), remaining(0), running(false)
+{
+    pool.setMaxThreadCount(qMax(1, concurrency));
+    connect(&listWatcher, SIGNAL(finished()), this, SLOT(filesListed()));
+}
+
+//Waits for the files being read and writes them, with any others not written yet.
+AudioScanner::~AudioScanner()
+{
+    cancel();
+    pool.waitForDone();
+    if (!running)
+        return;
+
+    //Their fileDone() calls are still queued and will not be delivered now.
+    QList<int> unstored;
+    for (int i = 0; i < scannedFiles.size(); ++i) {
+        if (!scannedFiles.at(i).stored)
+            unstored.append(i);
+    }
+    if (!Store(unstored, false))
+        qWarning("Cannot store the audio details: %s", qPrintable(lastError));
+}
+
+//Creates the table the scan results are kept in if it does not exist yet. Call after BlobStore::InitManifest().
+bool AudioScanner::InitCache()
+{
+    QSqlQuery query(DatabaseSupport::Connection());
+    if (!query.exec("CREATE TABLE IF NOT EXISTS " AUDIO_TABLE " ("
+                    "entry_id TEXT NOT NULL,"
+                    "file_name TEXT NOT NULL,"
+                    "size INTEGER NOT NULL," //As in the manifest when the file was read; a change means reading it again.
+                    "modified INTEGER NOT NULL,"
+                    "format TEXT NOT NULL," //Empty if the file could not be read.
+                    "duration_ms INTEGER," //NULL if unknown.
+                    "bitrate INTEGER,"
+                    "channels INTEGER,"
+                    "sample_rate INTEGER,"
+                    "PRIMARY KEY (entry_id, file_name));")) {
+        DatabaseSupport::ReportError("Error", "Cannot prepare the audio details table. Error details: " +
+                                     query.lastError().text() + "\n Please contact your support team for assistance.");
+        return false;
+    }
+    return true;
+}
+
+qint64 AudioScanner::EntryDurationMs(const QString &entryId)
+{
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT SUM(duration_ms), COUNT(duration_ms) FROM " AUDIO_TABLE " WHERE entry_id = ?;");
+    query.bindValue(0, entryId);
+    qint64 duration = -1;
+    if (query.exec() && query.next() && query.value(1).toInt() > 0)
+        duration = query.value(0).toLongLong();
+    query.finish();
+    return duration;
+}
+
+/* Lists the files that need reading on a worker thread and starts reading
+ * them; returns at once. finished() is emitted when they are done and
+ * stored, also when there was nothing to read or they could not be listed.
+ */
+bool AudioScanner::start()
+{
+    if (running)
+        return false;
+    cancelled.store(0);
+    scannedFiles.clear();
+    unstoredFiles.clear();
+    lastError.clear();
+    timer.start();
+    running = true;
+    listWatcher.setFuture(QtConcurrent::run(&pool, ListFiles, root));
+    return true;
+}
+
+void AudioScanner::filesListed()
+{
+    FileListing listing = listWatcher.result();
+    if (!listing.error.isEmpty()) {
+        lastError = listing.error;
+        qWarning("Cannot list the audio files to read: %s", qPrintable(lastError));
+        running = false;
+        emit finished();
+        return;
+    }
+
+    scannedFiles = listing.files;
+    remaining.store(scannedFiles.size());
+    if (scannedFiles.isEmpty()) {
+        fileDone(-1);
+        return;
+    }
+
+    //As in AudioImporter, each worker writes to its own element only.
+    for (int i = 0; i < scannedFiles.size(); ++i)
+        QtConcurrent::run(&pool, ScanFile, this, &scannedFiles[i], i);
+}
+
+//Runs on a worker thread, on that thread's own connection.
+AudioScanner::FileListing AudioScanner::ListFiles(const QString &libraryRoot)
+{
+    TRACE_SCOPE("AudioScanner::ListFiles");
+    FileListing listing;
+    if (!BackfillManifest(libraryRoot, listing.error))
+        return listing;
+
+    QSqlQuery query(DatabaseSupport::Connection());
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT f.entry_id, f.file_name, f.size, f.modified FROM " ENTRY_FILE_TABLE " f "
+                    "LEFT JOIN " AUDIO_TABLE " a ON a.entry_id = f.entry_id AND a.file_name = f.file_name "
+                    "WHERE a.entry_id IS NULL OR a.size <> f.size OR a.modified <> f.modified;")) {
+        listing.error = query.lastError().text();
+        return listing;
+    }
+    while (query.next()) {
+        ScannedFile file;
+        file.entryId = query.value(0).toString();
+        file.fileName = query.value(1).toString();
+        file.size = query.value(2).toLongLong();
+        file.modified = query.value(3).toLongLong();
+        listing.files.append(file);
+    }
+    query.finish();
+    return listing;
+}
+
+/* Records the folders of entries that have audio but no manifest rows, as
+ * AttachmentManifest does when such an entry is first looked at: no hashes,
+ * as their files are not in the BlobStore. The folders are listed before
+ * the transaction, so the GUI's writes do not wait for the disk; an entry
+ * that got its rows in the meantime is left alone.
+ */
+bool AudioScanner::BackfillManifest(const QString &libraryRoot, QString &error)
+{
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT DISTINCT m.id FROM " + DatabaseSupport::GetCompatibleDBTableName() + " m "
+                    "WHERE m.id IS NOT NULL AND m.id <> '' "
+                    "AND NOT EXISTS (SELECT 1 FROM " ENTRY_FILE_TABLE " f WHERE f.entry_id = m.id);")) {
+        error = query.lastError().text();
+        return false;
+    }
+    QHash<QString, QFileInfoList> folders;
+    while (query.next()) {
+        QString entryId = query.value(0).toString();
+        QFileInfoList files = QDir(libraryRoot + "/" + entryId).entryInfoList(QDir::Files, QDir::Name);
+        if (!files.isEmpty())
+            folders.insert(entryId, files);
+    }
+    query.finish();
+    if (folders.isEmpty())
+        return true;
+
+    TraceSpan span("AudioScanner::BackfillManifest");
+    span.setValue(folders.size());
+    //Takes the write lock up front, so the check below still holds when the rows go in.
+    if (!query.exec("BEGIN IMMEDIATE;")) {
+        error = query.lastError().text();
+        return false;
+    }
+    QSqlQuery recorded(db);
+    recorded.prepare("SELECT 1 FROM " ENTRY_FILE_TABLE " WHERE entry_id = ? LIMIT 1;");
+    QSqlQuery addRow(db);
+    addRow.prepare("INSERT INTO " ENTRY_FILE_TABLE " (entry_id, file_name, size, modified, hash) VALUES (?, ?, ?, ?, NULL);");
+    bool ok = true;
+    QHash<QString, QFileInfoList>::const_iterator entry;
+    for (entry = folders.constBegin(); ok && entry != folders.constEnd(); ++entry) {
+        recorded.bindValue(0, entry.key());
+        ok = recorded.exec();
+        bool skip = ok && recorded.next();
+        recorded.finish();
+        if (skip)
+            continue;
+        foreach (const QFileInfo &info, entry.value()) {
+            addRow.bindValue(0, entry.key());
+            addRow.bindValue(1, info.fileName());
+            addRow.bindValue(2, info.size());
+            addRow.bindValue(3, info.lastModified().toMSecsSinceEpoch());
+            ok = addRow.exec();
+            if (!ok)
+                break;
+        }
+    }
+    if (!ok || !db.commit()) {
+        error = ok ? db.lastError().text() : recorded.lastError().text() + addRow.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+int AudioScanner::failedCount() const
+{
+    int failed = 0;
+    foreach (const ScannedFile &file, scannedFiles) {
+        if (!file.ok && !file.error.isEmpty())
+            ++failed;
+    }
+    return failed;
+}
+
+/* Files not read yet are left for the next scan. Those read so far are
+ * written now; the few still being read are written when they are done,
+ * or by the destructor.
+ */
+void AudioScanner::cancel()
+{
+    cancelled.store(1);
+    if (!unstoredFiles.isEmpty() && !Store(unstoredFiles, false))
+        qWarning("Cannot store the audio details: %s", qPrintable(lastError));
+    unstoredFiles.clear();
+}
+
+void AudioScanner::fileDone(int index)
+{
+    if (index >= 0 && (scannedFiles.at(index).ok || !scannedFiles.at(index).error.isEmpty()))
+        unstoredFiles.append(index); //Not the files skipped after a cancel.
+    if (remaining.fetchAndAddOrdered(-1) > 1) {
+        if (unstoredFiles.size() >= AUDIO_SCAN_STORE_FILES || (cancelled.load() && !unstoredFiles.isEmpty())) {
+            if (!Store(unstoredFiles, false))
+                qWarning("Cannot store the audio details: %s", qPrintable(lastError));
+            unstoredFiles.clear();
+        }
+        return;
+    }
+    //Rows of files the manifest no longer lists only go once the whole scan got through.
+    if (!Store(unstoredFiles, !cancelled.load()))
+        qWarning("Cannot store the audio details: %s", qPrintable(lastError));
+    unstoredFiles.clear();
+    running = false;
+    Tracer::RecordSince("AudioScanner::run", timer, scannedFiles.size());
+    emit finished();
+}
+
+//Runs on a worker thread.
+void AudioScanner::ScanFile(AudioScanner *scanner, ScannedFile *file, int index)
+{
+    if (!scanner->cancelled.load()) {
+        TraceSpan span("AudioScanner::ScanFile");
+        span.setValue(file->size);
+        file->ok = AudioMetadata::Read(scanner->root + "/" + file->entryId + "/" + file->fileName, file->info, file->error);
+    }
+    QMetaObject::invokeMethod(scanner, "fileDone", Qt::QueuedConnection, Q_ARG(int, index));
+}
+
+/* Writes these files, those of them that were read, in one transaction;
+ * with 'dropMissing', also drops the rows of files the manifest no longer lists.
+ */
+bool AudioScanner::Store(const QList<int> &files, bool dropMissing)
+{
+    if (files.isEmpty() && !dropMissing)
+        return true;
+    TraceSpan span("AudioScanner::Store");
+    span.setValue(files.size());
+    QSqlDatabase db = DatabaseSupport::Connection();
+    if (!db.transaction()) {
+        lastError = db.lastError().text();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO " AUDIO_TABLE " (entry_id, file_name, size, modified, format, duration_ms, bitrate, channels, sample_rate) "
+                  "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    foreach (int index, files) {
+        const ScannedFile &file = scannedFiles.at(index);
+        if (file.stored || (!file.ok && file.error.isEmpty()))
+            continue; //Not read; the scan was cancelled.
+        bool known = file.info.isValid();
+        query.bindValue(0, file.entryId);
+        query.bindValue(1, file.fileName);
+        query.bindValue(2, file.size);
+        query.bindValue(3, file.modified);
+        query.bindValue(4, file.ok ? file.info.format : QString(""));
+        query.bindValue(5, known ? QVariant(file.info.durationMs) : QVariant(QVariant::LongLong));
+        query.bindValue(6, known ? QVariant(file.info.bitrate) : QVariant(QVariant::Int));
+        query.bindValue(7, known ? QVariant(file.info.channels) : QVariant(QVariant::Int));
+        query.bindValue(8, known ? QVariant(file.info.sampleRate) : QVariant(QVariant::Int));
+        if (!query.exec()) {
+            lastError = query.lastError().text();
+            query.finish();
+            db.rollback();
+            return false;
+        }
+    }
+    query.finish();
+
+    if (dropMissing && !query.exec("DELETE FROM " AUDIO_TABLE " WHERE NOT EXISTS (SELECT 1 FROM " ENTRY_FILE_TABLE " f "
+                    "WHERE f.entry_id = " AUDIO_TABLE ".entry_id AND f.file_name = " AUDIO_TABLE ".file_name);")) {
+        lastError = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        lastError = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    foreach (int index, files)
+        scannedFiles[index].stored = true;
+    return true;
+}
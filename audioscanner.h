@@ -0,0 +1,103 @@
+#ifndef AUDIOSCANNER_H
+#define AUDIOSCANNER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+
+#include "audiometadata.h"
+
+#define AUDIO_SCAN_THREADS 8 //The workers mostly wait for the disk (or the network share), not the CPU.
+#define AUDIO_SCAN_STORE_FILES 256 //Files read between writes of the results.
+#define AUDIO_TABLE "Attachment_Audio"
+
+//One file of a scan: where it is, as the manifest last saw it, and what its headers say.
+struct ScannedFile
+{
+    ScannedFile() : size(0), modified(0), ok(false), stored(false) {}
+
+    QString entryId;
+    QString fileName;
+    qint64 size;
+    qint64 modified;
+    AudioInfo info;
+    bool ok;
+    QString error;
+    bool stored; //Written to the table; only touched on the GUI thread.
+};
+
+/* Reads the playing time, bitrate, channels and sample rate of the
+ * library's audio files (see AudioMetadata) on worker threads, and keeps
+ * them in the Attachment_Audio table. Only files the attachment manifest
+ * lists that are not in that table yet, or whose size or modification time
+ * changed since, are read; a library that was scanned before costs one
+ * query. Files that cannot be read are recorded too, so they are not tried
+ * again until they change.
+ *
+ * Entries imported before the manifest existed have no rows in it until
+ * they are first looked at. Their folders are listed into the manifest
+ * first, on a worker thread like the rest, so their files are read too.
+ *
+ * The results are written on the GUI thread, one transaction for every
+ * AUDIO_SCAN_STORE_FILES files read, and what is left once every file is
+ * done; then finished() is emitted. Cancelling writes what has been read so
+ * far, and destroying the scanner waits for the files being read and writes
+ * those too, so nothing read is lost when the program closes.
+ */
+class AudioScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AudioScanner(const QString &libraryRoot, int concurrency = AUDIO_SCAN_THREADS, QObject *parent = 0);
+    ~AudioScanner();
+
+    static bool InitCache();
+    static qint64 EntryDurationMs(const QString &entryId); //-1 if no file of the entry could be timed.
+
+    bool start(); //False if a scan is running. Whether the files could be listed is in errorString() at finished().
+    bool isRunning() const { return running; }
+    int scannedCount() const { return scannedFiles.size(); }
+    int failedCount() const;
+    qint64 elapsedMs() const { return timer.isValid() ? timer.elapsed() : 0; }
+    QString errorString() const { return lastError; }
+
+signals:
+    void finished();
+
+public slots:
+    void cancel();
+
+private slots:
+    void filesListed();
+    void fileDone(int index);
+
+private:
+    struct FileListing
+    {
+        QVector<ScannedFile> files;
+        QString error;
+    };
+
+    static FileListing ListFiles(const QString &libraryRoot);
+    static bool BackfillManifest(const QString &libraryRoot, QString &error);
+    static void ScanFile(AudioScanner *scanner, ScannedFile *file, int index);
+    bool Store(const QList<int> &files, bool dropMissing);
+
+    QString root;
+    QThreadPool pool;
+    QFutureWatcher<FileListing> listWatcher;
+    QVector<ScannedFile> scannedFiles;
+    QList<int> unstoredFiles; //Read, and reported back to the GUI thread, but not written yet.
+    QAtomicInt cancelled;
+    QAtomicInt remaining;
+    bool running;
+    QString lastError;
+    QElapsedTimer timer;
+};
+
+#endif // AUDIOSCANNER_H
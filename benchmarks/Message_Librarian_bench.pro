@@ -0,0 +1,58 @@
+#-------------------------------------------------
+#
+# Benchmarks: generates synthetic libraries and
+# times the library code against them.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       += sql
+QT       += concurrent
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+DEFINES  += MESSAGE_LIBRARIAN_HEADLESS
+
+TARGET = message-librarian-bench
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+    librarygenerator.cpp \
+    benchmarkrunner.cpp \
+    ../databasesupport.cpp \
+    ../tracer.cpp \
+    ../sermonfiltermatcher.cpp \
+    ../sermonsearchquery.cpp \
+    ../sermonsortfilterproxymodel.cpp \
+    ../sermontablemodel.cpp \
+    ../sermoncatalog.cpp \
+    ../sermoncatalogprovider.cpp \
+    ../audioimporter.cpp \
+    ../blobstore.cpp \
+    ../attachmentmanifest.cpp \
+    ../editjournal.cpp \
+    ../audiometadata.cpp \
+    ../publishplanner.cpp \
+    ../publishstager.cpp
+
+HEADERS  += librarygenerator.h \
+    benchmarkrunner.h \
+    ../databasesupport.h \
+    ../tracer.h \
+    ../sermonfiltermatcher.h \
+    ../sermonsearchquery.h \
+    ../sermonsortfilterproxymodel.h \
+    ../sermontablemodel.h \
+    ../sermoncatalog.h \
+    ../sermoncatalogprovider.h \
+    ../audioimporter.h \
+    ../blobstore.h \
+    ../attachmentmanifest.h \
+    ../editjournal.h \
+    ../audiometadata.h \
+    ../publishplanner.h \
+    ../publishstager.h
@@ -0,0 +1,392 @@
+#include "benchmarkrunner.h"
+#include "librarygenerator.h"
+#include "databasesupport.h"
+#include "blobstore.h"
+#include "audioimporter.h"
+#include "sermontablemodel.h"
+#include "sermoncatalogprovider.h"
+#include "sermonsortfilterproxymodel.h"
+#include "editjournal.h"
+#include "publishplanner.h"
+#include "publishstager.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+#include <algorithm>
+
+#define BENCHMARK_EDIT_ROWS 500
+#define BENCHMARK_EDIT_SUFFIX " (edited)"
+#define BENCHMARK_LOOKUP_IDS 1000
+#define BENCHMARK_PUBLISH_ENTRIES 1000
+
+//Edits the description of the first 'rows' rows, one row at a time as the Edit dialog submits them, or takes the edit back again.
+static bool EditDescriptions(SermonTableModel &model, int rows, bool revert)
+{
+    for (int row = 0; row < rows; ++row) {
+        QModelIndex description = model.index(row, Sermon_Description);
+        QString text = model.data(description).toString();
+        if (revert)
+            text.chop(QString(BENCHMARK_EDIT_SUFFIX).length());
+        else
+            text += BENCHMARK_EDIT_SUFFIX;
+        if (!model.setData(description, text) || !model.submit())
+            return false;
+    }
+    return true;
+}
+
+BenchmarkRunner::BenchmarkRunner(int iterations) :
+    iterations(qMax(1, iterations))
+{
+}
+
+//The start-up sequence of main(), up to the point where the main window would be shown.
+bool BenchmarkRunner::OpenLibrary(const QString &path, QString &error)
+{
+    if (!DatabaseSupport::InitDatabase(path) || !DatabaseSupport::CheckDatabaseVersion() ||
+            !DatabaseSupport::LoadDatabase() || !BlobStore::InitManifest()) {
+        error = "Cannot open " + path + ": " + DatabaseSupport::LastErrorMessage();
+        return false;
+    }
+    DatabaseSupport::InitSearchIndex();
+    return true;
+}
+
+void BenchmarkRunner::CloseLibrary()
+{
+    DatabaseSupport::ReleaseConnection();
+    QSqlDatabase::database().close();
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+bool BenchmarkRunner::runLibrary(const QString &path, int rows, const LibraryGenerator &generator, QString &error)
+{
+    QElapsedTimer timer;
+    QVector<qint64> samples;
+
+    for (int i = 0; i < iterations; ++i) {
+        timer.start();
+        bool ok = OpenLibrary(path, error);
+        samples << timer.nsecsElapsed();
+        if (!ok)
+            return false;
+        CloseLibrary();
+    }
+    Record("startup", QString(), rows, samples);
+
+    if (!OpenLibrary(path, error))
+        return false;
+    if (sqlite.isEmpty()) {
+        QSqlQuery version(DatabaseSupport::Connection());
+        if (version.exec("SELECT sqlite_version();") && version.next())
+            sqlite = version.value(0).toString();
+    }
+
+    bool ok = true;
+    {
+        SermonTableModel model;
+        model.setTable(DatabaseSupport::GetCompatibleDBTableName());
+        SermonCatalogProvider catalogs(&model);
+        QVector<qint64> selectSamples, fetchSamples, catalogSamples;
+        for (int i = 0; ok && i < iterations; ++i) {
+            timer.start();
+            ok = model.select();
+            selectSamples << timer.nsecsElapsed();
+            while (model.canFetchMore())
+                model.fetchMore();
+            fetchSamples << timer.nsecsElapsed();
+            timer.start();
+            ok = ok && !catalogs.catalog().isNull();
+            catalogSamples << timer.nsecsElapsed();
+        }
+        if (!ok) {
+            error = "Cannot read the message table: " + model.lastError().text();
+        } else {
+            Record("select", "first-batch", rows, selectSamples);
+            Record("select", "fetch-all", rows, fetchSamples);
+            QJsonObject details;
+            details.insert("bytesPerRow", double(catalogs.catalog()->memoryUsage()) / qMax(1, model.rowCount()));
+            Record("catalog", QString(), rows, catalogSamples, details);
+        }
+
+        //Opening entries by their audio id; the first lookup also builds the index over the fetched rows.
+        QStringList entryIds;
+        for (int row = 0; row < model.rowCount() && entryIds.size() < BENCHMARK_LOOKUP_IDS; ++row) {
+            QString entryId = model.data(model.index(row, Sermon_ID)).toString();
+            if (!entryId.isEmpty())
+                entryIds << entryId;
+        }
+        if (ok && !entryIds.isEmpty()) {
+            QVector<qint64> lookupSamples;
+            for (int i = 0; ok && i < iterations; ++i) {
+                timer.start();
+                foreach (const QString &entryId, entryIds)
+                    ok = ok && model.rowOfEntry(entryId) >= 0;
+                lookupSamples << timer.nsecsElapsed();
+            }
+            QJsonObject details;
+            details.insert("lookups", entryIds.size());
+            Record("lookup", "by-id", rows, lookupSamples, details);
+            if (!ok)
+                error = "An entry could not be found by its id.";
+        }
+
+        SermonSortFilterProxyModel proxy;
+        proxy.setSourceModel(&model);
+
+        QList<QPair<QString, SermonSearchQuery> > queries;
+        QHash<int, QRegExp> patterns;
+        SermonSearchQuery query;
+        patterns.insert(Sermon_Title, QRegExp(generator.word(0), Qt::CaseInsensitive));
+        query.setColumnPatterns(patterns);
+        queries << qMakePair(QString("title-common-word"), query);
+        patterns.clear();
+        patterns.insert(Sermon_Description, QRegExp(generator.word(generator.vocabularySize() - 1), Qt::CaseInsensitive));
+        query.setColumnPatterns(patterns);
+        queries << qMakePair(QString("description-rare-word"), query);
+        patterns.clear();
+        patterns.insert(Sermon_Speaker, QRegExp("^" + QRegExp::escape(generator.speaker(0).left(7)), Qt::CaseInsensitive));
+        query.setColumnPatterns(patterns);
+        queries << qMakePair(QString("speaker-regexp"), query);
+        query.clear();
+        query.setMinimumDate(QDate(1990, 1, 1));
+        query.setMaximumDate(QDate(1999, 12, 31));
+        queries << qMakePair(QString("date-range"), query);
+
+        //Full-text hits are looked up once, as FindSermon does before handing them to the proxy.
+        QHash<int, QString> terms;
+        terms.insert(Sermon_Title, generator.word(10));
+        QSet<qint64> hits;
+        if (DatabaseSupport::SearchFullText(DatabaseSupport::BuildSearchExpression(terms), hits)) {
+            query.clear();
+            query.setRowIdFilter(hits);
+            queries << qMakePair(QString("fulltext-hits"), query);
+        }
+
+        for (int q = 0; ok && q < queries.size(); ++q) {
+            QVector<qint64> filterSamples;
+            for (int i = 0; i < iterations; ++i) {
+                proxy.resetFilters();
+                timer.start();
+                proxy.setSearchQuery(queries.at(q).second);
+                filterSamples << timer.nsecsElapsed();
+            }
+            QJsonObject details;
+            details.insert("matches", proxy.rowCount());
+            Record("filter", queries.at(q).first, rows, filterSamples, details);
+        }
+
+        //Typing a word a letter at a time; every query after the first narrows the previous one.
+        QString word = generator.word(1);
+        QVector<qint64> typingSamples;
+        for (int i = 0; ok && i < iterations; ++i) {
+            proxy.resetFilters();
+            timer.start();
+            for (int length = 1; length <= word.length(); ++length) {
+                patterns.clear();
+                patterns.insert(Sermon_Title, QRegExp(word.left(length), Qt::CaseInsensitive));
+                query.clear();
+                query.setColumnPatterns(patterns);
+                proxy.setSearchQuery(query);
+            }
+            typingSamples << timer.nsecsElapsed();
+        }
+        if (ok) {
+            QJsonObject details;
+            details.insert("keystrokes", word.length());
+            Record("filter", "typing", rows, typingSamples, details);
+        }
+
+        proxy.resetFilters();
+        const int sortColumns[] = { Sermon_Title, Sermon_Speaker, Sermon_Location, Sermon_Date };
+        const char *sortNames[] = { "title", "speaker", "location", "date" };
+        for (int c = 0; ok && c < 4; ++c) {
+            QVector<qint64> sortSamples;
+            for (int i = 0; i < iterations; ++i) {
+                proxy.sort(-1);
+                timer.start();
+                proxy.sort(sortColumns[c], i % 2 ? Qt::DescendingOrder : Qt::AscendingOrder);
+                sortSamples << timer.nsecsElapsed();
+            }
+            Record("sort", sortNames[c], rows, sortSamples);
+        }
+
+        //Each sample edits the rows and then puts them back, so the library can be reused.
+        proxy.sort(-1);
+        const int editRows = qMin(model.rowCount(), BENCHMARK_EDIT_ROWS);
+        for (int journalled = 0; ok && journalled < 2 && editRows > 0; ++journalled) {
+            EditJournal journal(model.tableName(), DatabaseSupport::LibraryPath() + "/" EDIT_JOURNAL_FILE_NAME);
+            model.setEditJournal(journalled ? &journal : NULL);
+            QVector<qint64> editSamples;
+            for (int i = 0; ok && i < iterations; ++i) {
+                timer.start();
+                for (int pass = 0; ok && pass < 2; ++pass)
+                    ok = EditDescriptions(model, editRows, pass == 1) && journal.flush();
+                editSamples << timer.nsecsElapsed();
+            }
+            model.setEditJournal(NULL);
+            if (!ok) {
+                error = "Cannot write the message table: " + (journalled ? journal.errorString() : model.lastError().text());
+                break;
+            }
+            QVector<qint64> sorted = editSamples;
+            std::sort(sorted.begin(), sorted.end());
+            double seconds = sorted.at(sorted.size() / 2) / 1e9;
+            int commits = journalled ? 2 : 2 * editRows; //Per sample: one flush per pass, or one per row.
+            QJsonObject details;
+            details.insert("edits", 2 * editRows);
+            details.insert("commits", commits);
+            details.insert("editsPerSecond", 2 * editRows / seconds);
+            details.insert("commitsPerSecond", commits / seconds);
+            Record("edit", journalled ? "write-behind" : "write-through", rows, editSamples, details);
+        }
+    }
+    CloseLibrary();
+    return ok;
+}
+
+bool BenchmarkRunner::runImport(const QString &dir, int fileCount, qint64 fileSize, quint64 seed, QString &error)
+{
+    QStringList files;
+    if (!LibraryGenerator::WriteSampleFiles(dir + "/source", fileCount, fileSize, seed, files, error))
+        return false;
+
+    QVector<qint64> samples;
+    double bytesPerSecond = 0;
+    for (int i = 0; i < iterations; ++i) {
+        AudioImporter importer;
+        QEventLoop loop;
+        QObject::connect(&importer, SIGNAL(finished()), &loop, SLOT(quit()));
+        QElapsedTimer timer;
+        timer.start();
+        importer.start(files, dir + "/staging");
+        if (importer.isRunning())
+            loop.exec();
+        samples << timer.nsecsElapsed();
+        bool ok = importer.succeeded();
+        if (!ok)
+            error = importer.errorString();
+        bytesPerSecond = qMax(bytesPerSecond, importer.bytesPerSecond());
+        importer.discard();
+        if (!ok)
+            return false;
+    }
+
+    QJsonObject details;
+    details.insert("files", fileCount);
+    details.insert("bytes", double(fileCount) * fileSize);
+    details.insert("bestMegabytesPerSecond", bytesPerSecond / (1024 * 1024));
+    Record("import", "copy-and-verify", 0, samples, details);
+    return true;
+}
+
+/* Plans a selection of entries onto CDs and drives, then stages the
+ * sample files: linked, as when the staging folder is on the library's
+ * drive, and copied, as when it is not.
+ */
+bool BenchmarkRunner::runPublish(const QString &dir, int fileCount, qint64 fileSize, quint64 seed, QString &error)
+{
+    //One to three recordings of 20 to 90 minutes per entry, as in a sermon library.
+    BenchmarkRandom random(seed);
+    QVector<PublishItem> items(BENCHMARK_PUBLISH_ENTRIES);
+    for (int i = 0; i < items.size(); ++i) {
+        items[i].entryId = QString::number(i);
+        for (int f = 1 + random.bounded(3); f > 0; --f) {
+            PublishFile file;
+            file.name = QString("part%1.mp3").arg(f);
+            file.durationMs = (20 + random.bounded(71)) * 60000LL;
+            file.size = file.durationMs * 16; //128 kbit/s
+            file.audio = true;
+            items[i].files.append(file);
+        }
+    }
+    QList<QPair<QString, PublishTarget> > targets;
+    targets << qMakePair(QString("plan-cd80"), PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS))
+            << qMakePair(QString("plan-usb8g"), PublishTarget(PublishTarget::UsbDrive, 7600000000LL));
+    for (int t = 0; t < targets.size(); ++t) {
+        QVector<qint64> samples;
+        int volumes = 0;
+        for (int i = 0; i < iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            volumes = PublishPlanner::Plan(items, targets.at(t).second).volumes.size();
+            samples << timer.nsecsElapsed();
+        }
+        QJsonObject details;
+        details.insert("entries", items.size());
+        details.insert("volumes", volumes);
+        Record("publish", targets.at(t).first, 0, samples, details);
+    }
+
+    QStringList files;
+    if (!LibraryGenerator::WriteSampleFiles(dir + "/source", fileCount, fileSize, seed, files, error))
+        return false;
+    QVector<PublishItem> staged(1);
+    foreach (const QString &path, files) {
+        PublishFile file;
+        file.path = path;
+        file.name = QFileInfo(path).fileName();
+        file.size = fileSize;
+        staged[0].files.append(file);
+    }
+    PublishPlan plan = PublishPlanner::Plan(staged, PublishTarget(PublishTarget::UsbDrive, fileSize * fileCount * 2));
+    foreach (const QString &path, files)
+        BlobStore::Protect(path); //Only read-only files are linked, as in a library.
+
+    for (int linking = 1; linking >= 0; --linking) {
+        QVector<qint64> samples;
+        double bytesPerSecond = 0;
+        for (int i = 0; i < iterations; ++i) {
+            PublishStager stager;
+            stager.setLinking(linking);
+            QEventLoop loop;
+            QObject::connect(&stager, SIGNAL(finished()), &loop, SLOT(quit()));
+            QString staging = dir + "/staging";
+            QDir(staging).removeRecursively();
+            QElapsedTimer timer;
+            timer.start();
+            bool ok = stager.start(staged, plan, staging);
+            if (ok && stager.isRunning())
+                loop.exec();
+            samples << timer.nsecsElapsed();
+            ok = ok && stager.succeeded();
+            if (!ok)
+                error = stager.errorString();
+            bytesPerSecond = qMax(bytesPerSecond, stager.bytesPerSecond());
+            QDir(staging).removeRecursively();
+            if (!ok)
+                return false;
+        }
+        QJsonObject details;
+        details.insert("files", fileCount);
+        details.insert("bytes", double(fileCount) * fileSize);
+        if (!linking)
+            details.insert("bestMegabytesPerSecond", bytesPerSecond / (1024 * 1024));
+        Record("publish", linking ? "stage-link" : "stage-copy", 0, samples, details);
+    }
+    return true;
+}
+
+void BenchmarkRunner::Record(const QString &benchmark, const QString &variant, int rows, const QVector<qint64> &samplesNs,
+                             const QJsonObject &details)
+{
+    QVector<qint64> sorted = samplesNs;
+    std::sort(sorted.begin(), sorted.end());
+    QJsonArray samplesMs;
+    foreach (qint64 sample, samplesNs)
+        samplesMs.append(sample / 1e6);
+
+    QJsonObject result = details;
+    result.insert("benchmark", benchmark);
+    if (!variant.isEmpty())
+        result.insert("variant", variant);
+    if (rows > 0)
+        result.insert("rows", rows);
+    result.insert("samplesMs", samplesMs);
+    result.insert("medianMs", sorted.at(sorted.size() / 2) / 1e6);
+    result.insert("minMs", sorted.first() / 1e6);
+    recorded.append(result);
+}
@@ -0,0 +1,54 @@
+#ifndef BENCHMARKRUNNER_H
+#define BENCHMARKRUNNER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QJsonArray>
+#include <QJsonObject>
+
+class LibraryGenerator;
+
+/* Times the operations a user waits for, against a generated library:
+ *
+ *   startup    InitDatabase, CheckDatabaseVersion, LoadDatabase and the
+ *              index and manifest set-up, as main() runs them
+ *   select     SermonTableModel::select(), then fetching every row
+ *   catalog    loading the SermonCatalog background searches run on
+ *   lookup     finding entries' rows by their audio id
+ *   filter     SermonSortFilterProxyModel::setSearchQuery() with typical
+ *              queries, including one typed a letter at a time
+ *   sort       the proxy sorting all rows by each visible column
+ *   edit       rapid data entry: one entry after another edited and
+ *              submitted, written through and with the EditJournal
+ *   import     AudioImporter copying and verifying a set of files
+ *   publish    PublishPlanner laying out a thousand entries, and
+ *              PublishStager linking and copying a set of files
+ *
+ * Each is run a number of times; every sample is kept, in milliseconds,
+ * with the median and minimum, as one JSON object per benchmark.
+ */
+class BenchmarkRunner
+{
+public:
+    explicit BenchmarkRunner(int iterations);
+
+    bool runLibrary(const QString &path, int rows, const LibraryGenerator &generator, QString &error);
+    bool runImport(const QString &dir, int fileCount, qint64 fileSize, quint64 seed, QString &error);
+    bool runPublish(const QString &dir, int fileCount, qint64 fileSize, quint64 seed, QString &error);
+
+    QJsonArray results() const { return recorded; }
+    QString sqliteVersion() const { return sqlite; }
+
+private:
+    bool OpenLibrary(const QString &path, QString &error);
+    void CloseLibrary();
+    void Record(const QString &benchmark, const QString &variant, int rows, const QVector<qint64> &samplesNs,
+                const QJsonObject &details = QJsonObject());
+
+    int iterations;
+    QJsonArray recorded;
+    QString sqlite;
+};
+
+#endif // BENCHMARKRUNNER_H
@@ -0,0 +1,219 @@
+#include "librarygenerator.h"
+#include "databasesupport.h"
+#include "blobstore.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QUuid>
+#include <QtMath>
+
+#include <algorithm>
+
+#define GENERATOR_MARKER "generator.txt"
+#define GENERATOR_BATCH_ROWS 50000
+#define VOCABULARY_SIZE 3000
+#define SPEAKER_COUNT 300
+#define LOCATION_COUNT 120
+#define FIRST_DATE QDate(1960, 1, 1)
+#define LAST_DATE QDate(2016, 12, 31)
+
+LibraryGenerator::LibraryGenerator(int rows, quint64 seed) :
+    rowCount(rows), seed(seed), transcriptionRate(0.03), attachmentRate(0.02), elapsed(0)
+{
+    //The word lists come from a generator of their own, so they do not change with the row count.
+    static const char *syllables[] = { "ka", "lo", "mi", "ren", "sa", "tu", "vel", "do", "rin", "ma", "the", "ol",
+                                       "an", "ber", "gra", "ce", "fa", "ith", "ho", "pe", "lu", "cor", "dan", "el" };
+    const int syllableCount = int(sizeof(syllables) / sizeof(syllables[0]));
+    BenchmarkRandom random(seed ^ 0x5EED);
+    while (vocabulary.size() < VOCABULARY_SIZE) {
+        QString word;
+        for (int i = 1 + random.bounded(3); i > 0; --i)
+            word += syllables[random.bounded(syllableCount)];
+        if (!vocabulary.contains(word))
+            vocabulary << word;
+    }
+    for (int i = 0; i < SPEAKER_COUNT; ++i)
+        speakers << "Bro. " + Words(random, 2, true);
+    for (int i = 0; i < LOCATION_COUNT; ++i)
+        locations << Words(random, 1 + random.bounded(2), true) + " Church";
+
+    wordWeights = ZipfTable(VOCABULARY_SIZE, 1.0);
+    speakerWeights = ZipfTable(SPEAKER_COUNT, 1.1);
+    locationWeights = ZipfTable(LOCATION_COUNT, 1.0);
+}
+
+QString LibraryGenerator::Parameters() const
+{
+    return QString("rows=%1 seed=%2 transcriptions=%3 attachments=%4\n").arg(rowCount).arg(seed).arg(transcriptionRate).arg(attachmentRate);
+}
+
+bool LibraryGenerator::generate(const QString &path, QString &error)
+{
+    elapsed = 0;
+    QFile marker(path + "/" GENERATOR_MARKER);
+    if (marker.open(QIODevice::ReadOnly) && QString::fromUtf8(marker.readAll()) == Parameters())
+        return true;
+    marker.close();
+
+    //Only a folder this generator made (or an empty one) is ever replaced.
+    QDir dir(path);
+    if (dir.exists() && !marker.exists() && !dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty()) {
+        error = path + " is not empty and was not made by the generator.";
+        return false;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (dir.exists() && !dir.removeRecursively()) {
+        error = "Cannot remove the old library at " + path + ".";
+        return false;
+    }
+    if (!QDir().mkpath(path) || !DatabaseSupport::InitDatabase(path) || !DatabaseSupport::CreateNewDatabase() ||
+            !BlobStore::InitManifest()) {
+        error = "Cannot create a library at " + path + ": " + DatabaseSupport::LastErrorMessage();
+        return false;
+    }
+
+    bool ok = true;
+    {
+        QSqlDatabase db = DatabaseSupport::Connection();
+        QSqlQuery insert(db);
+        insert.prepare("INSERT INTO " + DatabaseSupport::GetCompatibleDBTableName() +
+                       " (id, title, speaker, location, date, description, transcription) VALUES (?, ?, ?, ?, ?, ?, ?);");
+        QSqlQuery insertFile(db);
+        insertFile.prepare("INSERT INTO " ENTRY_FILE_TABLE " (entry_id, file_name, size, modified, hash) VALUES (?, ?, ?, ?, NULL);");
+
+        BenchmarkRandom random(seed);
+        int days = FIRST_DATE.daysTo(LAST_DATE);
+        QByteArray noise(64 * 1024, 0);
+        db.transaction();
+        for (int row = 0; ok && row < rowCount; ++row) {
+            QString title = Words(random, 3 + random.bounded(7), true);
+            QString id;
+            if (random.uniform() < attachmentRate) {
+                //QUuid from generated bits, so that folder names are reproducible too.
+                QUuid uuid(uint(random.next()), ushort(random.next()), ushort(random.next()),
+                           uchar(random.next()), uchar(random.next()), uchar(random.next()), uchar(random.next()),
+                           uchar(random.next()), uchar(random.next()), uchar(random.next()), uchar(random.next()));
+                id = uuid.toString();
+                QDir().mkpath(path + "/" + id);
+                for (int i = 1 + random.bounded(3); ok && i > 0; --i) {
+                    QString fileName = QString("%1 - %2.mp3").arg(i).arg(title.left(40));
+                    QFile file(path + "/" + id + "/" + fileName);
+                    int size = 4096 + random.bounded(noise.size() - 4096);
+                    for (int b = 0; b < size; b += 8)
+                        *reinterpret_cast<quint64 *>(noise.data() + b) = random.next();
+                    ok = file.open(QIODevice::WriteOnly) && file.write(noise.constData(), size) == size;
+                    file.close();
+                    insertFile.bindValue(0, id);
+                    insertFile.bindValue(1, fileName);
+                    insertFile.bindValue(2, size);
+                    insertFile.bindValue(3, QFileInfo(file).lastModified().toMSecsSinceEpoch());
+                    ok = ok && insertFile.exec();
+                }
+            }
+
+            insert.bindValue(0, id.isEmpty() ? QVariant(QVariant::String) : QVariant(id));
+            insert.bindValue(1, title);
+            insert.bindValue(2, speakers.at(Zipf(random, speakerWeights)));
+            insert.bindValue(3, locations.at(Zipf(random, locationWeights)));
+            insert.bindValue(4, FIRST_DATE.addDays(random.bounded(days + 1)).toString(Qt::ISODate));
+            insert.bindValue(5, Words(random, 20 + random.bounded(60), false));
+            insert.bindValue(6, random.uniform() < transcriptionRate ? QVariant(Words(random, 800 + random.bounded(3200), false))
+                                                                     : QVariant(QVariant::String));
+            ok = ok && insert.exec();
+            if (ok && (row + 1) % GENERATOR_BATCH_ROWS == 0)
+                ok = db.commit() && db.transaction();
+        }
+        if (!ok)
+            error = insert.lastError().text() + insertFile.lastError().text() + db.lastError().text();
+        insert.finish();
+        insertFile.finish();
+        ok = ok && db.commit();
+    }
+    ok = ok && DatabaseSupport::InitSearchIndex();
+
+    DatabaseSupport::ReleaseConnection();
+    QSqlDatabase::database().close();
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    if (!ok) {
+        error = "Cannot fill the library at " + path + ": " + error;
+        return false;
+    }
+
+    if (!marker.open(QIODevice::WriteOnly) || marker.write(Parameters().toUtf8()) < 0) {
+        error = marker.errorString();
+        return false;
+    }
+    elapsed = timer.elapsed();
+    return true;
+}
+
+bool LibraryGenerator::WriteSampleFiles(const QString &dir, int count, qint64 size, quint64 seed, QStringList &files, QString &error)
+{
+    if (!QDir().mkpath(dir)) {
+        error = "Cannot create " + dir + ".";
+        return false;
+    }
+    BenchmarkRandom random(seed);
+    QByteArray block(1024 * 1024, 0);
+    files.clear();
+    for (int i = 0; i < count; ++i) {
+        QFile file(QString("%1/sample%2.mp3").arg(dir).arg(i));
+        if (file.exists() && file.size() == size) {
+            files << file.fileName();
+            continue;
+        }
+        if (!file.open(QIODevice::WriteOnly)) {
+            error = file.errorString();
+            return false;
+        }
+        for (qint64 written = 0; written < size; written += block.size()) {
+            for (int b = 0; b < block.size(); b += 8)
+                *reinterpret_cast<quint64 *>(block.data() + b) = random.next();
+            qint64 chunk = qMin<qint64>(block.size(), size - written);
+            if (file.write(block.constData(), chunk) != chunk) {
+                error = file.errorString();
+                return false;
+            }
+        }
+        files << file.fileName();
+    }
+    return true;
+}
+
+QString LibraryGenerator::Words(BenchmarkRandom &random, int count, bool capitalise) const
+{
+    QString text;
+    text.reserve(count * 8);
+    for (int i = 0; i < count; ++i) {
+        if (i > 0)
+            text += ' ';
+        QString word = vocabulary.at(wordWeights.isEmpty() ? random.bounded(vocabulary.size()) : Zipf(random, wordWeights));
+        if (capitalise)
+            word[0] = word.at(0).toUpper();
+        text += word;
+    }
+    return text;
+}
+
+int LibraryGenerator::Zipf(BenchmarkRandom &random, const QVector<double> &cumulative) const
+{
+    double value = random.uniform() * cumulative.last();
+    return qMin(int(std::upper_bound(cumulative.constBegin(), cumulative.constEnd(), value) - cumulative.constBegin()),
+                cumulative.size() - 1);
+}
+
+//Running totals of 1/k^exponent, k = 1 to 'size'.
+QVector<double> LibraryGenerator::ZipfTable(int size, double exponent)
+{
+    QVector<double> cumulative(size);
+    double total = 0;
+    for (int k = 0; k < size; ++k) {
+        total += 1.0 / qPow(k + 1, exponent);
+        cumulative[k] = total;
+    }
+    return cumulative;
+}
@@ -0,0 +1,77 @@
+#ifndef LIBRARYGENERATOR_H
+#define LIBRARYGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/* A small deterministic random number generator (xorshift64*). qrand()
+ * wraps the C library's rand(), which differs between platforms, so it
+ * cannot give the same library on every machine.
+ */
+class BenchmarkRandom
+{
+public:
+    explicit BenchmarkRandom(quint64 seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    quint64 next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+    int bounded(int limit) { return int(next() % quint64(limit)); } //0 to limit - 1.
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); } //0 to 1.
+
+private:
+    quint64 state;
+};
+
+/* Writes a synthetic message library: the message table, the search index,
+ * the attachment manifest and the entry folders the manifest lists. The
+ * same seed and row count always give the same library.
+ *
+ * Speakers and locations follow a Zipf distribution, as in real libraries,
+ * where a few speakers account for most of the messages. Descriptions run
+ * to a few dozen words; a small share of entries carries a transcription of
+ * several thousand words, and a smaller one a folder of audio files.
+ */
+class LibraryGenerator
+{
+public:
+    LibraryGenerator(int rows, quint64 seed);
+
+    void setTranscriptionRate(double rate) { transcriptionRate = rate; }
+    void setAttachmentRate(double rate) { attachmentRate = rate; }
+
+    //Creates the library in 'path', unless one made with the same parameters is already there.
+    bool generate(const QString &path, QString &error);
+    qint64 elapsedMs() const { return elapsed; } //0 if an existing library was reused.
+    QString word(int rank) const { return vocabulary.at(rank); } //0 is the most frequent.
+    int vocabularySize() const { return vocabulary.size(); }
+    QString speaker(int rank) const { return speakers.at(rank); }
+
+    //Files of 'size' bytes of noise, for the import benchmark.
+    static bool WriteSampleFiles(const QString &dir, int count, qint64 size, quint64 seed, QStringList &files, QString &error);
+
+private:
+    QString Parameters() const;
+    QString Words(BenchmarkRandom &random, int count, bool capitalise) const;
+    int Zipf(BenchmarkRandom &random, const QVector<double> &cumulative) const;
+    static QVector<double> ZipfTable(int size, double exponent);
+
+    int rowCount;
+    quint64 seed;
+    double transcriptionRate;
+    double attachmentRate;
+    qint64 elapsed;
+    QStringList vocabulary;
+    QVector<double> wordWeights;
+    QStringList speakers;
+    QVector<double> speakerWeights;
+    QStringList locations;
+    QVector<double> locationWeights;
+};
+
+#endif // LIBRARYGENERATOR_H
@@ -0,0 +1,117 @@
+#include "benchmarkrunner.h"
+#include "librarygenerator.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QSysInfo>
+#include <cstdio>
+
+static bool verbose = false;
+
+//Progress and qDebug output go to stderr only with --verbose, so stdout can be piped straight into a results store.
+static void MessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type == QtDebugMsg && !verbose)
+        return;
+    fprintf(stderr, "%s\n", qPrintable(message));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates synthetic message libraries and times search, sorting, start-up, import and publishing against them. "
+                                     "Results are written as JSON.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("data", "Where the generated libraries are kept (default: benchmark-data).", "dir", "benchmark-data"));
+    parser.addOption(QCommandLineOption("sizes", "Comma-separated library sizes in rows (default: 10000,100000,1000000).", "rows", "10000,100000,1000000"));
+    parser.addOption(QCommandLineOption("seed", "Seed for the generated libraries (default: 1).", "number", "1"));
+    parser.addOption(QCommandLineOption("iterations", "Runs of each benchmark (default: 5).", "count", "5"));
+    parser.addOption(QCommandLineOption("import-files", "Files copied by the import and publish benchmarks; 0 skips them (default: 8).", "count", "8"));
+    parser.addOption(QCommandLineOption("import-size", "Size of each of those files in MiB (default: 32).", "MiB", "32"));
+    parser.addOption(QCommandLineOption("output", "Write the results to this file instead of stdout.", "file"));
+    parser.addOption(QCommandLineOption("verbose", "Print progress to stderr."));
+    parser.process(a);
+
+    verbose = parser.isSet("verbose");
+    qInstallMessageHandler(MessageHandler);
+
+    quint64 seed = parser.value("seed").toULongLong();
+    int iterations = parser.value("iterations").toInt();
+    QString data = QDir(parser.value("data")).absolutePath();
+    BenchmarkRunner runner(iterations);
+    QJsonArray generated;
+    QString error;
+
+    foreach (const QString &size, parser.value("sizes").split(',', QString::SkipEmptyParts)) {
+        int rows = size.trimmed().toInt();
+        if (rows <= 0) {
+            fprintf(stderr, "Invalid library size \"%s\".\n", qPrintable(size));
+            return 64;
+        }
+        QString path = QString("%1/library-%2").arg(data).arg(rows);
+        LibraryGenerator generator(rows, seed);
+        qDebug("Generating %d rows in %s . . .", rows, qPrintable(path));
+        if (!generator.generate(path, error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 1;
+        }
+        QJsonObject library;
+        library.insert("rows", rows);
+        library.insert("path", path);
+        library.insert("generatedMs", generator.elapsedMs() > 0 ? QJsonValue(double(generator.elapsedMs())) : QJsonValue()); //null if reused.
+        generated.append(library);
+
+        qDebug("Running the library benchmarks on %d rows . . .", rows);
+        if (!runner.runLibrary(path, rows, generator, error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 2;
+        }
+    }
+
+    int importFiles = parser.value("import-files").toInt();
+    if (importFiles > 0) {
+        qDebug("Running the import benchmark . . .");
+        if (!runner.runImport(data + "/import", importFiles, parser.value("import-size").toLongLong() * 1024 * 1024, seed, error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 3;
+        }
+        qDebug("Running the publish benchmark . . .");
+        if (!runner.runPublish(data + "/publish", importFiles, parser.value("import-size").toLongLong() * 1024 * 1024, seed, error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 3;
+        }
+    }
+
+    QJsonObject report;
+    report.insert("format", 1);
+    report.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    report.insert("qtVersion", QString(qVersion()));
+    report.insert("sqliteVersion", runner.sqliteVersion());
+    report.insert("os", QSysInfo::prettyProductName());
+    report.insert("cpu", QSysInfo::currentCpuArchitecture());
+    report.insert("seed", QString::number(seed));
+    report.insert("iterations", iterations);
+    report.insert("libraries", generated);
+    report.insert("results", runner.results());
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    QFile output;
+    if (parser.isSet("output")) {
+        output.setFileName(parser.value("output"));
+        if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "Cannot write %s: %s\n", qPrintable(output.fileName()), qPrintable(output.errorString()));
+            return 4;
+        }
+    } else {
+        output.open(stdout, QIODevice::WriteOnly);
+    }
+    output.write(json);
+    return 0;
+}
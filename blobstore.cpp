@@ -0,0 +1,267 @@
+#include "blobstore.h"
+#include "databasesupport.h"
+#include "tracer.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BLOB_DIRECTORY ".blobs"
+
+BlobStore::BlobStore(const QString &libraryRoot) :
+    root(libraryRoot)
+{
+}
+
+//Creates the manifest tables if they do not exist yet.
+bool BlobStore::InitManifest()
+{
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QStringList statements;
+    statements << "CREATE TABLE IF NOT EXISTS " BLOB_TABLE " ("
+                  "hash TEXT PRIMARY KEY,"
+                  "size INTEGER NOT NULL,"
+                  "refcount INTEGER NOT NULL);"
+               << "CREATE INDEX IF NOT EXISTS " BLOB_TABLE "_Size_Index ON " BLOB_TABLE " (size);"
+               << "CREATE TABLE IF NOT EXISTS " ENTRY_FILE_TABLE " ("
+                  "entry_id TEXT NOT NULL,"
+                  "file_name TEXT NOT NULL,"
+                  "size INTEGER NOT NULL,"
+                  "modified INTEGER NOT NULL," //Milliseconds since the epoch.
+                  "hash TEXT REFERENCES " BLOB_TABLE " (hash)," //NULL for files that are not kept in the store.
+                  "PRIMARY KEY (entry_id, file_name));";
+
+    foreach (const QString &statement, statements) {
+        QSqlQuery query(db);
+        if (!query.exec(statement)) {
+            DatabaseSupport::ReportError("Error", "Cannot prepare the audio file manifest. Error details: " +
+                                         query.lastError().text() + "\n Please contact your support team for assistance.");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Makes 'to' a hard link to 'from', which costs no space and no copying.
+ * Impossible across drives and on FAT-formatted media.
+ */
+bool BlobStore::Link(const QString &from, const QString &to)
+{
+#ifdef Q_OS_WIN
+    return CreateHardLinkW(reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(to).utf16()),
+                           reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(from).utf16()), NULL);
+#else
+    return ::link(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+//Links where possible, and falls back to a real copy where not.
+bool BlobStore::LinkOrCopy(const QString &from, const QString &to)
+{
+    TRACE_SCOPE("BlobStore::LinkOrCopy");
+    return Link(from, to) || QFile::copy(from, to);
+}
+
+/* Takes away every write permission. On Windows this sets the read-only
+ * attribute, which a hard link shares with the stored file.
+ */
+bool BlobStore::Protect(const QString &path)
+{
+    return QFile::setPermissions(path, QFile::permissions(path) &
+                                 ~(QFile::WriteOwner | QFile::WriteUser | QFile::WriteGroup | QFile::WriteOther));
+}
+
+QString BlobStore::blobPath(const QByteArray &sha256) const
+{
+    QString hex = QString::fromLatin1(sha256.toHex());
+    return root + "/" BLOB_DIRECTORY "/" + hex.left(2) + "/" + hex;
+}
+
+QHash<qint64, QSet<QByteArray> > BlobStore::knownContent() const
+{
+    QHash<qint64, QSet<QByteArray> > content;
+    QSqlQuery query(DatabaseSupport::Connection());
+    query.setForwardOnly(true);
+    if (query.exec("SELECT size, hash FROM " BLOB_TABLE ";")) {
+        while (query.next())
+            content[query.value(0).toLongLong()].insert(QByteArray::fromHex(query.value(1).toByteArray()));
+    }
+    return content;
+}
+
+bool BlobStore::addEntryFiles(const QString &entryId, const QVector<ImportedFile> &files, QString &error)
+{
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery addBlob(db);
+    addBlob.prepare("INSERT OR IGNORE INTO " BLOB_TABLE " (hash, size, refcount) VALUES (?, ?, 0);");
+    QSqlQuery addReference(db);
+    addReference.prepare("UPDATE " BLOB_TABLE " SET refcount = refcount + 1 WHERE hash = ?;");
+    QSqlQuery addFile(db);
+    addFile.prepare("INSERT INTO " ENTRY_FILE_TABLE " (entry_id, file_name, size, modified, hash) VALUES (?, ?, ?, ?, ?);");
+
+    foreach (const ImportedFile &file, files) {
+        QString blob = blobPath(file.sha256);
+        bool stored = QFile::exists(blob);
+        if (!stored) {
+            if (file.alreadyStored) {
+                error = "A stored audio file is missing: " + blob;
+                return false;
+            }
+            QDir().mkpath(QFileInfo(blob).path());
+            if (!QFile::rename(file.stagedPath, blob)) {
+                error = "Cannot move " + file.stagedPath + " into the audio store.";
+                return false;
+            }
+            newBlobs << blob;
+        } else if (QFile::exists(file.stagedPath)) {
+            QFile::remove(file.stagedPath); //Same content as a file we already have.
+        }
+        if (!Protect(blob)) { //Before the link exists, so no entry ever holds a writable copy of a stored file.
+            error = "Cannot make " + blob + " read-only.";
+            return false;
+        }
+
+        if (stored)
+            releasedBlobs << blob; //Should the import be rolled back, removing the link must not leave it writable.
+        if (!LinkOrCopy(blob, file.stagedPath)) {
+            error = "Cannot link " + file.stagedPath + " to the audio store.";
+            return false;
+        }
+
+        QString hash = QString::fromLatin1(file.sha256.toHex());
+        addBlob.bindValue(0, hash);
+        addBlob.bindValue(1, file.size);
+        addReference.bindValue(0, hash);
+        QFileInfo linked(file.stagedPath);
+        addFile.bindValue(0, entryId);
+        addFile.bindValue(1, linked.fileName());
+        addFile.bindValue(2, linked.size());
+        addFile.bindValue(3, linked.lastModified().toMSecsSinceEpoch());
+        addFile.bindValue(4, hash);
+        QSqlQuery *steps[] = { &addBlob, &addReference, &addFile };
+        for (int i = 0; i < 3; ++i) {
+            if (!steps[i]->exec()) {
+                error = steps[i]->lastError().text();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void BlobStore::discardNewBlobs()
+{
+    foreach (const QString &blob, newBlobs) {
+        QFile::setPermissions(blob, QFile::permissions(blob) | QFile::WriteOwner | QFile::WriteUser);
+        QFile::remove(blob);
+    }
+    newBlobs.clear();
+    foreach (const QString &blob, releasedBlobs)
+        Protect(blob);
+    releasedBlobs.clear();
+}
+
+bool BlobStore::releaseEntry(const QString &entryId, QString &error)
+{
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery files(db);
+    files.prepare("SELECT hash FROM " ENTRY_FILE_TABLE " WHERE entry_id = ? AND hash IS NOT NULL;");
+    files.addBindValue(entryId);
+    if (!files.exec()) {
+        error = files.lastError().text();
+        return false;
+    }
+    QStringList hashes;
+    while (files.next())
+        hashes << files.value(0).toString();
+    files.finish();
+    if (!dropReferences(hashes, error))
+        return false;
+
+    QSqlQuery dropFiles(db);
+    dropFiles.prepare("DELETE FROM " ENTRY_FILE_TABLE " WHERE entry_id = ?;");
+    dropFiles.addBindValue(entryId);
+    if (!dropFiles.exec()) {
+        error = dropFiles.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool BlobStore::dropReferences(const QStringList &hashes, QString &error)
+{
+    if (hashes.isEmpty())
+        return true; //Imported before the store existed; nothing to release.
+
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery dropReference(db);
+    dropReference.prepare("UPDATE " BLOB_TABLE " SET refcount = refcount - 1 WHERE hash = ?;");
+    QSqlQuery findUnused(db);
+    findUnused.prepare("SELECT refcount FROM " BLOB_TABLE " WHERE hash = ?;");
+    foreach (const QString &hash, hashes) {
+        dropReference.bindValue(0, hash);
+        findUnused.bindValue(0, hash);
+        if (!dropReference.exec() || !findUnused.exec()) {
+            error = dropReference.lastError().text() + findUnused.lastError().text();
+            return false;
+        }
+        QString blob = blobPath(QByteArray::fromHex(hash.toLatin1()));
+        if (findUnused.next() && findUnused.value(0).toInt() <= 0)
+            unusedBlobs << blob;
+        else
+            releasedBlobs << blob;
+        findUnused.finish();
+    }
+
+    QSqlQuery dropBlobs(db);
+    if (!dropBlobs.exec("DELETE FROM " BLOB_TABLE " WHERE refcount <= 0;")) {
+        error = dropBlobs.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* The entries' rows stop referring to the stored files and the files leave
+ * the store. Their data stays where the entries link to it, already edited.
+ */
+bool BlobStore::splitOff(const QStringList &hashes, QString &error)
+{
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery dropHash(db);
+    dropHash.prepare("UPDATE " ENTRY_FILE_TABLE " SET hash = NULL WHERE hash = ?;");
+    QSqlQuery dropBlob(db);
+    dropBlob.prepare("DELETE FROM " BLOB_TABLE " WHERE hash = ?;");
+    foreach (const QString &hash, hashes) {
+        dropHash.bindValue(0, hash);
+        dropBlob.bindValue(0, hash);
+        if (!dropHash.exec() || !dropBlob.exec()) {
+            error = dropHash.lastError().text() + dropBlob.lastError().text();
+            return false;
+        }
+        unusedBlobs << blobPath(QByteArray::fromHex(hash.toLatin1()));
+    }
+    return true;
+}
+
+/* Deleting a read-only file on Windows first clears the attribute, and with
+ * it that of every other link to the file; QDir::removeRecursively() does
+ * the same. So the stored files an entry let go of are protected again here,
+ * which is why this runs after the entry's folder is gone.
+ */
+void BlobStore::removeUnusedBlobs()
+{
+    foreach (const QString &blob, unusedBlobs) {
+        QFile::setPermissions(blob, QFile::permissions(blob) | QFile::WriteOwner | QFile::WriteUser);
+        QFile::remove(blob);
+    }
+    unusedBlobs.clear();
+    foreach (const QString &blob, releasedBlobs)
+        Protect(blob);
+    releasedBlobs.clear();
+}
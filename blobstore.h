@@ -0,0 +1,61 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include "audioimporter.h"
+
+#define BLOB_TABLE "Attachment_Blobs" //One row per stored file, with its reference count.
+#define ENTRY_FILE_TABLE "Attachment_Files" //One row per file of an entry; shared with AttachmentManifest.
+
+/* Keeps every distinct audio file exactly once, under
+ * <library>/.blobs/<first two hex digits>/<SHA-256 in hex>. Entry folders
+ * (<library>/<UUID>/) hold hard links to those files, so they look as they
+ * always have. Stored files are read-only: a link is the same file, so an
+ * edit made through one entry would change every entry sharing it. Two
+ * manifest tables record which entry holds which file
+ * and how many references each stored file has; a file is deleted when
+ * its last reference goes.
+ *
+ * Entries imported before the store existed keep their plain folders;
+ * their manifest rows (see AttachmentManifest) carry no hash. The manifest
+ * methods must be called inside the caller's transaction on the GUI
+ * thread's connection.
+ */
+class BlobStore
+{
+public:
+    explicit BlobStore(const QString &libraryRoot);
+
+    static bool InitManifest();
+    static bool Link(const QString &from, const QString &to);
+    static bool LinkOrCopy(const QString &from, const QString &to);
+    static bool Protect(const QString &path);
+
+    QString blobPath(const QByteArray &sha256) const;
+    QHash<qint64, QSet<QByteArray> > knownContent() const;
+
+    //Moves freshly imported files into the store, links them back in place and records them for 'entryId'.
+    bool addEntryFiles(const QString &entryId, const QVector<ImportedFile> &files, QString &error);
+    void discardNewBlobs(); //After a rollback and removing the entry's folder: undoes what addEntryFiles() did to the store.
+
+    //Drops the entry's references. Files nobody refers to any more are removed by removeUnusedBlobs(), after the commit.
+    bool releaseEntry(const QString &entryId, QString &error);
+    bool dropReferences(const QStringList &hashes, QString &error); //One reference per hash listed.
+    //For a stored file that was written to despite being read-only: every entry keeps it as a plain file.
+    bool splitOff(const QStringList &hashes, QString &error);
+    void removeUnusedBlobs(); //Also makes the released files that are still used read-only again.
+
+private:
+    QString root;
+    QStringList newBlobs;
+    QStringList unusedBlobs;
+    QStringList releasedBlobs;
+};
+
+#endif // BLOBSTORE_H
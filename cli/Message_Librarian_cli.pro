@@ -0,0 +1,48 @@
+#-------------------------------------------------
+#
+# Headless batch tool: the library's search, import,
+# export and maintenance without any GUI modules.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       += sql
+QT       += concurrent
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+DEFINES  += MESSAGE_LIBRARIAN_HEADLESS
+
+TARGET = message-librarian-cli
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+    batchcommands.cpp \
+    ../databasesupport.cpp \
+    ../tracer.cpp \
+    ../sermonfiltermatcher.cpp \
+    ../sermonsearchquery.cpp \
+    ../audioimporter.cpp \
+    ../blobstore.cpp \
+    ../csvreader.cpp \
+    ../sermoncsvimporter.cpp \
+    ../sermonexporter.cpp \
+    ../audiometadata.cpp \
+    ../audioscanner.cpp
+
+HEADERS  += batchcommands.h \
+    ../databasesupport.h \
+    ../tracer.h \
+    ../sermonfiltermatcher.h \
+    ../sermonsearchquery.h \
+    ../audioimporter.h \
+    ../blobstore.h \
+    ../csvreader.h \
+    ../sermoncsvimporter.h \
+    ../sermonexporter.h \
+    ../audiometadata.h \
+    ../audioscanner.h
@@ -0,0 +1,510 @@
+#include "batchcommands.h"
+#include "databasesupport.h"
+#include "blobstore.h"
+#include "sermoncsvimporter.h"
+#include "sermonexporter.h"
+#include "audioscanner.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QCryptographicHash>
+#include <QEventLoop>
+#include <cstdio>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+QString BatchCommands::command;
+
+int BatchCommands::Run(const QStringList &arguments)
+{
+    command = arguments.value(1);
+    QStringList commands;
+    commands << "search" << "import" << "export" << "verify" << "migrate" << "stats" << "audio";
+    if (!command.isEmpty() && !command.startsWith('-') && !commands.contains(command))
+        return Fail(Exit_Usage, "usage", "Unknown command \"" + command + "\". Commands: " + commands.join(", ") + ".");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Message Librarian batch tool. Commands: search, import, export, verify, migrate, stats, audio.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "search, import, export, verify, migrate, stats or audio.");
+    parser.addOption(QCommandLineOption("library", "The library folder. Defaults to the one set in the program settings.", "path"));
+
+    if (command == "search") {
+        AddSearchOptions(parser);
+    } else if (command == "import") {
+        parser.addPositionalArgument("file", "The CSV file to import.");
+        parser.addOption(QCommandLineOption("date-format", "How dates are written, e.g. M/d/yy (the default).", "format"));
+        parser.addOption(QCommandLineOption("column", "Reads a column from the named CSV column, e.g. title=\"Sermon Title\". May be repeated.", "column=header"));
+    } else if (command == "export") {
+        parser.addPositionalArgument("file", "The file to write, or - for standard output.");
+        AddSearchOptions(parser);
+        parser.addOption(QCommandLineOption("attachments", "Lists each entry's files as well."));
+    } else if (command == "verify") {
+        parser.addOption(QCommandLineOption("rehash", "Also reads every stored file and compares its SHA-256."));
+    } else if (command == "audio") {
+        parser.addOption(QCommandLineOption("threads", "How many files to read at once (default " + QString::number(AUDIO_SCAN_THREADS) + ").", "count"));
+    }
+
+    if (!parser.parse(arguments))
+        return Fail(Exit_Usage, "usage", parser.errorText());
+    if (parser.isSet("help")) {
+        fputs(qPrintable(parser.helpText()), stdout);
+        return Exit_Success;
+    }
+
+    if (command == "search")
+        return Search(parser);
+    if (command == "import")
+        return Import(parser);
+    if (command == "export")
+        return Export(parser);
+    if (command == "verify")
+        return Verify(parser);
+    if (command == "migrate")
+        return Migrate(parser);
+    if (command == "stats")
+        return Stats(parser);
+    if (command == "audio")
+        return Audio(parser);
+    return Fail(Exit_Usage, "usage", "Name a command: " + commands.join(", ") + ".");
+}
+
+void BatchCommands::AddSearchOptions(QCommandLineParser &parser)
+{
+    parser.addOption(QCommandLineOption("title", "Text or regular expression to find in the title.", "text"));
+    parser.addOption(QCommandLineOption("speaker", "Text or regular expression to find in the speaker.", "text"));
+    parser.addOption(QCommandLineOption("location", "Text or regular expression to find in the location.", "text"));
+    parser.addOption(QCommandLineOption("description", "Text or regular expression to find in the description.", "text"));
+    parser.addOption(QCommandLineOption("transcription", "Text or regular expression to find in the transcription.", "text"));
+    parser.addOption(QCommandLineOption("from", "Earliest date (yyyy-MM-dd).", "date"));
+    parser.addOption(QCommandLineOption("to", "Latest date (yyyy-MM-dd).", "date"));
+    parser.addOption(QCommandLineOption("case-sensitive", "Matches text case-sensitively."));
+    parser.addOption(QCommandLineOption("format", "csv or jsonl.", "format"));
+    parser.addOption(QCommandLineOption("columns", "Comma-separated columns to write: id, title, speaker, location, date, description, transcription.", "list"));
+}
+
+/* The same query FindSermon builds: plain words are answered by the
+ * full-text index, everything else is matched row by row. There is no
+ * worker to leave the index lookup to, so it is done here.
+ */
+bool BatchCommands::BuildQuery(const QCommandLineParser &parser, SermonSearchQuery &query, QString &error)
+{
+    Qt::CaseSensitivity caseSense = parser.isSet("case-sensitive") ? Qt::CaseSensitive : Qt::CaseInsensitive;
+
+    QHash<int, QString> searchText;
+    searchText.insert(Sermon_Title, parser.value("title"));
+    searchText.insert(Sermon_Speaker, parser.value("speaker"));
+    searchText.insert(Sermon_Location, parser.value("location"));
+    searchText.insert(Sermon_Description, parser.value("description"));
+    searchText.insert(Sermon_Transcription, parser.value("transcription"));
+
+    QDate from, to;
+    if (parser.isSet("from") && !(from = QDate::fromString(parser.value("from"), Qt::ISODate)).isValid()) {
+        error = "Cannot read the date \"" + parser.value("from") + "\"; write it as yyyy-MM-dd.";
+        return false;
+    }
+    if (parser.isSet("to") && !(to = QDate::fromString(parser.value("to"), Qt::ISODate)).isValid()) {
+        error = "Cannot read the date \"" + parser.value("to") + "\"; write it as yyyy-MM-dd.";
+        return false;
+    }
+
+    QHash<int, QString>::const_iterator i;
+    for (i = searchText.constBegin(); i != searchText.constEnd(); ++i) {
+        QRegExp pattern(i.value(), caseSense);
+        if (!i.value().isEmpty() && !pattern.isValid()) {
+            error = "Invalid search pattern \"" + i.value() + "\": " + pattern.errorString();
+            return false;
+        }
+    }
+
+    query = SermonSearchQuery::FromCriteria(searchText, caseSense, from, to);
+    query.resolveFullText();
+    return true;
+}
+
+bool BatchCommands::ParseColumns(const QString &list, QList<int> &columns, QString &error)
+{
+    columns.clear();
+    foreach (const QString &name, list.split(',', QString::SkipEmptyParts)) {
+        int column = SermonExporter::ColumnNumber(name);
+        if (column < 0) {
+            error = "Unknown column \"" + name.trimmed() + "\".";
+            return false;
+        }
+        columns << column;
+    }
+    if (columns.isEmpty()) {
+        error = "No columns given.";
+        return false;
+    }
+    return true;
+}
+
+/* Opens the library and checks its version. Only 'migrate' may update an
+ * older library; every other command stops and says so.
+ */
+int BatchCommands::OpenLibrary(const QCommandLineParser &parser, OpenMode mode, bool *migrated)
+{
+    QString library = parser.value("library");
+    if (!library.isEmpty() && !QDir(library).exists())
+        return Fail(Exit_NoLibrary, "no-library", "There is no library at " + library + ".");
+    if (!DatabaseSupport::InitDatabase(library))
+        return Fail(Exit_NoLibrary, "no-library", DatabaseSupport::LastErrorMessage());
+
+    if (migrated != NULL)
+        *migrated = false;
+    if (!DatabaseSupport::CheckDatabaseVersion()) {
+        if (DatabaseSupport::GetDbVersion() == -1)
+            return Fail(Exit_UnreadableVersion, "unreadable-version", DatabaseSupport::LastErrorMessage());
+        if (DatabaseSupport::GetDbVersion() == -2)
+            return Fail(Exit_NewerVersion, "newer-version", DatabaseSupport::LastErrorMessage());
+        if (mode != OpenAndMigrate)
+            return Fail(Exit_NeedsMigration, "needs-migration",
+                        QString("The library is at version %1 and needs to be updated to version %2; run the migrate command first.")
+                        .arg(DatabaseSupport::GetDbVersion()).arg(DatabaseSupport::GetCompatibleVersion()));
+        if (!DatabaseSupport::UpdateDatabase())
+            return Fail(Exit_MigrationFailed, "migration-failed", DatabaseSupport::LastErrorMessage());
+        if (migrated != NULL)
+            *migrated = true;
+    }
+    if (!DatabaseSupport::LoadDatabase())
+        return Fail(Exit_LoadFailed, "load-failed", DatabaseSupport::LastErrorMessage());
+    return Exit_Success;
+}
+
+int BatchCommands::Search(const QCommandLineParser &parser)
+{
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    DatabaseSupport::OpenSearchIndex(); //Optional, as in the GUI. Only the GUI and migrate build it.
+
+    QString error;
+    SermonSearchQuery query;
+    if (!BuildQuery(parser, query, error))
+        return Fail(Exit_Usage, "usage", error);
+    QList<int> columns;
+    columns << Sermon_ID << Sermon_Title << Sermon_Speaker << Sermon_Location << Sermon_Date;
+    if (parser.isSet("columns") && !ParseColumns(parser.value("columns"), columns, error))
+        return Fail(Exit_Usage, "usage", error);
+    QString format = parser.value("format");
+    if (!format.isEmpty() && format != "csv" && format != "jsonl")
+        return Fail(Exit_Usage, "usage", "Unknown format \"" + format + "\"; use csv or jsonl.");
+
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdout), _O_BINARY); //The exporter writes its own line ends.
+#endif
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+    SermonExporter exporter;
+    exporter.setColumns(columns);
+    exporter.setQuery(query);
+    if (!exporter.exportTo(&out, format == "csv" ? SermonExporter::Csv : SermonExporter::JsonLines,
+                           DatabaseSupport::GetCompatibleDBTableName()))
+        return Fail(Exit_CommandFailed, "search-failed", exporter.errorString());
+    return Exit_Success;
+}
+
+int BatchCommands::Import(const QCommandLineParser &parser)
+{
+    QStringList files = parser.positionalArguments().mid(1);
+    if (files.size() != 1)
+        return Fail(Exit_Usage, "usage", "Name one CSV file to import.");
+
+    SermonCsvImporter importer;
+    if (parser.isSet("date-format"))
+        importer.setDateFormat(parser.value("date-format"));
+    foreach (const QString &mapping, parser.values("column")) {
+        int separator = mapping.indexOf('=');
+        int column = separator > 0 ? SermonExporter::ColumnNumber(mapping.left(separator)) : -1;
+        if (column < Sermon_Title || column > Sermon_Description)
+            return Fail(Exit_Usage, "usage", "Cannot read the column mapping \"" + mapping + "\"; write it as title=\"Header\".");
+        importer.setColumn(column, mapping.mid(separator + 1));
+    }
+
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    if (!importer.import(files.first(), DatabaseSupport::GetCompatibleDBTableName()))
+        return Fail(Exit_CommandFailed, "import-failed", importer.errorString());
+
+    QJsonObject summary;
+    summary.insert("command", command);
+    summary.insert("imported", importer.rowsImported());
+    summary.insert("rejected", importer.rowsRejected());
+    summary.insert("report", importer.rowsRejected() > 0 ? QJsonValue(importer.reportFileName()) : QJsonValue());
+    WriteResult(summary);
+    return Exit_Success;
+}
+
+int BatchCommands::Export(const QCommandLineParser &parser)
+{
+    QStringList files = parser.positionalArguments().mid(1);
+    if (files.size() != 1)
+        return Fail(Exit_Usage, "usage", "Name one file to export to, or - for standard output.");
+    QString fileName = files.first();
+
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    bool attachments = parser.isSet("attachments");
+    if (attachments && !BlobStore::InitManifest())
+        return Fail(Exit_ManifestFailed, "manifest-failed", DatabaseSupport::LastErrorMessage());
+    DatabaseSupport::OpenSearchIndex();
+
+    QString error;
+    SermonExporter exporter;
+    SermonSearchQuery query;
+    if (!BuildQuery(parser, query, error))
+        return Fail(Exit_Usage, "usage", error);
+    exporter.setQuery(query);
+    exporter.setIncludeAttachments(attachments);
+    if (parser.isSet("columns")) {
+        QList<int> columns;
+        if (!ParseColumns(parser.value("columns"), columns, error))
+            return Fail(Exit_Usage, "usage", error);
+        exporter.setColumns(columns);
+    }
+    QString format = parser.value("format");
+    if (format.isEmpty())
+        format = fileName.endsWith(".jsonl", Qt::CaseInsensitive) || fileName.endsWith(".json", Qt::CaseInsensitive) ? "jsonl" : "csv";
+    if (format != "csv" && format != "jsonl")
+        return Fail(Exit_Usage, "usage", "Unknown format \"" + format + "\"; use csv or jsonl.");
+    SermonExporter::Format exportFormat = format == "csv" ? SermonExporter::Csv : SermonExporter::JsonLines;
+
+    bool ok;
+    if (fileName == "-") {
+#ifdef Q_OS_WIN
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        ok = exporter.exportTo(&out, exportFormat, DatabaseSupport::GetCompatibleDBTableName());
+    } else {
+        ok = exporter.exportTo(fileName, exportFormat, DatabaseSupport::GetCompatibleDBTableName());
+    }
+    if (!ok)
+        return Fail(Exit_CommandFailed, "export-failed", exporter.errorString());
+
+    if (fileName != "-") {
+        QJsonObject summary;
+        summary.insert("command", command);
+        summary.insert("exported", exporter.rowsExported());
+        summary.insert("file", QFileInfo(fileName).absoluteFilePath());
+        WriteResult(summary);
+    }
+    return Exit_Success;
+}
+
+/* Checks, without changing anything:
+ *  - the database file (PRAGMA quick_check) and the full-text index;
+ *  - that every file the manifest lists is in its entry folder, at its size;
+ *  - that every stored file exists, has its size and its reference count;
+ *  - with --rehash, that every stored file still has its SHA-256.
+ */
+int BatchCommands::Verify(const QCommandLineParser &parser)
+{
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    if (!BlobStore::InitManifest())
+        return Fail(Exit_ManifestFailed, "manifest-failed", DatabaseSupport::LastErrorMessage());
+
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QString root = DatabaseSupport::LibraryPath();
+    QJsonArray problems;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("PRAGMA quick_check;"))
+        problems.append("database: " + query.lastError().text());
+    while (query.next()) {
+        if (query.value(0).toString() != "ok")
+            problems.append("database: " + query.value(0).toString());
+    }
+    query.finish();
+
+    QString index = DatabaseSupport::GetSearchIndexName();
+    if (db.tables().contains(index) && !query.exec("INSERT INTO " + index + "(" + index + ") VALUES ('integrity-check');"))
+        problems.append("search index: " + query.lastError().text());
+
+    int filesChecked = 0;
+    if (!query.exec("SELECT entry_id, file_name, size FROM " ENTRY_FILE_TABLE ";"))
+        problems.append("manifest: " + query.lastError().text());
+    while (query.next()) {
+        QString path = root + "/" + query.value(0).toString() + "/" + query.value(1).toString();
+        QFileInfo info(path);
+        if (!info.exists())
+            problems.append("missing file: " + path);
+        else if (info.size() != query.value(2).toLongLong())
+            problems.append(QString("size of %1 is %2, the manifest says %3").arg(path).arg(info.size()).arg(query.value(2).toLongLong()));
+        ++filesChecked;
+    }
+    query.finish();
+
+    BlobStore store(root);
+    bool rehash = parser.isSet("rehash");
+    int blobsChecked = 0;
+    if (!query.exec("SELECT hash, size, refcount, (SELECT COUNT(*) FROM " ENTRY_FILE_TABLE " f WHERE f.hash = b.hash) "
+                    "FROM " BLOB_TABLE " b;"))
+        problems.append("manifest: " + query.lastError().text());
+    while (query.next()) {
+        QByteArray hash = query.value(0).toByteArray();
+        QString path = store.blobPath(QByteArray::fromHex(hash));
+        QFile file(path);
+        if (query.value(2).toLongLong() != query.value(3).toLongLong())
+            problems.append(QString("stored file %1 has %2 references, the manifest counts %3")
+                            .arg(QString(hash)).arg(query.value(2).toLongLong()).arg(query.value(3).toLongLong()));
+        if (!file.exists()) {
+            problems.append("missing stored file: " + path);
+        } else if (file.size() != query.value(1).toLongLong()) {
+            problems.append(QString("size of %1 is %2, the manifest says %3").arg(path).arg(file.size()).arg(query.value(1).toLongLong()));
+        } else if (rehash) {
+            QCryptographicHash sha256(QCryptographicHash::Sha256);
+            if (!file.open(QIODevice::ReadOnly) || !sha256.addData(&file))
+                problems.append("cannot read " + path + ": " + file.errorString());
+            else if (sha256.result().toHex() != hash)
+                problems.append("contents of " + path + " no longer match its hash");
+        }
+        ++blobsChecked;
+    }
+    query.finish();
+
+    QJsonObject report;
+    report.insert("command", command);
+    report.insert("ok", problems.isEmpty());
+    report.insert("filesChecked", filesChecked);
+    report.insert("storedFilesChecked", blobsChecked);
+    report.insert("problems", problems);
+    WriteResult(report);
+    return problems.isEmpty() ? Exit_Success : Exit_VerifyFailed;
+}
+
+int BatchCommands::Migrate(const QCommandLineParser &parser)
+{
+    bool migrated = false;
+    int result = OpenLibrary(parser, OpenAndMigrate, &migrated);
+    if (result != Exit_Success)
+        return result;
+
+    //The one write that may take minutes; search and export never start it.
+    bool indexed = DatabaseSupport::InitSearchIndex();
+
+    QJsonObject summary;
+    summary.insert("command", command);
+    summary.insert("migrated", migrated);
+    summary.insert("version", DatabaseSupport::GetCompatibleVersion());
+    summary.insert("searchIndex", indexed);
+    WriteResult(summary);
+    return Exit_Success;
+}
+
+int BatchCommands::Stats(const QCommandLineParser &parser)
+{
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    if (!BlobStore::InitManifest())
+        return Fail(Exit_ManifestFailed, "manifest-failed", DatabaseSupport::LastErrorMessage());
+
+    QSqlQuery query(DatabaseSupport::Connection());
+    query.setForwardOnly(true);
+    QJsonObject stats;
+    stats.insert("command", command);
+    stats.insert("library", DatabaseSupport::LibraryPath());
+    stats.insert("version", DatabaseSupport::GetDbVersion());
+
+    if (!query.exec("SELECT COUNT(*), MIN(date), MAX(date), SUM(IFNULL(transcription, '') <> '') FROM " +
+                    DatabaseSupport::GetCompatibleDBTableName() + ";") || !query.next())
+        return Fail(Exit_CommandFailed, "stats-failed", query.lastError().text());
+    stats.insert("entries", query.value(0).toLongLong());
+    stats.insert("firstDate", query.value(1).isNull() ? QJsonValue() : QJsonValue(query.value(1).toString()));
+    stats.insert("lastDate", query.value(2).isNull() ? QJsonValue() : QJsonValue(query.value(2).toString()));
+    stats.insert("withTranscription", query.value(3).toLongLong());
+    query.finish();
+
+    if (!query.exec("SELECT COUNT(DISTINCT entry_id), COUNT(*), IFNULL(SUM(size), 0) FROM " ENTRY_FILE_TABLE ";") || !query.next())
+        return Fail(Exit_CommandFailed, "stats-failed", query.lastError().text());
+    stats.insert("withFiles", query.value(0).toLongLong());
+    stats.insert("files", query.value(1).toLongLong());
+    stats.insert("fileBytes", query.value(2).toLongLong());
+    query.finish();
+
+    //Entry folders hold links to the stored files, so the store is what actually takes up space.
+    if (!query.exec("SELECT COUNT(*), IFNULL(SUM(size), 0) FROM " BLOB_TABLE ";") || !query.next())
+        return Fail(Exit_CommandFailed, "stats-failed", query.lastError().text());
+    qint64 storedBytes = query.value(1).toLongLong();
+    stats.insert("storedFiles", query.value(0).toLongLong());
+    stats.insert("storedBytes", storedBytes);
+    query.finish();
+    if (!query.exec("SELECT IFNULL(SUM(size), 0) FROM " ENTRY_FILE_TABLE " WHERE hash IS NOT NULL;") || !query.next())
+        return Fail(Exit_CommandFailed, "stats-failed", query.lastError().text());
+    stats.insert("bytesSavedByDeduplication", query.value(0).toLongLong() - storedBytes);
+    query.finish();
+
+    stats.insert("searchIndex", DatabaseSupport::Connection().tables().contains(DatabaseSupport::GetSearchIndexName()));
+    WriteResult(stats);
+    return Exit_Success;
+}
+
+/* Reads the playing time and format of every audio file that is new or
+ * changed since the last scan (by this command or the GUI) and keeps them
+ * in the database.
+ */
+int BatchCommands::Audio(const QCommandLineParser &parser)
+{
+    int threads = AUDIO_SCAN_THREADS;
+    if (parser.isSet("threads")) {
+        bool ok = false;
+        threads = parser.value("threads").toInt(&ok);
+        if (!ok || threads < 1)
+            return Fail(Exit_Usage, "usage", "The number of threads must be a positive whole number.");
+    }
+
+    int result = OpenLibrary(parser, OpenCurrent);
+    if (result != Exit_Success)
+        return result;
+    if (!BlobStore::InitManifest() || !AudioScanner::InitCache())
+        return Fail(Exit_ManifestFailed, "manifest-failed", DatabaseSupport::LastErrorMessage());
+
+    AudioScanner scanner(DatabaseSupport::LibraryPath(), threads);
+    QEventLoop loop;
+    QObject::connect(&scanner, SIGNAL(finished()), &loop, SLOT(quit()));
+    if (!scanner.start())
+        return Fail(Exit_CommandFailed, "audio-failed", scanner.errorString());
+    if (scanner.isRunning())
+        loop.exec();
+    if (!scanner.errorString().isEmpty())
+        return Fail(Exit_CommandFailed, "audio-failed", scanner.errorString());
+
+    QJsonObject summary;
+    summary.insert("command", command);
+    summary.insert("read", scanner.scannedCount());
+    summary.insert("unreadable", scanner.failedCount());
+    summary.insert("elapsedMs", double(scanner.elapsedMs()));
+    WriteResult(summary);
+    return Exit_Success;
+}
+
+int BatchCommands::Fail(int exitCode, const QString &error, const QString &message)
+{
+    QJsonObject failure;
+    failure.insert("command", command);
+    failure.insert("error", error);
+    failure.insert("message", message);
+    failure.insert("exitCode", exitCode);
+    fputs(QJsonDocument(failure).toJson(QJsonDocument::Compact).append('\n').constData(), stderr);
+    return exitCode;
+}
+
+void BatchCommands::WriteResult(const QJsonObject &result)
+{
+    fputs(QJsonDocument(result).toJson(QJsonDocument::Compact).append('\n').constData(), stdout);
+    fflush(stdout);
+}
@@ -0,0 +1,72 @@
+#ifndef BATCHCOMMANDS_H
+#define BATCHCOMMANDS_H
+
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+#include <QCommandLineParser>
+
+#include "sermonsearchquery.h"
+
+//Exit codes of the batch tool. 1 to 6 mean what they mean for the GUI's start-up (see ../main.cpp).
+enum {
+    Exit_Success = 0,
+    Exit_NoLibrary = 1,
+    Exit_UnreadableVersion = 2,
+    Exit_NewerVersion = 3,
+    Exit_MigrationFailed = 4,
+    Exit_LoadFailed = 5,
+    Exit_ManifestFailed = 6,
+    Exit_NeedsMigration = 7,
+    Exit_CommandFailed = 8,
+    Exit_VerifyFailed = 9,
+    Exit_Usage = 64
+};
+
+/* The subcommands of message-librarian-cli, for scripts and ingest jobs:
+ *
+ *   search   writes the matching entries to stdout (JSON Lines or CSV)
+ *   import   adds the rows of a title spreadsheet saved as CSV
+ *   export   writes the table, or the matching part of it, to a file
+ *   verify   checks the database, the search index and the stored files
+ *   migrate  brings an older library up to the current table layout and
+ *            builds the search index
+ *   stats    prints counts and sizes
+ *   audio    reads the playing times of new and changed audio files
+ *
+ * Results go to stdout; an error goes to stderr as one JSON object
+ * ({"command", "error", "message", "exitCode"}) and sets the exit code.
+ * Nothing is ever asked: where the GUI would ask, the command fails.
+ *
+ * A command only opens what it needs. A search opens the database and the
+ * search index and nothing else, so a batch job can run thousands of them.
+ * Search and export only read: without a finished index they scan the table.
+ */
+class BatchCommands
+{
+public:
+    static int Run(const QStringList &arguments);
+
+private:
+    BatchCommands();
+    enum OpenMode { OpenCurrent, OpenAndMigrate };
+
+    static int Search(const QCommandLineParser &parser);
+    static int Import(const QCommandLineParser &parser);
+    static int Export(const QCommandLineParser &parser);
+    static int Verify(const QCommandLineParser &parser);
+    static int Migrate(const QCommandLineParser &parser);
+    static int Stats(const QCommandLineParser &parser);
+    static int Audio(const QCommandLineParser &parser);
+
+    static void AddSearchOptions(QCommandLineParser &parser);
+    static bool BuildQuery(const QCommandLineParser &parser, SermonSearchQuery &query, QString &error);
+    static bool ParseColumns(const QString &list, QList<int> &columns, QString &error);
+    static int OpenLibrary(const QCommandLineParser &parser, OpenMode mode, bool *migrated = NULL);
+    static int Fail(int exitCode, const QString &error, const QString &message);
+    static void WriteResult(const QJsonObject &result);
+
+    static QString command;
+};
+
+#endif // BATCHCOMMANDS_H
@@ -0,0 +1,29 @@
+#include "batchcommands.h"
+#include "databasesupport.h"
+#include "tracer.h"
+#include <QCoreApplication>
+
+static bool verbose = false;
+
+//Only warnings and worse reach stderr unless --verbose is given; stdout is left to the results.
+static void MessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context);
+    if (type == QtDebugMsg && !verbose)
+        return;
+    fprintf(stderr, "%s\n", qPrintable(message));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    Tracer::StartFromEnvironment();
+    QStringList arguments = a.arguments();
+    verbose = arguments.removeAll("--verbose") > 0;
+    qInstallMessageHandler(MessageHandler);
+
+    int result = BatchCommands::Run(arguments);
+
+    DatabaseSupport::ReleaseConnection();
+    return result;
+}
@@ -0,0 +1,97 @@
+#include "csvreader.h"
+
+#include <cstring>
+
+CsvReader::CsvReader(const QString &fileName, char fieldSeparator) :
+    file(fileName), begin(NULL), current(NULL), end(NULL), separator(fieldSeparator), line(1), recordLine(0)
+{
+}
+
+CsvReader::~CsvReader()
+{
+    file.close(); //Also drops the mapping.
+}
+
+bool CsvReader::open()
+{
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = file.errorString();
+        return false;
+    }
+
+    begin = NULL;
+    if (file.size() > 0)
+        begin = reinterpret_cast<const char *>(file.map(0, file.size()));
+    if (begin == NULL) {
+        //Empty, or on a file system that cannot map; read it in instead.
+        contents = file.readAll();
+        begin = contents.constData();
+    }
+    end = begin + (contents.isEmpty() ? file.size() : contents.size());
+    current = begin;
+    if (end - current >= 3 && std::memcmp(current, "\xEF\xBB\xBF", 3) == 0)
+        current += 3;
+    line = 1;
+    return true;
+}
+
+bool CsvReader::readRecord(QVector<QString> &fields)
+{
+    fields.resize(0);
+    if (current >= end)
+        return false;
+    recordLine = line;
+
+    for (;;) {
+        if (current < end && *current == '"') {
+            //Quoted: runs to the next quote that is not doubled.
+            unquoted.resize(0);
+            const char *start = ++current;
+            for (;;) {
+                const char *quote = static_cast<const char *>(std::memchr(current, '"', end - current));
+                if (quote == NULL) {
+                    quote = end; //Unterminated; take the rest of the file.
+                }
+                for (const char *p = current; p < quote; ++p) {
+                    if (*p == '\n')
+                        ++line;
+                }
+                if (quote + 1 < end && quote[1] == '"') {
+                    unquoted.append(start, int(quote + 1 - start));
+                    current = start = quote + 2;
+                    continue;
+                }
+                if (unquoted.isEmpty()) {
+                    fields.append(QString::fromUtf8(start, int(quote - start)));
+                } else {
+                    unquoted.append(start, int(quote - start));
+                    fields.append(QString::fromUtf8(unquoted));
+                }
+                current = quote < end ? quote + 1 : end;
+                break;
+            }
+            //Anything between the closing quote and the separator is ignored.
+            while (current < end && *current != separator && *current != '\n')
+                ++current;
+        } else {
+            const char *start = current;
+            while (current < end && *current != separator && *current != '\n')
+                ++current;
+            const char *fieldEnd = current;
+            if (fieldEnd > start && fieldEnd[-1] == '\r')
+                --fieldEnd;
+            fields.append(QString::fromUtf8(start, int(fieldEnd - start)));
+        }
+
+        if (current >= end)
+            return true;
+        if (*current == separator) {
+            ++current;
+            continue;
+        }
+        //End of line.
+        ++current;
+        ++line;
+        return true;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef CSVREADER_H
+#define CSVREADER_H
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+/* Reads a UTF-8 CSV file record by record, straight out of a memory mapping
+ * of the file (or, where the file cannot be mapped, out of one read of it).
+ * Fields may be quoted, with "" for a quote inside, and quoted fields may
+ * span lines. A leading byte order mark is skipped; line ends may be LF or
+ * CR LF.
+ */
+class CsvReader
+{
+public:
+    explicit CsvReader(const QString &fileName, char fieldSeparator = ',');
+    ~CsvReader();
+
+    bool open();
+    QString errorString() const { return error; }
+
+    //Fills 'fields' with the next record; false at the end of the file.
+    bool readRecord(QVector<QString> &fields);
+    int lineNumber() const { return recordLine; } //Where the record last read starts, counting from 1.
+    qint64 position() const { return current - begin; }
+    qint64 size() const { return end - begin; }
+
+private:
+    QFile file;
+    QByteArray contents; //Only used if the file could not be mapped.
+    const char *begin;
+    const char *current;
+    const char *end;
+    char separator;
+    int line;
+    int recordLine;
+    QByteArray unquoted; //Scratch space for quoted fields.
+    QString error;
+};
+
+#endif // CSVREADER_H
@@ -1,14 +1,76 @@
 #include "databasesupport.h"
-#include "editsermon.h"
+#include "tracer.h"
 
 #include <QDate>
+#include <QDir>
+#include <QFileInfo>
+#include <QThread>
+#include <QThreadStorage>
+#include <QCoreApplication>
+
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+#include <QMessageBox>
+#include <QProgressDialog>
+#endif
 
 #define COMPAT_DBTABLENAME \
-    "Messages_Version_Alpha_1"\
+    "Messages_Version_Alpha_2"\
+
+#define DATE_INDEX_NAME \
+    "Messages_Date_Index"\
+
+#define ISO_DATE_PATTERN \
+    "'[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]'"\
+
+#define SEARCH_INDEX_NAME \
+    "Messages_Search_Index"\
+
+#define SEARCH_INDEX_PROGRESS_NAME \
+    "Messages_Search_Index_Progress"\
+
+#define SEARCH_INDEX_BUILD_ROWS 1000 //Rows the search index build adds per transaction.
+
+#define CHANGE_LOG_NAME \
+    "Messages_Change_Log"\
+
+#define CHANGE_LOG_KEEP_ENTRIES 100000 //Older entries are pruned at start-up.
+#define MIGRATION_BATCH_ROWS 50000
+#define MIGRATION_PROGRESS_STEPS 1000 //Progress dialog units per migration step.
+
+#define CONNECT_OPTIONS "QSQLITE_BUSY_TIMEOUT=5000" //Wait for a writer on another connection instead of failing with "database is locked".
+
+/* Owns one thread's database connection (see DatabaseSupport::Connection())
+ * and the statements prepared on it. QThreadStorage deletes it when the
+ * thread finishes.
+ */
+class ThreadConnection
+{
+public:
+    ThreadConnection(const QString &name, bool owned) : connectionName(name), ownsConnection(owned) {}
+    ~ThreadConnection()
+    {
+        preparedQueries.clear(); //The queries have to go before their connection does.
+        if (ownsConnection) {
+            QSqlDatabase::database(connectionName, false).close();
+            QSqlDatabase::removeDatabase(connectionName);
+        }
+    }
+
+    QString connectionName;
+    bool ownsConnection;
+    QHash<QString, QSqlQuery> preparedQueries;
+};
+
+static QThreadStorage<ThreadConnection *> threadConnections;
 
 int DatabaseSupport::compatibleVersion = -1;
 int DatabaseSupport::dbVersion = -1;
 QString DatabaseSupport::releaseDescription = "NULL";
+QAtomicInt DatabaseSupport::searchIndexAvailable;
+QAtomicInt DatabaseSupport::searchIndexCancelled;
+QString DatabaseSupport::databaseFile;
+QString DatabaseSupport::journalMode = "WAL";
+QString DatabaseSupport::lastErrorMessage;
 
 DatabaseSupport::DatabaseSupport()
 {
@@ -24,16 +86,33 @@ QString DatabaseSupport::GetCompatibleDBTableName()
     return COMPAT_DBTABLENAME;
 }
 
-bool DatabaseSupport::InitDatabase()
+//The folder of the library opened by InitDatabase().
+QString DatabaseSupport::LibraryPath()
+{
+    return QFileInfo(databaseFile).absolutePath();
+}
+
+QString DatabaseSupport::GetSearchIndexName()
+{
+    return SEARCH_INDEX_NAME;
+}
+
+QString DatabaseSupport::GetChangeLogName()
+{
+    return CHANGE_LOG_NAME;
+}
+
+//Opens the library at 'libraryPath', or if that is empty, at the location set in the program settings.
+bool DatabaseSupport::InitDatabase(const QString &libraryPath)
 {
+    TRACE_SCOPE("DatabaseSupport::InitDatabase");
     QSettings settings("TrueLife Tracks", "Message Librarian");
-    QString dbpath = settings.value("paths/databaseLocation", "C:/Audio Message Library").toString();
+    QString dbpath = libraryPath.isEmpty() ? settings.value("paths/databaseLocation", "C:/Audio Message Library").toString() : libraryPath;
     if (!QDir(dbpath).exists()) {
         //The database path in settings does not exist. Display a message and ask the user what to do.
-        int answer = QMessageBox::warning(0, "Error", "Your sermon library could not be found at the location specified in program settings. Do you want to initialze a new library at <i>" +
-                                        dbpath + "</i>?<p>(If your sermon library is stored on an external disk or network resource, make sure that your computer can access it, and then try starting the program again.)",
-                                        QMessageBox::Yes, QMessageBox::No, QMessageBox::NoButton);
-        if (answer == QMessageBox::Yes) {
+        bool answer = AskUser("Error", "Your sermon library could not be found at the location specified in program settings. Do you want to initialze a new library at <i>" +
+                              dbpath + "</i>?<p>(If your sermon library is stored on an external disk or network resource, make sure that your computer can access it, and then try starting the program again.)");
+        if (answer) {
             qDebug("Creating default database directory . . .");
             if(!QDir(dbpath).mkpath(dbpath))
                 qDebug("Error creating parent directory!");
@@ -42,34 +121,131 @@ bool DatabaseSupport::InitDatabase()
             return false; //Database path did not exist, and user chose not to create it.
     }
 
+    databaseFile = dbpath + "/Message_Library_Database.db";
+    journalMode = settings.value("database/journalMode", "WAL").toString(); //Set to DELETE for libraries on network shares, where WAL does not work.
+
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName(dbpath + "/Message_Library_Database.db");
+    db.setConnectOptions(CONNECT_OPTIONS);
+    db.setDatabaseName(databaseFile);
     bool ok = db.open();
 
     if (!ok) {
-        QMessageBox::warning(0, "Error", "Cannot open database. Error details: " + db.lastError().text() +
-                             "\nPlease contact your support team for assistance.");
+        ReportError("Error", "Cannot open database. Error details: " + db.lastError().text() +
+                    "\nPlease contact your support team for assistance.");
+    } else {
+        ConfigureConnection(db);
     }
 
     return ok;
 }
 
+/* In WAL mode readers do not block the writer or each other, so background
+ * jobs can read on their own connections while the GUI saves an edit.
+ */
+void DatabaseSupport::ConfigureConnection(QSqlDatabase db)
+{
+    //SQLite answers with the mode it is in, which stays the old one where WAL is not possible.
+    QSqlQuery journal(db);
+    bool wal = false;
+    if (journal.exec("PRAGMA journal_mode = " + journalMode + ";") && journal.next())
+        wal = journal.value(0).toString().compare("wal", Qt::CaseInsensitive) == 0;
+    else
+        qDebug("PRAGMA journal_mode = %s failed: %s", qPrintable(journalMode), qPrintable(journal.lastError().text()));
+    journal.finish();
+
+    QStringList pragmas;
+    //NORMAL is only safe in WAL mode, where the last commits can be lost on power failure but the database cannot be corrupted.
+    pragmas << (wal ? "PRAGMA synchronous = NORMAL;" : "PRAGMA synchronous = FULL;")
+            << "PRAGMA cache_size = -32768;" //32 MiB per connection.
+            << "PRAGMA mmap_size = 268435456;" //Read through a 256 MiB memory map instead of read() calls.
+            << "PRAGMA temp_store = MEMORY;";
+    foreach (const QString &pragma, pragmas) {
+        QSqlQuery query(db);
+        if (!query.exec(pragma))
+            qDebug("%s failed: %s", qPrintable(pragma), qPrintable(query.lastError().text()));
+    }
+}
+
+/* Returns the calling thread's connection to the library. The GUI thread
+ * uses the default connection opened by InitDatabase(); any other thread
+ * gets a connection of its own, opened on first use and closed when the
+ * thread finishes. A QSqlDatabase must only be used by the thread it was
+ * opened on, so never pass the result on to another thread.
+ */
+QSqlDatabase DatabaseSupport::Connection()
+{
+    if (!threadConnections.hasLocalData()) {
+        if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+            threadConnections.setLocalData(new ThreadConnection(QSqlDatabase::defaultConnection, false));
+        } else {
+            QString name = QString("Message_Librarian_%1").arg(quintptr(QThread::currentThreadId()));
+            {
+                QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+                db.setConnectOptions(CONNECT_OPTIONS);
+                db.setDatabaseName(databaseFile);
+                if (db.open())
+                    ConfigureConnection(db);
+                else
+                    qDebug("Cannot open a database connection for this thread: %s", qPrintable(db.lastError().text()));
+            }
+            threadConnections.setLocalData(new ThreadConnection(name, true));
+        }
+    }
+    return QSqlDatabase::database(threadConnections.localData()->connectionName, false);
+}
+
+/* Returns 'statement' prepared (forward-only) on the calling thread's
+ * connection. Each statement is only prepared once per thread; later calls
+ * hand back the same query, ready to be bound and run again. Copies share
+ * one result, so a thread must not run the same statement twice at once.
+ */
+QSqlQuery DatabaseSupport::PreparedQuery(const QString &statement)
+{
+    QSqlDatabase db = Connection();
+    QHash<QString, QSqlQuery> &cache = threadConnections.localData()->preparedQueries;
+    QHash<QString, QSqlQuery>::iterator cached = cache.find(statement);
+    if (cached != cache.end()) {
+        cached.value().finish();
+        return cached.value();
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (query.prepare(statement))
+        cache.insert(statement, query);
+    else
+        qDebug("Cannot prepare \"%s\": %s", qPrintable(statement), qPrintable(query.lastError().text()));
+    return query;
+}
+
+//Drops the calling thread's prepared statements (and connection, if it owns one). Call before the database goes away.
+void DatabaseSupport::ReleaseConnection()
+{
+    threadConnections.setLocalData(NULL);
+}
+
+/* Checks that the message table is there with the columns we read, by
+ * preparing a query that returns no rows. This only reads the schema, so
+ * it costs the same on a 500,000-row library on a network share as on an
+ * empty one.
+ */
 bool DatabaseSupport::LoadDatabase()
 {
-    QSqlTableModel model(0, QSqlDatabase::database());
-    model.setTable(GetCompatibleDBTableName());
+    TRACE_SCOPE("DatabaseSupport::LoadDatabase");
+    QSqlQuery query(QSqlDatabase::database());
+    query.exec("SELECT id, title, speaker, location, date, description, transcription FROM " +
+               GetCompatibleDBTableName() + " LIMIT 0;");
 
-    if (model.lastError().type() != QSqlError::NoError) {
-        int result = QMessageBox::warning(0, "Error", "Cannot load database. Error details: " + model.lastError().text() +
-                                          "\nDo you want to initialize a new one with default values?",
-                                          QMessageBox::Yes, QMessageBox::No, QMessageBox::NoButton);
-        if (result == QMessageBox::Yes) {
+    if (query.lastError().type() != QSqlError::NoError) {
+        bool result = AskUser("Error", "Cannot load database. Error details: " + query.lastError().text() +
+                              "\nDo you want to initialize a new one with default values?");
+        if (result) {
             if (CreateNewDatabase()) {
-                QMessageBox::information(0, "Operation successful", "New database has been successfully created. Choose <b>Edit</b> from the <b>File</b> menu to add entries.");
+                ReportInformation("Operation successful", "New database has been successfully created. Choose <b>Edit</b> from the <b>File</b> menu to add entries.");
                 return true;
             }
             return false;
-        } else if (result == QMessageBox::No) {
+        } else {
             return false;
         }
     }
@@ -81,6 +257,7 @@ bool DatabaseSupport::LoadDatabase()
 /// If you send a db connection, that will be used instead of the default, as in preparing to merge libraries.
 bool DatabaseSupport::CheckDatabaseVersion(QSqlDatabase curDB)
 {
+    TRACE_SCOPE("DatabaseSupport::CheckDatabaseVersion");
     // Get the database version that works with this release of the software.
     QString stringCompatibleVersion = QString(COMPAT_DBTABLENAME).remove("Messages_Version_");
     compatibleVersion = stringCompatibleVersion.right(2).remove("_").toInt();
@@ -90,8 +267,8 @@ bool DatabaseSupport::CheckDatabaseVersion(QSqlDatabase curDB)
 
     int versionSeparatorCharPos = stringDbVersion.indexOf("_");
     if (stringDbVersion == "" || versionSeparatorCharPos == -1) {
-        QMessageBox::critical(0, "Error", "Failed to load version number from database. Data structure does not match Message Librarian's signature."
-                                         "\n Please contact your support team for assistance.");
+        ReportError("Error", "Failed to load version number from database. Data structure does not match Message Librarian's signature."
+                             "\n Please contact your support team for assistance.");
         return false;
     }
 
@@ -100,17 +277,48 @@ bool DatabaseSupport::CheckDatabaseVersion(QSqlDatabase curDB)
 
     // Compare them!
     if (dbVersion < compatibleVersion) {
-        QMessageBox::warning(0, "Error", "Your message library needs to be updated to work with this version of the software.\nPlease press OK to begin this process.");
+        ReportInformation("Error", "Your message library needs to be updated to work with this version of the software.\nPlease press OK to begin this process.");
         return false;
     } else if (dbVersion > compatibleVersion) {
         dbVersion = -2; // return version number to -2 so that we know to attempt an update.
-        QMessageBox::warning(0, "Error", "This message library is from a newer version of the software. You will need to update the program to continue.\nIf you need assistance, please contact your support team.");
+        ReportError("Error", "This message library is from a newer version of the software. You will need to update the program to continue.\nIf you need assistance, please contact your support team.");
         return false;
     }
 
     return  true; // Version matches. Proceed with program loading.
 }
 
+void DatabaseSupport::ReportError(const QString &title, const QString &text)
+{
+    lastErrorMessage = QString(text).remove(QRegExp("<[^>]*>"));
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    QMessageBox::warning(0, title, text);
+#else
+    Q_UNUSED(title); //The caller reports LastErrorMessage() in its own format.
+#endif
+}
+
+void DatabaseSupport::ReportInformation(const QString &title, const QString &text)
+{
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    QMessageBox::information(0, title, text);
+#else
+    qDebug("%s: %s", qPrintable(title), qPrintable(QString(text).remove(QRegExp("<[^>]*>"))));
+#endif
+}
+
+//A yes/no question. Without a GUI there is nobody to answer, which counts as "no".
+bool DatabaseSupport::AskUser(const QString &title, const QString &question)
+{
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    return QMessageBox::warning(0, title, question, QMessageBox::Yes, QMessageBox::No, QMessageBox::NoButton) == QMessageBox::Yes;
+#else
+    Q_UNUSED(title);
+    lastErrorMessage = QString(question).remove(QRegExp("<[^>]*>"));
+    return false;
+#endif
+}
+
 int DatabaseSupport::GetCompatibleVersion()
 {
     return compatibleVersion;
@@ -128,53 +336,314 @@ QString DatabaseSupport::GetReleaseDescription()
 
 bool DatabaseSupport::CreateNewDatabase()
 {
-    QSqlQuery query("CREATE TABLE " + QString(COMPAT_DBTABLENAME) + " ("
-                     "id VARCHAR(40),"
-                     "title CLOB NOT NULL,"
-                     "speaker VARCHAR(40) NOT NULL,"
-                     "location VARCHAR(40) NOT NULL,"
-                     "date VARCHAR(40) NOT NULL,"
-                     "description VARCHAR(40) NOT NULL,"
-                     "transcription CLOB);", QSqlDatabase::database());
+    QSqlDatabase db = QSqlDatabase::database();
+    QStringList statements;
+    statements << TableDefinition(COMPAT_DBTABLENAME) << IndexDefinitions(COMPAT_DBTABLENAME, true);
 
-    if (!query.isActive()) {
-        QMessageBox::warning(0, "Error", "Cannot create new database. Error details: " +
-                             query.lastError().text() + "\n Please contact your support team for assistance.");
-        return false;
+    db.transaction();
+    foreach (const QString &statement, statements) {
+        QSqlQuery query(db);
+        if (!query.exec(statement)) {
+            ReportError("Error", "Cannot create new database. Error details: " +
+                        query.lastError().text() + "\n Please contact your support team for assistance.");
+            db.rollback();
+            return false;
+        }
     }
+    return db.commit();
+}
 
-    query.finish();
-    return true;
+/* The statement that creates the current message table. Dates are stored
+ * as ISO-8601 text (yyyy-MM-dd), which is what Qt writes for a QDate, sorts
+ * chronologically and can be range-searched on the index.
+ */
+QString DatabaseSupport::TableDefinition(const QString &tableName)
+{
+    return "CREATE TABLE " + tableName + " ("
+           "id VARCHAR(40),"
+           "title CLOB NOT NULL,"
+           "speaker VARCHAR(40) NOT NULL,"
+           "location VARCHAR(40) NOT NULL,"
+           "date TEXT NOT NULL,"
+           "description VARCHAR(40) NOT NULL,"
+           "transcription CLOB);";
+}
+
+QStringList DatabaseSupport::IndexDefinitions(const QString &tableName, bool uniqueIds)
+{
+    QStringList statements;
+    statements << "CREATE " + QString(uniqueIds ? "UNIQUE " : "") + "INDEX IF NOT EXISTS Messages_ID_Index ON " + tableName + " (id);"
+               << "CREATE INDEX IF NOT EXISTS Messages_Speaker_Index ON " + tableName + " (speaker);"
+               << "CREATE INDEX IF NOT EXISTS Messages_Location_Index ON " + tableName + " (location);"
+               << "CREATE INDEX IF NOT EXISTS " + QString(DATE_INDEX_NAME) + " ON " + tableName + " (date);";
+    return statements;
 }
 
 QString DatabaseSupport::ExtractDatabaseVersion(QSqlDatabase db)
 {
-    QStringList availableTables = db.tables();
+    //Only look at message tables; the search index and its shadow tables live alongside them.
+    //One query on the schema, rather than QSqlDatabase::tables(), which lists views and system tables as well.
+    QStringList availableTables;
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (query.exec("SELECT name FROM sqlite_master WHERE type = 'table' AND name LIKE 'Messages\\_Version\\_%' ESCAPE '\\';"))
+        while (query.next())
+            availableTables << query.value(0).toString();
     //Check for proper table count
     if (availableTables.size() < 1 || availableTables.size() > 1) {
             return "";
     }
-    //Check to make sure it looks like our table
-    for (int i = 0; i < availableTables.size(); i++) {
-        if (!availableTables[i].contains("Messages_Version_"))
-            return "";
-    }
 
     return QString(availableTables[0]).remove("Messages_Version_"); //We assume that there is only one table in the database.
 }
 
+/* Brings an older message library up to the table layout this version of
+ * the software works with. The table name carries the schema version
+ * (Messages_Version_<release>_<n>); the steps listed below each turn the
+ * table of version n into that of version n + 1, and are run in order from
+ * the library's version to ours. Everything happens in one transaction,
+ * so an update that fails, is cancelled or is cut short by a crash or power
+ * loss leaves the library exactly as it was.
+ */
 bool DatabaseSupport::UpdateDatabase()
 {
+    TRACE_SCOPE("DatabaseSupport::UpdateDatabase");
+    static const MigrationStep steps[] = {
+        { 1, &DatabaseSupport::MigrateAlpha1ToAlpha2 }
+    };
+    const int stepCount = sizeof(steps) / sizeof(steps[0]);
+
+    QSqlDatabase db = QSqlDatabase::database();
+    QString table = "Messages_Version_" + ExtractDatabaseVersion(db);
+
+    //Collect the steps between the library's version and ours.
+    QList<MigrationStep> path;
+    for (int version = dbVersion; version < compatibleVersion; ++version) {
+        int s = 0;
+        while (s < stepCount && steps[s].fromVersion != version)
+            ++s;
+        if (s == stepCount) {
+            ReportError("Error", QString("Your message library (version %1) cannot be updated by this version of the software."
+                                         "\nPlease contact your support team for assistance.").arg(dbVersion));
+            return false;
+        }
+        path.append(steps[s]);
+    }
+
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    QProgressDialog progress("Updating your message library . . .", "Cancel", 0, (path.size() + 1) * MIGRATION_PROGRESS_STEPS);
+    progress.setWindowModality(Qt::ApplicationModal);
+    progress.setMinimumDuration(0);
+    QProgressDialog *dialog = &progress;
+#else
+    QProgressDialog *dialog = NULL; //Nothing to show, and nobody to cancel.
+#endif
+    QSqlQuery pragma(db);
+    pragma.exec("PRAGMA cache_size = -65536;"); //64 MiB, so index builds sort in memory.
+
+    db.transaction();
+    QString error;
+    bool ok = true;
+    for (int i = 0; i < path.size() && ok; ++i) {
+        int toVersion = path.at(i).fromVersion + 1;
+        QString nextTable = toVersion == compatibleVersion ? QString(COMPAT_DBTABLENAME)
+                                                           : "Messages_Version_" + releaseDescription + "_" + QString::number(toVersion);
+        MigrationProgress stepProgress = { dialog, i * MIGRATION_PROGRESS_STEPS };
+        ok = (*path.at(i).migrate)(db, table, nextTable, stepProgress, error);
+        table = nextTable;
+    }
+
+    //Indexes are built once the rows are in, which is much faster than updating them row by row.
+    if (ok)
+        ok = BuildIndexes(db, table, error);
+    //The full-text index belongs to the old table; InitSearchIndex() builds a new one.
+    if (ok && !path.isEmpty() && db.tables().contains(SEARCH_INDEX_NAME)) {
+        QSqlQuery dropIndex(db);
+        ok = dropIndex.exec("DROP TABLE " + QString(SEARCH_INDEX_NAME) + ";") &&
+             dropIndex.exec("DROP TABLE IF EXISTS " + QString(SEARCH_INDEX_PROGRESS_NAME) + ";");
+        if (!ok)
+            error = dropIndex.lastError().text();
+    }
+    MigrationProgress overall = { dialog, path.size() * MIGRATION_PROGRESS_STEPS };
+    ReportProgress(overall, 1, 1);
+
+    if (!ok || !db.commit()) {
+        db.rollback();
+        if (WasCanceled(overall))
+            ReportInformation("Update cancelled", "The update was cancelled. Your message library has not been changed.");
+        else
+            ReportError("Error", "Your message library could not be updated. Error details: " + error +
+                        "\nPlease contact your support team for assistance.");
+        return false;
+    }
+
+    dbVersion = compatibleVersion;
+    return true;
+}
+
+/* Copies every row of 'fromTable' into 'toTable', keeping rowids.
+ * 'selectColumns' are the expressions read from the old table for
+ * 'insertColumns' in the new one. The copy is done by SQLite itself, in
+ * large rowid ranges, so that progress can be shown (and the user can
+ * cancel) without paying for a round trip per row.
+ */
+bool DatabaseSupport::CopyRows(QSqlDatabase db, const QString &fromTable, const QString &toTable, const QString &insertColumns,
+                               const QString &selectColumns, MigrationProgress &progress, QString &error)
+{
+    QSqlQuery range(db);
+    if (!range.exec("SELECT MIN(rowid), MAX(rowid) FROM " + fromTable + ";") || !range.next()) {
+        error = range.lastError().text();
+        return false;
+    }
+    if (range.value(0).isNull())
+        return true; //Nothing to copy.
+    const qint64 firstRowId = range.value(0).toLongLong();
+    const qint64 lastRowId = range.value(1).toLongLong();
+
+    QSqlQuery copy(db);
+    if (!copy.prepare("INSERT INTO " + toTable + " (rowid, " + insertColumns + ") "
+                      "SELECT rowid, " + selectColumns + " FROM " + fromTable + " WHERE rowid BETWEEN ? AND ?;")) {
+        error = copy.lastError().text();
+        return false;
+    }
+    for (qint64 first = firstRowId; first <= lastRowId; first += MIGRATION_BATCH_ROWS) {
+        copy.bindValue(0, first);
+        copy.bindValue(1, first + MIGRATION_BATCH_ROWS - 1);
+        if (!copy.exec()) {
+            error = copy.lastError().text();
+            return false;
+        }
+        if (!ReportProgress(progress, first - firstRowId + MIGRATION_BATCH_ROWS, lastRowId - firstRowId + 1)) {
+            error = "Cancelled.";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatabaseSupport::ReportProgress(MigrationProgress &progress, qint64 done, qint64 total)
+{
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    if (progress.dialog == NULL)
+        return true;
+    int steps = total > 0 ? int(qMin(done, total) * MIGRATION_PROGRESS_STEPS / total) : MIGRATION_PROGRESS_STEPS;
+    progress.dialog->setValue(progress.base + steps); //Also keeps the (modal) dialog responsive.
+    return !progress.dialog->wasCanceled();
+#else
+    Q_UNUSED(progress);
+    Q_UNUSED(done);
+    Q_UNUSED(total);
+    return true;
+#endif
+}
+
+bool DatabaseSupport::WasCanceled(const MigrationProgress &progress)
+{
+#ifndef MESSAGE_LIBRARIAN_HEADLESS
+    return progress.dialog != NULL && progress.dialog->wasCanceled();
+#else
+    Q_UNUSED(progress);
+    return false;
+#endif
+}
+
+/* Creates whichever of the table's indexes are missing. Audio bindings
+ * (id) should be unique; should an old library hold duplicates anyway, it
+ * gets a plain index rather than failing the update.
+ */
+bool DatabaseSupport::BuildIndexes(QSqlDatabase db, const QString &tableName, QString &error)
+{
+    QSqlQuery duplicates(db);
+    duplicates.exec("SELECT id FROM " + tableName + " WHERE id IS NOT NULL GROUP BY id HAVING COUNT(*) > 1 LIMIT 1;");
+    bool uniqueIds = !duplicates.next();
+    if (!uniqueIds)
+        qDebug("Duplicate audio bindings found; the id index will not be unique.");
+    duplicates.finish();
+
+    foreach (const QString &statement, IndexDefinitions(tableName, uniqueIds)) {
+        QSqlQuery query(db);
+        if (!query.exec(statement)) {
+            error = query.lastError().text();
+            return false;
+        }
+    }
     return true;
 }
 
+/* Alpha_1 stored dates as free text; Alpha_2 stores ISO-8601 dates. The rows
+ * are copied in bulk with their rowids, then the few dates that are not ISO
+ * already are parsed and rewritten.
+ */
+bool DatabaseSupport::MigrateAlpha1ToAlpha2(QSqlDatabase db, const QString &fromTable, const QString &toTable,
+                                            MigrationProgress &progress, QString &error)
+{
+    QString columns = "id, title, speaker, location, date, description, transcription";
+    QSqlQuery create(db);
+    if (!create.exec(TableDefinition(toTable))) {
+        error = create.lastError().text();
+        return false;
+    }
+    if (!CopyRows(db, fromTable, toTable, columns, columns, progress, error))
+        return false;
+
+    QSqlQuery drop(db);
+    if (!drop.exec("DROP TABLE " + fromTable + ";")) {
+        error = drop.lastError().text();
+        return false;
+    }
+
+    QSqlQuery select(db);
+    select.setForwardOnly(true);
+    if (!select.exec("SELECT rowid, date FROM " + toTable + " WHERE date NOT GLOB " ISO_DATE_PATTERN ";")) {
+        error = select.lastError().text();
+        return false;
+    }
+    QList<QPair<qint64, QString> > legacyDates;
+    while (select.next())
+        legacyDates.append(qMakePair(select.value(0).toLongLong(), select.value(1).toString()));
+    select.finish();
+
+    QSqlQuery update(db);
+    update.prepare("UPDATE " + toTable + " SET date = ? WHERE rowid = ?;");
+    int unparsed = 0;
+    for (int i = 0; i < legacyDates.size(); ++i) {
+        QDate date = ParseLegacyDate(legacyDates.at(i).second);
+        if (!date.isValid()) {
+            unparsed++; //Left as it was; better an oddly sorted row than a lost date.
+            continue;
+        }
+        update.bindValue(0, date.toString(Qt::ISODate));
+        update.bindValue(1, legacyDates.at(i).first);
+        if (!update.exec()) {
+            error = update.lastError().text();
+            return false;
+        }
+    }
+    if (unparsed > 0)
+        qDebug("%d dates could not be converted and were left as they were.", unparsed);
+    return true;
+}
+
+QDate DatabaseSupport::ParseLegacyDate(const QString &text)
+{
+    QString trimmed = text.trimmed();
+    QDate date = QDate::fromString(trimmed.left(10), Qt::ISODate);
+    if (!date.isValid())
+        date = QDate::fromString(trimmed, Qt::TextDate);
+    if (!date.isValid())
+        date = QDate::fromString(trimmed, "M/d/yyyy");
+    if (!date.isValid())
+        date = QDate::fromString(trimmed, "d.M.yyyy");
+    return date;
+}
+
 bool DatabaseSupport::RenameSQLTable(QString oldName, QString newName)
 {
     QSqlQuery query("ALTER TABLE " + oldName + " RENAME TO " + newName + ";");
 
     if (!query.isActive()) {
-        QMessageBox::warning(0, "Error", "Cannot rename table '" + oldName + "'. Error details: " +
-                             query.lastError().text() + "\n Please contact your support team for assistance.");
+        ReportError("Error", "Cannot rename table '" + oldName + "'. Error details: " +
+                    query.lastError().text() + "\n Please contact your support team for assistance.");
         return false;
     }
 
@@ -182,3 +651,286 @@ bool DatabaseSupport::RenameSQLTable(QString oldName, QString newName)
     return true;
 }
 
+
+/* Creates the full-text search index, if it does not exist yet, and the
+ * triggers that keep it in step with the message table. The index is an
+ * external-content FTS5 table, so it stores no second copy of the text.
+ * If this SQLite build lacks FTS5, searching falls back to the table scan
+ * in SermonSortFilterProxyModel, so failure here is not fatal.
+ *
+ * The rows already in the table are indexed SEARCH_INDEX_BUILD_ROWS at a
+ * time, in rowid order, each batch in its own short transaction, so the
+ * GUI's writes never wait long for the build. Until it is done, a progress
+ * table says how far it got; the triggers only touch rows up to there (the
+ * build reads the others as they are when it gets to them), and a build
+ * that was cut short carries on from there the next time. Then the
+ * progress table goes and the triggers keep every row in step.
+ */
+bool DatabaseSupport::InitSearchIndex()
+{
+    TRACE_SCOPE("DatabaseSupport::InitSearchIndex");
+    QSqlDatabase db = Connection();
+    searchIndexCancelled.store(0);
+    bool indexExists;
+    if (OpenSearchIndex(&indexExists))
+        return true;
+
+    QString table = COMPAT_DBTABLENAME;
+    QString index = SEARCH_INDEX_NAME;
+    QString progress = SEARCH_INDEX_PROGRESS_NAME;
+    QString columns = "title, speaker, location, description, transcription";
+    if (!indexExists) {
+        QStringList statements;
+        statements << "CREATE VIRTUAL TABLE " + index + " USING fts5(" + columns + ", content='" + table + "', content_rowid='rowid');"
+                   << "CREATE TABLE " + progress + " (indexed_through INTEGER NOT NULL);"
+                   << "INSERT INTO " + progress + " VALUES (0);"
+                   << SearchIndexTriggers(true);
+        if (!ExecuteInTransaction(db, statements))
+            return false;
+    }
+
+    QSqlQuery query(db);
+    for (;;) {
+        if (searchIndexCancelled.load())
+            return false; //Carries on from here next time.
+        TraceSpan span("DatabaseSupport::InitSearchIndex (batch)");
+        //Takes the write lock up front (waiting for the GUI's writes), so it cannot be refused once the batch has been read.
+        if (!query.exec("BEGIN IMMEDIATE;")) {
+            qDebug("Full-text search index unavailable: %s", qPrintable(query.lastError().text()));
+            return false;
+        }
+        qint64 from = -1;
+        qint64 through = -1;
+        if (query.exec("SELECT indexed_through FROM " + progress + ";") && query.next())
+            from = query.value(0).toLongLong();
+        query.finish();
+        if (from >= 0 && query.exec("SELECT MAX(rowid) FROM (SELECT rowid FROM " + table + " WHERE rowid > " + QString::number(from) +
+                                    " ORDER BY rowid LIMIT " + QString::number(SEARCH_INDEX_BUILD_ROWS) + ");") && query.next())
+            through = query.value(0).isNull() ? from : query.value(0).toLongLong();
+        query.finish();
+        if (through < 0 || through == from) {
+            db.rollback();
+            break; //Every row is in (or the progress could not be read, which the final step reports).
+        }
+
+        bool ok = query.exec("INSERT INTO " + index + "(rowid, " + columns + ") SELECT rowid, " + columns + " FROM " + table +
+                             " WHERE rowid > " + QString::number(from) + " AND rowid <= " + QString::number(through) + ";") &&
+                  query.exec("UPDATE " + progress + " SET indexed_through = " + QString::number(through) + ";");
+        if (!ok || !db.commit()) {
+            qDebug("Full-text search index unavailable: %s", qPrintable(ok ? db.lastError().text() : query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+        span.setValue(through - from);
+    }
+
+    QStringList statements;
+    statements << "DROP TRIGGER IF EXISTS " + index + "_ai;"
+               << "DROP TRIGGER IF EXISTS " + index + "_ad;"
+               << "DROP TRIGGER IF EXISTS " + index + "_au;"
+               << SearchIndexTriggers(false)
+               << "DROP TABLE " + progress + ";";
+    if (!ExecuteInTransaction(db, statements))
+        return false;
+
+    searchIndexAvailable.store(1);
+    return true;
+}
+
+/* Uses the full-text search index if a finished one is there, and writes
+ * nothing: a missing or half-built index stays as it is, and searches scan
+ * the table instead. For readers that must not build it, such as the batch
+ * tool's search and export; InitSearchIndex() builds it.
+ */
+bool DatabaseSupport::OpenSearchIndex(bool *indexExists)
+{
+    QSqlDatabase db = Connection();
+    searchIndexAvailable.store(0);
+
+    QSqlQuery existing(db);
+    bool exists = existing.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = '" SEARCH_INDEX_NAME "';") && existing.next();
+    existing.finish();
+    bool building = existing.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = '" SEARCH_INDEX_PROGRESS_NAME "';") && existing.next();
+    existing.finish();
+    if (indexExists != NULL)
+        *indexExists = exists;
+    if (!exists || building)
+        return false;
+
+    //Reads the index's first pages, so the first search does not wait for them.
+    QSqlQuery warmUp(db);
+    warmUp.exec("SELECT rowid FROM " SEARCH_INDEX_NAME " WHERE " SEARCH_INDEX_NAME " MATCH 'a*' LIMIT 1;");
+    searchIndexAvailable.store(1);
+    return true;
+}
+
+//Stops a build running in InitSearchIndex() after its current batch. Call before the program quits.
+void DatabaseSupport::CancelSearchIndexBuild()
+{
+    searchIndexCancelled.store(1);
+}
+
+/* The triggers that keep the search index in step with the message table.
+ * While the index is being built they leave alone the rows the build has
+ * not got to yet; see InitSearchIndex().
+ */
+QStringList DatabaseSupport::SearchIndexTriggers(bool whileBuilding)
+{
+    QString table = COMPAT_DBTABLENAME;
+    QString index = SEARCH_INDEX_NAME;
+    QString columns = "title, speaker, location, description, transcription";
+    QString indexed = " WHERE %1.rowid <= (SELECT indexed_through FROM " SEARCH_INDEX_PROGRESS_NAME ")";
+    QString newRow = whileBuilding ? indexed.arg("new") : QString();
+    QString oldRow = whileBuilding ? indexed.arg("old") : QString();
+
+    QStringList triggers;
+    triggers << "CREATE TRIGGER " + index + "_ai AFTER INSERT ON " + table + " BEGIN "
+                "INSERT INTO " + index + "(rowid, " + columns + ") "
+                "SELECT new.rowid, new.title, new.speaker, new.location, new.description, new.transcription" + newRow + "; END;"
+             << "CREATE TRIGGER " + index + "_ad AFTER DELETE ON " + table + " BEGIN "
+                "INSERT INTO " + index + "(" + index + ", rowid, " + columns + ") "
+                "SELECT 'delete', old.rowid, old.title, old.speaker, old.location, old.description, old.transcription" + oldRow + "; END;"
+             << "CREATE TRIGGER " + index + "_au AFTER UPDATE ON " + table + " BEGIN "
+                "INSERT INTO " + index + "(" + index + ", rowid, " + columns + ") "
+                "SELECT 'delete', old.rowid, old.title, old.speaker, old.location, old.description, old.transcription" + oldRow + "; "
+                "INSERT INTO " + index + "(rowid, " + columns + ") "
+                "SELECT new.rowid, new.title, new.speaker, new.location, new.description, new.transcription" + newRow + "; END;";
+    return triggers;
+}
+
+//Runs 'statements' in one transaction; all or nothing.
+bool DatabaseSupport::ExecuteInTransaction(QSqlDatabase db, const QStringList &statements)
+{
+    if (!db.transaction()) {
+        qDebug("Full-text search index unavailable: %s", qPrintable(db.lastError().text()));
+        return false;
+    }
+    foreach (const QString &statement, statements) {
+        QSqlQuery query(db);
+        if (!query.exec(statement)) {
+            qDebug("Full-text search index unavailable: %s", qPrintable(query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        qDebug("Full-text search index unavailable: %s", qPrintable(db.lastError().text()));
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+/* Creates the change log, if it does not exist yet: triggers note the rowid
+ * of every row inserted, updated or deleted in the message table, by this
+ * program or any other, so that SermonTableModel::applyChanges() can bring
+ * an open model up to date row by row. Entries are numbered; each reader
+ * keeps track of the last one it has seen, so several copies of the program
+ * can share a library. Without the log, models fall back to select().
+ */
+bool DatabaseSupport::InitChangeLog()
+{
+    TRACE_SCOPE("DatabaseSupport::InitChangeLog");
+    QSqlDatabase db = Connection();
+    QString table = COMPAT_DBTABLENAME;
+    QString log = CHANGE_LOG_NAME;
+    QStringList statements;
+    statements << "CREATE TABLE IF NOT EXISTS " + log + " (seq INTEGER PRIMARY KEY AUTOINCREMENT, row_id INTEGER NOT NULL, change TEXT NOT NULL);"
+               << "CREATE TRIGGER IF NOT EXISTS " + log + "_ai AFTER INSERT ON " + table + " BEGIN "
+                  "INSERT INTO " + log + "(row_id, change) VALUES (new.rowid, 'I'); END;"
+               << "CREATE TRIGGER IF NOT EXISTS " + log + "_au AFTER UPDATE ON " + table + " BEGIN "
+                  "INSERT INTO " + log + "(row_id, change) VALUES (new.rowid, 'U'); END;"
+               << "CREATE TRIGGER IF NOT EXISTS " + log + "_ad AFTER DELETE ON " + table + " BEGIN "
+                  "INSERT INTO " + log + "(row_id, change) VALUES (old.rowid, 'D'); END;"
+               << "DELETE FROM " + log + " WHERE seq <= (SELECT MAX(seq) FROM " + log + ") - " + QString::number(CHANGE_LOG_KEEP_ENTRIES) + ";";
+
+    db.transaction();
+    foreach (const QString &statement, statements) {
+        QSqlQuery query(db);
+        if (!query.exec(statement)) {
+            qDebug("Change log unavailable: %s", qPrintable(query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+    return db.commit();
+}
+
+bool DatabaseSupport::IsSearchIndexAvailable()
+{
+    return searchIndexAvailable.load() != 0;
+}
+
+/* Turns plain search text into an FTS5 query: every word in every column
+ * must be present, and the last word may be incomplete (prefix match), so
+ * results keep up with the user while they type.
+ */
+QString DatabaseSupport::BuildSearchExpression(const QHash<int, QString> &columnTerms)
+{
+    QStringList clauses;
+    QHash<int, QString>::const_iterator i;
+    for (i = columnTerms.constBegin(); i != columnTerms.constEnd(); ++i) {
+        QString column;
+        switch (i.key()) {
+        case Sermon_Title: column = "title"; break;
+        case Sermon_Speaker: column = "speaker"; break;
+        case Sermon_Location: column = "location"; break;
+        case Sermon_Description: column = "description"; break;
+        case Sermon_Transcription: column = "transcription"; break;
+        default: continue; //Not indexed.
+        }
+        QStringList words = i.value().split(QRegExp("[^\\w]+"), QString::SkipEmptyParts);
+        foreach (const QString &word, words)
+            clauses << column + " : \"" + word + "\"*"; //Words are split on non-word characters, so they never contain quotes.
+    }
+    return clauses.join(" AND ");
+}
+
+/* Runs a full-text query built by BuildSearchExpression and returns the
+ * rowids of the matches. They are not ranked: the results are shown in the
+ * table's own order, so ranking would only cost time.
+ */
+bool DatabaseSupport::SearchFullText(const QString &searchExpression, QSet<qint64> &rowIds,
+                                     const QDate &minimumDate, const QDate &maximumDate)
+{
+    rowIds.clear();
+    if (!IsSearchIndexAvailable() || searchExpression.isEmpty())
+        return false;
+    TraceSpan span("DatabaseSupport::SearchFullText");
+
+    QString index = SEARCH_INDEX_NAME;
+    QString table = COMPAT_DBTABLENAME;
+    QString dateRange = DateRangeCondition(minimumDate, maximumDate);
+    QSqlQuery query = PreparedQuery("SELECT rowid FROM " + index + " WHERE " + index + " MATCH ? " +
+                                    (dateRange.isEmpty() ? QString() : "AND rowid IN (SELECT rowid FROM " + table + " WHERE " + dateRange + ")") + ";");
+    int bindIndex = 0;
+    query.bindValue(bindIndex++, searchExpression);
+    if (minimumDate.isValid())
+        query.bindValue(bindIndex++, minimumDate.toString(Qt::ISODate));
+    if (maximumDate.isValid())
+        query.bindValue(bindIndex++, maximumDate.toString(Qt::ISODate));
+    if (!query.exec()) {
+        qDebug("Full-text search failed: %s", qPrintable(query.lastError().text()));
+        return false;
+    }
+
+    while (query.next())
+        rowIds.insert(query.value(0).toLongLong());
+    span.setValue(rowIds.size());
+    return true;
+}
+
+/* A WHERE condition restricting the date to the given range, so that SQLite
+ * can answer it from the date index. Takes one bind value per valid bound,
+ * in the order minimum, maximum. Empty if both bounds are open.
+ */
+QString DatabaseSupport::DateRangeCondition(const QDate &minimumDate, const QDate &maximumDate)
+{
+    if (minimumDate.isValid() && maximumDate.isValid())
+        return "date BETWEEN ? AND ?";
+    if (minimumDate.isValid())
+        return "date >= ?";
+    if (maximumDate.isValid())
+        return "date <= ?";
+    return QString();
+}
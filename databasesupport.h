@@ -2,12 +2,18 @@
 #define DATABASESUPPORT_H
 
 #include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QDate>
+#include <QStringList>
 #include <QSettings>
 #include <QSqlDatabase>
 #include <QSqlTableModel>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QMessageBox>
+#include <QAtomicInt>
+
+class QProgressDialog; //Only used by the GUI build; see MESSAGE_LIBRARIAN_HEADLESS.
 
 enum {
     Sermon_ID = 0,
@@ -16,21 +22,46 @@ enum {
     Sermon_Location = 3,
     Sermon_Date = 4,
     Sermon_Description = 5,
-    Sermon_Transcription = 6
+    Sermon_Transcription = 6,
+    Sermon_RowId = 7 //Not a real table column; appended to every select by SermonTableModel.
 };
 
 class DatabaseSupport
 {
 public:
     static QString GetCompatibleDBTableName();
-    static bool InitDatabase();
+    static QString GetSearchIndexName();
+    static QString GetChangeLogName();
+    static QString LibraryPath();
+    static bool InitDatabase(const QString &libraryPath = QString());
+    static QSqlDatabase Connection();
+    static QSqlQuery PreparedQuery(const QString &statement);
+    static void ReleaseConnection();
     static bool LoadDatabase();
+    static bool CreateNewDatabase(); //An empty message table in the open library; LoadDatabase() offers this to the user.
     static bool CheckDatabaseVersion(QSqlDatabase curDB = QSqlDatabase::database());
     static bool UpdateDatabase();
 
+    static bool InitChangeLog();
+    static bool InitSearchIndex(); //Safe to run on a worker thread; see MainWindow::finishStartup().
+    static bool OpenSearchIndex(bool *indexExists = NULL);
+    static void CancelSearchIndexBuild();
+    static bool IsSearchIndexAvailable();
+    static QString BuildSearchExpression(const QHash<int, QString> &columnTerms);
+    static bool SearchFullText(const QString &searchExpression, QSet<qint64> &rowIds,
+                               const QDate &minimumDate = QDate(), const QDate &maximumDate = QDate());
+    static QString DateRangeCondition(const QDate &minimumDate, const QDate &maximumDate);
+    static QDate ParseLegacyDate(const QString &text);
+
     //only temporarily public for testing!
     static bool RenameSQLTable(QString oldName, QString newName);
 
+    //Messages for the user. The headless build (MESSAGE_LIBRARIAN_HEADLESS) only keeps the last error and never asks.
+    static void ReportError(const QString &title, const QString &text);
+    static void ReportInformation(const QString &title, const QString &text);
+    static bool AskUser(const QString &title, const QString &question);
+    static QString LastErrorMessage() { return lastErrorMessage; }
+
     // You must call CheckVersionNumber before you can retreive the actual value;
     static int GetCompatibleVersion();
     static int GetDbVersion();
@@ -40,12 +71,40 @@ private:
     //Made the constructor private because having an object of the database makes little sense,
     //considering that we are working with only one database connection at a time.
     DatabaseSupport();
-    static bool CreateNewDatabase();
+    static void ConfigureConnection(QSqlDatabase db);
+    static QString TableDefinition(const QString &tableName);
+    static QStringList IndexDefinitions(const QString &tableName, bool uniqueIds);
+    static QStringList SearchIndexTriggers(bool whileBuilding);
+    static bool ExecuteInTransaction(QSqlDatabase db, const QStringList &statements);
+
+    //Schema updates; see UpdateDatabase().
+    struct MigrationProgress
+    {
+        QProgressDialog *dialog;
+        int base; //Where this step's share of the progress bar starts.
+    };
+    struct MigrationStep
+    {
+        int fromVersion;
+        bool (*migrate)(QSqlDatabase db, const QString &fromTable, const QString &toTable, MigrationProgress &progress, QString &error);
+    };
+    static bool MigrateAlpha1ToAlpha2(QSqlDatabase db, const QString &fromTable, const QString &toTable,
+                                      MigrationProgress &progress, QString &error);
+    static bool CopyRows(QSqlDatabase db, const QString &fromTable, const QString &toTable, const QString &insertColumns,
+                         const QString &selectColumns, MigrationProgress &progress, QString &error);
+    static bool ReportProgress(MigrationProgress &progress, qint64 done, qint64 total);
+    static bool WasCanceled(const MigrationProgress &progress);
+    static bool BuildIndexes(QSqlDatabase db, const QString &tableName, QString &error);
     static QString ExtractDatabaseVersion(QSqlDatabase db);
     //static bool RenameSQLTable(QString oldName, QString newName);
     static int compatibleVersion;
     static int dbVersion;
     static QString releaseDescription;
+    static QAtomicInt searchIndexAvailable; //Set by whichever thread built or found the index.
+    static QAtomicInt searchIndexCancelled;
+    static QString databaseFile;
+    static QString journalMode;
+    static QString lastErrorMessage;
 };
 
 #endif // DATABASESUPPORT_H
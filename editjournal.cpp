@@ -0,0 +1,163 @@
+#include "editjournal.h"
+#include "databasesupport.h"
+#include "tracer.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+
+EditJournal::EditJournal(const QString &tableName, const QString &journalFileName, QObject *parent) :
+    QObject(parent), table(tableName), journal(journalFileName), transactions(0)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(EDIT_JOURNAL_FLUSH_DELAY_MS);
+    connect(&flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+EditJournal::~EditJournal()
+{
+    if (!flush())
+        qDebug("Edits left in the journal for the next start: %s", qPrintable(lastError));
+}
+
+/* Writes what a previous run left in the journal to the database. Lines
+ * that cannot be read (the last one may have been cut short by a crash)
+ * and columns the table does not have are skipped.
+ */
+bool EditJournal::recover()
+{
+    TraceSpan span("EditJournal::recover");
+    if (!journal.exists())
+        return true;
+    if (!journal.open(QIODevice::ReadOnly)) {
+        lastError = journal.errorString();
+        return false;
+    }
+    QSqlRecord columns = DatabaseSupport::Connection().record(table);
+    int lines = 0;
+    while (!journal.atEnd()) {
+        QJsonObject line = QJsonDocument::fromJson(journal.readLine()).object();
+        if (!line.contains("rowid"))
+            continue;
+        qint64 rowId = qint64(line.value("rowid").toDouble());
+        QVariantMap &row = pending[rowId];
+        for (QJsonObject::const_iterator i = line.constBegin(); i != line.constEnd(); ++i) {
+            if (i.key() == "rowid" || !columns.contains(i.key()))
+                continue;
+            row.insert(i.key(), i.value().isNull() ? QVariant(QVariant::String) : i.value().toVariant());
+        }
+        ++lines;
+    }
+    journal.close();
+
+    if (pending.isEmpty())
+        return Clear();
+    span.setValue(lines);
+    return flush();
+}
+
+/* Keeps the edit of one row. If it cannot be journalled, nothing is kept
+ * and false is returned, so the caller can write the row straight away.
+ */
+bool EditJournal::record(qint64 rowId, const QSqlRecord &values)
+{
+    QVariantMap columns;
+    for (int i = 0; i < values.count(); ++i) {
+        if (values.isGenerated(i) && values.fieldName(i) != "rowid")
+            columns.insert(values.fieldName(i), values.value(i));
+    }
+    if (columns.isEmpty())
+        return true;
+    if (!Append(rowId, columns))
+        return false;
+
+    QVariantMap &row = pending[rowId];
+    for (QVariantMap::const_iterator i = columns.constBegin(); i != columns.constEnd(); ++i)
+        row.insert(i.key(), i.value());
+    if (!flushTimer.isActive())
+        flushTimer.start(); //Not restarted by later edits, so none waits much longer than the delay.
+    return true;
+}
+
+/* Writes every pending row in one transaction and empties the journal. On
+ * failure everything stays pending and is tried again on the next flush.
+ */
+bool EditJournal::flush()
+{
+    flushTimer.stop();
+    if (pending.isEmpty())
+        return true;
+    TraceSpan span("EditJournal::flush");
+    span.setValue(pending.size());
+
+    QSqlDatabase db = DatabaseSupport::Connection();
+    if (!db.transaction()) {
+        //Most likely another transaction is open on this connection; it is not ours to join.
+        lastError = db.lastError().text();
+        flushTimer.start();
+        return false;
+    }
+    QSqlDriver *driver = db.driver();
+    QString tableName = driver->escapeIdentifier(table, QSqlDriver::TableName);
+    for (QMap<qint64, QVariantMap>::const_iterator row = pending.constBegin(); row != pending.constEnd(); ++row) {
+        QStringList assignments;
+        foreach (const QString &column, row.value().keys())
+            assignments << driver->escapeIdentifier(column, QSqlDriver::FieldName) + " = ?";
+        //The same few column sets come up again and again, so the statements are worth keeping prepared.
+        QSqlQuery query = DatabaseSupport::PreparedQuery("UPDATE " + tableName + " SET " + assignments.join(", ") + " WHERE rowid = ?;");
+        int position = 0;
+        foreach (const QVariant &value, row.value())
+            query.bindValue(position++, value);
+        query.bindValue(position, row.key());
+        if (!query.exec()) {
+            lastError = query.lastError().text();
+            query.finish();
+            db.rollback();
+            return false;
+        }
+        query.finish();
+    }
+    if (!db.commit()) {
+        lastError = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    pending.clear();
+    ++transactions;
+    return Clear();
+}
+
+bool EditJournal::Append(qint64 rowId, const QVariantMap &columns)
+{
+    if (!journal.isOpen() && !journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        lastError = journal.errorString();
+        return false;
+    }
+    QJsonObject line;
+    line.insert("rowid", double(rowId));
+    for (QVariantMap::const_iterator i = columns.constBegin(); i != columns.constEnd(); ++i) {
+        const QVariant &value = i.value();
+        if (value.isNull())
+            line.insert(i.key(), QJsonValue());
+        else if (value.type() == QVariant::Date)
+            line.insert(i.key(), value.toDate().toString(Qt::ISODate)); //As the SQLite driver stores it.
+        else
+            line.insert(i.key(), QJsonValue::fromVariant(value));
+    }
+    if (journal.write(QJsonDocument(line).toJson(QJsonDocument::Compact) + '\n') < 0 || !journal.flush()) {
+        lastError = journal.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool EditJournal::Clear()
+{
+    if (journal.isOpen())
+        return journal.resize(0);
+    return !journal.exists() || journal.remove();
+}
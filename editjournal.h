@@ -0,0 +1,57 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QMap>
+#include <QTimer>
+#include <QVariantMap>
+#include <QSqlRecord>
+
+#define EDIT_JOURNAL_FILE_NAME "Edits.journal" //In the library folder, next to the database.
+#define EDIT_JOURNAL_FLUSH_DELAY_MS 3000
+
+/* Write-behind for edits to the message table. Each edit is appended to a
+ * small journal file (one JSON object per line: the rowid and the changed
+ * columns) and kept in memory; a few seconds after the first one, all rows
+ * edited since are written in one transaction and the journal is emptied.
+ * Stepping through entries in the Edit dialog thus costs one commit (and
+ * one sync of a possibly remote database) per flush rather than per entry.
+ *
+ * If the program dies before a flush, recover() applies what the journal
+ * holds at the next start. Writing a row twice gives the same result, so
+ * a crash between the commit and emptying the journal does no harm. The
+ * journal is flushed to the operating system, not synced to the disk, so it
+ * survives the program crashing but not necessarily a power cut.
+ */
+class EditJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    EditJournal(const QString &tableName, const QString &journalFileName, QObject *parent = 0);
+    ~EditJournal();
+
+    bool recover();
+    bool record(qint64 rowId, const QSqlRecord &values); //Only the generated fields of 'values' are kept.
+    bool isPending(qint64 rowId) const { return pending.contains(rowId); }
+    int pendingRows() const { return pending.size(); }
+    int transactionCount() const { return transactions; } //Flushes that wrote something, since construction.
+    QString errorString() const { return lastError; }
+
+public slots:
+    bool flush();
+
+private:
+    bool Append(qint64 rowId, const QVariantMap &columns);
+    bool Clear();
+
+    QString table;
+    QFile journal;
+    QTimer flushTimer;
+    QMap<qint64, QVariantMap> pending; //By rowid: column name to value.
+    QString lastError;
+    int transactions;
+};
+
+#endif // EDITJOURNAL_H
@@ -6,11 +6,19 @@
 #include <QSqlError>
 
 #include <QDebug> //may remove when debugging is finished.
+#include <QAction>
+#include <QEventLoop>
+#include <QFileInfo>
+
+#include "blobstore.h"
+#include "tracer.h"
+
+#define IMPORT_PROGRESS_RANGE 1000
 
 //
-EditSermon::EditSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, MainWindow *parent, QString id, QPersistentModelIndex *index) :
+EditSermon::EditSermon(QSettings *settings, SermonTableModel *mainWinTableModel, MainWindow *parent, QString id, QPersistentModelIndex *index) :
     QDialog(parent),
-    ui(new Ui::EditSermon), gsettings(settings), sermonTableModel(mainWinTableModel), parentWindow(parent)
+    ui(new Ui::EditSermon), gsettings(settings), sermonTableModel(mainWinTableModel), parentWindow(parent), importProgress(NULL)
 {
     ui->setupUi(this);
     ui->dateEdit->setDate(QDate::currentDate());
@@ -65,17 +73,12 @@ EditSermon::EditSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, M
             break;
         }
     } else {
-        bool foundMatch = false;
-        for (int row = 0; row < sermonTableModel->rowCount(); ++row) {
-            QSqlRecord record = sermonTableModel->record(row);
-            if (record.value(Sermon_ID).toString() != "" && record.value(Sermon_ID).toString() == id) {
-                foundMatch = true;
-                sermonDataMapper->setCurrentIndex(row);
-                break;
-            } else if ((row == sermonTableModel->rowCount() - 1) && !foundMatch) {
-                qDebug("No match found! Initializing table with first entry.");
-                sermonDataMapper->toFirst();
-            }
+        int row = sermonTableModel->rowOfEntry(id);
+        if (row >= 0) {
+            sermonDataMapper->setCurrentIndex(row);
+        } else {
+            qDebug("No match found! Initializing table with first entry.");
+            MoveTo(0, 1);
         }
     }
     UpdateRecordIndexLabel();
@@ -84,6 +87,12 @@ EditSermon::EditSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, M
     connect(ui->pB_Previous, SIGNAL(clicked()), this, SLOT(toPreviousSermon()));
     connect(ui->pB_Next, SIGNAL(clicked()), this, SLOT(toNextSermon()));
     connect(ui->pB_Last, SIGNAL(clicked()), this, SLOT(toLastSermon()));
+
+    //Edits are written in batches (see EditJournal); this writes them at once.
+    QAction *saveAction = new QAction("Save", this);
+    saveAction->setShortcut(QKeySequence::Save);
+    connect(saveAction, SIGNAL(triggered()), this, SLOT(saveNow()));
+    addAction(saveAction);
 }
 
 EditSermon::~EditSermon()
@@ -99,8 +108,8 @@ void EditSermon::toFirstSermon()
     if (!ValidateEntry())
         return; //Dialog missing some data and user opted to continue editing.
 
-    sermonDataMapper->submit();
-    sermonDataMapper->toFirst();
+    SubmitEntry();
+    MoveTo(0, 1);
     UpdateRecordIndexLabel();
 }
 
@@ -109,8 +118,8 @@ void EditSermon::toPreviousSermon()
     if (!ValidateEntry())
         return; //Dialog missing some data and user opted to continue editing.
 
-    sermonDataMapper->submit();
-    sermonDataMapper->toPrevious();
+    SubmitEntry();
+    MoveTo(sermonDataMapper->currentIndex() - 1, -1);
     UpdateRecordIndexLabel();
 }
 
@@ -119,8 +128,8 @@ void EditSermon::toNextSermon()
     if (!ValidateEntry())
         return; //Dialog missing some data and user opted to continue editing.
 
-    sermonDataMapper->submit();
-    sermonDataMapper->toNext();
+    SubmitEntry();
+    MoveTo(sermonDataMapper->currentIndex() + 1, 1);
     UpdateRecordIndexLabel();
 }
 
@@ -129,8 +138,8 @@ void EditSermon::toLastSermon()
     if (!ValidateEntry())
         return; //Dialog missing some data and user opted to continue editing.
 
-    sermonDataMapper->submit();
-    sermonDataMapper->toLast();
+    SubmitEntry();
+    MoveTo(sermonTableModel->rowCount() - 1, -1);
     UpdateRecordIndexLabel();
 }
 
@@ -167,7 +176,7 @@ void EditSermon::on_pB_Add_clicked()
         return; //Dialog missing some data and user opted to continue editing.
 
     int row = sermonDataMapper->currentIndex();
-    sermonDataMapper->submit();
+    SubmitEntry();
     row++;
     sermonTableModel->insertRow(row);
     sermonDataMapper->setCurrentIndex(row);
@@ -201,18 +210,38 @@ void EditSermon::on_pB_Delete_clicked()
 
 void EditSermon::UpdateRecordIndexLabel()
 {
-    ui->recordIndex_lbl->setText(QString("<html><head/><body><p align=center><span style= color:#ff0000;>Record %1 of %2</span></p></body></html>").arg(sermonDataMapper->currentIndex() + 1).arg(sermonTableModel->rowCount()));
+    int current = sermonDataMapper->currentIndex();
+    ui->recordIndex_lbl->setText(QString("<html><head/><body><p align=center><span style= color:#ff0000;>Record %1 of %2</span></p></body></html>")
+                                 .arg(current + 1 - sermonTableModel->removedRowsBefore(current))
+                                 .arg(sermonTableModel->rowCount() - sermonTableModel->removedRowCount()));
     UpdateAudioFileListing();
 }
 
+/* Shows the first entry from 'row' on, going by 'step', that has not been
+ * deleted (deleted entries stay in the table model as blank rows until it
+ * is next selected). Returns false, and stays put, if there is none.
+ */
+bool EditSermon::MoveTo(int row, int step)
+{
+    while (row >= 0 && row < sermonTableModel->rowCount() && sermonTableModel->isRowRemoved(row))
+        row += step;
+    if (row < 0 || row >= sermonTableModel->rowCount())
+        return false;
+    sermonDataMapper->setCurrentIndex(row);
+    return true;
+}
+
 void EditSermon::closeEvent(QCloseEvent *event)
 {
-    if (!ValidateEntry())
+    if (importProgress != NULL)
+        event->ignore(); //Files are being imported; the progress dialog's Cancel stops them.
+    else if (!ValidateEntry())
         event->ignore();
     else {
         //save the current sermonIndex so that we can re-select it in the main window
         //Eventually the second argument will specify which field in the Edit Sermon window was last active.
         parentWindow->SetCurrentModelIndex(new QPersistentModelIndex(sermonTableModel->index(sermonDataMapper->currentIndex(), 1)));
+        FlushEdits();
         event->accept();
     }
 }
@@ -249,7 +278,7 @@ bool EditSermon::ValidateEntry() {
     qDebug("Dialog closing or preparing for a different entry. Saving changes . . .");
 
     int currow = sermonDataMapper->currentIndex();
-    sermonDataMapper->submit();
+    SubmitEntry();
     sermonDataMapper->setCurrentIndex(currow);
 
     //Check to see if UUID has been generated already. If not, make a new one.
@@ -267,20 +296,98 @@ bool EditSermon::ValidateEntry() {
 }
 
 void EditSermon::GenerateNewEntry() {
+    TRACE_SCOPE("EditSermon::GenerateNewEntry");
     qDebug("Creating entry and copying files . . .");
     QString destDir = gsettings->value("paths/databaseLocation", "C:/Audio Message Library").toString();
     QString UUID = QUuid::createUuid().toString();
-    QDir objDestDir(destDir);
-    objDestDir.mkdir(UUID);
-    foreach (const QString &fileName, audioFileNames) {
-        QStringList splitPath = fileName.split("/");
-        QString nameOnly = splitPath.at(splitPath.count() - 1);
-        QFile::copy(fileName, destDir + "/" + UUID + "/" + nameOnly);
+
+    //Copy into a staging folder on worker threads. The entry's own folder only appears once every file has been verified.
+    AudioImporter importer(gsettings->value("import/concurrency", 2).toInt());
+    importProgress = new QProgressDialog("Importing audio files . . .", "Cancel", 0, IMPORT_PROGRESS_RANGE, this);
+    importProgress->setWindowModality(Qt::WindowModal);
+    importProgress->setMinimumDuration(0); //Shown at once, so nothing else in this window can be clicked while the loop below runs.
+    connect(&importer, SIGNAL(progress(qint64,qint64)), this, SLOT(showImportProgress(qint64,qint64)));
+    connect(&importer, SIGNAL(fileProgress(int,qint64,qint64)), this, SLOT(showImportFileProgress(int,qint64,qint64)));
+    connect(importProgress, SIGNAL(canceled()), &importer, SLOT(cancel()));
+
+    //Files the library already holds are only hashed; they are linked in from the store rather than copied again.
+    BlobStore store(destDir);
+    importer.setKnownContent(store.knownContent());
+
+    //The callers go on to another entry or close once this returns, so it waits here. Only the progress dialog takes input meanwhile.
+    QEventLoop waitForImport;
+    connect(&importer, SIGNAL(finished()), &waitForImport, SLOT(quit()));
+    SetControlsEnabled(false);
+    importer.start(audioFileNames, destDir + "/.importing-" + UUID);
+    if (importer.isRunning())
+        waitForImport.exec(); //Keeps the dialogs painting and the Cancel button working while the files copy.
+    delete importProgress;
+    importProgress = NULL;
+    SetControlsEnabled(true);
+
+    if (!importer.succeeded()) {
+        QString reason = importer.errorString();
+        importer.discard();
+        QMessageBox::warning(this, "Audio Import Failed", "The audio files could not be imported:\n" + reason +
+                             "\nThe entry has been saved without them.");
+        return;
     }
 
-    //Write the new UUID back to the database.
-    sermonTableModel->setData(sermonTableModel->index(sermonDataMapper->currentIndex(), Sermon_ID), UUID);
-    sermonTableModel->submit();
+    //Store the files, record them and write the new UUID back to the database, all or nothing.
+    FlushEdits(); //The journal cannot write while our transaction is open.
+    QSqlDatabase db = DatabaseSupport::Connection();
+    db.transaction();
+    QString error;
+    bool saved = store.addEntryFiles(UUID, importer.files(), error);
+    if (saved && !importer.commit(destDir + "/" + UUID)) {
+        error = "The entry folder could not be created.";
+        saved = false;
+    }
+    if (saved) {
+        sermonTableModel->setData(sermonTableModel->index(sermonDataMapper->currentIndex(), Sermon_ID), UUID);
+        saved = sermonTableModel->submit();
+        if (!saved)
+            error = sermonTableModel->lastError().text();
+    }
+    if (saved && !db.commit()) {
+        error = db.lastError().text();
+        saved = false;
+    }
+    if (saved) {
+        parentWindow->GetAttachmentManifest()->reload(UUID);
+    } else {
+        db.rollback();
+        importer.discard(); //Don't leave a folder behind that no entry refers to.
+        store.discardNewBlobs();
+        QMessageBox::warning(this, "Audio Import Failed", "The entry could not be saved: " + error +
+                             "\nPlease contact your support team for assistance.");
+    }
+}
+
+//Every control of the dialog, but not the windows it owns, such as the import's progress dialog.
+void EditSermon::SetControlsEnabled(bool enabled)
+{
+    foreach (QWidget *child, findChildren<QWidget *>(QString(), Qt::FindDirectChildrenOnly)) {
+        if (!child->isWindow())
+            child->setEnabled(enabled);
+    }
+}
+
+void EditSermon::showImportProgress(qint64 bytesCopied, qint64 bytesTotal)
+{
+    if (importProgress != NULL && bytesTotal > 0)
+        importProgress->setValue(int(bytesCopied * IMPORT_PROGRESS_RANGE / bytesTotal));
+}
+
+void EditSermon::showImportFileProgress(int fileIndex, qint64 bytesCopied, qint64 fileSize)
+{
+    AudioImporter *importer = qobject_cast<AudioImporter *>(sender());
+    if (importProgress == NULL || importer == NULL || fileIndex >= audioFileNames.size())
+        return;
+    importProgress->setLabelText(QString("Importing %1 (%2%) . . .\n%3 MB/s")
+                                 .arg(QFileInfo(audioFileNames.at(fileIndex)).fileName())
+                                 .arg(fileSize > 0 ? bytesCopied * 100 / fileSize : 100)
+                                 .arg(importer->bytesPerSecond() / (1024 * 1024), 0, 'f', 1));
 }
 
 void EditSermon::RemoveSermon(bool permanentlyDeleteFiles)
@@ -309,7 +416,7 @@ void EditSermon::RemoveSermon(bool permanentlyDeleteFiles)
             foreach (const QString &fileName, audioFileNames) {
                 QStringList splitPath = fileName.split("/");
                 QString nameOnly = splitPath.at(splitPath.count() - 1);
-                copySuccess = QFile::copy(fileName, thisStorageBinDir + "/" + nameOnly);
+                copySuccess = BlobStore::LinkOrCopy(fileName, thisStorageBinDir + "/" + nameOnly) && copySuccess;
             }
 
             //Show messagebox indicating success or failure of backup procedure.
@@ -326,7 +433,36 @@ void EditSermon::RemoveSermon(bool permanentlyDeleteFiles)
                 return;
             }
         }
-        //Delete the files and their UUID directory.
+        /* Give up the entry's claim on its stored files and delete its row in
+         * one transaction, so that neither can happen without the other. Stored
+         * files no other entry uses are deleted once that is committed.
+         */
+        FlushEdits(); //The journal cannot write while our transaction is open.
+        int row = sermonDataMapper->currentIndex();
+        BlobStore store(sourceDir);
+        QSqlDatabase db = DatabaseSupport::Connection();
+        QString error;
+        db.transaction();
+        bool released = store.releaseEntry(UUID, error);
+        bool rowRemoved = released && sermonTableModel->removeRow(row);
+        if (released && !rowRemoved)
+            error = sermonTableModel->lastError().text();
+        bool committed = rowRemoved && db.commit();
+        if (rowRemoved && !committed)
+            error = db.lastError().text();
+        if (!committed) {
+            db.rollback();
+            if (rowRemoved)
+                sermonTableModel->select(); //The model already shows the row as deleted.
+            else
+                sermonTableModel->revertRow(row);
+            QMessageBox::warning(this, "Audio File Removal Failed",
+                "The entry could not be removed: " + error + "\nPlease contact your support team for further assistance.");
+            return;
+        }
+        parentWindow->GetAttachmentManifest()->forget(UUID);
+
+        //Delete the files and their UUID directory. The stored files only this entry used go afterwards (see BlobStore::removeUnusedBlobs()).
         if (objSourceDir.exists()) {
             if (objSourceDir.removeRecursively())
                 QMessageBox::information(this, "Audio Files Removed",
@@ -335,19 +471,53 @@ void EditSermon::RemoveSermon(bool permanentlyDeleteFiles)
                 QMessageBox::warning(this, "Audio File Removal Failed",
                     "An error occurred attempting to remove the audio files from their internal storage location.\nPlease contact your support team for further assistance.");
         }
+        store.removeUnusedBlobs();
+        ShowEntryAfter(row);
+        return;
     }
 
     //Delete the sermon metadata from the database and refresh the table model.
     RemoveEntry();
 }
 
+//Writes the dialog's fields back to the table (and from there to the database).
+bool EditSermon::SubmitEntry()
+{
+    TRACE_SCOPE("EditSermon::SubmitEntry");
+    return sermonDataMapper->submit();
+}
+
+bool EditSermon::FlushEdits()
+{
+    EditJournal *journal = parentWindow->GetEditJournal();
+    if (journal->flush())
+        return true;
+    QMessageBox::warning(this, "Saving Failed", "Your changes could not be saved to the library yet: " + journal->errorString() +
+                         "\nThey are kept and will be saved on the next try, or the next time the program starts.");
+    return false;
+}
+
+void EditSermon::saveNow()
+{
+    if (importProgress != NULL)
+        return; //The import saves the entry when it is done.
+    SubmitEntry();
+    FlushEdits();
+}
+
 void EditSermon::RemoveEntry()
 {
     int row = sermonDataMapper->currentIndex();
+    FlushEdits(); //Nothing may be left pending for a row that is about to go.
     sermonTableModel->removeRow(row);
-    sermonTableModel->select(); // Added this to pull database changes back into the table model. Previously deleted rows remained as empty entries until the next reload of the window.
-    sermonDataMapper->submit();
-    sermonDataMapper->setCurrentIndex(qMin(row, sermonTableModel->rowCount() - 1));
+    ShowEntryAfter(row);
+}
+
+//The model keeps a deleted row as a blank one, which the main window and MoveTo() skip; no need to read the whole table again.
+void EditSermon::ShowEntryAfter(int removedRow)
+{
+    if (!MoveTo(removedRow, 1))
+        MoveTo(removedRow - 1, -1);
     UpdateRecordIndexLabel();
 }
 
@@ -355,25 +525,12 @@ void EditSermon::UpdateAudioFileListing() {
     audioFileNames.clear(); //Re-set internal list of audio file names for the current entry.
     ui->importAudioFiles_readOnlyEdit->clear();
     if (!sermonTableModel->record(sermonDataMapper->currentIndex()).field(Sermon_ID).isNull()) {
-        //The current database field does contain a valid UUID.
-        QString sourceDir = gsettings->value("paths/databaseLocation", "C:/Audio Message Library").toString();
+        //The current database field does contain a valid UUID. The listing comes from the manifest, not the disk.
         QString UUID = sermonTableModel->record(sermonDataMapper->currentIndex()).value(Sermon_ID).toString();
-        QDir objSourceDir = (sourceDir + "/" + UUID);
-        QString fileName = "";
-        QString fileNamesList = "";
-        audioFileNames = objSourceDir.entryList(QDir::Files, QDir::Name);   //Currently contains only the names.
-        QString newlineChar = "";
-        foreach (const QString &fileName, audioFileNames) {
-            fileNamesList += newlineChar + fileName;
-            if (audioFileNames.count() > 1) {
-                newlineChar = "\n";
-            }
-        }
-        //Add the complete path to the filename for direct file referencing purposes.
-        //Must use a separate for loop here because the foreach loop is read-only!
-        for (int i = 0; i < audioFileNames.count(); i++) {
-            audioFileNames[i].prepend(objSourceDir.path() + "/");
-        }
-        ui->importAudioFiles_readOnlyEdit->setText(fileNamesList);
+        audioFileNames = parentWindow->GetAttachmentManifest()->filePaths(UUID);
+        QStringList fileNames;
+        foreach (const QString &fileName, audioFileNames)
+            fileNames << QFileInfo(fileName).fileName();
+        ui->importAudioFiles_readOnlyEdit->setText(fileNames.join("\n"));
     }
 }
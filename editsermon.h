@@ -12,8 +12,10 @@
 #include <QSqlTableModel>
 #include <QDataWidgetMapper>
 #include <QCloseEvent>
+#include <QProgressDialog>
 
 #include "mainwindow.h" //Includes sermon table enum
+#include "audioimporter.h"
 
 namespace Ui {
 class EditSermon;
@@ -24,7 +26,7 @@ class EditSermon : public QDialog
     Q_OBJECT
 
 public:
-    explicit EditSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, MainWindow *parent = 0, QString id = "", QPersistentModelIndex *index = new QPersistentModelIndex());
+    explicit EditSermon(QSettings *settings, SermonTableModel *mainWinTableModel, MainWindow *parent = 0, QString id = "", QPersistentModelIndex *index = new QPersistentModelIndex());
     ~EditSermon();
 
 private slots:
@@ -46,19 +48,31 @@ private slots:
 
     void closeEvent(QCloseEvent *event);
 
+    void showImportProgress(qint64 bytesCopied, qint64 bytesTotal);
+
+    void showImportFileProgress(int fileIndex, qint64 bytesCopied, qint64 fileSize);
+
+    void saveNow();
+
 private:
     Ui::EditSermon *ui;
     QSettings *gsettings;
     QStringList audioFileNames;
-    QSqlTableModel *sermonTableModel;
+    SermonTableModel *sermonTableModel;
     QDataWidgetMapper *sermonDataMapper;
     MainWindow *parentWindow;
+    QProgressDialog *importProgress;
 
     void UpdateRecordIndexLabel();
+    bool MoveTo(int row, int step);
     bool ValidateEntry();
+    bool SubmitEntry();
+    bool FlushEdits();
     void GenerateNewEntry();
+    void SetControlsEnabled(bool enabled);
     void RemoveSermon(bool permanentlyDeleteFiles);
     void RemoveEntry();
+    void ShowEntryAfter(int removedRow);
     void UpdateAudioFileListing();
 };
 
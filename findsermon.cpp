@@ -6,18 +6,22 @@ FindSermon::FindSermon(SermonSortFilterProxyModel *model, QWidget *parent) :
     ui(new Ui::FindSermon), mainSortFilterModel(model)
 {
     ui->setupUi(this);
+    searchScheduler = new SearchScheduler(mainSortFilterModel, this);
 
     ui->clearSearch_pushButton->setEnabled(false);
     ui->from_dateEdit->setDate(QDate::currentDate().addYears(-5));
     ui->to_dateEdit->setDate(QDate::currentDate());
 
-    connect(ui->title_lineEdit, SIGNAL(textChanged(QString)), this, SLOT(beginSearch()));
-    connect(ui->speaker_lineEdit, SIGNAL(textChanged(QString)), this, SLOT(beginSearch()));
-    connect(ui->location_lineEdit, SIGNAL(textChanged(QString)), this, SLOT(beginSearch()));
-    connect(ui->from_dateEdit, SIGNAL(dateChanged(QDate)), this, SLOT(beginSearch()));
-    connect(ui->to_dateEdit, SIGNAL(dateChanged(QDate)), this, SLOT(beginSearch()));
-    connect(ui->description_lineEdit, SIGNAL(textChanged(QString)), this, SLOT(beginSearch()));
-    connect(ui->caseSensitive_checkBox, SIGNAL(toggled(bool)), this, SLOT(beginSearch()));
+    //Every edit goes through the scheduler, which calls beginSearch once the typing pauses.
+    connect(ui->title_lineEdit, SIGNAL(textChanged(QString)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->speaker_lineEdit, SIGNAL(textChanged(QString)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->location_lineEdit, SIGNAL(textChanged(QString)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->from_dateEdit, SIGNAL(dateChanged(QDate)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->to_dateEdit, SIGNAL(dateChanged(QDate)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->description_lineEdit, SIGNAL(textChanged(QString)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->transcription_lineEdit, SIGNAL(textChanged(QString)), searchScheduler, SLOT(requestSearch()));
+    connect(ui->caseSensitive_checkBox, SIGNAL(toggled(bool)), searchScheduler, SLOT(requestSearch()));
+    connect(searchScheduler, SIGNAL(searchRequested()), this, SLOT(beginSearch()));
 }
 
 FindSermon::~FindSermon()
@@ -28,6 +32,7 @@ FindSermon::~FindSermon()
 
 void FindSermon::closeEvent(QCloseEvent *event)
 {
+    searchScheduler->cancelSearch();
     mainSortFilterModel->resetFilters();
     event->accept();
 }
@@ -39,8 +44,10 @@ void FindSermon::beginSearch()
             ui->location_lineEdit->text() == "" &&
             ui->from_dateEdit->date() == QDate::currentDate().addYears(-5) &&
             ui->to_dateEdit->date() == QDate::currentDate() &&
-            ui->description_lineEdit->text() == "") { //this edit resulted in default values, so we can reset the search.
+            ui->description_lineEdit->text() == "" &&
+            ui->transcription_lineEdit->text() == "") { //this edit resulted in default values, so we can reset the search.
 
+        searchScheduler->cancelSearch();
         mainSortFilterModel->resetFilters();
         ui->clearSearch_pushButton->setEnabled(false);
         return;
@@ -49,15 +56,16 @@ void FindSermon::beginSearch()
     ui->clearSearch_pushButton->setEnabled(true);
     Qt::CaseSensitivity caseSense = ui->caseSensitive_checkBox->isChecked() ? Qt::CaseSensitive : Qt::CaseInsensitive;
 
-    QHash<int, QRegExp> searchHash;
-    searchHash.insert(Sermon_Title, QRegExp(ui->title_lineEdit->text(), caseSense));
-    searchHash.insert(Sermon_Speaker, QRegExp(ui->speaker_lineEdit->text(), caseSense));
-    searchHash.insert(Sermon_Location, QRegExp(ui->location_lineEdit->text(), caseSense));
-    searchHash.insert(Sermon_Description, QRegExp(ui->description_lineEdit->text(), caseSense));
-    mainSortFilterModel->setMultiFilterRegExp(searchHash);
+    QHash<int, QString> searchText;
+    searchText.insert(Sermon_Title, ui->title_lineEdit->text());
+    searchText.insert(Sermon_Speaker, ui->speaker_lineEdit->text());
+    searchText.insert(Sermon_Location, ui->location_lineEdit->text());
+    searchText.insert(Sermon_Description, ui->description_lineEdit->text());
+    searchText.insert(Sermon_Transcription, ui->transcription_lineEdit->text());
 
-    mainSortFilterModel->setFilterMinimumDate(ui->from_dateEdit->date(), false);
-    mainSortFilterModel->setFilterMaximumDate(ui->to_dateEdit->date()); //Only need to invalidate filter once; save some processing
+    //The index is asked on the search's worker thread, not here; the results are handed to the proxy when they are ready.
+    searchScheduler->startSearch(SermonSearchQuery::FromCriteria(searchText, caseSense,
+                                                                 ui->from_dateEdit->date(), ui->to_dateEdit->date()));
 }
 
 void FindSermon::on_clearSearch_pushButton_clicked()
@@ -68,7 +76,9 @@ void FindSermon::on_clearSearch_pushButton_clicked()
     ui->from_dateEdit->setDate(QDate::currentDate().addYears(-5));
     ui->to_dateEdit->setDate(QDate::currentDate());
     ui->description_lineEdit->clear();
+    ui->transcription_lineEdit->clear();
 
+    searchScheduler->cancelSearch();
     mainSortFilterModel->resetFilters();
     ui->clearSearch_pushButton->setEnabled(false);
 }
@@ -5,6 +5,7 @@
 #include <QCloseEvent>
 
 #include "sermonsortfilterproxymodel.h"
+#include "searchscheduler.h"
 
 namespace Ui {
 class FindSermon;
@@ -28,6 +29,7 @@ private slots:
 private:
     Ui::FindSermon *ui;
     SermonSortFilterProxyModel *mainSortFilterModel;
+    SearchScheduler *searchScheduler;
 };
 
 #endif // FINDSERMON_H
@@ -1,12 +1,17 @@
 #include "mainwindow.h"
 #include "databasesupport.h"
+#include "blobstore.h"
+#include "audioscanner.h"
+#include "tracer.h"
 #include <QApplication>
+#include <QTimer>
 
 void InvokeUpdater();
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    Tracer::StartFromEnvironment();
 
     //Create connection to database, abort on error
 
@@ -29,10 +34,24 @@ int main(int argc, char *argv[])
     if (!DatabaseSupport::LoadDatabase())
         return 5;
 
-    MainWindow w;
-    w.showMaximized();
-    
-    return a.exec();
+    DatabaseSupport::InitChangeLog(); //Optional; the main window re-reads the whole table without it.
+
+    if (!BlobStore::InitManifest())
+        return 6;
+
+    AudioScanner::InitCache(); //Optional; entries just go without playing times.
+
+    int result;
+    {
+        MainWindow w;
+        w.showMaximized();
+        if (a.arguments().contains("--benchmark-scroll"))
+            QTimer::singleShot(0, &w, SLOT(benchmarkScrolling()));
+        result = a.exec();
+    }
+
+    DatabaseSupport::ReleaseConnection();
+    return result;
 }
 
 void InvokeUpdater() //Get file location of running EXE in order to find updater binary.
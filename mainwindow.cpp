@@ -5,6 +5,18 @@
 #include "findsermon.h"
 #include "publishsermon.h"
 #include "databasesupport.h"
+#include "sermoncsvimporter.h"
+#include "sermonexporter.h"
+#include "tracer.h"
+
+#include <QScrollBar>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QProgressDialog>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
 
 #define ABOUTTEXT \
     "<i><b>Message Librarian</b> © 2016 - 2019 by Stanley B. Gehman.</i><p>"\
@@ -30,14 +42,67 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->setupUi(this);
     globalSettings = new QSettings("TrueLife Tracks", "Message Librarian", this);
     findwin = NULL;
+    lastScrollPosition = 0;
+
+    //Entry folders are listed from the manifest, so moving between entries does not go to the disk.
+    //It is read in finishStartup(); until then entries are looked up one at a time.
+    attachments = new AttachmentManifest(globalSettings->value("paths/databaseLocation", "C:/Audio Message Library").toString(), this);
+    connect(attachments, SIGNAL(entryChanged(QString)), this, SLOT(attachmentsChanged()));
+
+    //Edits are written in batches; anything a crash kept from being written is applied before the table is read.
+    editJournal = new EditJournal(DatabaseSupport::GetCompatibleDBTableName(), DatabaseSupport::LibraryPath() + "/" EDIT_JOURNAL_FILE_NAME, this);
+    if (!editJournal->recover())
+        QMessageBox::warning(this, "Unsaved Edits", "Edits from the last session could not be saved: " + editJournal->errorString() +
+                             "\nThey are kept and will be tried again next time. If this persists, please contact your support team.");
+
+    //Not in any menu: for support, when something is slow. See Tracer.
+    QAction *traceAction = new QAction("Trace", this);
+    traceAction->setShortcut(QKeySequence("Ctrl+Alt+Shift+T"));
+    connect(traceAction, SIGNAL(triggered()), this, SLOT(toggleTracing()));
+    addAction(traceAction);
+
+    //Playing times are read in finishStartup(), for the files that are new or changed since the last start.
+    audioScanner = new AudioScanner(DatabaseSupport::LibraryPath(), AUDIO_SCAN_THREADS, this);
 
     InitTableModelAndView();
+
+    //Runs once the window is on screen.
+    QTimer::singleShot(0, this, SLOT(finishStartup()));
+}
+
+/* The part of start-up the window does not need in order to be shown:
+ * column widths, going back to the last entry, and everything that reads
+ * the whole library. The attachment manifest, the search index and the
+ * audio files' playing times are read on worker threads, so a large library
+ * on a network share does not keep the window blank. Until they are in,
+ * searches scan the table and entries' files are looked up one at a time.
+ * The catalog is only read once the Find window opens; see SearchScheduler.
+ */
+void MainWindow::finishStartup()
+{
+    TRACE_SCOPE("MainWindow::finishStartup");
+    ui->mainSermonTableView->resizeColumnsToContents();
+    ui->mainSermonTableView->setColumnWidth(Sermon_ID, 130);
+    ui->mainSermonTableView->setColumnWidth(Sermon_Transcription, 130);
+
+    int lastActive = globalSettings->value("metadata/lastActiveSermon", "0").toInt();
+    while (lastActive >= sermonTableModel->rowCount() && sermonTableModel->canFetchMore())
+        sermonTableModel->fetchMore();
+    ui->mainSermonTableView->selectRow(lastActive);
+    on_mainSermonTableView_clicked(sermonTableModel->index(lastActive, 1)); //It is not necessary to know which column, as that is specified later.
+
+    attachments->loadInBackground();
+    QtConcurrent::run(DatabaseSupport::InitSearchIndex); //Optional; searches fall back to a table scan without it.
+    audioScanner->start(); //Lists the files to read on a worker thread as well.
 }
 
 void MainWindow::InitTableModelAndView()
 {
-    sermonTableModel = new QSqlTableModel(this, QSqlDatabase::database());
+    TRACE_SCOPE("MainWindow::InitTableModelAndView");
+    sermonTableModel = new SermonTableModel(this, QSqlDatabase::database());
     sermonTableModel->setTable(DatabaseSupport::GetCompatibleDBTableName());
+    sermonTableModel->setAttachmentManifest(attachments);
+    sermonTableModel->setEditJournal(editJournal);
     sermonTableModel->setSort(Sermon_Date, Qt::AscendingOrder);
     sermonTableModel->select();
 
@@ -53,18 +118,16 @@ void MainWindow::InitTableModelAndView()
     sermonTableModel->setHeaderData(Sermon_Transcription, Qt::Horizontal, "Transcription");
 
     ui->mainSermonTableView->setModel(sortFilterSermonModel);
+    ui->mainSermonTableView->setColumnHidden(Sermon_RowId, true); //Internal key only; never shown to the user.
     ui->mainSermonTableView->setSortingEnabled(true); //Turn sort-by-header-click on.
     ui->mainSermonTableView->horizontalHeader()->setSortIndicator(Sermon_Date, Qt::AscendingOrder); //Specifies the default sort order and column for the table view.
     ui->mainSermonTableView->horizontalHeader()->moveSection(Sermon_ID, Sermon_Description);    //Awsome code!! moves columns around in the table view without changing the order in the sql table itself!
     ui->mainSermonTableView->horizontalHeader()->setSectionResizeMode(Sermon_Title, QHeaderView::Stretch);
-    ui->mainSermonTableView->resizeColumnsToContents();
-    ui->mainSermonTableView->setColumnWidth(Sermon_ID, 130);
-    ui->mainSermonTableView->setColumnWidth(Sermon_Transcription, 130);
+    ui->mainSermonTableView->horizontalHeader()->setResizeContentsPrecision(0); //Size columns by the rows on screen, not by every row fetched so far.
     ui->mainSermonTableView->setItemDelegateForColumn(Sermon_ID, new StatusIndicatorDelegate);  //Invokes our custom state indicator icons for certain data types in our table.
     ui->mainSermonTableView->setItemDelegateForColumn(Sermon_Transcription, new StatusIndicatorDelegate);   //Same here.
 
-    ui->mainSermonTableView->selectRow(globalSettings->value("metadata/lastActiveSermon", "0").toInt());
-    on_mainSermonTableView_clicked(sermonTableModel->index(globalSettings->value("metadata/lastActiveSermon", "0").toInt(), 1)); //It is not necessary to know which column, as that is specified later.
+    connect(ui->mainSermonTableView->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(prefetchSermons(int)));
 
     setCentralWidget(ui->mainSermonTableView);
 }
@@ -80,6 +143,9 @@ void MainWindow::closeEvent(QCloseEvent *event)
 {
     //Save current sermon selection from main table.
     globalSettings->setValue("metadata/lastActiveSermon", ui->mainSermonTableView->currentIndex().row());
+    editJournal->flush(); //If this fails, the edits are still in the journal for the next start.
+    DatabaseSupport::CancelSearchIndexBuild(); //A build cut short carries on at the next start.
+    audioScanner->cancel(); //Writes what was read so far; files still being read are written as the scanner is destroyed.
     event->accept();
 }
 
@@ -102,6 +168,14 @@ void MainWindow::on_actionExit_triggered()
     QCoreApplication::quit();
 }
 
+//Coming back to the window, e.g. from the batch tool or a second copy of the program, picks up what they changed.
+void MainWindow::changeEvent(QEvent *event)
+{
+    if (event->type() == QEvent::ActivationChange && isActiveWindow())
+        sermonTableModel->applyChanges();
+    QMainWindow::changeEvent(event);
+}
+
 void MainWindow::on_actionEdit_triggered()
 {
     //Here we set the ID of the currently selected sermon in MainWindow
@@ -148,18 +222,20 @@ void MainWindow::on_actionSearch_triggered()
 
 void MainWindow::on_actionPublish_triggered()
 {
-    /* Development direction:
-     *  Have a warning dialog pop up if no audio is bound to the entry. Give option to edit sermon where they could add files.
-     *  If audio is available, display a dialog listing the files, with total playback time (to ensure that they will fit on CD.)
-     *  - OR - do we want to do this check before we get this far, i.e. by disabling this action in MenuBar, etc. <- Chosen solution, for the time being
-     */
+    //Everything selected goes, in the order the table shows it.
+    QModelIndexList selected = ui->mainSermonTableView->selectionModel()->selectedRows();
+    std::sort(selected.begin(), selected.end());
+    QList<int> rows;
+    foreach (const QModelIndex &index, selected)
+        rows << sortFilterSermonModel->mapToSource(index).row();
+    if (rows.isEmpty()) {
+        QMessageBox::information(this, "Publish", "Please select the entries to publish first.");
+        return;
+    }
 
-    // Deprecate unfinished feature for alpha release to VIPs.
-    /* ui->mainSermonTableView->selectionModel()->reset();  //Added this to force custom delegates to repaint when they lose focus.
-     * PublishSermon pubwin(globalSettings, sermonTableModel, currentModelIndex, this);
-     * pubwin.exec();
-     */
-    QMessageBox::critical(this, "Not Implemented Yet", NOTIMPLEMENTEDTEXT);
+    ui->mainSermonTableView->selectionModel()->reset();  //Added this to force custom delegates to repaint when they lose focus.
+    PublishSermon pubwin(globalSettings, sermonTableModel, attachments, rows, this);
+    pubwin.exec();
 }
 
 void MainWindow::on_mainSermonTableView_doubleClicked(const QModelIndex &index)
@@ -171,15 +247,192 @@ void MainWindow::on_mainSermonTableView_doubleClicked(const QModelIndex &index)
     newwin.exec();
 }
 
+/* Column names and the date format can be set under "csvImport/" in the
+ * settings (e.g. csvImport/speakerColumn=Preacher, csvImport/dateFormat=d.M.yyyy)
+ * for spreadsheets whose headings are not recognised.
+ */
+void MainWindow::on_actionImportTitles_triggered()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "Import Sermon Titles", globalSettings->value("csvImport/lastFolder").toString(),
+                                                    "CSV files (*.csv);;All files (*)");
+    if (fileName.isEmpty())
+        return;
+    globalSettings->setValue("csvImport/lastFolder", QFileInfo(fileName).absolutePath());
+
+    SermonCsvImporter importer;
+    importer.setDateFormat(globalSettings->value("csvImport/dateFormat", "M/d/yy").toString());
+    const struct { int column; const char *key; } columnSettings[] = {
+        { Sermon_Title, "csvImport/titleColumn" },
+        { Sermon_Speaker, "csvImport/speakerColumn" },
+        { Sermon_Location, "csvImport/locationColumn" },
+        { Sermon_Date, "csvImport/dateColumn" },
+        { Sermon_Description, "csvImport/descriptionColumn" }
+    };
+    for (int i = 0; i < 5; ++i) {
+        QString headerName = globalSettings->value(columnSettings[i].key).toString();
+        if (!headerName.isEmpty())
+            importer.setColumn(columnSettings[i].column, headerName);
+    }
+
+    QProgressDialog progress("Importing sermon titles . . .", "Cancel", 0, CSV_IMPORT_PROGRESS_RANGE, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+    connect(&importer, SIGNAL(progress(int)), &progress, SLOT(setValue(int)));
+    connect(&progress, SIGNAL(canceled()), &importer, SLOT(cancel()));
+
+    bool imported = importer.import(fileName, DatabaseSupport::GetCompatibleDBTableName());
+    progress.reset();
+    sermonTableModel->select();
+
+    if (!imported) {
+        QMessageBox::warning(this, "Import Failed", "The titles could not be imported: " + importer.errorString() +
+                             "\nNo entries were added.");
+    } else if (importer.rowsRejected() > 0) {
+        QMessageBox::information(this, "Import Finished", QString("%1 entries were added. %2 rows could not be imported;\n"
+                                 "they are listed, with the reason, in %3").arg(importer.rowsImported())
+                                 .arg(importer.rowsRejected()).arg(QDir::toNativeSeparators(importer.reportFileName())));
+    } else {
+        QMessageBox::information(this, "Import Finished", QString("%1 entries were added.").arg(importer.rowsImported()));
+    }
+}
+
+/* Exports the whole catalog, or only the current search results while the
+ * search window is open. The columns written can be set with the
+ * "export/columns" setting (e.g. title,speaker,date); "export/includeAttachments"
+ * adds each entry's file listing.
+ */
+void MainWindow::on_actionExport_triggered()
+{
+    QString selectedFilter;
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Catalog", globalSettings->value("export/lastFolder").toString(),
+                                                    "CSV files (*.csv);;JSON Lines files (*.jsonl)", &selectedFilter);
+    if (fileName.isEmpty())
+        return;
+    globalSettings->setValue("export/lastFolder", QFileInfo(fileName).absolutePath());
+    bool json = fileName.endsWith(".jsonl", Qt::CaseInsensitive) || selectedFilter.contains("jsonl");
+
+    SermonExporter exporter;
+    QStringList columnNames = globalSettings->value("export/columns", "title,speaker,location,date,description").toString().split(',');
+    QList<int> columns;
+    foreach (const QString &name, columnNames) {
+        int column = SermonExporter::ColumnNumber(name);
+        if (column >= 0)
+            columns << column;
+    }
+    if (!columns.isEmpty())
+        exporter.setColumns(columns);
+    exporter.setIncludeAttachments(globalSettings->value("export/includeAttachments", true).toBool());
+    if (findwin != NULL && findwin->isVisible())
+        exporter.setQuery(sortFilterSermonModel->appliedSearchQuery());
+
+    QProgressDialog progress("Exporting the catalog . . .", "Cancel", 0, EXPORT_PROGRESS_RANGE, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+    connect(&exporter, SIGNAL(progress(int)), &progress, SLOT(setValue(int)));
+    connect(&progress, SIGNAL(canceled()), &exporter, SLOT(cancel()));
+
+    bool exported = exporter.exportTo(fileName, json ? SermonExporter::JsonLines : SermonExporter::Csv,
+                                      DatabaseSupport::GetCompatibleDBTableName());
+    progress.reset();
+    if (exported)
+        QMessageBox::information(this, "Export Finished", QString("%1 entries were written to %2.")
+                                 .arg(exporter.rowsExported()).arg(QDir::toNativeSeparators(fileName)));
+    else
+        QMessageBox::warning(this, "Export Failed", "The catalog could not be exported: " + exporter.errorString());
+}
+
 void MainWindow::on_mainSermonTableView_clicked(const QModelIndex &index)
 {
     /*
      * enable/disable certain actions based on available data.
      */
 
-    // Disable Publishing if no audio is available.
-    if (sermonTableModel->record(index.row()).field(Sermon_ID).isNull())
+    //The view hands over the proxy's index; the row in the table model may be another one.
+    int row = index.model() == sortFilterSermonModel ? sortFilterSermonModel->mapToSource(index).row() : index.row();
+
+    // Disable Publishing if no audio is available. With several entries selected, the Publish dialog says which have none.
+    if (ui->mainSermonTableView->selectionModel()->selectedRows().size() > 1)
+        ui->actionPublish->setEnabled(true);
+    else if (sermonTableModel->record(row).field(Sermon_ID).isNull())
        ui->actionPublish->setEnabled(false);
     else
-        ui->actionPublish->setEnabled(true);
+        ui->actionPublish->setEnabled(attachments->hasFiles(sermonTableModel->record(row).value(Sermon_ID).toString()));
+}
+
+/* The first press starts tracing; the next one saves what has been recorded
+ * since as a Chrome trace and stops.
+ */
+void MainWindow::toggleTracing()
+{
+    if (!Tracer::IsTracing()) {
+        Tracer::Start();
+        ui->statusBar->showMessage("Tracing. Press Ctrl+Alt+Shift+T again to save the trace.");
+        return;
+    }
+
+    Tracer::Stop();
+    ui->statusBar->clearMessage();
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Trace", QDir::homePath() + "/message-librarian-trace.json",
+                                                    "Chrome trace files (*.json)");
+    if (fileName.isEmpty())
+        return;
+    QString error;
+    if (!Tracer::WriteChromeTrace(fileName, error))
+        QMessageBox::warning(this, "Error", "The trace could not be saved: " + error);
+    else
+        ui->statusBar->showMessage("Trace saved to " + QDir::toNativeSeparators(fileName), 5000);
+}
+
+//Files were added or removed, possibly outside the program; the current entry may have gained or lost its audio.
+void MainWindow::attachmentsChanged()
+{
+    on_mainSermonTableView_clicked(ui->mainSermonTableView->currentIndex());
+}
+
+/* The model only pulls rows from the database as the view scrolls down to
+ * them. Ask for the next batch a couple of pages early, so scrolling on does
+ * not stall at the end of what has been fetched.
+ */
+void MainWindow::prefetchSermons(int scrollPosition)
+{
+    QScrollBar *scrollBar = ui->mainSermonTableView->verticalScrollBar();
+    bool scrollingDown = scrollPosition > lastScrollPosition;
+    lastScrollPosition = scrollPosition;
+
+    if (scrollingDown && scrollPosition >= scrollBar->maximum() - 2 * scrollBar->pageStep()
+            && sortFilterSermonModel->canFetchMore(QModelIndex()))
+        sortFilterSermonModel->fetchMore(QModelIndex());
+}
+
+/* Scrolls the table from top to bottom, three rows (one wheel step) at a
+ * time, repainting after each step, and logs the frame rate. Started with
+ * --benchmark-scroll; run it on a large library to compare painting changes.
+ * Rows are fetched as the scrolling reaches them (prefetchSermons()), as they
+ * are for the user, so the time spent fetching is part of the measurement.
+ */
+void MainWindow::benchmarkScrolling()
+{
+    QScrollBar *scrollBar = ui->mainSermonTableView->verticalScrollBar();
+    QElapsedTimer timer;
+    timer.start();
+    int frames = 0;
+    int position = 0;
+    for (;;) {
+        if (position > scrollBar->maximum()) {
+            ui->mainSermonTableView->doItemsLayout(); //Fetched rows only extend the scroll range once the view lays them out.
+            if (position > scrollBar->maximum()) {
+                if (!sortFilterSermonModel->canFetchMore(QModelIndex()))
+                    break;
+                sortFilterSermonModel->fetchMore(QModelIndex());
+                continue;
+            }
+        }
+        scrollBar->setValue(position);
+        ui->mainSermonTableView->viewport()->repaint();
+        ++frames;
+        position += 3 * scrollBar->singleStep();
+    }
+    qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    qDebug("Scroll benchmark: %d rows, %d frames in %lld ms, %.1f frames/s.",
+           sortFilterSermonModel->rowCount(), frames, elapsed, frames * 1000.0 / elapsed);
 }
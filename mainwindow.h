@@ -9,6 +9,10 @@
 #include "statusindicatordelegate.h"
 #include "findsermon.h"
 #include "sermonsortfilterproxymodel.h"
+#include "sermontablemodel.h"
+#include "attachmentmanifest.h"
+#include "editjournal.h"
+#include "audioscanner.h"
 
 namespace Ui {
 class MainWindow;
@@ -22,8 +26,18 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
     void SetCurrentModelIndex(QPersistentModelIndex *index);
+    AttachmentManifest *GetAttachmentManifest() const { return attachments; }
+    EditJournal *GetEditJournal() const { return editJournal; }
+
+public slots:
+    void benchmarkScrolling();
     
+protected:
+    void changeEvent(QEvent *event) Q_DECL_OVERRIDE;
+
 private slots:
+    void finishStartup();
+
     void on_actionAbout_triggered();
 
     void on_actionExit_triggered();
@@ -42,21 +56,35 @@ private slots:
 
     void on_actionPublish_triggered();
 
+    void on_actionImportTitles_triggered();
+
+    void on_actionExport_triggered();
+
     void on_mainSermonTableView_doubleClicked(const QModelIndex &index);
 
     void closeEvent(QCloseEvent *event);
 
     void on_mainSermonTableView_clicked(const QModelIndex &index);
 
+    void prefetchSermons(int scrollPosition);
+
+    void attachmentsChanged();
+
+    void toggleTracing();
+
 private:
     void InitTableModelAndView();
 
     Ui::MainWindow *ui;
     QSettings *globalSettings;
-    QSqlTableModel *sermonTableModel;
+    SermonTableModel *sermonTableModel;
     QPersistentModelIndex *currentModelIndex;
     SermonSortFilterProxyModel *sortFilterSermonModel;
     FindSermon *findwin;
+    AttachmentManifest *attachments;
+    EditJournal *editJournal;
+    AudioScanner *audioScanner;
+    int lastScrollPosition;
 };
 
 #endif // MAINWINDOW_H
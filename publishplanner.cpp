@@ -0,0 +1,148 @@
+#include "publishplanner.h"
+#include "databasesupport.h"
+#include "audiometadata.h"
+#include "audioscanner.h"
+#include "tracer.h"
+
+#include <QHash>
+#include <QRegExp>
+#include <QSqlQuery>
+
+#include <algorithm>
+
+#define FOLDER_NAME_MAX_LENGTH 80 //Leaves room for the file names under the 255 or so characters older burners allow.
+
+/* Fills in the playing time of every file from what AudioScanner recorded.
+ * Files it has not got to yet (it runs in the background after start-up)
+ * are read here; only their headers are read, so that is quick too. A file
+ * that cannot be read but is named like audio stays audio, without a
+ * playing time, so the plan reports it rather than leaving it off a CD.
+ */
+void PublishPlanner::ReadDurations(QVector<PublishItem> &items)
+{
+    TraceSpan span("PublishPlanner::ReadDurations");
+    span.setValue(items.size());
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT file_name, format, duration_ms FROM " AUDIO_TABLE " WHERE entry_id = ?;");
+    for (int i = 0; i < items.size(); ++i) {
+        PublishItem &item = items[i];
+        QHash<QString, QPair<bool, qint64> > recorded; //By file name: whether it is audio, and its playing time.
+        query.bindValue(0, item.entryId);
+        if (query.exec()) {
+            while (query.next())
+                recorded.insert(query.value(0).toString(), qMakePair(!query.value(1).toString().isEmpty(),
+                                                                      query.value(2).isNull() ? qint64(-1) : query.value(2).toLongLong()));
+        }
+        query.finish();
+
+        for (int f = 0; f < item.files.size(); ++f) {
+            PublishFile &file = item.files[f];
+            QHash<QString, QPair<bool, qint64> >::const_iterator known = recorded.constFind(file.name);
+            if (known != recorded.constEnd()) {
+                file.audio = known.value().first;
+                file.durationMs = known.value().second;
+            } else {
+                AudioInfo info;
+                QString error;
+                file.audio = AudioMetadata::Read(file.path, info, error);
+                file.durationMs = file.audio ? info.durationMs : -1;
+            }
+            file.audio = file.audio || AudioMetadata::IsAudioFileName(file.name);
+        }
+    }
+}
+
+bool PublishPlanner::IsPublished(const PublishFile &file, const PublishTarget &target)
+{
+    return target.kind == PublishTarget::UsbDrive || file.audio;
+}
+
+//What the item takes up on the target. False, with the reason, if it cannot be planned at all.
+bool PublishPlanner::Cost(const PublishItem &item, const PublishTarget &target, qint64 &cost, int &tracks, QString &reason)
+{
+    cost = 0;
+    tracks = 0;
+    foreach (const PublishFile &file, item.files) {
+        if (!IsPublished(file, target))
+            continue;
+        if (target.kind == PublishTarget::UsbDrive) {
+            cost += (file.size + USB_CLUSTER_BYTES - 1) / USB_CLUSTER_BYTES * USB_CLUSTER_BYTES;
+        } else if (file.durationMs < 0) {
+            reason = "the playing time of " + file.name + " is not known";
+            return false;
+        } else {
+            cost += file.durationMs + CD_TRACK_GAP_MS;
+        }
+        ++tracks;
+    }
+
+    if (tracks == 0) {
+        reason = target.kind == PublishTarget::AudioCd ? "it has no audio files" : "it has no files";
+        return false;
+    }
+    if (cost > target.capacity || (target.kind == PublishTarget::AudioCd && tracks > CD_MAX_TRACKS)) {
+        reason = target.kind == PublishTarget::AudioCd ? "it does not fit on one CD" : "it does not fit on one drive";
+        return false;
+    }
+    return true;
+}
+
+PublishPlan PublishPlanner::Plan(const QVector<PublishItem> &items, const PublishTarget &target)
+{
+    TraceSpan span("PublishPlanner::Plan");
+    span.setValue(items.size());
+    PublishPlan plan;
+    plan.target = target;
+
+    QVector<qint64> costs(items.size());
+    QVector<int> tracks(items.size());
+    QVector<QPair<qint64, int> > order; //Negated cost and index, so sorting puts the largest first and keeps ties in order.
+    for (int i = 0; i < items.size(); ++i) {
+        QString reason;
+        if (Cost(items.at(i), target, costs[i], tracks[i], reason))
+            order << qMakePair(-costs.at(i), i);
+        else
+            plan.unplaced << qMakePair(i, reason);
+    }
+    std::sort(order.begin(), order.end());
+
+    for (int n = 0; n < order.size(); ++n) {
+        int i = order.at(n).second;
+        int volume = 0;
+        for (; volume < plan.volumes.size(); ++volume) {
+            const PublishVolume &candidate = plan.volumes.at(volume);
+            if (candidate.used + costs.at(i) <= target.capacity &&
+                    (target.kind != PublishTarget::AudioCd || candidate.tracks + tracks.at(i) <= CD_MAX_TRACKS))
+                break;
+        }
+        if (volume == plan.volumes.size())
+            plan.volumes.append(PublishVolume());
+        PublishVolume &chosen = plan.volumes[volume];
+        chosen.items << i;
+        chosen.used += costs.at(i);
+        chosen.tracks += tracks.at(i);
+    }
+
+    //On each volume, the entries go in the order they were selected in (usually by date).
+    for (int volume = 0; volume < plan.volumes.size(); ++volume)
+        std::sort(plan.volumes[volume].items.begin(), plan.volumes[volume].items.end());
+    return plan;
+}
+
+QString PublishPlanner::VolumeFolderName(const PublishTarget &target, int volume)
+{
+    return QString(target.kind == PublishTarget::AudioCd ? "CD %1" : "Drive %1").arg(volume + 1, 2, 10, QChar('0'));
+}
+
+//Numbered, so burners and players keep the entries in order.
+QString PublishPlanner::ItemFolderName(const PublishItem &item, int position)
+{
+    QString name = QString("%1 ").arg(position + 1, 2, 10, QChar('0'));
+    if (item.date.isValid())
+        name += item.date.toString(Qt::ISODate) + " ";
+    name += item.title.isEmpty() ? item.entryId : item.title;
+    name.replace(QRegExp("[\\\\/:*?\"<>|\\x0000-\\x001f]"), "_");
+    name = name.left(FOLDER_NAME_MAX_LENGTH).trimmed();
+    while (name.endsWith('.'))
+        name.chop(1); //Windows drops a trailing dot, which would make the name differ from what we created.
+    return name;
+}
@@ -0,0 +1,92 @@
+#ifndef PUBLISHPLANNER_H
+#define PUBLISHPLANNER_H
+
+#include <QString>
+#include <QStringList>
+#include <QDate>
+#include <QList>
+#include <QPair>
+#include <QVector>
+
+#define CD_74_MINUTES_MS (74 * 60 * 1000)
+#define CD_80_MINUTES_MS (80 * 60 * 1000)
+#define CD_TRACK_GAP_MS 2000 //The pause a burner puts before each track.
+#define CD_MAX_TRACKS 99
+#define USB_CLUSTER_BYTES (32 * 1024) //exFAT's default for drives up to 32 GB; every file takes whole clusters.
+
+//One file of an entry, with its playing time if it is audio.
+struct PublishFile
+{
+    PublishFile() : size(0), durationMs(-1), audio(false) {}
+
+    QString path;
+    QString name;
+    qint64 size;
+    qint64 durationMs; //-1 if not known, also for audio whose headers could not be read.
+    bool audio; //False for files that are not audio, e.g. a PDF of the notes.
+};
+
+//One entry to publish, with the files that go along with it.
+struct PublishItem
+{
+    QString entryId;
+    QString title;
+    QDate date;
+    QVector<PublishFile> files;
+};
+
+//What the entries are put onto. Audio CDs are filled by playing time, drives by size.
+struct PublishTarget
+{
+    enum Kind { AudioCd, UsbDrive };
+
+    PublishTarget(Kind targetKind = AudioCd, qint64 targetCapacity = CD_80_MINUTES_MS) :
+        kind(targetKind), capacity(targetCapacity) {}
+
+    Kind kind;
+    qint64 capacity; //Milliseconds for a CD, bytes for a drive.
+};
+
+//One CD or drive of a plan: which items go on it, in the order they were given, and how full it is.
+struct PublishVolume
+{
+    PublishVolume() : used(0), tracks(0) {}
+
+    QList<int> items;
+    qint64 used; //In the target's unit.
+    int tracks;
+};
+
+struct PublishPlan
+{
+    PublishTarget target;
+    QVector<PublishVolume> volumes;
+    QList<QPair<int, QString> > unplaced; //Items that could not be planned, and why.
+};
+
+/* Lays a selection of entries out onto as few CDs or drives as it can.
+ * An entry is never split over two volumes. The packing is first fit
+ * decreasing: the largest entries are placed first, each on the first
+ * volume with room, which is quick for thousands of entries and in
+ * practice rarely more than a volume off the best possible layout.
+ *
+ * On a CD each audio file is a track and takes its playing time plus the
+ * pause before it; other files are left off. On a drive every file takes
+ * its size rounded up to whole clusters.
+ */
+class PublishPlanner
+{
+public:
+    static void ReadDurations(QVector<PublishItem> &items);
+    static PublishPlan Plan(const QVector<PublishItem> &items, const PublishTarget &target);
+
+    static bool IsPublished(const PublishFile &file, const PublishTarget &target);
+    static bool Cost(const PublishItem &item, const PublishTarget &target, qint64 &cost, int &tracks, QString &reason);
+    static QString VolumeFolderName(const PublishTarget &target, int volume);
+    static QString ItemFolderName(const PublishItem &item, int position);
+
+private:
+    PublishPlanner();
+};
+
+#endif // PUBLISHPLANNER_H
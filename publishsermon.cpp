@@ -1,14 +1,293 @@
 #include "publishsermon.h"
 #include "ui_publishsermon.h"
+#include "databasesupport.h"
+#include "tracer.h"
+#include "blobstore.h"
 
-PublishSermon::PublishSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, QPersistentModelIndex *index, QWidget *parent) :
+#include <QDateTime>
+#include <QDesktopServices>
+#include <QDir>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QUrl>
+#include <QtConcurrent>
+
+#define STAGE_PROGRESS_RANGE 1000
+#define TARGET_CD_74 0
+#define TARGET_CD_80 1
+#define TARGET_USB 2
+
+#define INFOTEXT(text) \
+    "<html><head/><body><p align=\"center\"><span style=\" font-size:12pt; font-weight:600; color:#0055ff;\">" + (text) + "</span></p></body></html>"
+
+static QString FormatDuration(qint64 ms)
+{
+    qint64 seconds = ms / 1000;
+    if (seconds >= 3600)
+        return QString("%1:%2:%3").arg(seconds / 3600).arg(seconds / 60 % 60, 2, 10, QChar('0')).arg(seconds % 60, 2, 10, QChar('0'));
+    return QString("%1:%2").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+}
+
+static QString FormatMegabytes(qint64 bytes)
+{
+    return QString("%L1 MB").arg((bytes + 999999) / 1000000); //Decimal, as drives are sold.
+}
+
+//Runs on a worker thread: files the audio scan has not timed yet are read here.
+static QVector<PublishItem> ReadDurationsOnWorker(QVector<PublishItem> items)
+{
+    PublishPlanner::ReadDurations(items);
+    return items;
+}
+
+PublishSermon::PublishSermon(QSettings *settings, SermonTableModel *mainWinTableModel, AttachmentManifest *manifest, const QList<int> &rows, QWidget *parent) :
     QDialog(parent),
-    ui(new Ui::PublishSermon)
+    ui(new Ui::PublishSermon),
+    gsettings(settings),
+    stager(NULL),
+    closeWhenStaged(false)
 {
     ui->setupUi(this);
+    TRACE_SCOPE("PublishSermon::PublishSermon");
+
+    foreach (int row, rows) {
+        QSqlRecord record = mainWinTableModel->record(row);
+        PublishItem item;
+        item.entryId = record.value(Sermon_ID).toString();
+        item.title = record.value(Sermon_Title).toString();
+        item.date = record.value(Sermon_Date).toDate();
+        if (!item.entryId.isEmpty()) {
+            //Both come from the manifest's listing, in the same order. An entry the manifest has not listed yet is listed from its folder.
+            QVector<AttachmentFile> listing = manifest->files(item.entryId);
+            QStringList paths = manifest->filePaths(item.entryId);
+            for (int i = 0; i < listing.size() && i < paths.size(); ++i) {
+                PublishFile file;
+                file.path = paths.at(i);
+                file.name = listing.at(i).fileName;
+                file.size = listing.at(i).size;
+                item.files.append(file);
+            }
+        }
+        items.append(item);
+    }
+
+    ui->stagingFolder_lineEdit->setText(QDir::toNativeSeparators(
+        gsettings->value("publish/stagingLocation", QDir::homePath() + "/Message Librarian Publish").toString()));
+    ui->usbSize_spinBox->setValue(gsettings->value("publish/usbSizeMB", ui->usbSize_spinBox->value()).toInt());
+    ui->target_comboBox->setCurrentIndex(gsettings->value("publish/target", TARGET_CD_80).toInt());
+    ui->usbSize_spinBox->setVisible(ui->target_comboBox->currentIndex() == TARGET_USB);
+    ui->linkFiles_checkBox->setChecked(gsettings->value("publish/linkFiles", false).toBool());
+    ui->stage_progressBar->setRange(0, STAGE_PROGRESS_RANGE);
+
+    //Planned once the playing times are in; until then there is nothing to stage.
+    connect(&durationWatcher, SIGNAL(finished()), this, SLOT(durationsRead()));
+    durationWatcher.setFuture(QtConcurrent::run(ReadDurationsOnWorker, items));
+    UpdatePlan();
 }
 
 PublishSermon::~PublishSermon()
 {
+    durationWatcher.waitForFinished();
+    delete stager; //Waits for its workers, if a close got past reject().
     delete ui;
 }
+
+//While staging, closing the dialog cancels; it closes once the workers have stopped.
+void PublishSermon::reject()
+{
+    if (stager != NULL) {
+        closeWhenStaged = true;
+        stager->cancel();
+        return;
+    }
+    QDialog::reject();
+}
+
+PublishTarget PublishSermon::SelectedTarget() const
+{
+    switch (ui->target_comboBox->currentIndex()) {
+    case TARGET_CD_74:
+        return PublishTarget(PublishTarget::AudioCd, CD_74_MINUTES_MS);
+    case TARGET_USB:
+        return PublishTarget(PublishTarget::UsbDrive, qint64(ui->usbSize_spinBox->value()) * 1000000);
+    default:
+        return PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS);
+    }
+}
+
+void PublishSermon::on_target_comboBox_currentIndexChanged(int index)
+{
+    ui->usbSize_spinBox->setVisible(index == TARGET_USB);
+    UpdatePlan();
+}
+
+void PublishSermon::on_usbSize_spinBox_valueChanged(int megabytes)
+{
+    Q_UNUSED(megabytes);
+    UpdatePlan();
+}
+
+//Plans again and shows the result: each CD or drive with its entries and files, then what could not be planned.
+void PublishSermon::UpdatePlan()
+{
+    if (durationWatcher.isRunning()) {
+        ui->info_label->setText(INFOTEXT(QString("Reading the playing times . . .")));
+        ui->stage_pushButton->setEnabled(false);
+        return;
+    }
+    plan = PublishPlanner::Plan(items, SelectedTarget());
+    bool cd = plan.target.kind == PublishTarget::AudioCd;
+
+    QStringList lines;
+    qint64 used = 0;
+    for (int volume = 0; volume < plan.volumes.size(); ++volume) {
+        const PublishVolume &contents = plan.volumes.at(volume);
+        used += contents.used;
+        if (cd)
+            lines << QString("%1: %2 of %3, %4 tracks").arg(PublishPlanner::VolumeFolderName(plan.target, volume))
+                     .arg(FormatDuration(contents.used)).arg(FormatDuration(plan.target.capacity)).arg(contents.tracks);
+        else
+            lines << QString("%1: %2 of %3, %4 files").arg(PublishPlanner::VolumeFolderName(plan.target, volume))
+                     .arg(FormatMegabytes(contents.used)).arg(FormatMegabytes(plan.target.capacity)).arg(contents.tracks);
+        foreach (int i, contents.items) {
+            const PublishItem &item = items.at(i);
+            qint64 cost;
+            int tracks;
+            QString reason;
+            PublishPlanner::Cost(item, plan.target, cost, tracks, reason);
+            lines << QString("    %1  %2  (%3)").arg(item.date.toString(Qt::ISODate)).arg(item.title)
+                     .arg(cd ? FormatDuration(cost) : FormatMegabytes(cost));
+            foreach (const PublishFile &file, item.files) {
+                if (PublishPlanner::IsPublished(file, plan.target))
+                    lines << "        " + file.name;
+            }
+        }
+        lines << QString();
+    }
+    if (!plan.unplaced.isEmpty()) {
+        lines << "Not included:";
+        for (int i = 0; i < plan.unplaced.size(); ++i) {
+            const PublishItem &item = items.at(plan.unplaced.at(i).first);
+            lines << QString("    %1  %2: %3").arg(item.date.toString(Qt::ISODate)).arg(item.title).arg(plan.unplaced.at(i).second);
+        }
+    }
+    ui->audioFilesList_readonlyEdit->setPlainText(lines.join("\n"));
+
+    QString volumes = cd ? (plan.volumes.size() == 1 ? QString("one CD") : QString("%1 CDs").arg(plan.volumes.size()))
+                         : (plan.volumes.size() == 1 ? QString("one drive") : QString("%1 drives").arg(plan.volumes.size()));
+    if (plan.volumes.isEmpty())
+        ui->info_label->setText(INFOTEXT(QString("There is nothing to publish.")));
+    else
+        ui->info_label->setText(INFOTEXT(QString(cd ? "These files will be burned to %1." : "These files will be copied to %1.").arg(volumes)));
+
+    //Whole minutes or megabytes; what is used is rounded up, so the two never add up to more than there is.
+    qint64 unit = cd ? 60000 : 1000000;
+    qint64 capacity = plan.volumes.size() * plan.target.capacity;
+    ui->usedSpace_lcdNumber->display(int((used + unit - 1) / unit));
+    ui->availableSpace_lcdNumber->display(int((capacity - used) / unit));
+    ui->spaceUnit_label->setText(cd ? "minutes" : "MB");
+    ui->stage_pushButton->setEnabled(!plan.volumes.isEmpty());
+}
+
+void PublishSermon::durationsRead()
+{
+    items = durationWatcher.result();
+    UpdatePlan();
+}
+
+void PublishSermon::on_browse_pushButton_clicked()
+{
+    QString folder = QFileDialog::getExistingDirectory(this, "Staging Folder", ui->stagingFolder_lineEdit->text());
+    if (!folder.isEmpty())
+        ui->stagingFolder_lineEdit->setText(QDir::toNativeSeparators(folder));
+}
+
+//Doubles as Cancel while staging.
+void PublishSermon::on_stage_pushButton_clicked()
+{
+    if (stager != NULL) {
+        stager->cancel();
+        return;
+    }
+    QString root = QDir::fromNativeSeparators(ui->stagingFolder_lineEdit->text().trimmed());
+    if (root.isEmpty()) {
+        QMessageBox::warning(this, "Staging Folder", "Please choose a folder to stage the files in.");
+        return;
+    }
+    gsettings->setValue("publish/stagingLocation", root);
+    gsettings->setValue("publish/target", ui->target_comboBox->currentIndex());
+    gsettings->setValue("publish/usbSizeMB", ui->usbSize_spinBox->value());
+    gsettings->setValue("publish/linkFiles", ui->linkFiles_checkBox->isChecked());
+
+    //A new folder for each run, so nothing staged before is overwritten or mixed in.
+    stagingDir = root + "/" + QDateTime::currentDateTime().toString("yyyy-MM-dd hh.mm.ss");
+    stager = new PublishStager(gsettings->value("publish/concurrency", PUBLISH_STAGE_THREADS).toInt(), this);
+    connect(stager, SIGNAL(progress(qint64,qint64)), this, SLOT(showStageProgress(qint64,qint64)));
+    connect(stager, SIGNAL(finished()), this, SLOT(stagingFinished()));
+    stager->setLinking(ui->linkFiles_checkBox->isChecked());
+    SetStaging(true);
+    if (!stager->start(items, plan, stagingDir)) {
+        QString reason = stager->errorString();
+        delete stager;
+        stager = NULL;
+        SetStaging(false);
+        QDir(stagingDir).removeRecursively();
+        QMessageBox::warning(this, "Staging Failed", "The files could not be staged:\n" + reason);
+    }
+}
+
+void PublishSermon::showStageProgress(qint64 bytesDone, qint64 bytesTotal)
+{
+    if (stager == NULL || bytesTotal <= 0)
+        return;
+    ui->stage_progressBar->setValue(int(bytesDone * STAGE_PROGRESS_RANGE / bytesTotal));
+    ui->throughput_label->setText(QString("%1 of %2 staged, copying at %3 MB/s")
+                                  .arg(FormatMegabytes(bytesDone)).arg(FormatMegabytes(bytesTotal))
+                                  .arg(stager->bytesPerSecond() / (1024 * 1024), 0, 'f', 1));
+}
+
+void PublishSermon::stagingFinished()
+{
+    PublishStager *finished = stager;
+    stager = NULL;
+    finished->deleteLater();
+    SetStaging(false);
+
+    if (finished->succeeded()) {
+        ui->stage_progressBar->setValue(STAGE_PROGRESS_RANGE);
+        ui->throughput_label->setText(QString("%1 files staged, %2 of them linked").arg(finished->files().size()).arg(finished->linkedCount()));
+        if (!closeWhenStaged) {
+            QMessageBox::information(this, "Staging Finished", QString("The files are in %1, one folder for each %2.")
+                                     .arg(QDir::toNativeSeparators(stagingDir))
+                                     .arg(plan.target.kind == PublishTarget::AudioCd ? "CD to burn" : "drive to copy"));
+            QDesktopServices::openUrl(QUrl::fromLocalFile(stagingDir));
+        }
+    } else {
+        QString reason = finished->errorString();
+        QDir(stagingDir).removeRecursively(); //Only links and copies; the library's own files are not touched.
+        foreach (const StagedFile &file, finished->files()) {
+            if (file.linked)
+                BlobStore::Protect(file.sourcePath); //Deleting the link may have made it writable (see BlobStore::removeUnusedBlobs()).
+        }
+        ui->stage_progressBar->setValue(0);
+        ui->throughput_label->clear();
+        if (!closeWhenStaged)
+            QMessageBox::warning(this, "Staging Failed", "The files could not be staged:\n" + reason);
+    }
+    if (closeWhenStaged)
+        QDialog::reject();
+}
+
+void PublishSermon::SetStaging(bool staging)
+{
+    ui->target_comboBox->setEnabled(!staging);
+    ui->usbSize_spinBox->setEnabled(!staging);
+    ui->stagingFolder_lineEdit->setEnabled(!staging);
+    ui->browse_pushButton->setEnabled(!staging);
+    ui->linkFiles_checkBox->setEnabled(!staging);
+    ui->stage_pushButton->setText(staging ? "Cancel" : "Stage");
+    if (staging) {
+        ui->stage_progressBar->setValue(0);
+        ui->throughput_label->clear();
+    }
+}
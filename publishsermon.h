@@ -3,22 +3,62 @@
 
 #include <QDialog>
 #include <QSettings>
-#include <QSqlTableModel>
+#include <QFutureWatcher>
+#include <QList>
+#include <QVector>
+
+#include "sermontablemodel.h"
+#include "attachmentmanifest.h"
+#include "publishplanner.h"
+#include "publishstager.h"
 
 namespace Ui {
 class PublishSermon;
 }
 
+/* Lays the entries selected in the main window out onto CDs or drives
+ * (see PublishPlanner), shows how full they will be, and stages the
+ * result as one folder per CD or drive for burning or copying.
+ */
 class PublishSermon : public QDialog
 {
     Q_OBJECT
 
 public:
-    explicit PublishSermon(QSettings *settings, QSqlTableModel *mainWinTableModel, QPersistentModelIndex *index = new QPersistentModelIndex(), QWidget *parent = 0);
+    explicit PublishSermon(QSettings *settings, SermonTableModel *mainWinTableModel, AttachmentManifest *manifest, const QList<int> &rows, QWidget *parent = 0);
     ~PublishSermon();
 
+public slots:
+    void reject() Q_DECL_OVERRIDE;
+
+private slots:
+    void on_target_comboBox_currentIndexChanged(int index);
+
+    void on_usbSize_spinBox_valueChanged(int megabytes);
+
+    void on_browse_pushButton_clicked();
+
+    void on_stage_pushButton_clicked();
+
+    void showStageProgress(qint64 bytesDone, qint64 bytesTotal);
+
+    void stagingFinished();
+
+    void durationsRead();
+
 private:
     Ui::PublishSermon *ui;
+    QSettings *gsettings;
+    QVector<PublishItem> items;
+    QFutureWatcher<QVector<PublishItem> > durationWatcher;
+    PublishPlan plan;
+    PublishStager *stager;
+    QString stagingDir;
+    bool closeWhenStaged;
+
+    PublishTarget SelectedTarget() const;
+    void UpdatePlan();
+    void SetStaging(bool staging);
 };
 
 #endif // PUBLISHSERMON_H
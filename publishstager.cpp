@@ -0,0 +1,261 @@
+#include "publishstager.h"
+#include "blobstore.h"
+#include "tracer.h"
+
+#include <QtConcurrent>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#define STAGE_BUFFER_BYTES (1024 * 1024)
+#define STAGE_CHUNK_BYTES (8 * 1024 * 1024) //Progress is reported after each chunk.
+
+PublishStager::PublishStager(int concurrency, QObject *parent) :
+    QObject(parent), cancelled(0), remaining(0), linking(false), running(false), totalBytes(0), doneBytes(0), copiedBytes(0)
+{
+    pool.setMaxThreadCount(qMax(1, concurrency));
+}
+
+PublishStager::~PublishStager()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+/* Creates the folders of 'plan' under 'stagingDir', which must not exist
+ * yet or be empty, and starts putting the files in; returns at once.
+ * finished() is emitted when every file is done, one way or the other.
+ * False if the folders cannot be created; nothing is started then.
+ */
+bool PublishStager::start(const QVector<PublishItem> &items, const PublishPlan &plan, const QString &stagingDir)
+{
+    TRACE_SCOPE("PublishStager::start");
+    staging = stagingDir;
+    cancelled.store(0);
+    stagedFiles.clear();
+    lastError.clear();
+    totalBytes = 0;
+    doneBytes = 0;
+    copiedBytes = 0;
+
+    QDir root(staging);
+    if (root.exists() && !root.entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty()) {
+        lastError = "The folder " + QDir::toNativeSeparators(staging) + " is not empty.";
+        return false;
+    }
+
+    //The folders are made here, so the workers never race to create the same one.
+    for (int volume = 0; volume < plan.volumes.size(); ++volume) {
+        QString volumeDir = staging + "/" + PublishPlanner::VolumeFolderName(plan.target, volume);
+        const QList<int> &volumeItems = plan.volumes.at(volume).items;
+        for (int position = 0; position < volumeItems.size(); ++position) {
+            const PublishItem &item = items.at(volumeItems.at(position));
+            QString itemDir = volumeDir + "/" + PublishPlanner::ItemFolderName(item, position);
+            if (!QDir().mkpath(itemDir)) {
+                lastError = "Cannot create the folder " + QDir::toNativeSeparators(itemDir) + ".";
+                stagedFiles.clear();
+                return false;
+            }
+            foreach (const PublishFile &source, item.files) {
+                if (!PublishPlanner::IsPublished(source, plan.target))
+                    continue;
+                StagedFile file;
+                file.sourcePath = source.path;
+                file.targetPath = itemDir + "/" + source.name;
+                file.size = source.size;
+                totalBytes += file.size;
+                stagedFiles.append(file);
+            }
+        }
+    }
+    fileBytes.fill(0, stagedFiles.size());
+
+    running = true;
+    remaining.store(stagedFiles.size());
+    timer.start();
+    if (stagedFiles.isEmpty()) {
+        running = false;
+        emit finished();
+        return true;
+    }
+
+    //As in AudioImporter, each worker writes to its own element only.
+    for (int i = 0; i < stagedFiles.size(); ++i)
+        QtConcurrent::run(&pool, StageFile, this, &stagedFiles[i], i);
+    return true;
+}
+
+bool PublishStager::succeeded() const
+{
+    if (running || cancelled.load() || !lastError.isEmpty())
+        return false;
+    foreach (const StagedFile &file, stagedFiles) {
+        if (!file.ok)
+            return false;
+    }
+    return true;
+}
+
+QString PublishStager::errorString() const
+{
+    if (!lastError.isEmpty())
+        return lastError;
+    if (cancelled.load())
+        return "Staging was cancelled.";
+    foreach (const StagedFile &file, stagedFiles) {
+        if (!file.ok)
+            return QFileInfo(file.sourcePath).fileName() + ": " + file.error;
+    }
+    return QString();
+}
+
+int PublishStager::linkedCount() const
+{
+    int linked = 0;
+    foreach (const StagedFile &file, stagedFiles) {
+        if (file.linked)
+            ++linked;
+    }
+    return linked;
+}
+
+double PublishStager::bytesPerSecond() const
+{
+    qint64 msecs = timer.isValid() ? timer.elapsed() : 0;
+    return msecs > 0 ? copiedBytes * 1000.0 / msecs : 0.0;
+}
+
+void PublishStager::cancel()
+{
+    cancelled.store(1);
+}
+
+void PublishStager::updateProgress(int fileIndex, qint64 bytesDone, bool copied)
+{
+    qint64 added = bytesDone - fileBytes.at(fileIndex);
+    fileBytes[fileIndex] = bytesDone;
+    doneBytes += added;
+    if (copied)
+        copiedBytes += added;
+    emit progress(doneBytes, totalBytes);
+}
+
+void PublishStager::fileDone()
+{
+    if (remaining.fetchAndAddOrdered(-1) != 1)
+        return;
+    running = false;
+    Tracer::RecordSince("PublishStager::run", timer, totalBytes);
+    emit finished();
+}
+
+//Runs on a worker thread.
+void PublishStager::StageFile(PublishStager *stager, StagedFile *file, int fileIndex)
+{
+    if (stager->cancelled.load()) {
+        file->error = "Cancelled.";
+    } else {
+        TraceSpan span("PublishStager::StageFile");
+        span.setValue(file->size);
+        if (stager->linking && !QFileInfo(file->sourcePath).isWritable() && BlobStore::Link(file->sourcePath, file->targetPath)) {
+            file->linked = true;
+            file->ok = true;
+            QMetaObject::invokeMethod(stager, "updateProgress", Qt::QueuedConnection,
+                                      Q_ARG(int, fileIndex), Q_ARG(qint64, file->size), Q_ARG(bool, false));
+        } else {
+            QString error;
+            file->ok = CopyContents(stager, *file, fileIndex, error);
+            file->error = error;
+        }
+    }
+    QMetaObject::invokeMethod(stager, "fileDone", Qt::QueuedConnection);
+}
+
+/* Copies the file a chunk at a time, so progress can be shown and a
+ * cancel is noticed. The kernel copies where it can; otherwise, or if the
+ * file systems do not allow it, the data goes through a buffer.
+ */
+bool PublishStager::CopyContents(PublishStager *stager, const StagedFile &file, int fileIndex, QString &error)
+{
+    QFile source(file.sourcePath);
+    if (!source.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        error = source.errorString();
+        return false;
+    }
+    QFile target(file.targetPath);
+    if (!target.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        error = target.errorString();
+        return false;
+    }
+
+    qint64 copied = 0;
+    bool kernelCopy = false;
+#if defined(Q_OS_LINUX) && defined(__NR_copy_file_range)
+    kernelCopy = true;
+#endif
+    QByteArray buffer;
+    for (;;) {
+        if (stager->cancelled.load()) {
+            error = "Cancelled.";
+            return false;
+        }
+        qint64 chunk = 0;
+#if defined(Q_OS_LINUX) && defined(__NR_copy_file_range)
+        if (kernelCopy) {
+            long count = syscall(__NR_copy_file_range, source.handle(), (loff_t *)NULL, target.handle(), (loff_t *)NULL,
+                                 size_t(STAGE_CHUNK_BYTES), 0u);
+            if (count < 0) {
+                //Older kernels, and some pairs of file systems, cannot; as nothing was written yet, copy the usual way.
+                if (copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                    kernelCopy = false;
+                    continue;
+                }
+                error = QString::fromLocal8Bit(strerror(errno));
+                return false;
+            }
+            chunk = count;
+        }
+#endif
+        if (!kernelCopy) {
+            if (buffer.isEmpty())
+                buffer.resize(STAGE_BUFFER_BYTES);
+            while (chunk < STAGE_CHUNK_BYTES) {
+                qint64 count = source.read(buffer.data(), buffer.size());
+                if (count < 0) {
+                    error = source.errorString();
+                    return false;
+                }
+                if (count == 0)
+                    break;
+                if (target.write(buffer.constData(), count) != count) {
+                    error = target.errorString();
+                    return false;
+                }
+                chunk += count;
+            }
+        }
+        if (chunk == 0)
+            break;
+        copied += chunk;
+        QMetaObject::invokeMethod(stager, "updateProgress", Qt::QueuedConnection,
+                                  Q_ARG(int, fileIndex), Q_ARG(qint64, copied), Q_ARG(bool, true));
+    }
+
+    target.close();
+    if (target.error() != QFileDevice::NoError) {
+        error = target.errorString();
+        return false;
+    }
+    if (copied != file.size) {
+        error = "The file changed size while it was being copied.";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef PUBLISHSTAGER_H
+#define PUBLISHSTAGER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "publishplanner.h"
+
+#define PUBLISH_STAGE_THREADS 2
+
+//One file of a staged plan.
+struct StagedFile
+{
+    StagedFile() : size(0), linked(false), ok(false) {}
+
+    QString sourcePath;
+    QString targetPath;
+    qint64 size;
+    bool linked; //A hard link to the library's (read-only) file; nothing was copied.
+    bool ok;
+    QString error;
+};
+
+/* Writes a publish plan out as a folder tree, one folder per CD or drive
+ * and in it one folder per entry, ready to be burned or copied across:
+ *
+ *   <staging folder>/CD 01/01 2019-03-10 Title/<the entry's files>
+ *
+ * Files are copied on worker threads; on Linux the kernel does the copying
+ * (copy_file_range), so the data never passes through the program and
+ * file systems that can share blocks do so. With linking allowed, read-only
+ * files (those of the BlobStore) are hard-linked instead where the staging
+ * folder is on the same drive, which costs neither time nor space. A link
+ * is the library's file itself, so a writable one is still copied: editing
+ * the staged file would change the library.
+ */
+class PublishStager : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PublishStager(int concurrency = PUBLISH_STAGE_THREADS, QObject *parent = 0);
+    ~PublishStager();
+
+    void setLinking(bool allowed) { linking = allowed; } //Off by default.
+
+    bool start(const QVector<PublishItem> &items, const PublishPlan &plan, const QString &stagingDir);
+    bool isRunning() const { return running; }
+    bool succeeded() const;
+    QString errorString() const;
+    QVector<StagedFile> files() const { return stagedFiles; }
+    int linkedCount() const;
+
+    qint64 bytesTotal() const { return totalBytes; }
+    double bytesPerSecond() const; //Of the files copied; links take no time worth counting.
+
+signals:
+    void progress(qint64 bytesDone, qint64 bytesTotal);
+    void finished();
+
+public slots:
+    void cancel();
+
+private slots:
+    void updateProgress(int fileIndex, qint64 bytesDone, bool copied);
+    void fileDone();
+
+private:
+    static void StageFile(PublishStager *stager, StagedFile *file, int fileIndex);
+    static bool CopyContents(PublishStager *stager, const StagedFile &file, int fileIndex, QString &error);
+
+    QThreadPool pool;
+    QVector<StagedFile> stagedFiles;
+    QVector<qint64> fileBytes; //GUI thread's view of each file's progress.
+    QString staging;
+    QString lastError; //Why start() failed.
+    QAtomicInt cancelled;
+    QAtomicInt remaining;
+    bool linking;
+    bool running;
+    qint64 totalBytes;
+    qint64 doneBytes;
+    qint64 copiedBytes;
+    QElapsedTimer timer;
+};
+
+#endif // PUBLISHSTAGER_H
@@ -0,0 +1,292 @@
+#include "searchscheduler.h"
+#include "tracer.h"
+
+#include <QtConcurrent>
+#include <QThread>
+
+#include <limits>
+
+#define SEARCH_DEBOUNCE_MSECS 150
+#define SEARCH_CANCEL_CHECK_ROWS 1024
+#define SEARCH_PARALLEL_MIN_ROWS 20000 //Below this, splitting the work costs more than it saves.
+#define SEARCH_MIN_CHUNK_ROWS 4096
+
+/* Tests one contiguous range of catalog rows and returns a bitmap for just
+ * that range. Several of these run side by side on the global thread pool;
+ * everything they share is read-only.
+ */
+struct SearchChunkEvaluator
+{
+    typedef QBitArray result_type;
+
+    SearchChunkEvaluator(QSharedPointer<const SermonCatalog> rows, const SermonSearchQuery &searchQuery,
+                         const QBitArray &candidateRows, int searchGeneration, QSharedPointer<QAtomicInt> latest) :
+        catalog(rows), query(searchQuery), candidates(candidateRows), generation(searchGeneration), latestGeneration(latest),
+        minimumDay(std::numeric_limits<int>::min()), maximumDay(std::numeric_limits<int>::max())
+    {
+        //Resolve the columns once, so the row loop does no hash lookups.
+        const QHash<int, SermonFilterMatcher> &columnMatchers = query.columnMatchers();
+        QHash<int, SermonFilterMatcher>::const_iterator i;
+        for (i = columnMatchers.constBegin(); i != columnMatchers.constEnd(); ++i) {
+            if (catalog->isTextColumn(i.key())) {
+                textMatchers.append(i.value());
+                textColumns.append(i.key());
+            } else if (catalog->isDictionaryColumn(i.key())) {
+                //Test each distinct speaker/location once; rows then only need a bit lookup.
+                QBitArray hits(catalog->valueCount(i.key()));
+                for (int id = 0; id < hits.size(); ++id)
+                    hits.setBit(id, i.value().matches(catalog->value(i.key(), id)));
+                valueHits.append(hits);
+                valueColumns.append(i.key());
+            }
+        }
+
+        if (query.minimumDate().isValid())
+            minimumDay = query.minimumDate().toJulianDay();
+        if (query.maximumDate().isValid())
+            maximumDay = query.maximumDate().toJulianDay();
+    }
+
+    QBitArray operator()(const QPair<int, int> &range) const
+    {
+        const int first = range.first;
+        const int end = range.second;
+        const bool restricted = !candidates.isEmpty();
+        QBitArray accepted(end - first);
+
+        for (int row = first; row < end; ++row) {
+            if ((row - first) % SEARCH_CANCEL_CHECK_ROWS == 0 && latestGeneration->load() != generation)
+                return QBitArray(); //Stale; the caller notices the generation change as well.
+            if (restricted && !candidates.testBit(row))
+                continue;
+
+            const int day = catalog->julianDay(row);
+            if (day < minimumDay || day > maximumDay)
+                continue;
+            if (!query.acceptsRowId(catalog->rowId(row)))
+                continue;
+
+            bool match = true;
+            for (int v = 0; v < valueColumns.size() && match; ++v)
+                match = valueHits.at(v).testBit(catalog->valueId(valueColumns.at(v), row));
+            for (int m = 0; m < textMatchers.size() && match; ++m)
+                match = textMatchers.at(m).matches(catalog->text(textColumns.at(m), row));
+
+            if (match)
+                accepted.setBit(row - first);
+        }
+        return accepted;
+    }
+
+    QSharedPointer<const SermonCatalog> catalog;
+    SermonSearchQuery query;
+    QBitArray candidates;
+    int generation;
+    QSharedPointer<QAtomicInt> latestGeneration;
+    QVector<SermonFilterMatcher> textMatchers;
+    QVector<int> textColumns;
+    QVector<QBitArray> valueHits;
+    QVector<int> valueColumns;
+    int minimumDay;
+    int maximumDay;
+};
+
+/* Runs on a worker thread. The query's full-text terms are looked up first,
+ * on this thread's own connection. If the query then only narrows the
+ * previous one, just the rows that one accepted need to be tested again.
+ * Only the rows inside the date range are looked at. Large ranges are split
+ * into chunks that are evaluated in parallel; each chunk produces its own
+ * bitmap, and the bitmaps are stitched together in row order, so the result
+ * is identical to a serial scan.
+ */
+static SermonSearchResult EvaluateSearch(SermonCatalogSource source, SermonSearchQuery query,
+                                         SermonSearchBaseline previous, int generation, QSharedPointer<QAtomicInt> latestGeneration)
+{
+    SermonSearchResult result;
+    result.generation = generation;
+    bool answered = query.resolveFullText();
+    result.query = query;
+    if (!answered && query.columnMatchers().contains(Sermon_Transcription) && !source.withTranscriptions) {
+        result.retry = true;
+        return result;
+    }
+
+    QSharedPointer<const SermonCatalog> catalog = source.catalog;
+    if (!catalog && !source.preload.isCanceled()) {
+        source.preload.waitForFinished();
+        catalog = source.preload.result();
+    }
+    if (!catalog)
+        catalog = SermonCatalogProvider::LoadCatalogOnWorker(source.statement, source.withTranscriptions);
+    result.catalog = catalog;
+    if (!catalog || latestGeneration->load() != generation) {
+        result.cancelled = latestGeneration->load() != generation;
+        return result;
+    }
+
+    TraceSpan span("SearchScheduler::EvaluateSearch");
+    result.acceptedRows.resize(catalog->rowCount());
+    QBitArray candidates;
+    if (!previous.rows.isEmpty() && query.narrows(previous.query))
+        candidates = previous.rows;
+
+    const QPair<int, int> range = catalog->rowRange(query.minimumDate(), query.maximumDate());
+    const int rowCount = range.second - range.first;
+    SearchChunkEvaluator evaluator(catalog, query, candidates, generation, latestGeneration);
+
+    QVector<QPair<int, int> > chunks;
+    if (rowCount < SEARCH_PARALLEL_MIN_ROWS) {
+        chunks.append(range);
+    } else {
+        //A few chunks per core, so that a slow chunk (long descriptions, say) does not hold everybody up.
+        const int chunkCount = QThread::idealThreadCount() * 4;
+        const int chunkSize = qMax(SEARCH_MIN_CHUNK_ROWS, (rowCount + chunkCount - 1) / chunkCount);
+        for (int first = range.first; first < range.second; first += chunkSize)
+            chunks.append(qMakePair(first, qMin(first + chunkSize, range.second)));
+    }
+
+    QVector<QBitArray> chunkResults;
+    if (chunks.size() == 1)
+        chunkResults.append(evaluator(chunks.first()));
+    else
+        chunkResults = QtConcurrent::blockingMapped<QVector<QBitArray> >(chunks, evaluator);
+
+    for (int c = 0; c < chunks.size(); ++c) {
+        const QBitArray &bits = chunkResults.at(c);
+        for (int i = 0; i < bits.size(); ++i) {
+            if (bits.testBit(i)) {
+                result.acceptedRows.setBit(chunks.at(c).first + i);
+                result.acceptedRowIds.insert(catalog->rowId(chunks.at(c).first + i));
+            }
+        }
+    }
+
+    result.cancelled = latestGeneration->load() != generation;
+    span.setValue(rowCount);
+    return result;
+}
+
+SearchScheduler::SearchScheduler(SermonSortFilterProxyModel *model, QObject *parent) :
+    QObject(parent), proxyModel(model), catalogProvider(NULL), dispatchedRevision(-1), latestGeneration(new QAtomicInt(0)), generation(0),
+    searchInFlight(false), pendingRequests(0), maxPendingRequests(0), cancellations(0), lastLatency(-1)
+{
+    debounceTimer.setSingleShot(true);
+    debounceTimer.setInterval(SEARCH_DEBOUNCE_MSECS);
+    connect(&debounceTimer, SIGNAL(timeout()), this, SIGNAL(searchRequested()));
+    connect(&resultWatcher, SIGNAL(finished()), this, SLOT(publishResult()));
+
+    //The catalog is read ahead while the first query is typed; see startSearch().
+    SermonTableModel *tableModel = qobject_cast<SermonTableModel *>(proxyModel->sourceModel());
+    if (tableModel) {
+        catalogProvider = new SermonCatalogProvider(tableModel, this);
+        catalogProvider->preloadCatalog();
+    }
+}
+
+SearchScheduler::~SearchScheduler()
+{
+    cancelSearch();
+    resultWatcher.waitForFinished();
+    proxyModel = NULL;
+}
+
+/* Called for every keystroke. The search itself is only requested once
+ * the input has been quiet for SEARCH_DEBOUNCE_MSECS.
+ */
+void SearchScheduler::requestSearch()
+{
+    if (!latencyTimer.isValid())
+        latencyTimer.start();
+    pendingRequests++;
+    maxPendingRequests = qMax(maxPendingRequests, pendingRequests);
+    debounceTimer.start();
+    if (catalogProvider)
+        catalogProvider->preloadCatalog(); //Does nothing if the catalog is current or already being read.
+}
+
+void SearchScheduler::startSearch(const SermonSearchQuery &query)
+{
+    if (!latencyTimer.isValid())
+        latencyTimer.start();
+    if (searchInFlight)
+        cancellations++; //The running search is stale now; it will notice and stop early.
+
+    generation++;
+    latestGeneration->store(generation);
+    pendingRequests = 0;
+
+    if (!catalogProvider) {
+        //Nothing to search in the background; let the proxy do it the slow way.
+        searchInFlight = false;
+        SermonSearchQuery resolved = query;
+        resolved.resolveFullText();
+        proxyModel->setSearchQuery(resolved);
+        latencyTimer.invalidate();
+        emit searchFinished();
+        return;
+    }
+
+    //Transcriptions are only kept in the catalog when a search needs them (i.e. there is no full-text index).
+    SermonCatalogSource source;
+    source.withTranscriptions = query.columnMatchers().contains(Sermon_Transcription);
+    source.catalog = catalogProvider->cachedCatalog(source.withTranscriptions);
+    if (!source.catalog) {
+        source.statement = catalogProvider->prepareCatalogLoad(source.withTranscriptions);
+        if (!source.withTranscriptions)
+            source.preload = catalogProvider->catalogPreload();
+    }
+
+    //Whether the query narrows the last one is only known once its full-text hits are in, on the worker.
+    SermonSearchBaseline previous;
+    previous.query = resultQuery;
+    if (source.catalog && source.catalog == resultCatalog)
+        previous.rows = resultRows;
+
+    searchInFlight = true;
+    dispatchedRevision = catalogProvider->catalogRevision();
+    resultWatcher.setFuture(QtConcurrent::run(EvaluateSearch, source, query, previous, generation, latestGeneration));
+}
+
+void SearchScheduler::cancelSearch()
+{
+    debounceTimer.stop();
+    if (searchInFlight)
+        cancellations++;
+    generation++;
+    latestGeneration->store(generation);
+    searchInFlight = false;
+    pendingRequests = 0;
+    latencyTimer.invalidate();
+}
+
+void SearchScheduler::publishResult()
+{
+    SermonSearchResult result = resultWatcher.result();
+    if (result.cancelled || result.generation != generation)
+        return; //Superseded by a newer search.
+    searchInFlight = false;
+
+    if (result.retry || dispatchedRevision != catalogProvider->catalogRevision()) {
+        //The table changed while we were searching, so the result may be out of date, or the catalog lacked transcriptions. Try again.
+        startSearch(result.query);
+        return;
+    }
+    if (!result.catalog) {
+        //The table could not be read on the worker; let the proxy do it the slow way.
+        proxyModel->setSearchQuery(result.query);
+        latencyTimer.invalidate();
+        emit searchFinished();
+        return;
+    }
+
+    catalogProvider->adoptCatalog(result.catalog, dispatchedRevision);
+    resultCatalog = result.catalog;
+    resultRows = result.acceptedRows;
+    resultQuery = result.query;
+
+    proxyModel->setAcceptedRowIds(result.acceptedRowIds, result.query);
+    lastLatency = latencyTimer.elapsed();
+    Tracer::RecordSince("SearchScheduler::search (end to end)", latencyTimer, result.acceptedRowIds.size());
+    latencyTimer.invalidate();
+    emit searchFinished();
+}
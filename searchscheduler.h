@@ -0,0 +1,109 @@
+#ifndef SEARCHSCHEDULER_H
+#define SEARCHSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QBitArray>
+#include <QVector>
+#include <QSet>
+
+#include "sermonsortfilterproxymodel.h"
+#include "sermoncatalogprovider.h"
+
+//Where a search gets its catalog: the provider's current one, the running preload, or a fresh read.
+struct SermonCatalogSource
+{
+    SermonCatalogSource() : withTranscriptions(false) {}
+
+    QSharedPointer<const SermonCatalog> catalog;
+    QFuture<QSharedPointer<const SermonCatalog> > preload;
+    QString statement;
+    bool withTranscriptions;
+};
+
+//The last published result, which a narrower query only needs to re-test the hits of.
+struct SermonSearchBaseline
+{
+    SermonSearchQuery query;
+    QBitArray rows; //Empty unless the search runs against the same catalog.
+};
+
+struct SermonSearchResult
+{
+    SermonSearchResult() : generation(0), cancelled(false), retry(false) {}
+
+    QSharedPointer<const SermonCatalog> catalog; //Null if it could not be read.
+    QBitArray acceptedRows; //One bit per catalog row.
+    QSet<qint64> acceptedRowIds;
+    SermonSearchQuery query; //With its full-text terms looked up.
+    int generation;
+    bool cancelled;
+    bool retry; //The index could not answer, and scanning for the terms needs a catalog with transcriptions.
+};
+
+/* Takes search requests from FindSermon and keeps the GUI responsive while
+ * they are answered: keystrokes are coalesced until the input has been
+ * quiet for a moment, the full-text lookup and the match run on a worker
+ * thread against a SermonCatalog of the table model, and any search still
+ * running when a newer one is started is abandoned. Finished results are
+ * handed to the proxy in one step.
+ *
+ * The catalog comes from a SermonCatalogProvider the scheduler owns. If it
+ * has no current one (the table was just edited, say), the worker reads one
+ * before it searches, or waits for the preload, and the provider keeps it;
+ * the GUI thread never reads the table for a search.
+ */
+class SearchScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SearchScheduler(SermonSortFilterProxyModel *model, QObject *parent = 0);
+    ~SearchScheduler();
+
+    void startSearch(const SermonSearchQuery &query);
+    void cancelSearch();
+
+    //Instrumentation.
+    int queueDepth() const { return pendingRequests; }
+    int maximumQueueDepth() const { return maxPendingRequests; }
+    int cancellationCount() const { return cancellations; }
+    qint64 lastLatencyMsecs() const { return lastLatency; }
+
+signals:
+    void searchRequested(); //Input has settled; time to build a query and call startSearch().
+    void searchFinished();
+
+public slots:
+    void requestSearch();
+
+private slots:
+    void publishResult();
+
+private:
+    SermonSortFilterProxyModel *proxyModel;
+    SermonCatalogProvider *catalogProvider; //NULL unless the proxy's source is a SermonTableModel.
+    QTimer debounceTimer;
+    QFutureWatcher<SermonSearchResult> resultWatcher;
+    int dispatchedRevision; //The provider's catalogRevision() when the running search started.
+
+    //The last published result, so a narrower query only re-tests its hits.
+    QSharedPointer<const SermonCatalog> resultCatalog;
+    QBitArray resultRows;
+    SermonSearchQuery resultQuery;
+
+    QSharedPointer<QAtomicInt> latestGeneration; //Shared with the workers, which poll it to notice they are stale.
+    int generation;
+    bool searchInFlight;
+    int pendingRequests;
+    int maxPendingRequests;
+    int cancellations;
+    qint64 lastLatency;
+    QElapsedTimer latencyTimer;
+};
+
+#endif // SEARCHSCHEDULER_H
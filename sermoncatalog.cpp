@@ -0,0 +1,167 @@
+#include "sermoncatalog.h"
+
+#include <QSqlError>
+
+#include <algorithm>
+#include <limits>
+
+#define NO_JULIAN_DAY std::numeric_limits<qint32>::min() //Sorts before every real date, like an invalid QDate does.
+
+void SermonCatalog::TextColumn::append(const QString &value)
+{
+    if (offsets.isEmpty())
+        offsets.append(0);
+    arena.append(value);
+    offsets.append(arena.size());
+}
+
+void SermonCatalog::DictionaryColumn::append(const QString &value)
+{
+    QHash<QString, int>::const_iterator known = lookup.constFind(value);
+    if (known != lookup.constEnd()) {
+        ids.append(known.value());
+        return;
+    }
+    int id = values.size();
+    values.append(value);
+    lookup.insert(value, id);
+    ids.append(id);
+}
+
+qint64 SermonCatalog::DictionaryColumn::memoryUsage() const
+{
+    qint64 bytes = ids.capacity() * sizeof(qint32);
+    foreach (const QString &value, values)
+        bytes += sizeof(QString) + value.capacity() * sizeof(QChar);
+    return bytes;
+}
+
+SermonCatalog::SermonCatalog() :
+    datesSorted(true), transcriptionsLoaded(false)
+{
+}
+
+bool SermonCatalog::load(QSqlQuery &query, bool withTranscriptions)
+{
+    transcriptionsLoaded = withTranscriptions;
+    qint32 previousDay = NO_JULIAN_DAY;
+
+    while (query.next()) {
+        const int row = rowIds.size();
+        rowIds.append(query.value(0).toLongLong());
+
+        audioFlags.resize(row + 1);
+        audioFlags.setBit(row, query.value(1).toBool());
+
+        titles.append(query.value(2).toString());
+        speakers.append(query.value(3).toString());
+        locations.append(query.value(4).toString());
+
+        QDate date = query.value(5).toDate();
+        qint32 day = date.isValid() ? qint32(date.toJulianDay()) : NO_JULIAN_DAY;
+        if (day < previousDay)
+            datesSorted = false;
+        previousDay = day;
+        julianDays.append(day);
+
+        descriptions.append(query.value(6).toString());
+
+        transcriptionFlags.resize(row + 1);
+        if (withTranscriptions) {
+            QString transcription = query.value(7).toString();
+            transcriptionFlags.setBit(row, !query.value(7).isNull());
+            transcriptions.append(transcription);
+        } else {
+            transcriptionFlags.setBit(row, query.value(7).toBool());
+        }
+    }
+    if (query.lastError().isValid())
+        return false;
+
+    rowIds.squeeze();
+    julianDays.squeeze();
+    titles.squeeze();
+    descriptions.squeeze();
+    transcriptions.squeeze();
+    speakers.squeeze();
+    locations.squeeze();
+    return true;
+}
+
+QDate SermonCatalog::date(int row) const
+{
+    qint32 day = julianDays.at(row);
+    return day == NO_JULIAN_DAY ? QDate() : QDate::fromJulianDay(day);
+}
+
+bool SermonCatalog::isTextColumn(int column) const
+{
+    return textColumn(column) != NULL;
+}
+
+QStringRef SermonCatalog::text(int column, int row) const
+{
+    return textColumn(column)->at(row);
+}
+
+bool SermonCatalog::isDictionaryColumn(int column) const
+{
+    return dictionaryColumn(column) != NULL;
+}
+
+int SermonCatalog::valueId(int column, int row) const
+{
+    return dictionaryColumn(column)->ids.at(row);
+}
+
+int SermonCatalog::valueCount(int column) const
+{
+    return dictionaryColumn(column)->values.size();
+}
+
+QString SermonCatalog::value(int column, int valueId) const
+{
+    return dictionaryColumn(column)->values.at(valueId);
+}
+
+QPair<int, int> SermonCatalog::rowRange(const QDate &minimumDate, const QDate &maximumDate) const
+{
+    if (!datesSorted)
+        return qMakePair(0, rowCount()); //No shortcut; every row has to be looked at.
+
+    //Rows are in date order, so the range can be found by bisection.
+    QVector<qint32>::const_iterator first = julianDays.constBegin();
+    QVector<qint32>::const_iterator end = julianDays.constEnd();
+    if (minimumDate.isValid())
+        first = std::lower_bound(first, end, qint32(minimumDate.toJulianDay()));
+    if (maximumDate.isValid())
+        end = std::upper_bound(first, end, qint32(maximumDate.toJulianDay()));
+    return qMakePair(int(first - julianDays.constBegin()), int(end - julianDays.constBegin()));
+}
+
+qint64 SermonCatalog::memoryUsage() const
+{
+    return rowIds.capacity() * sizeof(qint64) + julianDays.capacity() * sizeof(qint32)
+            + (audioFlags.size() + transcriptionFlags.size()) / 8
+            + titles.memoryUsage() + descriptions.memoryUsage() + transcriptions.memoryUsage()
+            + speakers.memoryUsage() + locations.memoryUsage();
+}
+
+const SermonCatalog::TextColumn *SermonCatalog::textColumn(int column) const
+{
+    switch (column) {
+    case Sermon_Title: return &titles;
+    case Sermon_Description: return &descriptions;
+    case Sermon_Transcription: return transcriptionsLoaded ? &transcriptions : NULL;
+    default: return NULL;
+    }
+}
+
+const SermonCatalog::DictionaryColumn *SermonCatalog::dictionaryColumn(int column) const
+{
+    switch (column) {
+    case Sermon_Speaker: return &speakers;
+    case Sermon_Location: return &locations;
+    default: return NULL;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef SERMONCATALOG_H
+#define SERMONCATALOG_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringRef>
+#include <QVector>
+#include <QBitArray>
+#include <QHash>
+#include <QDate>
+#include <QPair>
+#include <QSqlQuery>
+
+#include "databasesupport.h"
+
+/* A compact, read-only copy of the searchable part of the sermon table,
+ * stored column by column:
+ *  - title and description (and, on request, transcription) live in one
+ *    UTF-16 buffer per column, with an offset array marking where each row starts;
+ *  - speaker and location repeat a lot, so each distinct value is stored once
+ *    and rows only hold its number;
+ *  - dates are julian day numbers;
+ *  - "has audio" and "has transcription" are one bit each.
+ * Rows are in date order (ties broken by rowid). Nothing here is a QVariant,
+ * and the whole thing can be read from any number of threads at once.
+ */
+class SermonCatalog
+{
+public:
+    SermonCatalog();
+
+    /* Reads every row of 'query', which must return these columns in order:
+     * rowid, id IS NOT NULL, title, speaker, location, date, description, and
+     * either the transcription itself (withTranscriptions) or transcription IS NOT NULL.
+     */
+    bool load(QSqlQuery &query, bool withTranscriptions);
+
+    int rowCount() const { return rowIds.size(); }
+    qint64 rowId(int row) const { return rowIds.at(row); }
+    int julianDay(int row) const { return julianDays.at(row); }
+    QDate date(int row) const;
+    bool hasAudio(int row) const { return audioFlags.testBit(row); }
+    bool hasTranscription(int row) const { return transcriptionFlags.testBit(row); }
+    bool hasTranscriptionText() const { return transcriptionsLoaded; }
+
+    //Text columns: Sermon_Title, Sermon_Description and (if loaded) Sermon_Transcription.
+    bool isTextColumn(int column) const;
+    QStringRef text(int column, int row) const;
+
+    //Dictionary columns: Sermon_Speaker and Sermon_Location.
+    bool isDictionaryColumn(int column) const;
+    int valueId(int column, int row) const;
+    int valueCount(int column) const;
+    QString value(int column, int valueId) const;
+
+    //Rows [first, second) hold every date in the range; the bounds may be invalid (open).
+    QPair<int, int> rowRange(const QDate &minimumDate, const QDate &maximumDate) const;
+
+    qint64 memoryUsage() const; //Approximate, in bytes.
+
+private:
+    struct TextColumn
+    {
+        void append(const QString &value);
+        QStringRef at(int row) const { return QStringRef(&arena, offsets.at(row), offsets.at(row + 1) - offsets.at(row)); }
+        void squeeze() { arena.squeeze(); offsets.squeeze(); }
+        qint64 memoryUsage() const { return arena.capacity() * sizeof(QChar) + offsets.capacity() * sizeof(int); }
+
+        QString arena;
+        QVector<int> offsets; //rowCount() + 1 entries; row i is arena[offsets[i], offsets[i + 1]).
+    };
+
+    struct DictionaryColumn
+    {
+        void append(const QString &value);
+        void squeeze() { ids.squeeze(); lookup.clear(); lookup.squeeze(); }
+        qint64 memoryUsage() const;
+
+        QStringList values;
+        QVector<qint32> ids;
+        QHash<QString, int> lookup; //Only needed while loading.
+    };
+
+    const TextColumn *textColumn(int column) const;
+    const DictionaryColumn *dictionaryColumn(int column) const;
+
+    QVector<qint64> rowIds;
+    QVector<qint32> julianDays;
+    bool datesSorted; //False if some dates were stored in a form that does not sort as text.
+    QBitArray audioFlags;
+    QBitArray transcriptionFlags;
+    TextColumn titles;
+    TextColumn descriptions;
+    TextColumn transcriptions;
+    bool transcriptionsLoaded;
+    DictionaryColumn speakers;
+    DictionaryColumn locations;
+};
+
+#endif // SERMONCATALOG_H
@@ -0,0 +1,159 @@
+#include "sermoncatalogprovider.h"
+#include "databasesupport.h"
+#include "tracer.h"
+
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDebug>
+#include <QtConcurrent>
+
+SermonCatalogProvider::SermonCatalogProvider(SermonTableModel *model, QObject *parent) :
+    QObject(parent), tableModel(model), catalogVersion(0), preloadVersion(-1)
+{
+    connect(tableModel, SIGNAL(tableChanged()), this, SLOT(invalidateCatalog()));
+    connect(&preloadWatcher, SIGNAL(finished()), this, SLOT(catalogPreloaded()));
+}
+
+/* Reads the whole table (with the model's filter) into a fresh catalog with
+ * one forward-only pass, or returns the one loaded earlier if nothing has
+ * changed since. Returns a null pointer if the table cannot be read.
+ */
+QSharedPointer<const SermonCatalog> SermonCatalogProvider::catalog(bool withTranscriptions)
+{
+    if (catalogCache && (!withTranscriptions || catalogCache->hasTranscriptionText()))
+        return catalogCache;
+    if (tableModel->editJournal() != NULL)
+        tableModel->editJournal()->flush();
+
+    QSharedPointer<const SermonCatalog> loaded = LoadCatalog(tableModel->database(), CatalogStatement(withTranscriptions), withTranscriptions);
+    if (loaded)
+        catalogCache = loaded;
+    return loaded;
+}
+
+QSharedPointer<const SermonCatalog> SermonCatalogProvider::cachedCatalog(bool withTranscriptions) const
+{
+    if (catalogCache && withTranscriptions && !catalogCache->hasTranscriptionText())
+        return QSharedPointer<const SermonCatalog>();
+    return catalogCache;
+}
+
+/* Gets the table ready to be read from another connection: the journal is
+ * flushed, so the worker sees what the model shows. Returns the statement
+ * to hand to LoadCatalogOnWorker(). Note catalogRevision() afterwards and
+ * pass it to adoptCatalog() with the result.
+ */
+QString SermonCatalogProvider::prepareCatalogLoad(bool withTranscriptions)
+{
+    if (tableModel->editJournal() != NULL)
+        tableModel->editJournal()->flush();
+    return CatalogStatement(withTranscriptions);
+}
+
+//The preload of the current data, if one was started; a cancelled future otherwise.
+QFuture<QSharedPointer<const SermonCatalog> > SermonCatalogProvider::catalogPreload() const
+{
+    if (preloadVersion != catalogVersion)
+        return QFuture<QSharedPointer<const SermonCatalog> >();
+    return preloadWatcher.future();
+}
+
+//Keeps a catalog loaded elsewhere, unless the model has changed since 'revision'.
+void SermonCatalogProvider::adoptCatalog(const QSharedPointer<const SermonCatalog> &loaded, int revision)
+{
+    if (!loaded || revision != catalogVersion)
+        return;
+    if (!catalogCache || (loaded->hasTranscriptionText() && !catalogCache->hasTranscriptionText()))
+        catalogCache = loaded;
+}
+
+/* Starts loading the catalog (without transcriptions) on a worker thread.
+ * It is only adopted if the model has not changed, and no catalog has been
+ * loaded the ordinary way, in the meantime.
+ */
+void SermonCatalogProvider::preloadCatalog()
+{
+    EditJournal *journal = tableModel->editJournal();
+    if (catalogCache || preloadWatcher.isRunning() || (journal != NULL && journal->pendingRows() > 0))
+        return;
+    preloadVersion = catalogVersion;
+    preloadWatcher.setFuture(QtConcurrent::run(LoadCatalogOnWorker, CatalogStatement(false), false));
+}
+
+void SermonCatalogProvider::catalogPreloaded()
+{
+    QSharedPointer<const SermonCatalog> loaded = preloadWatcher.result();
+    if (loaded && !catalogCache && preloadVersion == catalogVersion)
+        catalogCache = loaded;
+}
+
+void SermonCatalogProvider::invalidateCatalog()
+{
+    catalogCache.clear(); //Searches still running keep their own reference.
+    ++catalogVersion;
+}
+
+QString SermonCatalogProvider::CatalogStatement(bool withTranscriptions) const
+{
+    QSqlDriver *driver = tableModel->database().driver();
+    QString stmt = "SELECT rowid, id IS NOT NULL, title, speaker, location, date, description, " +
+            QString(withTranscriptions ? "transcription" : "transcription IS NOT NULL") +
+            " FROM " + driver->escapeIdentifier(tableModel->tableName(), QSqlDriver::TableName);
+    if (!tableModel->filter().isEmpty())
+        stmt += " WHERE " + tableModel->filter();
+    stmt += " ORDER BY date, rowid";
+    return stmt;
+}
+
+QSharedPointer<const SermonCatalog> SermonCatalogProvider::LoadCatalog(QSqlDatabase db, const QString &statement, bool withTranscriptions)
+{
+    TraceSpan span("SermonCatalogProvider::LoadCatalog");
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    SermonCatalog *newCatalog = new SermonCatalog;
+    if (!query.exec(statement) || !newCatalog->load(query, withTranscriptions)) {
+        qDebug() << "Could not load the sermon catalog:" << query.lastError().text();
+        delete newCatalog;
+        return QSharedPointer<const SermonCatalog>();
+    }
+
+    span.setValue(newCatalog->rowCount());
+    return QSharedPointer<const SermonCatalog>(newCatalog);
+}
+
+//Runs on a worker thread, on that thread's own connection.
+QSharedPointer<const SermonCatalog> SermonCatalogProvider::LoadCatalogOnWorker(const QString &statement, bool withTranscriptions)
+{
+    TRACE_SCOPE("SermonCatalogProvider::LoadCatalogOnWorker");
+    return LoadCatalog(DatabaseSupport::Connection(), statement, withTranscriptions);
+}
+
+/* Returns the rowids of the rows (with the model's filter) whose
+ * transcription passes 'matcher'; a row without one is tested as empty
+ * text. One forward-only pass over the table, for searches that cannot use
+ * the catalog or the full-text index.
+ */
+QSet<qint64> SermonCatalogProvider::TranscriptionMatches(SermonTableModel *model, const SermonFilterMatcher &matcher)
+{
+    TraceSpan span("SermonCatalogProvider::TranscriptionMatches");
+    if (model->editJournal() != NULL)
+        model->editJournal()->flush();
+    QString stmt = "SELECT rowid, transcription FROM " + model->database().driver()->escapeIdentifier(model->tableName(), QSqlDriver::TableName);
+    if (!model->filter().isEmpty())
+        stmt += " WHERE " + model->filter();
+
+    QSet<qint64> matches;
+    QSqlQuery query(model->database());
+    query.setForwardOnly(true);
+    if (!query.exec(stmt)) {
+        qDebug() << "Could not read the transcriptions:" << query.lastError().text();
+        return matches;
+    }
+    while (query.next()) {
+        if (matcher.matches(query.value(1).toString()))
+            matches.insert(query.value(0).toLongLong());
+    }
+    span.setValue(matches.size());
+    return matches;
+}
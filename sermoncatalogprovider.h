@@ -0,0 +1,61 @@
+#ifndef SERMONCATALOGPROVIDER_H
+#define SERMONCATALOGPROVIDER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QFutureWatcher>
+#include <QSqlDatabase>
+#include <QSet>
+
+#include "sermontablemodel.h"
+#include "sermoncatalog.h"
+#include "sermonfiltermatcher.h"
+
+/* Hands out a SermonCatalog of the table behind a SermonTableModel (same
+ * table, same filter), for code that needs to scan every row. The catalog is
+ * loaded on first use and dropped whenever the model reports the table has
+ * changed. preloadCatalog() reads it on a worker thread ahead of the first
+ * search (SearchScheduler, which owns the provider, starts it as the Find
+ * window opens and while a query is typed). Searches load it on their worker
+ * if need be (prepareCatalogLoad(), LoadCatalogOnWorker()) and hand it back
+ * with adoptCatalog(), so the GUI thread never waits for a pass over the
+ * whole table.
+ */
+class SermonCatalogProvider : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SermonCatalogProvider(SermonTableModel *model, QObject *parent = 0);
+
+    //Transcriptions are big, so they are only read in if asked for.
+    QSharedPointer<const SermonCatalog> catalog(bool withTranscriptions = false); //Reads the table on the calling thread if need be.
+    QSharedPointer<const SermonCatalog> cachedCatalog(bool withTranscriptions = false) const; //Null if out of date.
+    void preloadCatalog();
+
+    //Loading the catalog on a worker thread; see SearchScheduler.
+    int catalogRevision() const { return catalogVersion; }
+    QString prepareCatalogLoad(bool withTranscriptions);
+    QFuture<QSharedPointer<const SermonCatalog> > catalogPreload() const;
+    void adoptCatalog(const QSharedPointer<const SermonCatalog> &loaded, int revision);
+    static QSharedPointer<const SermonCatalog> LoadCatalogOnWorker(const QString &statement, bool withTranscriptions = false);
+
+    //The model only knows whether a row has a transcription; this reads the text from its table.
+    static QSet<qint64> TranscriptionMatches(SermonTableModel *model, const SermonFilterMatcher &matcher);
+
+private slots:
+    void invalidateCatalog();
+    void catalogPreloaded();
+
+private:
+    QString CatalogStatement(bool withTranscriptions) const;
+    static QSharedPointer<const SermonCatalog> LoadCatalog(QSqlDatabase db, const QString &statement, bool withTranscriptions);
+
+    SermonTableModel *tableModel;
+    QSharedPointer<const SermonCatalog> catalogCache;
+    QFutureWatcher<QSharedPointer<const SermonCatalog> > preloadWatcher;
+    int catalogVersion; //Bumped whenever the catalog is dropped, so a catalog of older data is not adopted.
+    int preloadVersion; //catalogVersion when the running preload started.
+};
+
+#endif // SERMONCATALOGPROVIDER_H
@@ -0,0 +1,226 @@
+#include "sermoncsvimporter.h"
+#include "csvreader.h"
+#include "databasesupport.h"
+#include "tracer.h"
+
+#include <QFileInfo>
+#include <QDebug>
+
+#define CSV_IMPORT_BATCH_ROWS 50000
+#define CSV_IMPORT_PROGRESS_EVERY 4096 //Rows between progress reports (and checks for Cancel).
+#define TWO_DIGIT_YEAR_PIVOT 1950 //"yy" years before this are taken to be in the 2000s.
+
+SermonCsvImporter::SermonCsvImporter(QObject *parent) :
+    QObject(parent), dateFormat("M/d/yy"), imported(0), rejected(0), cancelled(false)
+{
+}
+
+QHash<int, int> SermonCsvImporter::GuessColumns(const QVector<QString> &header)
+{
+    QHash<QString, int> names;
+    names.insert("title", Sermon_Title);
+    names.insert("speaker", Sermon_Speaker);
+    names.insert("preacher", Sermon_Speaker);
+    names.insert("minister", Sermon_Speaker);
+    names.insert("location", Sermon_Location);
+    names.insert("place", Sermon_Location);
+    names.insert("church", Sermon_Location);
+    names.insert("date", Sermon_Date);
+    names.insert("description", Sermon_Description);
+    names.insert("notes", Sermon_Description);
+
+    QHash<int, int> columns;
+    for (int i = 0; i < header.size(); ++i) {
+        QHash<QString, int>::const_iterator known = names.constFind(header.at(i).trimmed().toLower());
+        if (known != names.constEnd() && !columns.contains(known.value()))
+            columns.insert(known.value(), i);
+    }
+    return columns;
+}
+
+bool SermonCsvImporter::import(const QString &fileName, const QString &tableName)
+{
+    imported = 0;
+    rejected = 0;
+    cancelled = false;
+    error.clear();
+
+    CsvReader reader(fileName);
+    if (!reader.open()) {
+        error = reader.errorString();
+        return false;
+    }
+    if (!reader.readRecord(header)) {
+        error = "The file is empty.";
+        return false;
+    }
+
+    QHash<int, int> columns = GuessColumns(header);
+    for (QHash<int, QString>::const_iterator it = columnNames.constBegin(); it != columnNames.constEnd(); ++it) {
+        int index = -1;
+        for (int i = 0; i < header.size() && index < 0; ++i) {
+            if (header.at(i).trimmed().compare(it.value(), Qt::CaseInsensitive) == 0)
+                index = i;
+        }
+        if (index < 0) {
+            error = "The file has no column named \"" + it.value() + "\".";
+            return false;
+        }
+        columns.insert(it.key(), index);
+    }
+    if (!columns.contains(Sermon_Title) || !columns.contains(Sermon_Date)) {
+        error = "The file needs at least a title and a date column.";
+        return false;
+    }
+    const int sermonColumns[] = { Sermon_Title, Sermon_Speaker, Sermon_Location, Sermon_Date, Sermon_Description };
+    int sourceColumns[5];
+    for (int i = 0; i < 5; ++i)
+        sourceColumns[i] = columns.value(sermonColumns[i], -1);
+
+    QFileInfo source(fileName);
+    reportName = source.absolutePath() + "/" + source.completeBaseName() + ".rejected.csv";
+    QFile::remove(reportName); //Left from an earlier run.
+
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QSqlQuery query(db);
+    qint64 lastRowIdBefore = 0;
+    if (query.exec("SELECT IFNULL(MAX(rowid), 0) FROM " + tableName) && query.next())
+        lastRowIdBefore = query.value(0).toLongLong();
+    query.finish();
+
+    QSqlQuery insert(db);
+    if (!insert.prepare("INSERT INTO " + tableName + " (title, speaker, location, date, description) VALUES (?, ?, ?, ?, ?);")) {
+        error = insert.lastError().text();
+        return false;
+    }
+
+    TraceSpan span("SermonCsvImporter::import (rows)");
+    QVector<QString> fields;
+    QString values[5];
+    int rows = 0;
+    if (!db.transaction()) {
+        error = db.lastError().text();
+        return false;
+    }
+    while (reader.readRecord(fields)) {
+        bool blank = true;
+        for (int i = 0; i < 5; ++i) {
+            //Missing columns and empty fields are empty text, never NULL; speaker, location and description do not allow NULL.
+            values[i] = sourceColumns[i] >= 0 && sourceColumns[i] < fields.size() ? fields.at(sourceColumns[i]).trimmed() : QString("");
+            if (values[i].isNull())
+                values[i] = QString("");
+            blank = blank && values[i].isEmpty();
+        }
+        if (blank)
+            continue; //Spreadsheets tend to end in a few empty lines.
+
+        QString date = NormaliseDate(values[3]);
+        if (values[0].isEmpty() || date.isEmpty()) {
+            if (!Reject(reader.lineNumber(), fields, values[0].isEmpty() ? "No title." : "Unrecognised date \"" + values[3] + "\"."))
+                break;
+        } else {
+            values[3] = date;
+            for (int i = 0; i < 5; ++i)
+                insert.bindValue(i, values[i]);
+            if (!insert.exec()) {
+                error = "Line " + QString::number(reader.lineNumber()) + ": " + insert.lastError().text();
+                break;
+            }
+            if (++imported % CSV_IMPORT_BATCH_ROWS == 0 && (!db.commit() || !db.transaction())) {
+                error = db.lastError().text();
+                break;
+            }
+        }
+
+        if (++rows % CSV_IMPORT_PROGRESS_EVERY == 0) {
+            emit progress(int(reader.position() * CSV_IMPORT_PROGRESS_RANGE / qMax<qint64>(1, reader.size())));
+            if (cancelled)
+                error = "The import was cancelled.";
+        }
+        if (!error.isEmpty())
+            break;
+    }
+    insert.finish();
+    if (error.isEmpty() && !db.commit())
+        error = db.lastError().text();
+    if (report.isOpen()) {
+        reportStream.flush();
+        report.close();
+    }
+
+    if (!error.isEmpty()) {
+        db.rollback();
+        Undo(tableName, lastRowIdBefore);
+        return false;
+    }
+    emit progress(CSV_IMPORT_PROGRESS_RANGE);
+    span.setValue(imported);
+    return true;
+}
+
+/* Reads 'text' with the configured format, then with the formats older
+ * libraries used. Returns yyyy-MM-dd, or an empty string if it is no date.
+ */
+QString SermonCsvImporter::NormaliseDate(const QString &text)
+{
+    QHash<QString, QString>::const_iterator cached = normalisedDates.constFind(text);
+    if (cached != normalisedDates.constEnd())
+        return cached.value();
+
+    QDate date;
+    if (!dateFormat.isEmpty()) {
+        date = QDate::fromString(text, dateFormat);
+        if (date.isValid() && !dateFormat.contains("yyyy") && date.year() < TWO_DIGIT_YEAR_PIVOT)
+            date = date.addYears(100);
+    }
+    if (!date.isValid())
+        date = DatabaseSupport::ParseLegacyDate(text);
+
+    QString normalised = date.isValid() ? date.toString(Qt::ISODate) : QString();
+    normalisedDates.insert(text, normalised);
+    return normalised;
+}
+
+bool SermonCsvImporter::Reject(int lineNumber, const QVector<QString> &fields, const QString &reason)
+{
+    ++rejected;
+    if (!report.isOpen()) {
+        report.setFileName(reportName);
+        if (!report.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            error = "Cannot write the report of rejected rows: " + report.errorString();
+            return false;
+        }
+        reportStream.setDevice(&report);
+        reportStream.setCodec("UTF-8");
+        reportStream << "Line,Reason";
+        foreach (const QString &name, header)
+            reportStream << "," << Quote(name);
+        reportStream << "\n";
+    }
+
+    reportStream << lineNumber << "," << Quote(reason);
+    foreach (const QString &field, fields)
+        reportStream << "," << Quote(field);
+    reportStream << "\n";
+    return true;
+}
+
+//Takes out the rows of an import that did not finish, including those of batches already committed.
+void SermonCsvImporter::Undo(const QString &tableName, qint64 lastRowIdBefore)
+{
+    QSqlQuery undo(DatabaseSupport::Connection());
+    undo.prepare("DELETE FROM " + tableName + " WHERE rowid > ?;");
+    undo.addBindValue(lastRowIdBefore);
+    if (!undo.exec())
+        error += "\nThe rows imported so far could not be removed: " + undo.lastError().text();
+    imported = 0;
+}
+
+QString SermonCsvImporter::Quote(const QString &field)
+{
+    if (!field.contains(',') && !field.contains('"') && !field.contains('\n') && !field.contains('\r'))
+        return field;
+    QString quoted = field;
+    quoted.replace("\"", "\"\"");
+    return "\"" + quoted + "\"";
+}
@@ -0,0 +1,69 @@
+#ifndef SERMONCSVIMPORTER_H
+#define SERMONCSVIMPORTER_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QFile>
+#include <QTextStream>
+
+#define CSV_IMPORT_PROGRESS_RANGE 1000
+
+/* Imports a spreadsheet of sermon titles (saved as CSV) into the message
+ * table. The first record names the columns; title, speaker, location, date
+ * and description are found by name, or can be set explicitly. Dates are
+ * read with a configurable format, falling back to the formats older
+ * libraries used, and every distinct date string is only parsed once.
+ *
+ * Rows go in through one prepared statement, committed in large batches.
+ * A row without a title or with a date that cannot be read is not imported;
+ * it is written, with the reason, to a report next to the source file
+ * (<name>.rejected.csv). If the import fails or is cancelled, every row it
+ * added is taken out again.
+ */
+class SermonCsvImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SermonCsvImporter(QObject *parent = 0);
+
+    static QHash<int, int> GuessColumns(const QVector<QString> &header); //Sermon_* column -> CSV column
+
+    void setColumn(int sermonColumn, const QString &headerName) { columnNames.insert(sermonColumn, headerName); }
+    void setDateFormat(const QString &format) { dateFormat = format; }
+
+    bool import(const QString &fileName, const QString &tableName);
+
+    int rowsImported() const { return imported; }
+    int rowsRejected() const { return rejected; }
+    QString reportFileName() const { return reportName; }
+    QString errorString() const { return error; }
+
+signals:
+    void progress(int value); //0 to CSV_IMPORT_PROGRESS_RANGE.
+
+public slots:
+    void cancel() { cancelled = true; }
+
+private:
+    QString NormaliseDate(const QString &text);
+    bool Reject(int lineNumber, const QVector<QString> &fields, const QString &reason);
+    void Undo(const QString &tableName, qint64 lastRowIdBefore);
+    static QString Quote(const QString &field);
+
+    QHash<int, QString> columnNames;
+    QString dateFormat;
+    QHash<QString, QString> normalisedDates; //As written in the file -> yyyy-MM-dd, or empty if unreadable.
+    QVector<QString> header;
+    QFile report;
+    QTextStream reportStream;
+    QString reportName;
+    QString error;
+    int imported;
+    int rejected;
+    bool cancelled;
+};
+
+#endif // SERMONCSVIMPORTER_H
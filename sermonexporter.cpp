@@ -0,0 +1,295 @@
+#include "sermonexporter.h"
+#include "databasesupport.h"
+#include "tracer.h"
+#include "blobstore.h"
+
+#include <QFile>
+#include <QVector>
+#include <QDebug>
+
+#define EXPORT_BUFFER_BYTES (1024 * 1024)
+#define EXPORT_PROGRESS_EVERY 4096 //Rows between progress reports (and checks for Cancel).
+#define EXPORT_ROWID_TABLE "temp.Export_Row_Ids" //The rowids a query is limited to, e.g. full-text hits; one per connection.
+
+//Column positions in the export query; the table's own columns follow the rowid in table order.
+#define EXPORT_ROWID 0
+#define EXPORT_COLUMN(sermonColumn) ((sermonColumn) + 1)
+#define EXPORT_FILES (Sermon_Transcription + 2)
+
+SermonExporter::SermonExporter(QObject *parent) :
+    QObject(parent), attachments(false), out(NULL), exported(0), cancelled(false)
+{
+    columns << Sermon_Title << Sermon_Speaker << Sermon_Location << Sermon_Date << Sermon_Description;
+}
+
+QString SermonExporter::ColumnName(int sermonColumn)
+{
+    switch (sermonColumn) {
+    case Sermon_ID: return "id";
+    case Sermon_Title: return "title";
+    case Sermon_Speaker: return "speaker";
+    case Sermon_Location: return "location";
+    case Sermon_Date: return "date";
+    case Sermon_Description: return "description";
+    case Sermon_Transcription: return "transcription";
+    default: return QString();
+    }
+}
+
+int SermonExporter::ColumnNumber(const QString &name)
+{
+    for (int column = Sermon_ID; column <= Sermon_Transcription; ++column) {
+        if (ColumnName(column).compare(name.trimmed(), Qt::CaseInsensitive) == 0)
+            return column;
+    }
+    return -1;
+}
+
+bool SermonExporter::exportTo(const QString &fileName, Format format, const QString &tableName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        exported = 0;
+        error = file.errorString();
+        return false;
+    }
+    bool ok = exportTo(&file, format, tableName);
+    file.close();
+    if (!ok)
+        file.remove(); //No half-written exports.
+    return ok;
+}
+
+/* Fills EXPORT_ROWID_TABLE with 'rowIds', so the export query can join
+ * them instead of testing every row of the table against the set.
+ */
+bool SermonExporter::StoreRowIds(QSqlDatabase db, const QSet<qint64> &rowIds)
+{
+    QSqlQuery query(db);
+    if (!query.exec("CREATE TEMP TABLE IF NOT EXISTS " EXPORT_ROWID_TABLE " (id INTEGER PRIMARY KEY);") ||
+            !query.exec("DELETE FROM " EXPORT_ROWID_TABLE ";")) {
+        error = query.lastError().text();
+        return false;
+    }
+    if (!db.transaction()) {
+        error = db.lastError().text();
+        return false;
+    }
+    query.prepare("INSERT INTO " EXPORT_ROWID_TABLE " (id) VALUES (?);");
+    foreach (qint64 rowId, rowIds) {
+        query.bindValue(0, rowId);
+        if (!query.exec()) {
+            error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+//Writes to a device that is already open, such as standard output.
+bool SermonExporter::exportTo(QIODevice *device, Format format, const QString &tableName)
+{
+    out = device;
+    exported = 0;
+    cancelled = false;
+    error.clear();
+
+    //Transcriptions are only read if they are written or searched; they are by far the biggest column.
+    const QHash<int, SermonFilterMatcher> &matchers = query.columnMatchers();
+    bool needTranscriptions = columns.contains(Sermon_Transcription) || matchers.contains(Sermon_Transcription);
+    QString stmt = "SELECT rowid, id, title, speaker, location, date, description, " +
+            QString(needTranscriptions ? "transcription" : "NULL");
+    if (attachments)
+        stmt += ", (SELECT group_concat(file_name || '/' || size || '/' || IFNULL(hash, ''), char(10)) FROM "
+                ENTRY_FILE_TABLE " WHERE entry_id = " + tableName + ".id)";
+    stmt += " FROM " + tableName;
+
+    //Only the rows in the date range and, with full-text hits, only those are read at all.
+    QSqlDatabase db = DatabaseSupport::Connection();
+    QStringList conditions;
+    QString dateRange = DatabaseSupport::DateRangeCondition(query.minimumDate(), query.maximumDate());
+    if (!dateRange.isEmpty())
+        conditions << dateRange;
+    if (query.hasRowIdFilter()) {
+        if (!StoreRowIds(db, query.rowIdFilter()))
+            return false;
+        conditions << "rowid IN (SELECT id FROM " EXPORT_ROWID_TABLE ")";
+    }
+    QString where = conditions.isEmpty() ? QString() : " WHERE " + conditions.join(" AND ");
+    stmt += where + " ORDER BY date, rowid;";
+
+    qint64 total = 0;
+    QSqlQuery count(db);
+    count.prepare("SELECT COUNT(*) FROM " + tableName + where);
+    QSqlQuery rows(db);
+    rows.setForwardOnly(true);
+    rows.prepare(stmt);
+    int bindIndex = 0;
+    if (query.minimumDate().isValid()) {
+        count.bindValue(bindIndex, query.minimumDate().toString(Qt::ISODate));
+        rows.bindValue(bindIndex++, query.minimumDate().toString(Qt::ISODate));
+    }
+    if (query.maximumDate().isValid()) {
+        count.bindValue(bindIndex, query.maximumDate().toString(Qt::ISODate));
+        rows.bindValue(bindIndex++, query.maximumDate().toString(Qt::ISODate));
+    }
+    if (count.exec() && count.next())
+        total = count.value(0).toLongLong();
+    count.finish();
+    if (!rows.exec()) {
+        error = rows.lastError().text();
+        return false;
+    }
+
+    buffer.clear();
+    buffer.reserve(EXPORT_BUFFER_BYTES + 64 * 1024);
+
+    if (format == Csv) {
+        for (int i = 0; i < columns.size(); ++i)
+            buffer.append(i == 0 ? "" : ",").append(ColumnName(columns.at(i)).toLatin1());
+        buffer.append(attachments ? ",files\r\n" : "\r\n");
+    }
+
+    TraceSpan span("SermonExporter::exportTo (rows)");
+    QVector<QString> values(Sermon_Transcription + 1);
+    qint64 read = 0;
+    while (rows.next()) {
+        if (++read % EXPORT_PROGRESS_EVERY == 0) {
+            emit progress(total > 0 ? int(qMin(read, total) * EXPORT_PROGRESS_RANGE / total) : 0);
+            if (cancelled) {
+                error = "The export was cancelled.";
+                break;
+            }
+        }
+
+        qint64 rowId = rows.value(EXPORT_ROWID).toLongLong();
+        for (int column = Sermon_ID; column <= Sermon_Transcription; ++column)
+            values[column] = rows.value(EXPORT_COLUMN(column)).toString();
+        bool accepted = true;
+        for (QHash<int, SermonFilterMatcher>::const_iterator i = matchers.constBegin(); accepted && i != matchers.constEnd(); ++i)
+            accepted = i.value().matches(values.at(i.key()));
+        if (!accepted)
+            continue;
+
+        if (format == Csv) {
+            for (int i = 0; i < columns.size(); ++i) {
+                if (i > 0)
+                    buffer.append(',');
+                AppendCsvField(values.at(columns.at(i)).toUtf8());
+            }
+            if (attachments) {
+                //One "name/size/hash" per line, as the manifest has them.
+                buffer.append(',');
+                AppendCsvField(rows.value(EXPORT_FILES).toString().toUtf8());
+            }
+            buffer.append("\r\n");
+        } else {
+            buffer.append("{\"rowid\":").append(QByteArray::number(rowId));
+            foreach (int column, columns) {
+                buffer.append(",\"").append(ColumnName(column).toLatin1()).append("\":");
+                if (rows.value(EXPORT_COLUMN(column)).isNull())
+                    buffer.append("null");
+                else
+                    AppendJsonString(values.at(column).toUtf8());
+            }
+            if (attachments) {
+                buffer.append(",\"files\":[");
+                QString files = rows.value(EXPORT_FILES).toString();
+                if (!files.isEmpty()) {
+                    bool first = true;
+                    foreach (const QString &entry, files.split('\n')) {
+                        //A file name cannot contain '/', which is why it separates the fields.
+                        QStringList parts = entry.split('/');
+                        if (parts.size() != 3)
+                            continue;
+                        buffer.append(first ? "{\"name\":" : ",{\"name\":");
+                        first = false;
+                        AppendJsonString(parts.at(0).toUtf8());
+                        buffer.append(",\"size\":").append(parts.at(1).toLatin1());
+                        buffer.append(",\"sha256\":");
+                        if (parts.at(2).isEmpty())
+                            buffer.append("null");
+                        else
+                            AppendJsonString(parts.at(2).toLatin1());
+                        buffer.append('}');
+                    }
+                }
+                buffer.append(']');
+            }
+            buffer.append("}\n");
+        }
+        ++exported;
+
+        if (buffer.size() >= EXPORT_BUFFER_BYTES && !Flush())
+            break;
+    }
+    rows.finish();
+
+    if (error.isEmpty())
+        Flush();
+    out = NULL;
+    if (!error.isEmpty())
+        return false;
+    emit progress(EXPORT_PROGRESS_RANGE);
+    span.setValue(exported);
+    return true;
+}
+
+//Quoted only where needed, with quotes doubled (RFC 4180).
+void SermonExporter::AppendCsvField(const QByteArray &utf8)
+{
+    bool quote = false;
+    for (const char *p = utf8.constData(), *end = p + utf8.size(); p < end && !quote; ++p)
+        quote = *p == ',' || *p == '"' || *p == '\n' || *p == '\r';
+    if (!quote) {
+        buffer.append(utf8);
+        return;
+    }
+    buffer.append('"');
+    for (const char *p = utf8.constData(), *end = p + utf8.size(); p < end; ++p) {
+        if (*p == '"')
+            buffer.append('"');
+        buffer.append(*p);
+    }
+    buffer.append('"');
+}
+
+//UTF-8 passes through as it is; only quotes, backslashes and control characters are escaped.
+void SermonExporter::AppendJsonString(const QByteArray &utf8)
+{
+    static const char hex[] = "0123456789abcdef";
+    buffer.append('"');
+    for (const char *p = utf8.constData(), *end = p + utf8.size(); p < end; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        switch (c) {
+        case '"': buffer.append("\\\""); break;
+        case '\\': buffer.append("\\\\"); break;
+        case '\n': buffer.append("\\n"); break;
+        case '\r': buffer.append("\\r"); break;
+        case '\t': buffer.append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                buffer.append("\\u00").append(hex[c >> 4]).append(hex[c & 0xF]);
+            } else {
+                buffer.append(char(c));
+            }
+        }
+    }
+    buffer.append('"');
+}
+
+bool SermonExporter::Flush()
+{
+    if (out->write(buffer) != buffer.size()) {
+        error = out->errorString();
+        return false;
+    }
+    buffer.resize(0); //Keeps the allocation.
+    return true;
+}
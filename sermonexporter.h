@@ -0,0 +1,71 @@
+#ifndef SERMONEXPORTER_H
+#define SERMONEXPORTER_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QByteArray>
+#include <QIODevice>
+#include <QSet>
+#include <QSqlDatabase>
+
+#include "sermonsearchquery.h"
+
+#define EXPORT_PROGRESS_RANGE 1000
+
+/* Writes the message table, or the part of it a SermonSearchQuery accepts,
+ * to a CSV or JSON Lines file. Rows are read one at a time from a
+ * forward-only query and written through a fixed-size buffer, so memory use
+ * does not grow with the size of the library. The date range and the
+ * full-text hits are handed to SQLite (its date index, and a temporary
+ * table of the hits' rowids), so only those rows are read; other text
+ * criteria are tested row by row, exactly as the main window's filter does.
+ *
+ * With attachments included, each row also lists the entry's files as
+ * recorded in the attachment manifest (name, size and hash).
+ */
+class SermonExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format { Csv, JsonLines };
+
+    explicit SermonExporter(QObject *parent = 0);
+
+    static QString ColumnName(int sermonColumn);
+    static int ColumnNumber(const QString &name); //-1 if there is no such column.
+
+    void setColumns(const QList<int> &sermonColumns) { columns = sermonColumns; }
+    void setQuery(const SermonSearchQuery &searchQuery) { query = searchQuery; }
+    void setIncludeAttachments(bool include) { attachments = include; }
+
+    bool exportTo(const QString &fileName, Format format, const QString &tableName);
+    bool exportTo(QIODevice *device, Format format, const QString &tableName);
+
+    int rowsExported() const { return exported; }
+    QString errorString() const { return error; }
+
+signals:
+    void progress(int value); //0 to EXPORT_PROGRESS_RANGE.
+
+public slots:
+    void cancel() { cancelled = true; }
+
+private:
+    void AppendCsvField(const QByteArray &utf8);
+    void AppendJsonString(const QByteArray &utf8);
+    bool Flush();
+    bool StoreRowIds(QSqlDatabase db, const QSet<qint64> &rowIds);
+
+    QList<int> columns;
+    SermonSearchQuery query;
+    bool attachments;
+    QIODevice *out;
+    QByteArray buffer;
+    QString error;
+    int exported;
+    bool cancelled;
+};
+
+#endif // SERMONEXPORTER_H
@@ -0,0 +1,81 @@
+#include "sermonfiltermatcher.h"
+
+SermonFilterMatcher::SermonFilterMatcher() :
+    caseSense(Qt::CaseInsensitive), literal(true)
+{
+}
+
+SermonFilterMatcher::SermonFilterMatcher(const QRegExp &source) :
+    patternText(source.pattern()), caseSense(source.caseSensitivity()), literal(false)
+{
+    if (patternText.isEmpty())
+        return; //Empty criteria match everything; nothing to compile.
+
+    if (source.patternSyntax() == QRegExp::FixedString || IsLiteralPattern(patternText)) {
+        literal = true;
+        literalMatcher.setPattern(patternText);
+        literalMatcher.setCaseSensitivity(caseSense);
+        return;
+    }
+
+    QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
+    if (caseSense == Qt::CaseInsensitive)
+        options |= QRegularExpression::CaseInsensitiveOption;
+    regex.setPattern(patternText);
+    regex.setPatternOptions(options);
+    regex.optimize(); //Compile (and JIT, if available) right now instead of on the first row.
+}
+
+bool SermonFilterMatcher::matches(const QString &text) const
+{
+    if (patternText.isEmpty())
+        return true;
+    if (literal)
+        return literalMatcher.indexIn(text) != -1;
+    return regex.match(text).hasMatch();
+}
+
+//Same as above, for text that lives inside a larger buffer (see SermonCatalog).
+bool SermonFilterMatcher::matches(const QStringRef &text) const
+{
+    if (patternText.isEmpty())
+        return true;
+    if (literal)
+        return literalMatcher.indexIn(text.unicode(), text.size()) != -1;
+    return regex.match(text).hasMatch();
+}
+
+/* Returns true if every text this matcher accepts is also accepted by
+ * 'previous', i.e. switching from 'previous' to this one can only shrink
+ * a result set. Only literals can be reasoned about; for regular
+ * expressions we just recognize an unchanged pattern.
+ */
+bool SermonFilterMatcher::narrows(const SermonFilterMatcher &previous) const
+{
+    if (previous.isEmpty())
+        return true;
+    if (isEmpty())
+        return false;
+
+    if (literal && previous.literal) {
+        //A case-sensitive hit is also a case-insensitive one, but not the other way around.
+        if (previous.caseSense == Qt::CaseSensitive && caseSense != Qt::CaseSensitive)
+            return false;
+        return patternText.contains(previous.patternText, previous.caseSense);
+    }
+
+    return literal == previous.literal && caseSense == previous.caseSense && patternText == previous.patternText;
+}
+
+/* Returns true if the pattern contains no regular expression
+ * metacharacters, i.e. it would only ever match itself.
+ */
+bool SermonFilterMatcher::IsLiteralPattern(const QString &pattern)
+{
+    static const QString metaChars = "\\^$.|?*+()[]{}";
+    for (int i = 0; i < pattern.size(); ++i) {
+        if (metaChars.contains(pattern.at(i)))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef SERMONFILTERMATCHER_H
+#define SERMONFILTERMATCHER_H
+
+#include <QString>
+#include <QRegExp>
+#include <QRegularExpression>
+#include <QStringMatcher>
+
+/* One column's search criterion, compiled once when the search changes
+ * rather than once for every row that gets tested. Plain text (by far
+ * the most common query) bypasses the regex engine and uses a prebuilt
+ * substring matcher; everything else goes through an optimized
+ * QRegularExpression, which PCRE will JIT-compile where supported.
+ */
+class SermonFilterMatcher
+{
+public:
+    SermonFilterMatcher();
+    explicit SermonFilterMatcher(const QRegExp &source);
+
+    bool isEmpty() const { return patternText.isEmpty(); }
+    bool isLiteral() const { return literal; }
+    QString pattern() const { return patternText; }
+    Qt::CaseSensitivity caseSensitivity() const { return caseSense; }
+
+    bool matches(const QString &text) const;
+    bool matches(const QStringRef &text) const;
+    bool narrows(const SermonFilterMatcher &previous) const;
+
+    static bool IsLiteralPattern(const QString &pattern);
+
+private:
+    QString patternText;
+    Qt::CaseSensitivity caseSense;
+    bool literal;
+    QStringMatcher literalMatcher;
+    QRegularExpression regex;
+};
+
+#endif // SERMONFILTERMATCHER_H
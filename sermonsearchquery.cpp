@@ -0,0 +1,135 @@
+#include "sermonsearchquery.h"
+#include "databasesupport.h"
+
+SermonSearchQuery::SermonSearchQuery() :
+    rowIdFilterActive(false)
+{
+}
+
+/* The query for the text typed into FindSermon's fields, or given to the
+ * batch tool, one entry per column. Plain words are left to the full-text
+ * index; regular expressions and case-sensitive searches are beyond what it
+ * can answer, so those are matched row by row. Empty fields are left out.
+ */
+SermonSearchQuery SermonSearchQuery::FromCriteria(const QHash<int, QString> &columnText, Qt::CaseSensitivity caseSense,
+                                                  const QDate &minimumDate, const QDate &maximumDate)
+{
+    QHash<int, QRegExp> searchHash;
+    QHash<int, QString> indexedTerms;
+    QHash<int, QString>::const_iterator i;
+    for (i = columnText.constBegin(); i != columnText.constEnd(); ++i) {
+        if (i.value().isEmpty())
+            continue;
+        if (DatabaseSupport::IsSearchIndexAvailable() && caseSense == Qt::CaseInsensitive &&
+                SermonFilterMatcher::IsLiteralPattern(i.value()) && i.value().contains(QRegExp("\\w")))
+            indexedTerms.insert(i.key(), i.value());
+        else
+            searchHash.insert(i.key(), QRegExp(i.value(), caseSense));
+    }
+
+    SermonSearchQuery query;
+    query.setFullTextTerms(indexedTerms);
+    query.setColumnPatterns(searchHash);
+    query.setMinimumDate(minimumDate);
+    query.setMaximumDate(maximumDate);
+    return query;
+}
+
+void SermonSearchQuery::setColumnPatterns(const QHash<int, QRegExp> &columnPatterns)
+{
+    patterns = columnPatterns;
+
+    //Compile each column's criteria once here, rather than once per row.
+    matchers.clear();
+    QHash<int, QRegExp>::const_iterator i;
+    for (i = patterns.constBegin(); i != patterns.constEnd(); ++i) {
+        if (!i.value().isEmpty())
+            matchers.insert(i.key(), SermonFilterMatcher(i.value()));
+    }
+}
+
+void SermonSearchQuery::setRowIdFilter(const QSet<qint64> &ids)
+{
+    rowIds = ids;
+    rowIdFilterActive = true;
+}
+
+void SermonSearchQuery::clearRowIdFilter()
+{
+    rowIds.clear();
+    rowIdFilterActive = false;
+}
+
+/* Answers the full-text terms from the index, using the calling thread's
+ * connection, and filters on the hits. If the index cannot answer, the
+ * terms are scanned for row by row instead and this returns false.
+ */
+bool SermonSearchQuery::resolveFullText()
+{
+    if (indexedTerms.isEmpty())
+        return true;
+
+    //The date range goes along to the index query, where SQLite answers it from the date index.
+    QSet<qint64> hits;
+    bool answered = DatabaseSupport::SearchFullText(DatabaseSupport::BuildSearchExpression(indexedTerms), hits, minDate, maxDate);
+    if (answered) {
+        setRowIdFilter(hits);
+    } else {
+        QHash<int, QRegExp> scanned = patterns;
+        QHash<int, QString>::const_iterator i;
+        for (i = indexedTerms.constBegin(); i != indexedTerms.constEnd(); ++i)
+            scanned.insert(i.key(), QRegExp(i.value(), Qt::CaseInsensitive)); //Only case-insensitive terms go to the index.
+        setColumnPatterns(scanned);
+    }
+    indexedTerms.clear();
+    return answered;
+}
+
+bool SermonSearchQuery::acceptsDate(const QDate &date) const
+{
+    return (!minDate.isValid() || date >= minDate)
+            && (!maxDate.isValid() || date <= maxDate);
+}
+
+/* Returns true if this query can only ever accept a subset of what
+ * 'previous' accepted, so that only previous hits need to be re-tested.
+ */
+bool SermonSearchQuery::narrows(const SermonSearchQuery &previous) const
+{
+    if (!indexedTerms.isEmpty() || !previous.indexedTerms.isEmpty())
+        return false; //Nothing is known about hits that have not been looked up.
+
+    //The date range may only shrink.
+    if (previous.minDate.isValid() && (!minDate.isValid() || minDate < previous.minDate))
+        return false;
+    if (previous.maxDate.isValid() && (!maxDate.isValid() || maxDate > previous.maxDate))
+        return false;
+
+    //Every column that was restricted before must be at least as restricted now.
+    QHash<int, SermonFilterMatcher>::const_iterator i;
+    for (i = previous.matchers.constBegin(); i != previous.matchers.constEnd(); ++i) {
+        if (!matchers.contains(i.key()) || !matchers.value(i.key()).narrows(i.value()))
+            return false;
+    }
+
+    //Full-text hits may only drop out, never come in.
+    if (previous.rowIdFilterActive) {
+        if (!rowIdFilterActive || rowIds.size() > previous.rowIds.size())
+            return false;
+        foreach (qint64 rowId, rowIds) {
+            if (!previous.rowIds.contains(rowId))
+                return false;
+        }
+    }
+    return true;
+}
+
+void SermonSearchQuery::clear()
+{
+    patterns.clear();
+    matchers.clear();
+    clearRowIdFilter();
+    indexedTerms.clear();
+    minDate = QDate();
+    maxDate = QDate();
+}
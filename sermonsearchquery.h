@@ -0,0 +1,59 @@
+#ifndef SERMONSEARCHQUERY_H
+#define SERMONSEARCHQUERY_H
+
+#include <QDate>
+#include <QHash>
+#include <QSet>
+#include <QRegExp>
+
+#include "sermonfiltermatcher.h"
+
+/* Everything the user asked for in FindSermon, in compiled form: per-column
+ * text criteria, the date range and (optionally) the set of full-text index
+ * hits. It is a plain value, so a copy can be handed to a search thread.
+ * Terms meant for the full-text index travel along unanswered; the thread
+ * that runs the search looks them up with resolveFullText().
+ */
+class SermonSearchQuery
+{
+public:
+    SermonSearchQuery();
+    static SermonSearchQuery FromCriteria(const QHash<int, QString> &columnText, Qt::CaseSensitivity caseSense,
+                                          const QDate &minimumDate, const QDate &maximumDate);
+
+    QHash<int, QRegExp> columnPatterns() const { return patterns; }
+    void setColumnPatterns(const QHash<int, QRegExp> &columnPatterns);
+    const QHash<int, SermonFilterMatcher> &columnMatchers() const { return matchers; }
+
+    QSet<qint64> rowIdFilter() const { return rowIds; }
+    void setRowIdFilter(const QSet<qint64> &ids);
+    void clearRowIdFilter();
+    bool hasRowIdFilter() const { return rowIdFilterActive; }
+
+    QHash<int, QString> fullTextTerms() const { return indexedTerms; }
+    void setFullTextTerms(const QHash<int, QString> &columnTerms) { indexedTerms = columnTerms; }
+    bool resolveFullText();
+
+    QDate minimumDate() const { return minDate; }
+    void setMinimumDate(const QDate &date) { minDate = date; }
+    QDate maximumDate() const { return maxDate; }
+    void setMaximumDate(const QDate &date) { maxDate = date; }
+    bool hasDateRange() const { return minDate.isValid() || maxDate.isValid(); }
+
+    bool acceptsRowId(qint64 rowId) const { return !rowIdFilterActive || rowIds.contains(rowId); }
+    bool acceptsDate(const QDate &date) const;
+
+    bool narrows(const SermonSearchQuery &previous) const;
+    void clear();
+
+private:
+    QHash<int, QRegExp> patterns;
+    QHash<int, SermonFilterMatcher> matchers; //Compiled form of patterns; empty criteria are left out.
+    QSet<qint64> rowIds;
+    bool rowIdFilterActive;
+    QHash<int, QString> indexedTerms; //Not looked up yet.
+    QDate minDate;
+    QDate maxDate;
+};
+
+#endif // SERMONSEARCHQUERY_H
@@ -1,63 +1,201 @@
 #include "sermonsortfilterproxymodel.h"
+#include "sermontablemodel.h"
+#include "sermoncatalogprovider.h"
+#include "tracer.h"
 
-SermonSortFilterProxyModel::SermonSortFilterProxyModel()
+SermonSortFilterProxyModel::SermonSortFilterProxyModel() :
+    sermonModel(NULL), acceptedRowsValid(false), narrowing(false), precomputed(false), transcriptionsMatched(false)
 {
 }
 
+void SermonSortFilterProxyModel::setSourceModel(QAbstractItemModel *model)
+{
+    if (sourceModel()) {
+        disconnect(sourceModel(), 0, this, SLOT(forgetAcceptedRows()));
+        disconnect(sourceModel(), 0, this, SLOT(sourceRowsInserted(QModelIndex,int,int)));
+    }
+
+    QSortFilterProxyModel::setSourceModel(model);
+    sermonModel = qobject_cast<SermonTableModel *>(model);
+    forgetAcceptedRows();
+
+    //Any change in the source's row numbering makes our record of accepted rows meaningless.
+    connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(sourceRowsInserted(QModelIndex,int,int)));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(forgetAcceptedRows()));
+    connect(model, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), this, SLOT(forgetAcceptedRows()));
+    connect(model, SIGNAL(modelReset()), this, SLOT(forgetAcceptedRows()));
+    connect(model, SIGNAL(layoutChanged()), this, SLOT(forgetAcceptedRows()));
+}
+
 //Might also need to reimplement lessThan virtual method to make sorting of filter results possible.
 
 bool SermonSortFilterProxyModel::filterAcceptsRow(int sourceRow,
         const QModelIndex &sourceParent) const
 {
-  bool flag = true;
-  QHash<int, QRegExp>::const_iterator i;
+  bool accepted;
+  if (sermonModel != NULL && sermonModel->isRowRemoved(sourceRow)) {
+      //Deleted, but kept as a blank row until the table is next selected; see SermonTableModel.
+      accepted = false;
+  } else if (precomputed) {
+      //A background search already decided this row.
+      accepted = precomputedRowIds.contains(sourceRowId(sourceRow, sourceParent));
+  } else {
+      //While narrowing, a row that failed the previous (looser) query cannot pass this one.
+      if (narrowing && sourceRow < acceptedRows.size() && !acceptedRows.testBit(sourceRow))
+          return false;
+      accepted = rowMatches(sourceRow, sourceParent);
+  }
+
+  if (sourceRow >= acceptedRows.size())
+      acceptedRows.resize(sourceRow + 1);
+  acceptedRows.setBit(sourceRow, accepted);
+  return accepted;
+}
+
+bool SermonSortFilterProxyModel::rowMatches(int sourceRow, const QModelIndex &sourceParent) const
+{
+  if (searchQuery.hasRowIdFilter() && !searchQuery.acceptsRowId(sourceRowId(sourceRow, sourceParent)))
+      return false;
 
-  for (i = multiFilter.constBegin(); i != multiFilter.constEnd(); ++i) {
-      //skip the loop body this time because it already passes but continue validation if further search criteria exists.
-      if (i.value().isEmpty())
+  const QHash<int, SermonFilterMatcher> &columnMatchers = searchQuery.columnMatchers();
+  QHash<int, SermonFilterMatcher>::const_iterator i;
+  for (i = columnMatchers.constBegin(); i != columnMatchers.constEnd(); ++i) {
+      if (i.key() == Sermon_Transcription && transcriptionsMatched) {
+          if (!transcriptionRowIds.contains(sourceRowId(sourceRow, sourceParent)))
+              return false;
           continue;
+      }
       QModelIndex mIndex = sourceModel()->index(sourceRow, i.key(), sourceParent);
-      flag = flag && (sourceModel()->data(mIndex).toString().contains(QRegExp(i.value())));
-      if (!flag) //don't waste iterations if we already know that this row doesn't qualify.
-          return false;
+      if (!i.value().matches(sourceModel()->data(mIndex).toString()))
+          return false; //don't waste iterations if we already know that this row doesn't qualify.
   }
 
+  if (!searchQuery.hasDateRange())
+      return true; //No date limits, so there is no need to parse the date at all.
+
   QModelIndex dateModelIndex = sourceModel()->index(sourceRow, Sermon_Date, sourceParent);
-  return flag && dateInRange(sourceModel()->data(dateModelIndex).toDate());
+  return searchQuery.acceptsDate(sourceModel()->data(dateModelIndex).toDate());
 }
 
-bool SermonSortFilterProxyModel::dateInRange(const QDate &date) const
+qint64 SermonSortFilterProxyModel::sourceRowId(int sourceRow, const QModelIndex &sourceParent) const
 {
-  return (!minDate.isValid() || date >= minDate)
-          && (!maxDate.isValid() || date <= maxDate);
+  return sourceModel()->data(sourceModel()->index(sourceRow, Sermon_RowId, sourceParent)).toLongLong();
 }
 
 void SermonSortFilterProxyModel::setFilterMinimumDate(const QDate &date, bool invalFltr)
 {
-  minDate = date;
+  searchQuery.setMinimumDate(date);
   if (invalFltr) {
-      invalidateFilter();
+      applyFilter();
   }
 }
 
 void SermonSortFilterProxyModel::setFilterMaximumDate(const QDate &date, bool invalFltr)
 {
-  maxDate = date;
+  searchQuery.setMaximumDate(date);
   if (invalFltr) {
-      invalidateFilter();
+      applyFilter();
   }
 }
 
 void SermonSortFilterProxyModel::setMultiFilterRegExp(const QHash<int, QRegExp> &filter)
 {
-   multiFilter = filter;
+   searchQuery.setColumnPatterns(filter); //Compiles the criteria once, rather than once per row.
+}
+
+void SermonSortFilterProxyModel::setRowIdFilter(const QSet<qint64> &rowIds)
+{
+    searchQuery.setRowIdFilter(rowIds);
+}
+
+void SermonSortFilterProxyModel::clearRowIdFilter()
+{
+    searchQuery.clearRowIdFilter();
 }
 
 void SermonSortFilterProxyModel::resetFilters()
 {
-    multiFilter.clear();
+    searchQuery.clear();
     setFilterMinimumDate(QDate::currentDate().addYears(-5), false);
     setFilterMaximumDate(QDate::currentDate(), false);
-    invalidateFilter();
+    applyFilter();
     sort(-1);
 }
+
+/* Re-filters after the criteria have changed. When the new query can only
+ * shrink the current results (one more character typed into a plain text
+ * field, a shorter date range, fewer full-text hits . . .), only the rows
+ * that are currently accepted get tested again; the rest are rejected by a
+ * single bit test. QSortFilterProxyModel then removes the rows that dropped
+ * out, without resetting the view.
+ */
+void SermonSortFilterProxyModel::applyFilter()
+{
+    precomputed = false;
+    precomputedRowIds.clear();
+
+    //SermonTableModel holds 1 or NULL in place of each transcription, so the text is matched in one pass over the table.
+    transcriptionsMatched = sermonModel != NULL && searchQuery.columnMatchers().contains(Sermon_Transcription);
+    if (transcriptionsMatched)
+        transcriptionRowIds = SermonCatalogProvider::TranscriptionMatches(sermonModel, searchQuery.columnMatchers().value(Sermon_Transcription));
+    else
+        transcriptionRowIds.clear();
+
+    narrowing = acceptedRowsValid && searchQuery.narrows(appliedQuery);
+    if (!narrowing)
+        acceptedRows.fill(false, sourceModel() ? sourceModel()->rowCount() : 0);
+
+    {
+        //One span per pass of filterAcceptsRow() over the source rows; its value is the number of rows accepted.
+        TraceSpan span(narrowing ? "SermonSortFilterProxyModel::filter (narrowing)" : "SermonSortFilterProxyModel::filter");
+        invalidateFilter();
+        span.setValue(rowCount());
+    }
+
+    narrowing = false;
+    acceptedRowsValid = true;
+    appliedQuery = searchQuery;
+}
+
+void SermonSortFilterProxyModel::setSearchQuery(const SermonSearchQuery &query)
+{
+    searchQuery = query;
+    applyFilter();
+}
+
+/* Publishes the outcome of a search that was evaluated off the GUI thread.
+ * The result is keyed on rowid rather than on row number, so it stays valid
+ * even if rows were added or fetched in the meantime; such rows could not be
+ * re-tested here anyway, since the table model does not hold transcriptions.
+ * The whole result replaces the current one in a single filter pass.
+ */
+void SermonSortFilterProxyModel::setAcceptedRowIds(const QSet<qint64> &rowIds, const SermonSearchQuery &query)
+{
+    searchQuery = query;
+    precomputedRowIds = rowIds;
+    acceptedRows.fill(false, sourceModel() ? sourceModel()->rowCount() : 0);
+
+    //Kept until the next query, for rows the source model has not fetched yet.
+    precomputed = true;
+    {
+        TraceSpan span("SermonSortFilterProxyModel::filter (precomputed)");
+        invalidateFilter();
+        span.setValue(rowCount());
+    }
+
+    acceptedRowsValid = true;
+    appliedQuery = searchQuery;
+}
+
+void SermonSortFilterProxyModel::forgetAcceptedRows()
+{
+    acceptedRowsValid = false;
+}
+
+void SermonSortFilterProxyModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(first);
+    //Rows appended at the end (e.g. fetchMore) leave the existing row numbers intact.
+    if (last != sourceModel()->rowCount(parent) - 1)
+        forgetAcceptedRows();
+}
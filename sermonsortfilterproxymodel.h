@@ -2,37 +2,72 @@
 #define SERMONSORTFILTERPROXYMODEL_H
 
 #include <QSortFilterProxyModel>
+#include <QBitArray>
 #include <QDate>
 #include <QHash>
+#include <QSet>
 #include <QRegExp>
 
 #include "databasesupport.h"
+#include "sermonsearchquery.h"
+
+class SermonTableModel;
 
 class SermonSortFilterProxyModel : public QSortFilterProxyModel
 {
+    Q_OBJECT
 
 public:
     SermonSortFilterProxyModel();
 
-    QDate filterMinimumDate() const { return minDate; }
+    void setSourceModel(QAbstractItemModel *model) Q_DECL_OVERRIDE;
+
+    QDate filterMinimumDate() const { return searchQuery.minimumDate(); }
     void setFilterMinimumDate(const QDate &date, bool invalFltr = true);
 
-    QDate filterMaximumDate() const { return maxDate; }
+    QDate filterMaximumDate() const { return searchQuery.maximumDate(); }
     void setFilterMaximumDate(const QDate &date, bool invalFltr = true);
 
-    QHash<int, QRegExp> multiFilterRegExp() const { return multiFilter; }
+    QHash<int, QRegExp> multiFilterRegExp() const { return searchQuery.columnPatterns(); }
     void setMultiFilterRegExp(const QHash<int, QRegExp> &filter);
+
+    //Restricts results to the given rowids, e.g. the hits of a full-text search.
+    void setRowIdFilter(const QSet<qint64> &rowIds);
+    void clearRowIdFilter();
+
     void resetFilters();
 
+    //Filters by 'query' right here, on the calling thread.
+    void setSearchQuery(const SermonSearchQuery &query);
+
+    //Results computed elsewhere (see SearchScheduler): the rowids of the rows that match 'query'.
+    void setAcceptedRowIds(const QSet<qint64> &rowIds, const SermonSearchQuery &query);
+    SermonSearchQuery appliedSearchQuery() const { return appliedQuery; }
+
 protected:
     bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const Q_DECL_OVERRIDE;
 
+private slots:
+    void forgetAcceptedRows();
+    void sourceRowsInserted(const QModelIndex &parent, int first, int last);
+
 private:
-    bool dateInRange(const QDate &date) const;
+    bool rowMatches(int sourceRow, const QModelIndex &sourceParent) const;
+    qint64 sourceRowId(int sourceRow, const QModelIndex &sourceParent) const;
+    void applyFilter();
+
+    SermonSearchQuery searchQuery;
+    SermonTableModel *sermonModel; //The source, if it is one; its deleted rows are never accepted.
 
-    QDate minDate;
-    QDate maxDate;
-    QHash<int, QRegExp> multiFilter;
+    //Incremental narrowing: what the current results were filtered with, and which source rows passed.
+    SermonSearchQuery appliedQuery;
+    mutable QBitArray acceptedRows;
+    bool acceptedRowsValid;
+    bool narrowing;
+    bool precomputed;
+    QSet<qint64> precomputedRowIds;
+    bool transcriptionsMatched; //The source's transcription column is only a flag; matches were read from the table.
+    QSet<qint64> transcriptionRowIds;
 };
 
 #endif // SERMONSORTFILTERPROXYMODEL_H
@@ -0,0 +1,465 @@
+#include "sermontablemodel.h"
+#include "tracer.h"
+
+#include <QSqlDriver>
+#include <QSqlField>
+#include <QSqlIndex>
+
+#define CHANGE_LOG_RESELECT_ROWS 1000 //More changed rows than this are read in with select().
+
+SermonTableModel::SermonTableModel(QObject *parent, QSqlDatabase db) :
+    QSqlTableModel(parent, db), attachments(NULL), journal(NULL), indexedRows(0), lastChange(-1), fetching(false),
+    sortedColumn(-1), sortedOrder(Qt::AscendingOrder), unfetchedInserts(false)
+{
+    connect(this, SIGNAL(primeInsert(int,QSqlRecord&)), this, SLOT(assignRowId(int,QSqlRecord&)));
+
+    connect(this, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)), this, SLOT(rowsChanged(QModelIndex,QModelIndex,QVector<int>)));
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(rowsAdded(QModelIndex,int,int)));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(rowsDropped(QModelIndex,int,int)));
+    connect(this, SIGNAL(modelReset()), this, SLOT(contentsChanged()));
+    connect(this, SIGNAL(modelReset()), this, SLOT(forgetRows()));
+}
+
+void SermonTableModel::setTable(const QString &tableName)
+{
+    QSqlTableModel::setTable(tableName);
+
+    QSqlDriver *driver = database().driver();
+    QSqlRecord tableRecord = database().record(tableName);
+    QStringList columns;
+    for (int i = 0; i < tableRecord.count(); ++i) {
+        QString column = driver->escapeIdentifier(tableRecord.fieldName(i), QSqlDriver::FieldName);
+        if (i == Sermon_Transcription)
+            //Transcriptions can be huge and are never shown in the table, only whether there is one.
+            columns << "NULLIF(" + column + " IS NOT NULL, 0) AS " + column;
+        else
+            columns << column;
+    }
+    tableColumns = columns.join(", ");
+
+    //The table has no declared key, so updates and row refreshes are matched on rowid.
+    QSqlIndex key(tableName, "rowid");
+    key.append(QSqlField("rowid", QVariant::LongLong));
+    setPrimaryKey(key);
+}
+
+//Lets the status flag entries whose audio folder has gone missing.
+void SermonTableModel::setAttachmentManifest(AttachmentManifest *manifest)
+{
+    attachments = manifest;
+    connect(attachments, SIGNAL(entryChanged(QString)), this, SLOT(attachmentsChanged(QString)));
+    connect(attachments, SIGNAL(manifestLoaded()), this, SLOT(manifestLoaded()));
+    statuses.clear();
+}
+
+QVariant SermonTableModel::data(const QModelIndex &index, int role) const
+{
+    if (role == SermonStatusRole)
+        return index.isValid() ? rowStatus(index.row()) : 0;
+    return QSqlTableModel::data(index, role);
+}
+
+/* Status_* bits for 'row'. The first call for a row reads its fields; later
+ * ones are a vector lookup, so painting the status columns is cheap.
+ */
+int SermonTableModel::rowStatus(int row) const
+{
+    if (row >= statuses.size())
+        statuses.resize(rowCount());
+    if (row < 0 || row >= statuses.size())
+        return 0;
+
+    quint8 status = statuses.at(row);
+    if (status & Status_Known)
+        return status;
+
+    status = Status_Known;
+    QVariant id = QSqlTableModel::data(index(row, Sermon_ID));
+    if (!id.isNull()) {
+        status |= Status_Audio;
+        //Only a listing the manifest already holds counts; an unlisted entry is not looked up from here.
+        if (attachments != NULL && attachments->fileCount(id.toString()) == 0)
+            status |= Status_MissingFiles;
+    }
+    if (!QSqlTableModel::data(index(row, Sermon_Transcription)).isNull())
+        status |= Status_Transcription;
+    statuses[row] = status;
+    return status;
+}
+
+qint64 SermonTableModel::rowId(int row) const
+{
+    return data(index(row, Sermon_RowId)).toLongLong();
+}
+
+/* Lazy fetching appends rows that are already in the database, so it does
+ * not count as a change to the table (see tableChanged()). Any other
+ * insertion is a new, unsaved record.
+ */
+void SermonTableModel::fetchMore(const QModelIndex &parent)
+{
+    fetching = true;
+    QSqlTableModel::fetchMore(parent);
+    fetching = false;
+
+    //The query the rows come from predates the rows added elsewhere; now that it is used up, read them in.
+    if (unfetchedInserts && !canFetchMore()) {
+        unfetchedInserts = false;
+        QMetaObject::invokeMethod(this, "select", Qt::QueuedConnection); //Not while the view is still fetching.
+    }
+}
+
+void SermonTableModel::rowsAdded(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent);
+    if (!fetching) {
+        contentsChanged();
+        ShiftRows(first, last - first + 1); //Rows after the new one have moved down.
+    }
+}
+
+//Only new rows that were never saved can really be taken out of the model; see deleteRowFromTable().
+void SermonTableModel::rowsDropped(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent);
+    contentsChanged();
+    ShiftRows(last + 1, first - last - 1);
+}
+
+void SermonTableModel::forgetRows()
+{
+    rowsById.clear();
+    rowsByEntryId.clear();
+    indexedRows = 0;
+    removedRows.clear();
+}
+
+//Row numbers from 'from' on have moved by 'offset'.
+void SermonTableModel::ShiftRows(int from, int offset)
+{
+    rowsById.clear();
+    rowsByEntryId.clear();
+    indexedRows = 0;
+    QSet<int> shifted;
+    foreach (int row, removedRows) {
+        if (row >= from)
+            shifted.insert(row + offset);
+        else if (offset > 0 || row < from + offset)
+            shifted.insert(row); //Unless it was one of the rows taken out.
+    }
+    removedRows = shifted;
+}
+
+void SermonTableModel::contentsChanged()
+{
+    statuses.clear();
+    emit tableChanged();
+}
+
+void SermonTableModel::rowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
+{
+    if (roles.size() == 1 && roles.first() == SermonStatusRole)
+        return; //Only our own status went stale; the data itself is the same.
+
+    emit tableChanged();
+    for (int row = topLeft.row(); row <= bottomRight.row() && row < statuses.size(); ++row)
+        statuses[row] = 0;
+    //Audio was bound (or unbound): the old id is caught when it is next looked up, the new one is added here.
+    if (topLeft.column() <= Sermon_ID && bottomRight.column() >= Sermon_ID) {
+        for (int row = topLeft.row(); row <= bottomRight.row() && row < indexedRows; ++row) {
+            QString entryId = QSqlTableModel::data(index(row, Sermon_ID)).toString();
+            if (!entryId.isEmpty())
+                rowsByEntryId.insert(entryId, row);
+        }
+    }
+}
+
+//Only rows whose status was worked out can be on screen, so a row not fetched yet is not looked for.
+void SermonTableModel::attachmentsChanged(const QString &entryId)
+{
+    int row = IndexedRowOfEntry(entryId);
+    if (row < 0 || row >= statuses.size() || statuses.at(row) == 0)
+        return;
+    statuses[row] = 0;
+    emit dataChanged(index(row, Sermon_ID), index(row, Sermon_ID), QVector<int>() << SermonStatusRole);
+}
+
+/* The manifest was read in the background, so rows painted before it came in
+ * could not tell whether their folder is empty. Works those out again.
+ */
+void SermonTableModel::manifestLoaded()
+{
+    for (int row = 0; row < statuses.size(); ++row) {
+        quint8 before = statuses.at(row);
+        if (!(before & Status_Audio))
+            continue;
+        statuses[row] = 0;
+        if (rowStatus(row) != before)
+            emit dataChanged(index(row, Sermon_ID), index(row, Sermon_ID), QVector<int>() << SermonStatusRole);
+    }
+}
+
+QString SermonTableModel::selectStatement() const
+{
+    if (tableColumns.isEmpty())
+        return QSqlTableModel::selectStatement();
+
+    //Same statement QSqlTableModel would build, plus the rowid as the last (hidden) column.
+    QString stmt = "SELECT " + tableColumns + ", rowid AS " +
+            database().driver()->escapeIdentifier("rowid", QSqlDriver::FieldName) +
+            " FROM " + database().driver()->escapeIdentifier(tableName(), QSqlDriver::TableName);
+    if (!filter().isEmpty())
+        stmt += " WHERE " + filter();
+    QString orderBy = orderByClause();
+    if (!orderBy.isEmpty())
+        stmt += " " + orderBy;
+    return stmt;
+}
+
+//Whatever is still in the journal would be read back as it was before the edit.
+bool SermonTableModel::select()
+{
+    if (journal != NULL)
+        journal->flush();
+    qint64 latest = LatestChange(); //Taken first: a change made meanwhile is read twice rather than missed.
+    if (!QSqlTableModel::select())
+        return false;
+    lastChange = latest;
+    unfetchedInserts = false;
+    return true;
+}
+
+void SermonTableModel::setSort(int column, Qt::SortOrder order)
+{
+    QSqlTableModel::setSort(column, order);
+    sortedColumn = column;
+    sortedOrder = order;
+}
+
+/* Brings the model up to date with what has been written to the table
+ * since it was selected, by this program or any other (the CSV import, the
+ * batch tool, a second copy on the same library). Changed rows are read in
+ * again one at a time and deleted ones marked removed, so the proxy and the
+ * views only update those rows. Rows added elsewhere have no place in the
+ * query the model reads from, so if they sort among the rows fetched so
+ * far they, or a flood of changes, still mean selecting the whole table
+ * again. Rows added past the fetched ones wait until the rest is fetched.
+ * Without a change log there is nothing to go by, and nothing is done.
+ */
+bool SermonTableModel::applyChanges()
+{
+    if (lastChange < 0)
+        return true;
+    TraceSpan span("SermonTableModel::applyChanges");
+    if (journal != NULL)
+        journal->flush();
+
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT seq, row_id, change FROM " + DatabaseSupport::GetChangeLogName() +
+                                                     " WHERE seq > ? ORDER BY seq;");
+    query.bindValue(0, lastChange);
+    if (!query.exec())
+        return select();
+    QHash<qint64, QChar> changes; //Last change to each row; an insertion followed by updates stays an insertion.
+    qint64 latest = lastChange;
+    while (query.next()) {
+        latest = query.value(0).toLongLong();
+        qint64 changedRow = query.value(1).toLongLong();
+        QChar change = query.value(2).toString().at(0);
+        if (change != 'U' || changes.value(changedRow) != 'I')
+            changes.insert(changedRow, change);
+        if (changes.size() > CHANGE_LOG_RESELECT_ROWS)
+            break;
+    }
+    query.finish();
+    span.setValue(changes.size());
+    if (changes.isEmpty())
+        return true;
+    if (changes.size() > CHANGE_LOG_RESELECT_ROWS)
+        return select();
+
+    IndexRows();
+    QList<qint64> added;
+    for (QHash<qint64, QChar>::const_iterator i = changes.constBegin(); i != changes.constEnd(); ++i) {
+        int row = rowsById.value(i.key(), -1);
+        if (row < 0) {
+            //Not among the rows fetched so far: an update or deletion there is read when the rows are fetched.
+            if (i.value() == 'I')
+                added.append(i.key());
+            continue;
+        }
+        if (removedRows.contains(row))
+            continue;
+        if (i.value() == 'D')
+            removedRows.insert(row); //Before selectRow() signals the change, so the proxy drops the row.
+        if (row < statuses.size())
+            statuses[row] = 0;
+        selectRow(row);
+    }
+    lastChange = latest;
+    if (added.isEmpty())
+        return true;
+    if (SortAmongFetchedRows(added))
+        return select();
+    unfetchedInserts = true;
+    return true;
+}
+
+/* Whether any of these new rows would be shown among the rows fetched so
+ * far, rather than after them. Ties with the last fetched row count as
+ * among them; so does anything that cannot be worked out.
+ */
+bool SermonTableModel::SortAmongFetchedRows(const QList<qint64> &insertedRowIds)
+{
+    const int last = rowCount() - 1;
+    if (!canFetchMore() || last < 0)
+        return true;
+    if (sortedColumn == Sermon_Transcription || sortedColumn >= Sermon_RowId)
+        return true; //Not a plain column of the table.
+
+    QSqlDriver *driver = database().driver();
+    QStringList ids;
+    foreach (qint64 rowId, insertedRowIds)
+        ids << QString::number(rowId);
+    const bool descending = sortedOrder == Qt::DescendingOrder;
+    QString column = sortedColumn < 0 ? QString("rowid") : driver->escapeIdentifier(record().fieldName(sortedColumn), QSqlDriver::FieldName);
+    QVariant lastValue = sortedColumn < 0 ? QVariant(rowId(last)) : QSqlTableModel::data(index(last, sortedColumn));
+
+    //SQLite sorts NULL first.
+    QString stmt = "SELECT COUNT(*) FROM " + driver->escapeIdentifier(tableName(), QSqlDriver::TableName) +
+            " WHERE rowid IN (" + ids.join(",") + ")";
+    if (!filter().isEmpty())
+        stmt += " AND (" + filter() + ")";
+    if (lastValue.isNull())
+        stmt += descending ? "" : " AND " + column + " IS NULL";
+    else
+        stmt += " AND (" + column + (descending ? " >= ?" : " <= ? OR " + column + " IS NULL") + ")";
+
+    QSqlQuery query(database());
+    query.prepare(stmt);
+    if (!lastValue.isNull())
+        query.addBindValue(lastValue);
+    if (!query.exec() || !query.next())
+        return true;
+    return query.value(0).toInt() > 0;
+}
+
+qint64 SermonTableModel::LatestChange() const
+{
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT IFNULL(MAX(seq), 0) FROM " + DatabaseSupport::GetChangeLogName() + ";");
+    qint64 latest = query.exec() && query.next() ? query.value(0).toLongLong() : -1;
+    query.finish();
+    return latest;
+}
+
+//Extends the rowid and id lookups to the rows fetched since they were last used.
+void SermonTableModel::IndexRows()
+{
+    for (; indexedRows < rowCount(); ++indexedRows) {
+        rowsById.insert(rowId(indexedRows), indexedRows);
+        QString entryId = QSqlTableModel::data(index(indexedRows, Sermon_ID)).toString();
+        if (!entryId.isEmpty() && !rowsByEntryId.contains(entryId))
+            rowsByEntryId.insert(entryId, indexedRows); //Older libraries may repeat an id; the first row wins, as it always has.
+    }
+}
+
+/* The row of the entry whose audio is bound under 'entryId', or -1. Rows
+ * fetched so far are found through a hash. Beyond them, the unique index on
+ * the id column tells at once whether the entry exists, and only then are
+ * more rows fetched until it turns up.
+ */
+int SermonTableModel::rowOfEntry(const QString &entryId)
+{
+    if (entryId.isEmpty())
+        return -1;
+    int row = IndexedRowOfEntry(entryId);
+    if (row >= 0 || !canFetchMore())
+        return row;
+
+    QSqlQuery query = DatabaseSupport::PreparedQuery("SELECT 1 FROM " + database().driver()->escapeIdentifier(tableName(), QSqlDriver::TableName) +
+                                                     " WHERE id = ?" + (filter().isEmpty() ? QString() : " AND (" + filter() + ")") + ";");
+    query.bindValue(0, entryId);
+    bool exists = query.exec() && query.next();
+    query.finish();
+    while (exists && row < 0 && canFetchMore()) {
+        fetchMore();
+        row = IndexedRowOfEntry(entryId);
+    }
+    return row;
+}
+
+int SermonTableModel::IndexedRowOfEntry(const QString &entryId)
+{
+    IndexRows();
+    QHash<QString, int>::iterator found = rowsByEntryId.find(entryId);
+    if (found == rowsByEntryId.end())
+        return -1;
+    int row = found.value();
+    if (!removedRows.contains(row) && QSqlTableModel::data(index(row, Sermon_ID)).toString() == entryId)
+        return row;
+
+    /* The row was deleted, or its audio has been bound anew. Another fetched
+     * row may still carry the id (older libraries repeat ids, and audio can be
+     * bound to a second row), so look for it before giving up.
+     */
+    rowsByEntryId.erase(found);
+    for (row = 0; row < indexedRows; ++row) {
+        if (!removedRows.contains(row) && QSqlTableModel::data(index(row, Sermon_ID)).toString() == entryId) {
+            rowsByEntryId.insert(entryId, row);
+            return row;
+        }
+    }
+    return -1;
+}
+
+int SermonTableModel::removedRowsBefore(int row) const
+{
+    int before = 0;
+    foreach (int removed, removedRows) {
+        if (removed < row)
+            ++before;
+    }
+    return before;
+}
+
+//After a row is submitted it is read back from the table; one whose edit is still in the journal keeps the edited values instead.
+bool SermonTableModel::selectRow(int row)
+{
+    if (journal != NULL && journal->isPending(rowId(row)))
+        return true;
+    return QSqlTableModel::selectRow(row);
+}
+
+/* Plain edits go to the journal. Binding audio (the id column) is written at
+ * once, because it is part of a larger transaction; see
+ * EditSermon::GenerateNewEntry(). So is any edit the journal cannot take.
+ */
+bool SermonTableModel::updateRowInTable(int row, const QSqlRecord &values)
+{
+    if (journal != NULL && !values.isGenerated(Sermon_ID) && journal->record(rowId(row), values))
+        return true;
+    return QSqlTableModel::updateRowInTable(row, values);
+}
+
+bool SermonTableModel::deleteRowFromTable(int row)
+{
+    if (!QSqlTableModel::deleteRowFromTable(row))
+        return false;
+    removedRows.insert(row);
+    if (row < statuses.size())
+        statuses[row] = 0;
+    return true;
+}
+
+/* New rows get their rowid up front, so that the row can be found again by
+ * its key as soon as it has been written to the database.
+ */
+void SermonTableModel::assignRowId(int row, QSqlRecord &record)
+{
+    Q_UNUSED(row);
+    QSqlQuery query("SELECT IFNULL(MAX(rowid), 0) + 1 FROM " + tableName(), database());
+    if (!query.next())
+        return; //Leave it to SQLite; the row will show up properly after the next select().
+
+    record.setValue("rowid", query.value(0));
+    record.setGenerated("rowid", true);
+}
@@ -0,0 +1,124 @@
+#ifndef SERMONTABLEMODEL_H
+#define SERMONTABLEMODEL_H
+
+#include <QSqlTableModel>
+#include <QSqlRecord>
+#include <QHash>
+#include <QSet>
+
+#include "databasesupport.h"
+#include "attachmentmanifest.h"
+#include "editjournal.h"
+
+/* The main sermon table model. It behaves like a plain QSqlTableModel, except
+ * that every row also carries SQLite's rowid (in the hidden Sermon_RowId column).
+ * The rowid is what the full-text index is keyed on, and it doubles as the
+ * primary key for updates, since the id column stays NULL until audio is bound.
+ * The Sermon_Transcription column only says whether there is a transcription
+ * (1 or NULL); the text itself is not read into the model.
+ *
+ * Code that needs to scan every row reads a SermonCatalog of the same table
+ * from a SermonCatalogProvider instead; tableChanged() tells it when the
+ * catalog it holds is out of date.
+ *
+ * For painting, SermonStatusRole gives each row's status bits, worked out
+ * once per row and kept until the row changes.
+ *
+ * With an EditJournal set, edited rows are handed to the journal instead of
+ * being written one UPDATE (and one commit) at a time. The model keeps
+ * showing the edited values, and the journal is flushed before anything
+ * reads the table again (select(), and the catalog provider via editJournal()).
+ *
+ * Rows deleted through the model, or found deleted by applyChanges(), stay
+ * in it as blank rows until the next select(), as QSqlTableModel leaves
+ * them; isRowRemoved() tells them apart, and the proxy and the Edit dialog
+ * skip them. That way dropping one entry does not mean reading the whole table.
+ *
+ * The model is not windowed: rows are fetched in order as the view scrolls
+ * to them and are kept until the next select(), and rowCount() is the number
+ * fetched so far rather than a COUNT(*). A model that only held pages around
+ * the viewport would not fit the code built on this one: the Edit dialog's
+ * QDataWidgetMapper, the sort/filter proxy and MainWindow all address
+ * entries by row number, and the proxy sorts and filters among loaded rows.
+ * What keeps startup short is that only the first batch of rows is read, with
+ * no transcription text, and that column widths are measured on visible rows
+ * only (see MainWindow::InitTableModelAndView()).
+ */
+class SermonTableModel : public QSqlTableModel
+{
+    Q_OBJECT
+
+public:
+    enum { SermonStatusRole = Qt::UserRole + 1 };
+    enum StatusFlag {
+        Status_Audio = 0x01,
+        Status_Transcription = 0x02,
+        Status_MissingFiles = 0x04, //Audio is bound, but the entry's folder has no files.
+        Status_Known = 0x80 //Internal: the row's status has been worked out.
+    };
+
+    explicit SermonTableModel(QObject *parent = 0, QSqlDatabase db = QSqlDatabase());
+
+    void setTable(const QString &tableName) Q_DECL_OVERRIDE;
+    void setSort(int column, Qt::SortOrder order) Q_DECL_OVERRIDE;
+    void setAttachmentManifest(AttachmentManifest *manifest);
+    void setEditJournal(EditJournal *editJournal) { journal = editJournal; }
+    EditJournal *editJournal() const { return journal; }
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
+    int rowStatus(int row) const;
+
+    qint64 rowId(int row) const;
+    int rowOfEntry(const QString &entryId);
+    bool isRowRemoved(int row) const { return removedRows.contains(row); }
+    int removedRowCount() const { return removedRows.size(); }
+    int removedRowsBefore(int row) const;
+
+    void fetchMore(const QModelIndex &parent = QModelIndex()) Q_DECL_OVERRIDE;
+
+signals:
+    void tableChanged(); //Rows were edited, added or removed, or read in again; fetching more rows does not count.
+
+public slots:
+    bool select() Q_DECL_OVERRIDE;
+    bool selectRow(int row) Q_DECL_OVERRIDE;
+    bool applyChanges();
+
+protected:
+    QString selectStatement() const Q_DECL_OVERRIDE;
+    bool updateRowInTable(int row, const QSqlRecord &values) Q_DECL_OVERRIDE;
+    bool deleteRowFromTable(int row) Q_DECL_OVERRIDE;
+
+private slots:
+    void assignRowId(int row, QSqlRecord &record);
+    void contentsChanged();
+    void rowsAdded(const QModelIndex &parent, int first, int last);
+    void rowsDropped(const QModelIndex &parent, int first, int last);
+    void rowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles);
+    void attachmentsChanged(const QString &entryId);
+    void manifestLoaded();
+    void forgetRows();
+
+private:
+    qint64 LatestChange() const;
+    bool SortAmongFetchedRows(const QList<qint64> &insertedRowIds);
+    void IndexRows();
+    int IndexedRowOfEntry(const QString &entryId);
+    void ShiftRows(int from, int offset);
+
+    QString tableColumns; //Escaped, comma separated column list of the underlying table.
+    AttachmentManifest *attachments;
+    EditJournal *journal;
+    mutable QVector<quint8> statuses; //By row; 0 where not worked out yet.
+    QSet<int> removedRows;
+    QHash<qint64, int> rowsById; //Row of each rowid, for rows 0 to indexedRows - 1.
+    QHash<QString, int> rowsByEntryId; //Likewise for the id column; checked against the row on use.
+    int indexedRows;
+    qint64 lastChange; //Last change log entry the model reflects; -1 if there is no change log.
+    bool fetching;
+    int sortedColumn; //As given to setSort(); -1 for rowid order.
+    Qt::SortOrder sortedOrder;
+    bool unfetchedInserts; //Rows added elsewhere that sort after the rows fetched so far; see fetchMore().
+};
+
+#endif // SERMONTABLEMODEL_H
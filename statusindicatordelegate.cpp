@@ -1,4 +1,5 @@
 #include "statusindicatordelegate.h"
+#include "sermontablemodel.h"
 
 StatusIndicatorDelegate::StatusIndicatorDelegate(QWidget *parent) :
     QStyledItemDelegate(parent)
@@ -17,14 +18,17 @@ void StatusIndicatorDelegate::paint(QPainter *painter, const QStyleOptionViewIte
     painter->setPen(Qt::NoPen);
     painter->translate(option.rect.x(), option.rect.y());
 
-    QPixmap stateIcon;
-    if (index.data().isNull()) {
-        stateIcon.load(":/images/fail.png");
-    } else {
-        stateIcon.load(":/images/ok.png");
-    }
+    //The model keeps each row's status bits, so there is nothing to decode or null-check here.
+    int status = index.data(SermonTableModel::SermonStatusRole).toInt();
+    bool ok;
+    if (index.column() == Sermon_Transcription)
+        ok = status & SermonTableModel::Status_Transcription;
+    else
+        ok = (status & SermonTableModel::Status_Audio) && !(status & SermonTableModel::Status_MissingFiles);
+    const QPixmap &stateIcon = StatusPixmap(ok, painter->device()->devicePixelRatioF());
+    const QSize iconSize = stateIcon.size() / stateIcon.devicePixelRatio();
 
-    painter->drawPixmap((option.rect.width() - stateIcon.width()) / 2, (option.rect.height() - stateIcon.height()) / 2, stateIcon.width(), stateIcon.height(), stateIcon);
+    painter->drawPixmap((option.rect.width() - iconSize.width()) / 2, (option.rect.height() - iconSize.height()) / 2, iconSize.width(), iconSize.height(), stateIcon);
     painter->restore();
 }
 
@@ -33,3 +37,21 @@ QSize StatusIndicatorDelegate::sizeHint(const QStyleOptionViewItem &option,
 {
     return QSize(option.rect.width(), option.rect.height());
 }
+
+/* The two icons, decoded once and kept for each screen resolution in use.
+ * QIcon picks an @2x image where the resources have one.
+ */
+const QPixmap &StatusIndicatorDelegate::StatusPixmap(bool ok, qreal devicePixelRatio)
+{
+    static QHash<int, QPixmap> cache;
+    int key = int(devicePixelRatio * 100) * 2 + (ok ? 1 : 0);
+    QHash<int, QPixmap>::iterator cached = cache.find(key);
+    if (cached == cache.end()) {
+        QIcon icon(ok ? ":/images/ok.png" : ":/images/fail.png");
+        QSize size = icon.availableSizes().value(0);
+        QPixmap pixmap = icon.pixmap(size * devicePixelRatio); //No bigger than the largest image there is.
+        pixmap.setDevicePixelRatio(qreal(pixmap.width()) / qMax(1, size.width()));
+        cached = cache.insert(key, pixmap);
+    }
+    return cached.value();
+}
@@ -15,6 +15,9 @@ public:
                      const QModelIndex &index) const Q_DECL_OVERRIDE;
     QSize sizeHint(const QStyleOptionViewItem &option,
                          const QModelIndex &index) const Q_DECL_OVERRIDE;
+
+private:
+    static const QPixmap &StatusPixmap(bool ok, qreal devicePixelRatio);
 };
 
 #endif // STATUSINDICATORDELEGATE_H
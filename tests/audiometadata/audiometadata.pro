@@ -0,0 +1,16 @@
+QT       += core
+QT       += testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_audiometadata
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_audiometadata.cpp \
+    ../../audiometadata.cpp
+
+HEADERS  += ../../audiometadata.h
@@ -0,0 +1,245 @@
+#include "audiometadata.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QtEndian>
+
+#define MP3_FRAME_128K_44K 417 //Bytes in an MPEG-1 layer III frame at 128 kbit/s and 44.1 kHz, without padding.
+
+//The headers are built here byte by byte, as the formats lay them out, so no sample files are needed.
+class TestAudioMetadata : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readsWav();
+    void readsTruncatedWav();
+    void readsConstantBitrateMp3();
+    void readsTaggedMp3();
+    void readsXingMp3();
+    void readsWma();
+    void rejectsLiveWma();
+    void rejectsOtherFiles();
+    void recognisesAudioFileNames();
+
+private:
+    QTemporaryDir dir;
+    QString WriteFile(const QString &name, const QByteArray &contents);
+    static QByteArray Mp3Frame(const QByteArray &payload = QByteArray());
+    static QByteArray AsfObject(const uchar *guid, const QByteArray &body);
+};
+
+static QByteArray LittleEndian16(quint16 value)
+{
+    uchar bytes[2];
+    qToLittleEndian(value, bytes);
+    return QByteArray(reinterpret_cast<const char *>(bytes), 2);
+}
+
+static QByteArray LittleEndian32(quint32 value)
+{
+    uchar bytes[4];
+    qToLittleEndian(value, bytes);
+    return QByteArray(reinterpret_cast<const char *>(bytes), 4);
+}
+
+static QByteArray LittleEndian64(quint64 value)
+{
+    uchar bytes[8];
+    qToLittleEndian(value, bytes);
+    return QByteArray(reinterpret_cast<const char *>(bytes), 8);
+}
+
+static QByteArray BigEndian32(quint32 value)
+{
+    uchar bytes[4];
+    qToBigEndian(value, bytes);
+    return QByteArray(reinterpret_cast<const char *>(bytes), 4);
+}
+
+static const uchar asfHeaderGuid[16] = { 0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C };
+static const uchar asfFilePropertiesGuid[16] = { 0xA1, 0xDC, 0xAB, 0x8C, 0x47, 0xA9, 0xCF, 0x11, 0x8E, 0xE4, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65 };
+static const uchar asfStreamPropertiesGuid[16] = { 0x91, 0x07, 0xDC, 0xB7, 0xB7, 0xA9, 0xCF, 0x11, 0x8E, 0xE6, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65 };
+static const uchar asfAudioMediaGuid[16] = { 0x40, 0x9E, 0x69, 0xF8, 0x4D, 0x5B, 0xCF, 0x11, 0xA8, 0xFD, 0x00, 0x80, 0x5F, 0x5C, 0x44, 0x2B };
+static const uchar asfOtherGuid[16] = { 0x33, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C }; //Content description.
+
+QString TestAudioMetadata::WriteFile(const QString &name, const QByteArray &contents)
+{
+    QString fileName = dir.path() + "/" + name;
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size())
+        return QString();
+    return fileName;
+}
+
+//MPEG-1 layer III, 128 kbit/s, 44.1 kHz, stereo, no CRC or padding.
+QByteArray TestAudioMetadata::Mp3Frame(const QByteArray &payload)
+{
+    QByteArray frame("\xFF\xFB\x90\x00", 4);
+    frame.append(payload);
+    frame.append(QByteArray(MP3_FRAME_128K_44K - frame.size(), '\0'));
+    return frame;
+}
+
+QByteArray TestAudioMetadata::AsfObject(const uchar *guid, const QByteArray &body)
+{
+    return QByteArray(reinterpret_cast<const char *>(guid), 16) + LittleEndian64(24 + body.size()) + body;
+}
+
+//16-bit stereo at 44.1 kHz, two seconds of it, after a LIST chunk of odd length (chunks are padded to even lengths).
+void TestAudioMetadata::readsWav()
+{
+    QByteArray format = LittleEndian16(1) + LittleEndian16(2) + LittleEndian32(44100) + LittleEndian32(176400) +
+            LittleEndian16(4) + LittleEndian16(16);
+    QByteArray wav = QByteArray("RIFF") + LittleEndian32(0) + "WAVE" +
+            "LIST" + LittleEndian32(5) + QByteArray("INFO!\0", 6) +
+            "fmt " + LittleEndian32(format.size()) + format +
+            "data" + LittleEndian32(2 * 176400) + QByteArray(2 * 176400, '\0');
+    QString fileName = WriteFile("two seconds.wav", wav);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.format, QString("wav"));
+    QCOMPARE(info.durationMs, qint64(2000));
+    QCOMPARE(info.channels, 2);
+    QCOMPARE(info.sampleRate, 44100);
+    QCOMPARE(info.bitrate, 1411200);
+}
+
+//A recorder that was cut off leaves the data size too large; the file's own size counts.
+void TestAudioMetadata::readsTruncatedWav()
+{
+    QByteArray format = LittleEndian16(1) + LittleEndian16(1) + LittleEndian32(8000) + LittleEndian32(8000) +
+            LittleEndian16(1) + LittleEndian16(8);
+    QByteArray wav = QByteArray("RIFF") + LittleEndian32(0xFFFFFFFF) + "WAVE" +
+            "fmt " + LittleEndian32(format.size()) + format +
+            "data" + LittleEndian32(0xFFFFFFFF) + QByteArray(4000, '\x80');
+    QString fileName = WriteFile("cut off.wav", wav);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.durationMs, qint64(500));
+    QCOMPARE(info.channels, 1);
+}
+
+void TestAudioMetadata::readsConstantBitrateMp3()
+{
+    QByteArray mp3;
+    for (int i = 0; i < 100; ++i)
+        mp3.append(Mp3Frame());
+    QString fileName = WriteFile("constant.mp3", mp3);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.format, QString("mp3"));
+    QCOMPARE(info.bitrate, 128000);
+    QCOMPARE(info.sampleRate, 44100);
+    QCOMPARE(info.channels, 2);
+    QCOMPARE(info.durationMs, qint64(100) * MP3_FRAME_128K_44K * 8 * 1000 / 128000);
+}
+
+//An ID3v2 tag in front and an ID3v1 tag at the end are not audio, and do not count towards the playing time.
+void TestAudioMetadata::readsTaggedMp3()
+{
+    QByteArray mp3 = QByteArray("ID3\x03\x00\x00", 6) + QByteArray("\x00\x00\x07\x68", 4) + QByteArray(1000, '\0'); //1000, in 7-bit bytes.
+    for (int i = 0; i < 100; ++i)
+        mp3.append(Mp3Frame());
+    mp3.append(QByteArray("TAG") + QByteArray(125, ' '));
+    QString fileName = WriteFile("tagged.mp3", mp3);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.durationMs, qint64(100) * MP3_FRAME_128K_44K * 8 * 1000 / 128000);
+}
+
+//A variable bitrate file: the Xing tag in the first frame gives the frame and byte counts.
+void TestAudioMetadata::readsXingMp3()
+{
+    QByteArray xing = QByteArray(32, '\0') + "Xing" + BigEndian32(0x03) + BigEndian32(1000) + BigEndian32(417000);
+    QByteArray mp3 = Mp3Frame(xing) + Mp3Frame() + Mp3Frame();
+    QString fileName = WriteFile("variable.mp3", mp3);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.durationMs, qint64(1000) * 1152 * 1000 / 44100);
+    QCOMPARE(info.bitrate, int(qint64(417000) * 8 * 1000 / info.durationMs));
+}
+
+void TestAudioMetadata::readsWma()
+{
+    QByteArray fileProperties = QByteArray(16, '\0') + LittleEndian64(0) + LittleEndian64(0) + LittleEndian64(0) +
+            LittleEndian64((3100 + 65000) * qint64(10000)) + LittleEndian64(0) + LittleEndian64(3100) +
+            LittleEndian32(0x02) + LittleEndian32(0) + LittleEndian32(0) + LittleEndian32(192000);
+    QByteArray streamProperties = QByteArray(reinterpret_cast<const char *>(asfAudioMediaGuid), 16) + QByteArray(16, '\0') +
+            LittleEndian64(0) + LittleEndian32(18) + LittleEndian32(0) + LittleEndian16(1) + LittleEndian32(0) +
+            LittleEndian16(0x161) + LittleEndian16(2) + LittleEndian32(44100) + LittleEndian32(16000) +
+            LittleEndian16(0) + LittleEndian16(16) + LittleEndian16(0);
+    QByteArray objects = AsfObject(asfOtherGuid, QByteArray(10, 'x')) +
+            AsfObject(asfFilePropertiesGuid, fileProperties) +
+            AsfObject(asfStreamPropertiesGuid, streamProperties);
+    QByteArray wma = QByteArray(reinterpret_cast<const char *>(asfHeaderGuid), 16) + LittleEndian64(30 + objects.size()) +
+            LittleEndian32(3) + QByteArray("\x01\x02", 2) + objects;
+    QString fileName = WriteFile("windows media.wma", wma);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY2(AudioMetadata::Read(fileName, info, error), qPrintable(error));
+    QCOMPARE(info.format, QString("wma"));
+    QCOMPARE(info.durationMs, qint64(65000));
+    QCOMPARE(info.channels, 2);
+    QCOMPARE(info.sampleRate, 44100);
+    QCOMPARE(info.bitrate, 128000);
+}
+
+void TestAudioMetadata::rejectsLiveWma()
+{
+    QByteArray fileProperties = QByteArray(56, '\0') + LittleEndian64(0) + LittleEndian32(0x01) + QByteArray(12, '\0');
+    QByteArray objects = AsfObject(asfFilePropertiesGuid, fileProperties);
+    QByteArray wma = QByteArray(reinterpret_cast<const char *>(asfHeaderGuid), 16) + LittleEndian64(30 + objects.size()) +
+            LittleEndian32(1) + QByteArray("\x01\x02", 2) + objects;
+    QString fileName = WriteFile("live.wma", wma);
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY(!AudioMetadata::Read(fileName, info, error));
+    QVERIFY(!info.isValid());
+}
+
+void TestAudioMetadata::rejectsOtherFiles()
+{
+    QString fileName = WriteFile("notes.pdf", "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+    QVERIFY(!fileName.isEmpty());
+
+    AudioInfo info;
+    QString error;
+    QVERIFY(!AudioMetadata::Read(fileName, info, error));
+    QVERIFY(!error.isEmpty());
+    QVERIFY(info.format.isEmpty());
+}
+
+//Used for files Read() gives up on, so an unreadable recording is not taken for notes.
+void TestAudioMetadata::recognisesAudioFileNames()
+{
+    QVERIFY(AudioMetadata::IsAudioFileName("Sunday.mp3"));
+    QVERIFY(AudioMetadata::IsAudioFileName("C:/Library/Part 2.WAV"));
+    QVERIFY(AudioMetadata::IsAudioFileName("sermon.m4a"));
+    QVERIFY(!AudioMetadata::IsAudioFileName("notes.pdf"));
+    QVERIFY(!AudioMetadata::IsAudioFileName("mp3"));
+    QVERIFY(!AudioMetadata::IsAudioFileName("sermon.mp3.txt"));
+}
+
+QTEST_GUILESS_MAIN(TestAudioMetadata)
+
+#include "tst_audiometadata.moc"
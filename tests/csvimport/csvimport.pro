@@ -0,0 +1,26 @@
+QT       += core
+QT       += sql
+QT       += testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+DEFINES  += MESSAGE_LIBRARIAN_HEADLESS
+DEFINES  += SOURCE_TREE=\\\"$$PWD/../..\\\"
+
+TARGET = tst_sermoncsvimporter
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_sermoncsvimporter.cpp \
+    ../../databasesupport.cpp \
+    ../../tracer.cpp \
+    ../../csvreader.cpp \
+    ../../sermoncsvimporter.cpp
+
+HEADERS  += ../../databasesupport.h \
+    ../../tracer.h \
+    ../../csvreader.h \
+    ../../sermoncsvimporter.h
@@ -0,0 +1,117 @@
+#include "databasesupport.h"
+#include "sermoncsvimporter.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#define MECHANICSVILLE_CSV SOURCE_TREE "/Excel Sermon Title Database/Mechanicsville Sermon Titles.csv"
+#define MECHANICSVILLE_ROWS 61
+
+class TestSermonCsvImporter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void importsMechanicsville();
+    void rejectsRowsWithoutTitleOrDate();
+
+private:
+    QTemporaryDir *library;
+    QString CopyToLibrary(const QString &fileName);
+    int RowCount();
+};
+
+//A new, empty library for every test; the importer writes its report next to the file, so files are copied in.
+void TestSermonCsvImporter::init()
+{
+    library = new QTemporaryDir();
+    QVERIFY(library->isValid());
+    QVERIFY(DatabaseSupport::InitDatabase(library->path()));
+    QVERIFY(DatabaseSupport::CreateNewDatabase());
+}
+
+void TestSermonCsvImporter::cleanup()
+{
+    DatabaseSupport::ReleaseConnection();
+    QSqlDatabase::database().close();
+    delete library;
+    library = NULL;
+}
+
+QString TestSermonCsvImporter::CopyToLibrary(const QString &fileName)
+{
+    QString copy = library->path() + "/" + QFileInfo(fileName).fileName();
+    if (!QFile::copy(fileName, copy))
+        return QString();
+    return copy;
+}
+
+int TestSermonCsvImporter::RowCount()
+{
+    QSqlQuery query(DatabaseSupport::Connection());
+    if (!query.exec("SELECT COUNT(*) FROM " + DatabaseSupport::GetCompatibleDBTableName() + ";") || !query.next())
+        return -1;
+    return query.value(0).toInt();
+}
+
+//Date,Service,Title,Speaker: no location or description column, which the table does not allow to be NULL.
+void TestSermonCsvImporter::importsMechanicsville()
+{
+    QString fileName = CopyToLibrary(MECHANICSVILLE_CSV);
+    QVERIFY(!fileName.isEmpty());
+
+    SermonCsvImporter importer;
+    QVERIFY2(importer.import(fileName, DatabaseSupport::GetCompatibleDBTableName()), qPrintable(importer.errorString()));
+    QCOMPARE(importer.rowsImported(), MECHANICSVILLE_ROWS);
+    QCOMPARE(importer.rowsRejected(), 0);
+    QCOMPARE(RowCount(), MECHANICSVILLE_ROWS);
+    QVERIFY(!QFile::exists(importer.reportFileName()));
+
+    QSqlQuery query(DatabaseSupport::Connection());
+    QVERIFY(query.exec("SELECT title, speaker, location, date, description FROM " + DatabaseSupport::GetCompatibleDBTableName() +
+                       " ORDER BY rowid LIMIT 3;"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("Effectual Fervent Prayer"));
+    QCOMPARE(query.value(1).toString(), QString("Nelson Martin"));
+    QVERIFY(!query.value(2).isNull());
+    QVERIFY(query.value(2).toString().isEmpty());
+    QCOMPARE(query.value(3).toString(), QString("2013-07-07"));
+    QVERIFY(!query.value(4).isNull());
+    QVERIFY(query.next());
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("\"The Unity of the Faith\""));
+}
+
+void TestSermonCsvImporter::rejectsRowsWithoutTitleOrDate()
+{
+    QString fileName = library->path() + "/rejects.csv";
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("Title,Date,Speaker\n"
+               "Kept,3/9/19,A. Speaker\n"
+               ",3/10/19,No Title\n"
+               "Bad Date,the tenth,B. Speaker\n"
+               "\n"
+               "Also Kept,12/31/99,\n");
+    file.close();
+
+    SermonCsvImporter importer;
+    QVERIFY2(importer.import(fileName, DatabaseSupport::GetCompatibleDBTableName()), qPrintable(importer.errorString()));
+    QCOMPARE(importer.rowsImported(), 2);
+    QCOMPARE(importer.rowsRejected(), 2);
+    QCOMPARE(RowCount(), 2);
+    QVERIFY(QFile::exists(importer.reportFileName()));
+
+    QSqlQuery query(DatabaseSupport::Connection());
+    QVERIFY(query.exec("SELECT date FROM " + DatabaseSupport::GetCompatibleDBTableName() + " ORDER BY rowid;"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("2019-03-09"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("1999-12-31"));
+}
+
+QTEST_GUILESS_MAIN(TestSermonCsvImporter)
+
+#include "tst_sermoncsvimporter.moc"
@@ -0,0 +1,16 @@
+QT       += core
+QT       += testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_csvreader
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_csvreader.cpp \
+    ../../csvreader.cpp
+
+HEADERS  += ../../csvreader.h
@@ -0,0 +1,120 @@
+#include "csvreader.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+class TestCsvReader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readsRecords_data();
+    void readsRecords();
+    void countsLinesOfQuotedFields();
+    void readsOtherSeparators();
+    void readsEmptyFile();
+
+private:
+    QTemporaryDir dir;
+    QString WriteFile(const QByteArray &contents);
+};
+
+QString TestCsvReader::WriteFile(const QByteArray &contents)
+{
+    QString fileName = dir.path() + "/test.csv";
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(contents) != contents.size())
+        return QString();
+    return fileName;
+}
+
+void TestCsvReader::readsRecords_data()
+{
+    QTest::addColumn<QByteArray>("contents");
+    QTest::addColumn<QList<QStringList> >("records");
+
+    QTest::newRow("plain") << QByteArray("a,b,c\n1,2,3\n")
+                           << (QList<QStringList>() << (QStringList() << "a" << "b" << "c") << (QStringList() << "1" << "2" << "3"));
+    QTest::newRow("crlf") << QByteArray("a,b\r\nc,d\r\n")
+                          << (QList<QStringList>() << (QStringList() << "a" << "b") << (QStringList() << "c" << "d"));
+    QTest::newRow("no final line end") << QByteArray("a,b\nc")
+                                       << (QList<QStringList>() << (QStringList() << "a" << "b") << (QStringList() << "c"));
+    QTest::newRow("empty fields") << QByteArray("a,,\n,\n")
+                                  << (QList<QStringList>() << (QStringList() << "a" << "" << "") << (QStringList() << "" << ""));
+    QTest::newRow("quoted") << QByteArray("\"x, y\",\"say \"\"hi\"\"\",z\n")
+                            << (QList<QStringList>() << (QStringList() << "x, y" << "say \"hi\"" << "z"));
+    QTest::newRow("quoted crlf") << QByteArray("\"a\"\r\n\"b\"\r\n")
+                                 << (QList<QStringList>() << (QStringList() << "a") << (QStringList() << "b"));
+    QTest::newRow("quoted multi-line") << QByteArray("\"one\ntwo\",b\n")
+                                       << (QList<QStringList>() << (QStringList() << "one\ntwo" << "b"));
+    QTest::newRow("unterminated quote") << QByteArray("a,\"rest of\nthe file")
+                                        << (QList<QStringList>() << (QStringList() << "a" << "rest of\nthe file"));
+    QTest::newRow("byte order mark") << QByteArray("\xEF\xBB\xBFtitle,date\n")
+                                     << (QList<QStringList>() << (QStringList() << "title" << "date"));
+    QTest::newRow("utf-8") << QByteArray("Caf\xC3\xA9,\"\xC3\x9C\"\n")
+                           << (QList<QStringList>() << (QStringList() << QString::fromUtf8("Caf\xC3\xA9") << QString::fromUtf8("\xC3\x9C")));
+}
+
+void TestCsvReader::readsRecords()
+{
+    QFETCH(QByteArray, contents);
+    QFETCH(QList<QStringList>, records);
+
+    QString fileName = WriteFile(contents);
+    QVERIFY(!fileName.isEmpty());
+    CsvReader reader(fileName);
+    QVERIFY2(reader.open(), qPrintable(reader.errorString()));
+
+    QVector<QString> fields;
+    foreach (const QStringList &record, records) {
+        QVERIFY(reader.readRecord(fields));
+        QCOMPARE(fields.toList(), record);
+    }
+    QVERIFY(!reader.readRecord(fields));
+    QCOMPARE(reader.position(), reader.size());
+}
+
+void TestCsvReader::countsLinesOfQuotedFields()
+{
+    QString fileName = WriteFile("\"one\ntwo\",b\nnext,\"three\n\nlines\"\nlast\n");
+    QVERIFY(!fileName.isEmpty());
+    CsvReader reader(fileName);
+    QVERIFY(reader.open());
+
+    QVector<QString> fields;
+    QVERIFY(reader.readRecord(fields));
+    QCOMPARE(reader.lineNumber(), 1);
+    QVERIFY(reader.readRecord(fields));
+    QCOMPARE(reader.lineNumber(), 3);
+    QVERIFY(reader.readRecord(fields));
+    QCOMPARE(reader.lineNumber(), 6);
+    QCOMPARE(fields.toList(), QStringList() << "last");
+}
+
+void TestCsvReader::readsOtherSeparators()
+{
+    QString fileName = WriteFile("a;\"b;c\";d,e\n");
+    QVERIFY(!fileName.isEmpty());
+    CsvReader reader(fileName, ';');
+    QVERIFY(reader.open());
+
+    QVector<QString> fields;
+    QVERIFY(reader.readRecord(fields));
+    QCOMPARE(fields.toList(), QStringList() << "a" << "b;c" << "d,e");
+}
+
+void TestCsvReader::readsEmptyFile()
+{
+    QString fileName = WriteFile(QByteArray());
+    QVERIFY(!fileName.isEmpty());
+    CsvReader reader(fileName);
+    QVERIFY(reader.open());
+
+    QVector<QString> fields;
+    QVERIFY(!reader.readRecord(fields));
+    QVERIFY(fields.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestCsvReader)
+
+#include "tst_csvreader.moc"
@@ -0,0 +1,25 @@
+QT       += core
+QT       += sql
+QT       += testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+DEFINES  += MESSAGE_LIBRARIAN_HEADLESS
+
+TARGET = tst_publishplanner
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_publishplanner.cpp \
+    ../../databasesupport.cpp \
+    ../../tracer.cpp \
+    ../../audiometadata.cpp \
+    ../../publishplanner.cpp
+
+HEADERS  += ../../databasesupport.h \
+    ../../tracer.h \
+    ../../audiometadata.h \
+    ../../publishplanner.h
@@ -0,0 +1,162 @@
+#include "publishplanner.h"
+
+#include <QtTest>
+
+#define MINUTES(n) (qint64(n) * 60 * 1000)
+
+class TestPublishPlanner : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void packsLargestFirst();
+    void keepsSelectionOrderOnEachVolume();
+    void leavesOutWhatCannotBePlanned();
+    void leavesNonAudioOffCds();
+    void limitsTracksPerCd();
+    void roundsDriveFilesToClusters();
+    void namesFolders();
+
+private:
+    static PublishItem Item(const QList<qint64> &durationsMs);
+    static PublishFile File(const QString &name, qint64 size, qint64 durationMs, bool audio);
+};
+
+PublishFile TestPublishPlanner::File(const QString &name, qint64 size, qint64 durationMs, bool audio)
+{
+    PublishFile file;
+    file.name = name;
+    file.path = "/library/entry/" + name;
+    file.size = size;
+    file.durationMs = durationMs;
+    file.audio = audio;
+    return file;
+}
+
+//An entry with one audio file per playing time given.
+PublishItem TestPublishPlanner::Item(const QList<qint64> &durationsMs)
+{
+    PublishItem item;
+    for (int i = 0; i < durationsMs.size(); ++i)
+        item.files << File(QString("%1.mp3").arg(i + 1), durationsMs.at(i) * 16, durationsMs.at(i), true);
+    return item;
+}
+
+//20, 30, 40 and 50 minutes fill two 80 minute CDs when the largest go first; taken in the given order they would need three.
+void TestPublishPlanner::packsLargestFirst()
+{
+    QVector<PublishItem> items;
+    items << Item(QList<qint64>() << MINUTES(20)) << Item(QList<qint64>() << MINUTES(30))
+          << Item(QList<qint64>() << MINUTES(40)) << Item(QList<qint64>() << MINUTES(50));
+    PublishPlan plan = PublishPlanner::Plan(items, PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS));
+
+    QVERIFY(plan.unplaced.isEmpty());
+    QCOMPARE(plan.volumes.size(), 2);
+    QCOMPARE(plan.volumes.at(0).items, QList<int>() << 0 << 3);
+    QCOMPARE(plan.volumes.at(0).used, MINUTES(70) + 2 * CD_TRACK_GAP_MS);
+    QCOMPARE(plan.volumes.at(0).tracks, 2);
+    QCOMPARE(plan.volumes.at(1).items, QList<int>() << 1 << 2);
+}
+
+void TestPublishPlanner::keepsSelectionOrderOnEachVolume()
+{
+    QVector<PublishItem> items;
+    items << Item(QList<qint64>() << MINUTES(20)) << Item(QList<qint64>() << MINUTES(50))
+          << Item(QList<qint64>() << MINUTES(30)) << Item(QList<qint64>() << MINUTES(40));
+    PublishPlan plan = PublishPlanner::Plan(items, PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS));
+
+    QCOMPARE(plan.volumes.size(), 2);
+    QCOMPARE(plan.volumes.at(0).items, QList<int>() << 0 << 1);
+    QCOMPARE(plan.volumes.at(1).items, QList<int>() << 2 << 3);
+}
+
+void TestPublishPlanner::leavesOutWhatCannotBePlanned()
+{
+    PublishItem notesOnly;
+    notesOnly.files << File("notes.pdf", 1000, -1, false);
+    QVector<PublishItem> items;
+    items << Item(QList<qint64>() << MINUTES(10))
+          << Item(QList<qint64>() << MINUTES(75) << MINUTES(10))
+          << Item(QList<qint64>() << -1)
+          << notesOnly
+          << PublishItem();
+    PublishPlan plan = PublishPlanner::Plan(items, PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS));
+
+    QCOMPARE(plan.volumes.size(), 1);
+    QCOMPARE(plan.volumes.at(0).items, QList<int>() << 0);
+    QCOMPARE(plan.unplaced.size(), 4);
+    QCOMPARE(plan.unplaced.at(0), qMakePair(1, QString("it does not fit on one CD")));
+    QCOMPARE(plan.unplaced.at(1), qMakePair(2, QString("the playing time of 1.mp3 is not known")));
+    QCOMPARE(plan.unplaced.at(2), qMakePair(3, QString("it has no audio files")));
+    QCOMPARE(plan.unplaced.at(3), qMakePair(4, QString("it has no audio files")));
+}
+
+void TestPublishPlanner::leavesNonAudioOffCds()
+{
+    PublishItem item = Item(QList<qint64>() << MINUTES(30));
+    item.files << File("notes.pdf", 1000000, -1, false);
+    PublishTarget cd(PublishTarget::AudioCd, CD_74_MINUTES_MS);
+    QVERIFY(!PublishPlanner::IsPublished(item.files.at(1), cd));
+
+    qint64 cost;
+    int tracks;
+    QString reason;
+    QVERIFY(PublishPlanner::Cost(item, cd, cost, tracks, reason));
+    QCOMPARE(cost, MINUTES(30) + CD_TRACK_GAP_MS);
+    QCOMPARE(tracks, 1);
+}
+
+//Two entries of 60 short tracks would fit on one CD by playing time, but not by the 99 track limit.
+void TestPublishPlanner::limitsTracksPerCd()
+{
+    QList<qint64> shortTracks;
+    for (int i = 0; i < 60; ++i)
+        shortTracks << 10 * 1000;
+    QVector<PublishItem> items;
+    items << Item(shortTracks) << Item(shortTracks);
+    PublishPlan plan = PublishPlanner::Plan(items, PublishTarget(PublishTarget::AudioCd, CD_80_MINUTES_MS));
+
+    QVERIFY(plan.unplaced.isEmpty());
+    QCOMPARE(plan.volumes.size(), 2);
+    QCOMPARE(plan.volumes.at(0).tracks, 60);
+}
+
+//On a drive every file counts, audio or not, and takes whole clusters.
+void TestPublishPlanner::roundsDriveFilesToClusters()
+{
+    PublishItem three;
+    three.files << File("1.mp3", 1, 1000, true) << File("2.mp3", USB_CLUSTER_BYTES, 1000, true)
+                << File("notes.pdf", USB_CLUSTER_BYTES + 1, -1, false);
+    PublishItem one;
+    one.files << File("1.wma", 1, 1000, true);
+    QVector<PublishItem> items;
+    items << three << one;
+    PublishPlan plan = PublishPlanner::Plan(items, PublishTarget(PublishTarget::UsbDrive, 4 * USB_CLUSTER_BYTES));
+
+    QVERIFY(plan.unplaced.isEmpty());
+    QCOMPARE(plan.volumes.size(), 2);
+    QCOMPARE(plan.volumes.at(0).items, QList<int>() << 0);
+    QCOMPARE(plan.volumes.at(0).used, qint64(4 * USB_CLUSTER_BYTES));
+    QCOMPARE(plan.volumes.at(0).tracks, 3);
+    QCOMPARE(plan.volumes.at(1).used, qint64(USB_CLUSTER_BYTES));
+}
+
+void TestPublishPlanner::namesFolders()
+{
+    QCOMPARE(PublishPlanner::VolumeFolderName(PublishTarget(PublishTarget::AudioCd), 0), QString("CD 01"));
+    QCOMPARE(PublishPlanner::VolumeFolderName(PublishTarget(PublishTarget::UsbDrive), 11), QString("Drive 12"));
+
+    PublishItem item;
+    item.entryId = "0f8fad5b-d9cb-469f-a165-70867728950e";
+    item.title = "What? Why: \"Now\".";
+    item.date = QDate(2019, 3, 10);
+    QCOMPARE(PublishPlanner::ItemFolderName(item, 0), QString("01 2019-03-10 What_ Why_ _Now_"));
+
+    item.title.clear();
+    item.date = QDate();
+    QCOMPARE(PublishPlanner::ItemFolderName(item, 9), QString("10 0f8fad5b-d9cb-469f-a165-70867728950e"));
+}
+
+QTEST_GUILESS_MAIN(TestPublishPlanner)
+
+#include "tst_publishplanner.moc"
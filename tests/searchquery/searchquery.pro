@@ -0,0 +1,25 @@
+QT       += core
+QT       += sql
+QT       += testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+DEFINES  += MESSAGE_LIBRARIAN_HEADLESS
+
+TARGET = tst_sermonsearchquery
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_sermonsearchquery.cpp \
+    ../../databasesupport.cpp \
+    ../../tracer.cpp \
+    ../../sermonfiltermatcher.cpp \
+    ../../sermonsearchquery.cpp
+
+HEADERS  += ../../databasesupport.h \
+    ../../tracer.h \
+    ../../sermonfiltermatcher.h \
+    ../../sermonsearchquery.h
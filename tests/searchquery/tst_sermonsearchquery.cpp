@@ -0,0 +1,257 @@
+#include "databasesupport.h"
+#include "sermonfiltermatcher.h"
+#include "sermonsearchquery.h"
+
+#include <QtTest>
+
+//How FindSermon's criteria are compiled: per-column matchers, whole queries, and the full-text expression.
+class TestSermonSearchQuery : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void recognizesLiterals_data();
+    void recognizesLiterals();
+    void matches_data();
+    void matches();
+    void matchesInsideLargerText();
+    void matcherNarrows_data();
+    void matcherNarrows();
+    void leavesOutEmptyCriteria();
+    void acceptsDates();
+    void queryNarrows();
+    void buildsFromCriteria();
+    void scansWhenTheIndexCannotAnswer();
+    void buildsSearchExpression();
+    void buildsSearchExpressionForSeveralColumns();
+};
+
+void TestSermonSearchQuery::recognizesLiterals_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<bool>("literal");
+
+    QTest::newRow("word") << "grace" << true;
+    QTest::newRow("words") << "amazing grace" << true;
+    QTest::newRow("punctuation") << "Jones, Sr. - the 2nd" << false;
+    QTest::newRow("apostrophe") << "don't" << true;
+    QTest::newRow("anchor") << "^The" << false;
+    QTest::newRow("alternation") << "faith|hope" << false;
+    QTest::newRow("class") << "Psalm [0-9]+" << false;
+    QTest::newRow("escape") << "a\\.b" << false;
+}
+
+void TestSermonSearchQuery::recognizesLiterals()
+{
+    QFETCH(QString, pattern);
+    QFETCH(bool, literal);
+    QCOMPARE(SermonFilterMatcher::IsLiteralPattern(pattern), literal);
+    QCOMPARE(SermonFilterMatcher(QRegExp(pattern, Qt::CaseInsensitive)).isLiteral(), literal);
+}
+
+void TestSermonSearchQuery::matches_data()
+{
+    QTest::addColumn<QRegExp>("pattern");
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<bool>("match");
+
+    QTest::newRow("empty") << QRegExp() << "anything" << true;
+    QTest::newRow("literal") << QRegExp("grace", Qt::CaseInsensitive) << "Amazing Grace" << true;
+    QTest::newRow("literal, case sensitive") << QRegExp("grace", Qt::CaseSensitive) << "Amazing Grace" << false;
+    QTest::newRow("literal, missing") << QRegExp("mercy", Qt::CaseInsensitive) << "Amazing Grace" << false;
+    QTest::newRow("fixed string") << QRegExp("2.5", Qt::CaseInsensitive, QRegExp::FixedString) << "John 2.5" << true;
+    QTest::newRow("fixed string, not a pattern") << QRegExp("2.5", Qt::CaseInsensitive, QRegExp::FixedString) << "John 245" << false;
+    QTest::newRow("regex") << QRegExp("^the\\s+\\w+ of", Qt::CaseInsensitive) << "The Unity of the Faith" << true;
+    QTest::newRow("regex, anchored") << QRegExp("^faith", Qt::CaseInsensitive) << "The Unity of the Faith" << false;
+    QTest::newRow("regex, case sensitive") << QRegExp("^the", Qt::CaseSensitive) << "The Unity of the Faith" << false;
+    QTest::newRow("regex, non-ASCII") << QRegExp("\\bm\\w+ller$", Qt::CaseInsensitive) << QString::fromUtf8("Hans M\xC3\xBCller") << true;
+}
+
+void TestSermonSearchQuery::matches()
+{
+    QFETCH(QRegExp, pattern);
+    QFETCH(QString, text);
+    QFETCH(bool, match);
+    QCOMPARE(SermonFilterMatcher(pattern).matches(text), match);
+}
+
+//The catalog hands out text as references into one large buffer; a match must not run over the end of the reference.
+void TestSermonSearchQuery::matchesInsideLargerText()
+{
+    QString buffer = "Amazing GraceThe Unity of the Faith";
+    QStringRef title(&buffer, 0, 13);
+    QVERIFY(SermonFilterMatcher(QRegExp("grace", Qt::CaseInsensitive)).matches(title));
+    QVERIFY(!SermonFilterMatcher(QRegExp("unity", Qt::CaseInsensitive)).matches(title));
+    QVERIFY(SermonFilterMatcher(QRegExp("grace$", Qt::CaseInsensitive)).matches(title));
+    QVERIFY(!SermonFilterMatcher(QRegExp("faith$", Qt::CaseInsensitive)).matches(title));
+}
+
+void TestSermonSearchQuery::matcherNarrows_data()
+{
+    QTest::addColumn<QRegExp>("previous");
+    QTest::addColumn<QRegExp>("current");
+    QTest::addColumn<bool>("narrows");
+
+    QTest::newRow("from nothing") << QRegExp() << QRegExp("g", Qt::CaseInsensitive) << true;
+    QTest::newRow("to nothing") << QRegExp("g", Qt::CaseInsensitive) << QRegExp() << false;
+    QTest::newRow("typing on") << QRegExp("gra", Qt::CaseInsensitive) << QRegExp("grace", Qt::CaseInsensitive) << true;
+    QTest::newRow("typing in front") << QRegExp("race", Qt::CaseInsensitive) << QRegExp("grace", Qt::CaseInsensitive) << true;
+    QTest::newRow("backspace") << QRegExp("grace", Qt::CaseInsensitive) << QRegExp("grac", Qt::CaseInsensitive) << false;
+    QTest::newRow("other word") << QRegExp("grace", Qt::CaseInsensitive) << QRegExp("mercy", Qt::CaseInsensitive) << false;
+    QTest::newRow("case differs") << QRegExp("gra", Qt::CaseInsensitive) << QRegExp("GRACE", Qt::CaseInsensitive) << true;
+    QTest::newRow("to case sensitive") << QRegExp("gra", Qt::CaseInsensitive) << QRegExp("Grace", Qt::CaseSensitive) << true;
+    QTest::newRow("to case insensitive") << QRegExp("Gra", Qt::CaseSensitive) << QRegExp("grace", Qt::CaseInsensitive) << false;
+    QTest::newRow("same regex") << QRegExp("^gr.ce", Qt::CaseInsensitive) << QRegExp("^gr.ce", Qt::CaseInsensitive) << true;
+    QTest::newRow("longer regex") << QRegExp("^gr.", Qt::CaseInsensitive) << QRegExp("^gr.ce", Qt::CaseInsensitive) << false;
+    QTest::newRow("literal to regex") << QRegExp("gr", Qt::CaseInsensitive) << QRegExp("gr.ce", Qt::CaseInsensitive) << false;
+}
+
+void TestSermonSearchQuery::matcherNarrows()
+{
+    QFETCH(QRegExp, previous);
+    QFETCH(QRegExp, current);
+    QFETCH(bool, narrows);
+    QCOMPARE(SermonFilterMatcher(current).narrows(SermonFilterMatcher(previous)), narrows);
+}
+
+void TestSermonSearchQuery::leavesOutEmptyCriteria()
+{
+    QHash<int, QRegExp> patterns;
+    patterns.insert(Sermon_Title, QRegExp("grace", Qt::CaseInsensitive));
+    patterns.insert(Sermon_Speaker, QRegExp());
+    SermonSearchQuery query;
+    query.setColumnPatterns(patterns);
+
+    QCOMPARE(query.columnPatterns().size(), 2);
+    QCOMPARE(query.columnMatchers().size(), 1);
+    QVERIFY(query.columnMatchers().contains(Sermon_Title));
+}
+
+void TestSermonSearchQuery::acceptsDates()
+{
+    SermonSearchQuery query;
+    QVERIFY(!query.hasDateRange());
+    QVERIFY(query.acceptsDate(QDate(1999, 12, 31)));
+
+    query.setMinimumDate(QDate(2013, 1, 1));
+    QVERIFY(query.hasDateRange());
+    QVERIFY(!query.acceptsDate(QDate(2012, 12, 31)));
+    QVERIFY(query.acceptsDate(QDate(2013, 1, 1)));
+    QVERIFY(query.acceptsDate(QDate(2020, 6, 1)));
+
+    query.setMaximumDate(QDate(2013, 12, 31));
+    QVERIFY(query.acceptsDate(QDate(2013, 12, 31)));
+    QVERIFY(!query.acceptsDate(QDate(2014, 1, 1)));
+}
+
+void TestSermonSearchQuery::queryNarrows()
+{
+    QHash<int, QRegExp> patterns;
+    patterns.insert(Sermon_Title, QRegExp("gra", Qt::CaseInsensitive));
+    SermonSearchQuery previous;
+    previous.setColumnPatterns(patterns);
+    previous.setMinimumDate(QDate(2013, 1, 1));
+    previous.setRowIdFilter(QSet<qint64>() << 1 << 2 << 3);
+
+    SermonSearchQuery query = previous;
+    QVERIFY(query.narrows(previous));
+
+    patterns.insert(Sermon_Title, QRegExp("grace", Qt::CaseInsensitive));
+    patterns.insert(Sermon_Speaker, QRegExp("martin", Qt::CaseInsensitive));
+    query.setColumnPatterns(patterns);
+    query.setMinimumDate(QDate(2014, 1, 1));
+    query.setMaximumDate(QDate(2015, 1, 1));
+    query.setRowIdFilter(QSet<qint64>() << 1 << 3);
+    QVERIFY(query.narrows(previous));
+    QVERIFY(!previous.narrows(query));
+
+    SermonSearchQuery widerDates = query;
+    widerDates.setMinimumDate(QDate());
+    QVERIFY(!widerDates.narrows(previous));
+
+    SermonSearchQuery otherHits = query;
+    otherHits.setRowIdFilter(QSet<qint64>() << 1 << 4);
+    QVERIFY(!otherHits.narrows(previous));
+
+    SermonSearchQuery noHits = query;
+    noHits.clearRowIdFilter();
+    QVERIFY(!noHits.narrows(previous));
+
+    SermonSearchQuery titleDropped = query;
+    patterns.remove(Sermon_Title);
+    titleDropped.setColumnPatterns(patterns);
+    QVERIFY(!titleDropped.narrows(previous));
+
+    SermonSearchQuery cleared = query;
+    cleared.clear();
+    QVERIFY(!cleared.narrows(previous));
+    QVERIFY(query.narrows(cleared));
+}
+
+//Every word must be present; the last may be unfinished, so each is a prefix query. Punctuation and quotes separate words.
+//No library is open here, so there is no index and every field is matched row by row.
+void TestSermonSearchQuery::buildsFromCriteria()
+{
+    QHash<int, QString> text;
+    text.insert(Sermon_Title, "grace");
+    text.insert(Sermon_Speaker, "^Mar");
+    text.insert(Sermon_Location, "");
+    SermonSearchQuery query = SermonSearchQuery::FromCriteria(text, Qt::CaseSensitive, QDate(2010, 1, 1), QDate());
+
+    QVERIFY(query.fullTextTerms().isEmpty());
+    QCOMPARE(query.columnMatchers().size(), 2);
+    QVERIFY(query.columnMatchers().value(Sermon_Title).matches(QString("Amazing grace")));
+    QVERIFY(!query.columnMatchers().value(Sermon_Title).matches(QString("Amazing Grace")));
+    QVERIFY(query.columnMatchers().value(Sermon_Speaker).matches(QString("Martin")));
+    QCOMPARE(query.minimumDate(), QDate(2010, 1, 1));
+    QVERIFY(!query.maximumDate().isValid());
+}
+
+void TestSermonSearchQuery::scansWhenTheIndexCannotAnswer()
+{
+    QHash<int, QString> terms;
+    terms.insert(Sermon_Description, "Prayer");
+    SermonSearchQuery query;
+    query.setFullTextTerms(terms);
+    QVERIFY(!query.narrows(query)); //Nothing is known before the lookup.
+
+    QVERIFY(!query.resolveFullText());
+    QVERIFY(query.fullTextTerms().isEmpty());
+    QVERIFY(!query.hasRowIdFilter());
+    QVERIFY(query.columnMatchers().value(Sermon_Description).matches(QString("a prayer meeting")));
+}
+
+void TestSermonSearchQuery::buildsSearchExpression()
+{
+    QHash<int, QString> terms;
+    terms.insert(Sermon_Title, "amazing gra");
+    QCOMPARE(DatabaseSupport::BuildSearchExpression(terms), QString("title : \"amazing\"* AND title : \"gra\"*"));
+
+    terms.insert(Sermon_Title, "  \"Faith\"-hope  ");
+    QCOMPARE(DatabaseSupport::BuildSearchExpression(terms), QString("title : \"Faith\"* AND title : \"hope\"*"));
+
+    terms.insert(Sermon_Title, " -- ");
+    QCOMPARE(DatabaseSupport::BuildSearchExpression(terms), QString());
+
+    terms.clear();
+    terms.insert(Sermon_Date, "2013");
+    QCOMPARE(DatabaseSupport::BuildSearchExpression(terms), QString()); //Not in the index.
+}
+
+void TestSermonSearchQuery::buildsSearchExpressionForSeveralColumns()
+{
+    QHash<int, QString> terms;
+    terms.insert(Sermon_Speaker, "martin");
+    terms.insert(Sermon_Location, "mechanicsville");
+    terms.insert(Sermon_Description, "prayer");
+    terms.insert(Sermon_Transcription, "fervent");
+
+    QStringList clauses = DatabaseSupport::BuildSearchExpression(terms).split(" AND ");
+    clauses.sort();
+    QCOMPARE(clauses, QStringList() << "description : \"prayer\"*" << "location : \"mechanicsville\"*"
+                                    << "speaker : \"martin\"*" << "transcription : \"fervent\"*");
+}
+
+QTEST_GUILESS_MAIN(TestSermonSearchQuery)
+
+#include "tst_sermonsearchquery.moc"
@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Unit tests (QtTest). "make check" runs them all.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += audiometadata \
+    csvimport \
+    csvreader \
+    publishplanner \
+    searchquery
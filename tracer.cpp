@@ -0,0 +1,210 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QThreadStorage>
+#include <QVector>
+
+#define TRACE_BUFFER_EVENTS 16384 //Per thread; about 512 KiB.
+
+struct TraceEvent
+{
+    const char *name;
+    qint64 start;
+    qint64 end;
+    qint64 value;
+};
+
+/* One thread's ring buffer. Only its own thread writes to it, but a flush
+ * reads it from another, hence the (practically never contended) lock.
+ */
+struct TraceBuffer
+{
+    TraceBuffer(int threadNumber, const QString &name) :
+        events(TRACE_BUFFER_EVENTS), next(0), wrapped(false), tid(threadNumber), threadName(name) {}
+
+    QMutex lock;
+    QVector<TraceEvent> events;
+    int next;
+    bool wrapped;
+    int tid;
+    QString threadName;
+};
+
+/* The buffers outlive their threads, so spans of finished worker threads
+ * still make it into the trace. A finished thread's buffer goes on the free
+ * list and the next new thread carries on in it (under its own name), so
+ * pools that keep retiring and starting threads do not add a buffer each
+ * time: there are never more buffers than threads that traced at once.
+ */
+struct TraceRegistry
+{
+    QMutex lock;
+    QList<TraceBuffer *> buffers;
+    QList<TraceBuffer *> freeBuffers;
+    QElapsedTimer clock;
+};
+
+//Hands the thread's buffer back when the thread finishes.
+struct TraceBufferHandle
+{
+    TraceBufferHandle() : buffer(NULL) {}
+    ~TraceBufferHandle();
+    TraceBuffer *buffer;
+};
+
+Q_GLOBAL_STATIC(TraceRegistry, registry)
+static QThreadStorage<TraceBufferHandle> threadBuffers;
+
+TraceBufferHandle::~TraceBufferHandle()
+{
+    if (buffer == NULL || registry.isDestroyed())
+        return;
+    QMutexLocker locker(&registry()->lock);
+    registry()->freeBuffers.append(buffer);
+}
+
+static TraceBuffer *ThreadBuffer()
+{
+    TraceBufferHandle &handle = threadBuffers.localData();
+    if (handle.buffer == NULL) {
+        QThread *thread = QThread::currentThread();
+        QString name = thread->objectName();
+        if (name.isEmpty()) {
+            if (QCoreApplication::instance() != NULL && thread == QCoreApplication::instance()->thread())
+                name = "Main";
+            else
+                name = QString("Thread %1").arg(quintptr(QThread::currentThreadId()));
+        }
+        QMutexLocker locker(&registry()->lock);
+        if (!registry()->freeBuffers.isEmpty()) {
+            handle.buffer = registry()->freeBuffers.takeLast();
+            handle.buffer->threadName = name;
+        } else {
+            handle.buffer = new TraceBuffer(registry()->buffers.size() + 1, name);
+            registry()->buffers.append(handle.buffer);
+        }
+    }
+    return handle.buffer;
+}
+
+QAtomicInt Tracer::tracing;
+
+void Tracer::Start()
+{
+    QMutexLocker locker(&registry()->lock);
+    if (!registry()->clock.isValid())
+        registry()->clock.start();
+    tracing.store(1);
+}
+
+void Tracer::Stop()
+{
+    tracing.store(0);
+}
+
+static void WriteEnvironmentTrace()
+{
+    QString error;
+    QString fileName = QString::fromLocal8Bit(qgetenv(TRACE_ENVIRONMENT_VARIABLE));
+    if (!Tracer::WriteChromeTrace(fileName, error))
+        qWarning("Cannot write the trace to %s: %s", qPrintable(fileName), qPrintable(error));
+}
+
+//Called first thing in main(), so start-up is traced too. The trace is written when the application object goes away.
+void Tracer::StartFromEnvironment()
+{
+    if (qgetenv(TRACE_ENVIRONMENT_VARIABLE).isEmpty())
+        return;
+    Start();
+    qAddPostRoutine(WriteEnvironmentTrace);
+}
+
+qint64 Tracer::Now()
+{
+    return registry()->clock.nsecsElapsed();
+}
+
+void Tracer::Record(const char *name, qint64 startNs, qint64 endNs, qint64 value)
+{
+    TraceBuffer *buffer = ThreadBuffer();
+    QMutexLocker locker(&buffer->lock);
+    TraceEvent &event = buffer->events[buffer->next];
+    event.name = name;
+    event.start = startNs;
+    event.end = endNs;
+    event.value = value;
+    if (++buffer->next == buffer->events.size()) {
+        buffer->next = 0;
+        buffer->wrapped = true;
+    }
+}
+
+void Tracer::RecordSince(const char *name, const QElapsedTimer &timer, qint64 value)
+{
+    if (!IsTracing() || !timer.isValid())
+        return;
+    qint64 end = Now();
+    Record(name, qMax<qint64>(0, end - timer.nsecsElapsed()), end, value);
+}
+
+/* Writes every thread's spans, oldest first, as complete ("X") events,
+ * with times in microseconds, plus one metadata event naming each thread.
+ * Tracing goes on; the buffers are not cleared.
+ */
+bool Tracer::WriteChromeTrace(const QString &fileName, QString &error)
+{
+    QJsonArray traceEvents;
+    QMutexLocker registryLocker(&registry()->lock);
+    foreach (TraceBuffer *buffer, registry()->buffers) {
+        QJsonObject threadName;
+        threadName.insert("name", "thread_name");
+        threadName.insert("ph", "M");
+        threadName.insert("pid", 1);
+        threadName.insert("tid", buffer->tid);
+        QJsonObject threadArgs;
+        threadArgs.insert("name", buffer->threadName);
+        threadName.insert("args", threadArgs);
+        traceEvents.append(threadName);
+
+        QMutexLocker locker(&buffer->lock);
+        int count = buffer->wrapped ? buffer->events.size() : buffer->next;
+        int first = buffer->wrapped ? buffer->next : 0;
+        for (int i = 0; i < count; ++i) {
+            const TraceEvent &event = buffer->events.at((first + i) % buffer->events.size());
+            QJsonObject span;
+            span.insert("name", QString::fromLatin1(event.name));
+            span.insert("ph", "X");
+            span.insert("pid", 1);
+            span.insert("tid", buffer->tid);
+            span.insert("ts", event.start / 1000.0);
+            span.insert("dur", (event.end - event.start) / 1000.0);
+            if (event.value >= 0) {
+                QJsonObject args;
+                args.insert("value", double(event.value));
+                span.insert("args", args);
+            }
+            traceEvents.append(span);
+        }
+    }
+    registryLocker.unlock();
+
+    QJsonObject trace;
+    trace.insert("traceEvents", traceEvents);
+    trace.insert("displayTimeUnit", "ms");
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+            file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) < 0) {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
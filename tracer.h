@@ -0,0 +1,63 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#define TRACE_ENVIRONMENT_VARIABLE "MESSAGE_LIBRARIAN_TRACE" //File to write a trace of the whole run to.
+
+/* Records how long the hot paths take, for when "search is slow" needs to
+ * be pinned down. Spans go into a fixed-size ring buffer per thread (the
+ * oldest are overwritten once it is full), and WriteChromeTrace() gathers
+ * every thread's buffer into a Chrome trace_event file, which
+ * chrome://tracing or Perfetto can open.
+ *
+ * Mark a span with TRACE_SCOPE("name") at the top of a block; the name
+ * must be a string literal. While tracing is off, a span costs one relaxed
+ * load of a flag, so spans can stay in release builds. Work that runs
+ * across several events (an import, a scan) is recorded with RecordSince()
+ * when it is done, from the timer it keeps anyway.
+ */
+class Tracer
+{
+public:
+    static void Start();
+    static void Stop();
+    static void StartFromEnvironment(); //If TRACE_ENVIRONMENT_VARIABLE is set, traces until the application quits.
+    static bool IsTracing() { return tracing.load() != 0; }
+
+    static qint64 Now(); //Nanoseconds since tracing was first started.
+    static void Record(const char *name, qint64 startNs, qint64 endNs, qint64 value);
+    static void RecordSince(const char *name, const QElapsedTimer &timer, qint64 value); //From when 'timer' was started until now.
+    static bool WriteChromeTrace(const QString &fileName, QString &error);
+
+private:
+    Tracer();
+    static QAtomicInt tracing;
+};
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *spanName) :
+        name(spanName), start(Tracer::IsTracing() ? Tracer::Now() : -1), value(-1) {}
+    ~TraceSpan()
+    {
+        if (start >= 0)
+            Tracer::Record(name, start, Tracer::Now(), value);
+    }
+
+    void setValue(qint64 spanValue) { value = spanValue; } //Shown as the span's "value" argument, e.g. a row count.
+
+private:
+    const char *name;
+    qint64 start; //-1 if tracing was off when the span began.
+    qint64 value;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif // TRACER_H